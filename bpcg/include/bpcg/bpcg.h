@@ -56,8 +56,9 @@ using namespace std;
 
 //typedef Matrix<double,6,1> Vector6d;
 //typedef Vector6d::AlignedMapType AV6d;
-#define AVNd typename Matrix<double,N,1>::AlignedMapType
-#define cAVNd(x) typename Matrix<double,N,1>::ConstAlignedMapType(x)
+// blocks of odd size N in a VectorXd are only 16-byte aligned every other block
+#define AVNd Map<Matrix<double,N,1>, (N%2 ? Unaligned : Aligned)>
+#define cAVNd(x) Map<const Matrix<double,N,1>, (N%2 ? Unaligned : Aligned)>(x)
 
 namespace sba
 {
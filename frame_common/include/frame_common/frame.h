@@ -114,11 +114,20 @@ namespace frame_common
     std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d> > pts;
     std::vector<char> goodPts;  ///< whether the points are good or not
     std::vector<double> disps;  ///< disparities
+    std::vector<double> weights; ///< stereo confidence of the points, 0 to 1; empty for none
     std::vector<int> ipts;      ///< index into SBA system points; -1 if not present
 
     // these are for point-to-plane matches
     /// Pointcloud storage.
     pcl::PointCloud<pcl::PointXYZRGBNormal> pointcloud;
+
+    /// Search tree over #pointcloud, built once when the pointcloud is set
+    /// and shared between copies of the frame; can be empty.
+    pcl::KdTreeFLANN<pcl::PointXYZRGBNormal>::Ptr pointcloud_tree;
+
+    /// Image grid over #pointcloud for projective matching (CV_32SC1); each
+    /// cell holds the index of the nearest point projecting into it, or -1.
+    cv::Mat pl_grid;
     
     /// Dense pointcloud storage, optional.
     pcl::PointCloud<pcl::PointXYZRGB> dense_pointcloud;
@@ -170,6 +179,8 @@ namespace frame_common
     void setStereoPoints(Frame &frame, int nfrac = 0, bool setPointCloud=false);
     int ndisp;                  ///< Number of disparities to search.
     bool doSparse;              ///< True if using sparse stereo.
+    int stereoMethod;           ///< Dense stereo algorithm, DenseStereo::BLOCK_MATCHING or DenseStereo::SGM.
+    StereoWorkspace stereoWorkspace; ///< Dense stereo buffers, kept between frames; copies get their own.
 
     /// \brief Set up stereo frame, assumes frame has camera parameters already set.
     /// \param frame The frame to be processed.
@@ -197,10 +208,28 @@ namespace frame_common
   class PointcloudProc
   {
     public:
-      // TODO: Have an initializer with some parameters here.
+      /// Create a PointcloudProc using nearest-neighbor matching.
+      PointcloudProc();
+
+      /// If true, match() uses projective data association: points of one frame
+      /// are projected into the other frame's image grid and matched by lookup,
+      /// instead of mutual nearest neighbors in 3D.
+      bool doProjective;
+      int projGridStep;         ///< Size of a projective grid cell, in pixels.
+      double maxMatchDist;      ///< Max 3D distance between matched points (meters).
+      double maxNormalDiff;     ///< Max norm of the difference between matched normals.
+
+      /// If true, setPointcloud reduces the cloud in a single pass over the input
+      /// (NaN/box filter, hashed voxel grid and normals from per-voxel moments),
+      /// instead of the PCL filter chain.
+      bool doFusedReduce;
+      double leafSize;          ///< Voxel size for reducing the cloud (meters).
+      int normalVoxels;         ///< Normals use moments of voxels within this many cells.
+      double maxCurvature;      ///< Points with higher curvature are dropped.
       
       /// \brief Add a pointcloud to the frame, doing all the necessary 
       /// pre-processing (downsampling, computing normals, and filering based on curvature).
+      /// Also builds the frame's search tree, which is reused by every match.
       void setPointcloud(Frame &frame, const pcl::PointCloud<pcl::PointXYZRGB>& input_cloud) const;
       
       /// \brief Match points with previous frame, given an initial pose estimate.
@@ -214,13 +243,33 @@ namespace frame_common
       void reduceCloud(const pcl::PointCloud<pcl::PointXYZRGB>& input, 
                         pcl::PointCloud<pcl::PointXYZRGBNormal>& output) const;
 
+      /// \brief Single-pass version of reduceCloud, which fills the frame's
+      /// pointcloud and pl_pts, pl_normals, pl_kpts, pl_ipts directly.
+      void reduceCloudFused(const pcl::PointCloud<pcl::PointXYZRGB>& input, Frame &frame) const;
+
       /// \brief Project a 3D point into the image frame.
       Eigen::Vector3d projectPoint(Eigen::Vector4d& point, CamParams cam) const;
+
+      /// \brief Fill in the frame's projective grid from its pointcloud.
+      /// \param width  Image width in pixels.
+      /// \param height Image height in pixels.
+      void setProjectiveGrid(Frame &frame, int width, int height) const;
+
+      /// \brief Find matches by projecting frame0 points into frame1's grid,
+      /// gating on distance and normals.
+      void matchProjective(const Frame& frame0, const Frame& frame1,
+          const Eigen::Vector3d& trans, const Eigen::Quaterniond& rot,
+          std::vector<cv::DMatch>& matches) const;
       
-      /// \brief Find matches between two pointclouds using nearest neighbor
-      /// KDtree search.
-      void getMatchingIndices(const pcl::PointCloud<pcl::PointXYZRGBNormal>& input, 
-          const pcl::PointCloud<pcl::PointXYZRGBNormal>& output, 
+      /// \brief Return the search tree of a frame, building a temporary one
+      /// if the frame's pointcloud was set without it.
+      pcl::KdTreeFLANN<pcl::PointXYZRGBNormal>::Ptr getSearchTree(const Frame& frame) const;
+
+      /// \brief Find mutual nearest neighbors between two pointclouds using
+      /// the frames' search trees. Points of frame0 are transformed on the fly
+      /// by (trans, rot) into frame1; no transformed cloud is created.
+      void getMatchingIndices(const Frame& frame0, const Frame& frame1,
+          const Eigen::Vector3d& trans, const Eigen::Quaterniond& rot,
           std::vector<int>& input_indices, std::vector<int>& output_indices) const;
   };
 
@@ -36,6 +36,7 @@
 #define _FRAME_COMMON_STEREO_H_
 
 #include <frame_common/stereolib.h>
+#include <frame_common/camparams.h>
 #include <cv.h>
 
 namespace frame_common
@@ -45,6 +46,11 @@ namespace frame_common
   {
   public:
     virtual double lookup_disparity(int x, int y) const = 0;
+    /// disparity at a sub-pixel position, by default at the pixel it is in
+    virtual double lookup_disparity_subpix(double x, double y) const
+    { return lookup_disparity((int)x, (int)y); }
+    /// confidence of the disparity at x,y, from 0 to 1
+    virtual double lookup_confidence(int x, int y) const { return 1.0; }
     virtual ~FrameStereo() { }
   };
 
@@ -67,29 +73,96 @@ namespace frame_common
     double lookup_disparity(int x, int y) const;
   };
 
+  /// \brief Buffers for dense stereo, kept from frame to frame so they
+  /// are only allocated when the images or the stereo storage grow.
+  /// A workspace serves one DenseStereo at a time.  Buffers are never
+  /// shared: a copy starts empty, and assignment keeps the buffers of
+  /// the target, so objects holding a workspace can be copied freely.
+  class StereoWorkspace
+  {
+  public:
+    StereoWorkspace();
+    StereoWorkspace(const StereoWorkspace &);
+    StereoWorkspace &operator=(const StereoWorkspace &);
+    ~StereoWorkspace();
+
+    /// Make room for <xim> x <yim> images, and <bufsize> bytes of
+    /// stereo algorithm storage.
+    void reserve(int xim, int yim, size_t bufsize);
+
+    uint8_t *buf;               ///< stereo algorithm storage
+    uint8_t *flim, *frim;       ///< feature images
+    uint32_t *labels, *wbuf;    ///< speckle filter buffers
+
+  private:
+    size_t bufSize, imSize;
+  };
+
   class DenseStereo : public FrameStereo
   {
   private:
     static const int ftzero = 31;
 
     cv::Mat lim, rim;
-    uint8_t *flim, *frim, *buf;
     int16_t *imDisp;
+    int16_t *imConf;            // confidence, NULL if not computed
+    int numDisp;                // disparities searched by this instance
+    double fracDisp;            // fractional disparity of imDisp
 
   public:
+    /// stereo algorithms
+    enum { BLOCK_MATCHING = 0, SGM = 1 };
+
+    /// <meth> is one of the algorithms above, or -1 for the default <method>
+    /// <ws> holds the buffers; if NULL, they are allocated for this image
     DenseStereo(const cv::Mat& leftImg, const cv::Mat& rightImg, 
-		int nd = 0, double frac = 0.0);
+		int nd = 0, double frac = 0.0, int meth = -1,
+		StereoWorkspace *ws = NULL);
     ~DenseStereo();
     double lookup_disparity(int x, int y) const;
+    /// interpolates between the four pixels around x,y if they are all
+    /// valid and within a pixel of disparity of each other, otherwise
+    /// takes the nearest pixel
+    double lookup_disparity_subpix(double x, double y) const;
+    /// 1 if confidence isn't computed
+    double lookup_confidence(int x, int y) const;
 
     static int textureThresh;
     static int uniqueThresh;
     static int corrSize;
-    static int ndisp;		// number of disparities
-    static double fdisp;	// fractional disparities, e.g., 1/16
+    static int ndisp;		// default number of disparities
+    static int method;		// default algorithm
+    static int speckleSize;	// disparity regions smaller than this are removed, 0 for none
+    static int speckleDiff;	// largest disparity step within a region, 1/16 pixel
+    static bool confidence;	// compute the confidence of block matching disparities
+
+    // semi-global matching parameters; penalties are in window SAD units
+    static int sgmCorrSize;	// matching cost window size
+    static int sgmPaths;	// path set, 4 or 8
+    static int sgmP1;		// penalty for disparity changes of one pixel
+    static int sgmP2;		// penalty for larger disparity changes
+    static bool sgmLRCheck;	// left-right consistency check
   };
 
 
+  /// lens distortion, radial <k1>, <k2>, <k3> and tangential <p1>, <p2>,
+  /// in the usual plumb-bob model
+  struct Distortion
+  {
+    double k1, k2, p1, p2, k3;
+  };
+
+  /// \brief Build the interpolation table that rectifies <w> x <h> images
+  /// from a camera with parameters <cam> and distortion <dist> into images
+  /// from the camera <rcam>.  <R> is the row-major rotation from the camera
+  /// into the rectified frame, as given by stereo calibration; NULL for
+  /// none, which just undistorts.  Pixels that fall outside the source
+  /// image are 0.  <rtab> needs <w>*<h> entries.
+  void buildRectifyTable(inttab_t *rtab, int w, int h,
+                         const CamParams &cam, const Distortion &dist,
+                         const CamParams &rcam, const double *R = NULL);
+
+
 }  // end namespace frame_common
 
 #endif // _SPARSE_STEREO_H_
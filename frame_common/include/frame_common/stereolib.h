@@ -44,6 +44,7 @@
 //                     ~ yim*dlen*(xwin+4)
 // do_stereo_d       - (dlen*(yim-YKERN-ywin) + yim + yim*dlen)*2 + yim*dlen*xwin + 6*64
 //                     ~ yim*dlen*(xwin+5)
+// do_stereo_sgm     - do_stereo_sgm_bufsize()
 
 #ifndef STEREOLIBH
 #define STEREOLIBH
@@ -157,10 +158,21 @@ do_stereo_y(uint8_t *lim, uint8_t *rim, // input feature images
 	  uint8_t *buf		// buffer storage
 	  );
 
+// <conf> gets a confidence for each disparity, in the same layout:
+//   the uniqueness ratio 1 - c1/c2 of the best correlation sum c1 and
+//   the best one away from it c2, scaled down where the texture is
+//   below twice the threshold, in units of 1/STEREO_CONF_ONE
+// it is 0 for matches that fail the uniqueness or texture test; the
+//   others take a second pass over their sums, so pass NULL if not needed
+// <conf> has the size and alignment of <disp>
+#define STEREO_CONF_ONE 256
+
+int stereo_confidence(int c1, int c2, int tex, int tthresh);
+
 void
 do_stereo_d_fast(uint8_t *lim, uint8_t *rim, // input feature images
 	  int16_t *disp,	// disparity output
-	  int16_t *text,	// texture output
+	  int16_t *conf,	// confidence output, or NULL
 	  int xim, int yim,	// size of images
 	  uint8_t ftzero,	// feature offset from zero
 	  int xwin, int ywin,	// size of corr window, usually square
@@ -171,8 +183,79 @@ do_stereo_d_fast(uint8_t *lim, uint8_t *rim, // input feature images
 	  );
 
 
+// SIMD kernels
+// the AVX2 versions are used if the processor has them, unless the
+// level is capped with stereo_set_simd_level(); they give the same
+// output as the SSE2 versions
+#define STEREO_SIMD_SSE2 1
+#define STEREO_SIMD_AVX2 2
+
+int stereo_simd_level(void);	// level in use
+void stereo_set_simd_level(int level); // cap the level, e.g. for testing
+
+// AVX2 kernels need gcc 4.9 or later, on x86
+#if defined(__GNUC__) && ((__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || __GNUC__ > 4) && \
+  (defined(__x86_64__) || defined(__i386__))
+#define STEREO_AVX2
+#endif
+
+#ifdef STEREO_AVX2
+// called by do_prefilter_fast and do_stereo_d_fast at the AVX2 level,
+//   same arguments
+void
+do_prefilter_fast_avx2(uint8_t *im, uint8_t *ftim, int xim, int yim,
+	  uint8_t ftzero, uint8_t *buf);
+
+void
+do_stereo_d_fast_avx2(uint8_t *lim, uint8_t *rim, int16_t *disp, int16_t *conf,
+	  int xim, int yim, uint8_t ftzero, int xwin, int ywin, int dlen,
+	  int tfilter_thresh, int ufilter_thresh, uint8_t *buf);
+#endif
+
+
+// semi-global matching
+// window SAD matching costs, aggregated in one top-down pass along the
+//   paths from the left, right and above, and for <npaths> 8 also the
+//   two upper diagonals (the path set of OpenCV's SGBM)
+// <p1>, <p2> are the penalties for disparity changes of one and more
+//   pixels, in the units of the window SAD
+// row strips run in parallel; each starts its paths 32 rows above the
+//   strip, so results with more than one strip are close to, but
+//   not the same as, the single strip result
+// output disparities are in 1/16 pixel, at the window center
+// buffer size is given by do_stereo_sgm_bufsize(); it holds a few rows
+//   of costs per strip, about 2*xim*(9*dlen+192) bytes whatever the
+//   height: 3.5 MB at 1280 wide and 128 disparities, 1.2 MB at 752
+//   and 64
+// single core runtime is about 7 times that of do_stereo_d_fast:
+//   0.5 s at 1280x960 and 128 disparities, 0.4 s with 4 paths;
+//   strips scale it down with the number of threads
+size_t do_stereo_sgm_bufsize(int xim, int yim, int dlen, int nstrips);
+
+void
+do_stereo_sgm(uint8_t *lim, uint8_t *rim, // input feature images
+	  int16_t *disp,	// disparity output
+	  int xim, int yim,	// size of images
+	  uint8_t ftzero,	// feature offset from zero
+	  int xwin, int ywin,	// size of corr window, odd
+	  int dlen,		// size of disparity search, multiple of 8
+	  int tfilter_thresh,	// texture filter threshold
+	  int ufilter_thresh,	// uniqueness filter threshold, percent
+	  int p1, int p2,	// disparity change penalties
+	  int npaths,		// path set, 4 or 8
+	  int lr_check,		// left-right consistency check
+	  int nstrips,		// row strips to run in parallel, 0 for one per thread
+	  uint8_t *buf		// buffer storage
+	  );
+
+
 //December 2008 
 //Additions by Federico Tombari
+// do_stereo_so and do_stereo_dp are implemented by semi-global matching,
+//   with the 8 and 4 path sets; <smooth_thresh> is the penalty P2, and
+//   P1 is a quarter of it
+// <unique_c> turns on the left-right check of do_stereo_sgm; the
+//   uniqueness filter is <ufilter_thresh>, applied either way
 //Stereo matching with regularization (Scanline Optimization)
 void do_stereo_so(uint8_t *lim, uint8_t *rim, // input feature images
 	  int16_t *disp,	// disparity output
@@ -275,6 +358,13 @@ void do_speckle(int16_t *disp, int16_t badval, int width, int height,
 		int rdiff, int rcount, 
 		uint32_t *labels, uint32_t *wbuf, uint8_t *rtype);
 
+// parallel speckle filter, same result as do_speckle
+// needs buffers: labels[image size], wbuf[image size]
+// <nstrips> row strips run in parallel, 0 for one per thread
+void do_speckle_fast(int16_t *disp, int16_t badval, int width, int height, 
+		int rdiff, int rcount, 
+		uint32_t *labels, uint32_t *wbuf, int nstrips);
+
 
 //
 // bilinear interpolation structure
@@ -307,6 +397,23 @@ do_rectify_mono_fast(uint8_t *dest, // destination image
 		);
 
 
+// rectification of a stereo pair fused with the x-sobel prefilter
+// row strips of both images run in parallel, and each row is
+//   prefiltered while it is still in cache
+// same output as do_rectify_mono followed by do_prefilter_xsobel
+// <lrect>, <rrect> get the rectified images, <lftim>, <rftim> the
+//   feature images
+void
+do_rectify_prefilter(uint8_t *lsrc, uint8_t *rsrc, // source images
+		     inttab_t *ltab, inttab_t *rtab, // interpolation tables
+		     uint8_t *lrect, uint8_t *rrect, // rectified images
+		     uint8_t *lftim, uint8_t *rftim, // feature images
+		     int w, int h,	// image size
+		     uint8_t ftzero,	// feature offset from zero
+		     int nstrips	// row strips to run in parallel, 0 for one per thread
+		     );
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -35,6 +35,9 @@
 
 #include <frame_common/frame.h>
 #include <opencv2/nonfree/nonfree.hpp>
+#include <boost/unordered_map.hpp>
+#include <algorithm>
+#include <cstring>
 
 using namespace Eigen;
 using namespace std;
@@ -52,6 +55,23 @@ static double mstime()
   return (double)ts*.001;
 }
 
+// first and second moments of the points falling into a voxel
+struct VoxelMoments
+{
+  int n;
+  double sum[3];
+  double sumsq[6];              // xx, xy, xz, yy, yz, zz
+  double rgb[3];
+  int ix, iy, iz;               // voxel coordinates
+};
+
+// pack voxel coordinates into a hash key, 21 bits each
+static inline uint64_t voxelKey(int ix, int iy, int iz)
+{
+  const int off = 1 << 20;
+  return ((uint64_t)(ix + off) << 42) | ((uint64_t)(iy + off) << 21) | (uint64_t)(iz + off);
+}
+
 namespace frame_common
 {
 
@@ -169,6 +189,7 @@ namespace frame_common
     // stereo
     ndisp = 64;
     doSparse = false;           // use dense stereo by default
+    stereoMethod = DenseStereo::BLOCK_MATCHING;
   }
 
   void FrameProc::setFrameDetector(const cv::Ptr<cv::FeatureDetector>& new_detector)
@@ -233,29 +254,28 @@ namespace frame_common
     if (doSparse)
       st = new SparseStereo(frame.img,frame.imgRight,true,ndisp);
     else if (nfrac > 0)
-      { 
-        DenseStereo::ndisp = ndisp;
-        st = new DenseStereo(frame.img,frame.imgRight,ndisp,1.0/(double)nfrac);
-      }
+      st = new DenseStereo(frame.img,frame.imgRight,ndisp,1.0/(double)nfrac);
     else
-      { 
-        DenseStereo::ndisp = ndisp;
-        st = new DenseStereo(frame.img,frame.imgRight,ndisp);
-      }
+      st = new DenseStereo(frame.img,frame.imgRight,ndisp,0.0,stereoMethod,&stereoWorkspace);
 
     int nkpts = frame.kpts.size();
     frame.goodPts.resize(nkpts);
     frame.pts.resize(nkpts);
     frame.disps.resize(nkpts);
+    frame.weights.resize(nkpts);
 
     #pragma omp parallel for shared( st )
     for (int i=0; i<nkpts; i++)
       {
-        double disp = st->lookup_disparity(frame.kpts[i].pt.x,frame.kpts[i].pt.y);
+        double x = frame.kpts[i].pt.x, y = frame.kpts[i].pt.y;
+        double disp = st->lookup_disparity_subpix(x,y);
         frame.disps[i] = disp;
+        frame.weights[i] = 0.0;
         if (disp > 0.0)           // good disparity
           {
             frame.goodPts[i] = true;
+            frame.weights[i] = st->lookup_confidence(std::min((int)(x+0.5),frame.img.cols-1),
+                                                     std::min((int)(y+0.5),frame.img.rows-1));
             Vector3d pt(frame.kpts[i].pt.x,frame.kpts[i].pt.y,disp);
             frame.pts[i].head(3) = frame.pix2cam(pt);
             frame.pts[i](3) = 1.0;
@@ -304,33 +324,98 @@ namespace frame_common
   }
   
 
+    PointcloudProc::PointcloudProc()
+    {
+      doProjective = false;     // mutual nearest neighbors by default
+      projGridStep = 4;
+      maxMatchDist = 0.2;
+      maxNormalDiff = 0.5;
+
+      doFusedReduce = true;
+      leafSize = 0.05;
+      normalVoxels = 2;         // 5x5x5 voxel support, 0.25m across
+      maxCurvature = 0.2;
+    }
+
     void PointcloudProc::setPointcloud(Frame &frame, const pcl::PointCloud<pcl::PointXYZRGB>& input_cloud) const
     {
-      reduceCloud(input_cloud, frame.pointcloud);
-      
-      // For now, let's keep a 1-1 mapping between pl_pts, keypts, etc., etc.
-      // Basically replicating all the info in the pointcloud but whatever.
-      // TODO: Do something more intelligent than this.
-      frame.pl_pts.clear();
-      frame.pl_kpts.clear();
-      frame.pl_normals.clear();
-      frame.pl_ipts.clear();
-      
+      if (doFusedReduce)
+        reduceCloudFused(input_cloud, frame);
+      else
+        {
+          reduceCloud(input_cloud, frame.pointcloud);
+
+          // For now, let's keep a 1-1 mapping between pl_pts, keypts, etc., etc.
+          // Basically replicating all the info in the pointcloud but whatever.
+          frame.pl_pts.clear();
+          frame.pl_kpts.clear();
+          frame.pl_normals.clear();
+          frame.pl_ipts.clear();
+
+          unsigned int ptcloudsize = frame.pointcloud.points.size();
+          frame.pl_pts.resize(ptcloudsize);
+          frame.pl_kpts.resize(ptcloudsize);
+          frame.pl_normals.resize(ptcloudsize);
+          frame.pl_ipts.resize(ptcloudsize);
+
+          #pragma omp parallel for
+          for (unsigned int i=0; i < frame.pointcloud.points.size(); i++)
+            {
+              PointXYZRGBNormal &pt = frame.pointcloud.points[i];
+
+              frame.pl_pts[i] = Eigen::Vector4d(pt.x, pt.y, pt.z, 1.0);
+              frame.pl_normals[i] = Eigen::Vector4d(pt.normal[0], pt.normal[1], pt.normal[2], 1.0);
+              frame.pl_kpts[i] = projectPoint(frame.pl_pts[i], frame.cam);
+              frame.pl_ipts[i] = -1;
+            }
+        }
       unsigned int ptcloudsize = frame.pointcloud.points.size();
-      frame.pl_pts.resize(ptcloudsize);
-      frame.pl_kpts.resize(ptcloudsize);
-      frame.pl_normals.resize(ptcloudsize);
-      frame.pl_ipts.resize(ptcloudsize);
-      
-      #pragma omp parallel for
-      for (unsigned int i=0; i < frame.pointcloud.points.size(); i++)
+
+      // The reduced cloud doesn't change after this, so build its search
+      // tree once here; copies of the frame share it.
+      frame.pointcloud_tree.reset();
+      if (ptcloudsize > 0)
       {
-        PointXYZRGBNormal &pt = frame.pointcloud.points[i];
-        
-        frame.pl_pts[i] = Eigen::Vector4d(pt.x, pt.y, pt.z, 1.0);
-        frame.pl_normals[i] = Eigen::Vector4d(pt.normal[0], pt.normal[1], pt.normal[2], 1.0);
-        frame.pl_kpts[i] = projectPoint(frame.pl_pts[i], frame.cam);
-        frame.pl_ipts[i] = -1;
+        frame.pointcloud_tree.reset(new KdTreeFLANN<PointXYZRGBNormal>);
+        frame.pointcloud_tree->setInputCloud(boost::make_shared<const PointCloud<PointXYZRGBNormal> >(frame.pointcloud));
+      }
+
+      // Image size comes from the input cloud if it's organized, otherwise
+      // from the image center.
+      int width = input_cloud.width;
+      int height = input_cloud.height;
+      if (height <= 1)
+      {
+        width = (int)(2.0*frame.cam.cx + 0.5);
+        height = (int)(2.0*frame.cam.cy + 0.5);
+      }
+      setProjectiveGrid(frame, width, height);
+    }
+
+    void PointcloudProc::setProjectiveGrid(Frame &frame, int width, int height) const
+    {
+      int step = projGridStep > 0 ? projGridStep : 1;
+      int gw = (width + step - 1)/step;
+      int gh = (height + step - 1)/step;
+      if (gw <= 0 || gh <= 0)
+      {
+        frame.pl_grid = cv::Mat();
+        return;
+      }
+
+      // Keep the closest point in each cell, as a z-buffer would.
+      frame.pl_grid.create(gh, gw, CV_32SC1);
+      frame.pl_grid.setTo(cv::Scalar(-1));
+      for (int i=0; i<(int)frame.pl_kpts.size(); i++)
+      {
+        if (frame.pl_pts[i].z() <= 0.0) continue;
+        int gu = (int)floor(frame.pl_kpts[i](0))/step;
+        int gv = (int)floor(frame.pl_kpts[i](1))/step;
+        if (frame.pl_kpts[i](0) < 0 || frame.pl_kpts[i](1) < 0 || gu >= gw || gv >= gh)
+          continue;
+        int &cell = frame.pl_grid.at<int>(gv,gu);
+        if (cell < 0 || frame.pl_pts[i].z() < frame.pl_pts[cell].z())
+          cell = i;
       }
     }
     
@@ -338,105 +423,334 @@ namespace frame_common
           const Eigen::Vector3d& trans, const Eigen::Quaterniond& rot, 
           std::vector<cv::DMatch>& matches) const
     {
-      PointCloud<PointXYZRGBNormal> transformed_cloud;
-      
-      // First, transform the current frame. (Is this inverse?) (Or just transform the other cloud?)
-      //transformPointCloudWithNormals<PointXYZRGBNormal>(frame1.cloud, transformed_cloud, -trans.cast<float>(), rot.cast<float>().conjugate());
-      
-      //transformPointCloudWithNormals<PointXYZRGBNormal>(frame0.pointcloud, transformed_cloud, -trans.cast<float>(), rot.cast<float>().conjugate());
-      transformPointCloudWithNormals<PointXYZRGBNormal>(frame0.pointcloud, transformed_cloud, Vector3f(0,0,0), rot.cast<float>().conjugate());
-      transformPointCloudWithNormals<PointXYZRGBNormal>(transformed_cloud, transformed_cloud, -trans.cast<float>(), Quaternionf(1, 0, 0, 0));
-      //pcl::io::savePCDFileASCII ("cloud0.pcd", transformed_cloud);
-      //pcl::io::savePCDFileASCII ("cloud1.pcd", frame1.pointcloud);
-      
-      // Optional/TODO: Perform ICP to further refine estimate.
-      /*PointCloud<PointXYZRGBNormal> cloud_reg;
+      matches.clear();
+      if (frame0.pointcloud.points.size() == 0 || frame1.pointcloud.points.size() == 0)
+        return;
 
-      IterativeClosestPointNonLinear<PointXYZRGBNormal, PointXYZRGBNormal> reg;
-      reg.setInputCloud (boost::make_shared<const PointCloud<PointXYZRGBNormal> > (transformed_cloud));
-      reg.setInputTarget (boost::make_shared<const PointCloud<PointXYZRGBNormal> > (frame1.pointcloud));
-      reg.setMaximumIterations(50);
-      reg.setTransformationEpsilon (1e-8);
+      if (doProjective && !frame1.pl_grid.empty())
+      {
+        matchProjective(frame0, frame1, trans, rot, matches);
+        return;
+      }
 
-      reg.align(cloud_reg); */
+      // Points of frame0 are taken into frame1 as R^T*p - t, normals as R^T*n.
+      Matrix3d Rt = rot.toRotationMatrix().transpose();
+      
+      // Optional/TODO: Perform ICP to further refine estimate.
             
-      // Find matches between pointclouds in frames. (TODO: also compare normals)
+      // Find matches between pointclouds in frames.
       std::vector<int> f0_indices, f1_indices;
-      getMatchingIndices(transformed_cloud, frame1.pointcloud, f0_indices, f1_indices);
+      getMatchingIndices(frame0, frame1, trans, rot, f0_indices, f1_indices);
       
       // Fill in keypoints and projections of relevant features.
       // Currently just done when setting the pointcloud.
       
-      // Convert matches into the correct format.
-      matches.clear();
-      // Starting at i=1 as a hack to not let through (0,0,0) matches (why is this in the ptcloud?))
+      // Convert matches into the correct format, keeping the order of f0_indices.
+      int nmatches = f0_indices.size();
+      std::vector<char> good(nmatches, 0);
+      std::vector<float> dists(nmatches);
       
-      #pragma omp parallel for shared( transformed_cloud, f0_indices, f1_indices )
-      for (unsigned int i=1; i < f0_indices.size(); i++)
+      #pragma omp parallel for shared( f0_indices, f1_indices, good, dists )
+      for (int i=0; i < nmatches; i++)
       {
-        const PointXYZRGBNormal &pt0 = transformed_cloud.points[f0_indices[i]];
+        const PointXYZRGBNormal &pt0 = frame0.pointcloud.points[f0_indices[i]];
         const PointXYZRGBNormal &pt1 = frame1.pointcloud.points[f1_indices[i]];
+
+        // Don't let through (0,0,0) points (why are these in the ptcloud?)
+        if (pt0.z == 0.0 || pt1.z == 0.0)
+          continue;
         
         // Figure out distance and angle between normals
-        Quaterniond normalquat;
-        Vector3d norm0(pt0.normal[0], pt0.normal[1], pt0.normal[2]), norm1(pt1.normal[0], pt1.normal[1], pt1.normal[2]);
-        normalquat.setFromTwoVectors(norm0, norm1);
-        //double angledist = normalquat.angularDistance(normalquat.Identity());
-        double dist = (Vector3d(pt0.x, pt0.y, pt0.z)-Vector3d(pt1.x, pt1.y, pt1.z)).norm();
-        
-        /* Vector4d p0_pt = Vector4d(pt0.x, pt0.y, pt0.z, 1.0);
-        Vector3d expected_proj = projectPoint(p0_pt, frame0.cam);
-        
-        Vector3d diff = expected_proj - frame1.pl_kpts[f1_indices[i]].head<3>();
-        diff(2) = diff(2) - diff(0);
+        Vector3d norm0 = Rt*Vector3d(pt0.normal[0], pt0.normal[1], pt0.normal[2]);
+        Vector3d norm1(pt1.normal[0], pt1.normal[1], pt1.normal[2]);
+        Vector3d p0 = Rt*Vector3d(pt0.x, pt0.y, pt0.z) - trans;
+        double dist = (p0-Vector3d(pt1.x, pt1.y, pt1.z)).norm();
         
-        printf("[Proj difference] %f %f %f\n", diff(0), diff(1), diff(2)); */
-        
-        if ((norm0 - norm1).norm() < 0.5 && dist < 0.2)
-          #pragma omp critical
-          matches.push_back(cv::DMatch(f0_indices[i], f1_indices[i], dist));
+        if ((norm0 - norm1).norm() < maxNormalDiff && dist < maxMatchDist)
+        {
+          good[i] = 1;
+          dists[i] = dist;
+        }
       }
+
+      for (int i=0; i < nmatches; i++)
+        if (good[i])
+          matches.push_back(cv::DMatch(f0_indices[i], f1_indices[i], dists[i]));
       
       printf("[Frame] Found %d matches, then converted %d matches.\n", (int)f0_indices.size(), (int)matches.size());
     }
+
+    // Projective data association: O(N) in the number of frame0 points.
+    void PointcloudProc::matchProjective(const Frame& frame0, const Frame& frame1, 
+          const Eigen::Vector3d& trans, const Eigen::Quaterniond& rot, 
+          std::vector<cv::DMatch>& matches) const
+    {
+      const CamParams &cam = frame1.cam;
+      const cv::Mat &grid = frame1.pl_grid;
+      int step = projGridStep > 0 ? projGridStep : 1;
+      Matrix3d Rt = rot.toRotationMatrix().transpose();
+
+      int npts = frame0.pl_pts.size();
+      std::vector<int> nearest(npts, -1);
+      std::vector<float> dists(npts);
+
+      #pragma omp parallel for shared( nearest, dists )
+      for (int i=0; i < npts; i++)
+      {
+        // Take the point and normal into frame1.
+        Vector3d p0 = Rt*frame0.pl_pts[i].head<3>() - trans;
+        if (p0.z() <= 0.0) continue;
+        Vector3d norm0 = Rt*frame0.pl_normals[i].head<3>();
+
+        double u = cam.fx*p0.x()/p0.z() + cam.cx;
+        double v = cam.fy*p0.y()/p0.z() + cam.cy;
+        if (u < 0 || v < 0) continue;
+        int gu = (int)u/step;
+        int gv = (int)v/step;
+        if (gu >= grid.cols || gv >= grid.rows) continue;
+
+        // Look in the cell and its neighbors for the closest gated point.
+        int best = -1;
+        double bestdist = maxMatchDist;
+        for (int dv=-1; dv<=1; dv++)
+        {
+          int rv = gv+dv;
+          if (rv < 0 || rv >= grid.rows) continue;
+          const int *row = grid.ptr<int>(rv);
+          for (int du=-1; du<=1; du++)
+          {
+            int cu = gu+du;
+            if (cu < 0 || cu >= grid.cols) continue;
+            int j = row[cu];
+            if (j < 0) continue;
+            double dist = (p0 - frame1.pl_pts[j].head<3>()).norm();
+            if (dist >= bestdist) continue;
+            if ((norm0 - frame1.pl_normals[j].head<3>()).norm() >= maxNormalDiff) continue;
+            best = j;
+            bestdist = dist;
+          }
+        }
+
+        nearest[i] = best;
+        dists[i] = bestdist;
+      }
+
+      // Keep only the closest frame0 point for each frame1 point.
+      std::vector<int> owner(frame1.pl_pts.size(), -1);
+      for (int i=0; i < npts; i++)
+      {
+        int j = nearest[i];
+        if (j < 0) continue;
+        if (owner[j] < 0 || dists[i] < dists[owner[j]])
+          owner[j] = i;
+      }
+
+      for (int i=0; i < npts; i++)
+      {
+        int j = nearest[i];
+        if (j >= 0 && owner[j] == i)
+          matches.push_back(cv::DMatch(i, j, dists[i]));
+      }
+
+      printf("[Frame] Found %d projective matches.\n", (int)matches.size());
+    }
+
+    KdTreeFLANN<PointXYZRGBNormal>::Ptr PointcloudProc::getSearchTree(const Frame& frame) const
+    {
+      if (frame.pointcloud_tree)
+        return frame.pointcloud_tree;
+
+      // Frame was set up without a tree; build a temporary one.
+      KdTreeFLANN<PointXYZRGBNormal>::Ptr tree(new KdTreeFLANN<PointXYZRGBNormal>);
+      tree->setInputCloud(boost::make_shared<const PointCloud<PointXYZRGBNormal> >(frame.pointcloud));
+      return tree;
+    }
     
-    void PointcloudProc::getMatchingIndices(const PointCloud<PointXYZRGBNormal>& input, 
-              const PointCloud<PointXYZRGBNormal>& output, 
+    void PointcloudProc::getMatchingIndices(const Frame& frame0, const Frame& frame1,
+              const Eigen::Vector3d& trans, const Eigen::Quaterniond& rot,
               std::vector<int>& input_indices, std::vector<int>& output_indices) const
     {
-      // TODO: Don't calculate the KDTree each time.
-      KdTreeFLANN<PointXYZRGBNormal> input_tree, output_tree;
-        
-      input_tree.setInputCloud(boost::make_shared<const PointCloud<PointXYZRGBNormal> >(input));
-      output_tree.setInputCloud(boost::make_shared<const PointCloud<PointXYZRGBNormal> >(output));
+      const PointCloud<PointXYZRGBNormal>& input = frame0.pointcloud;
+      const PointCloud<PointXYZRGBNormal>& output = frame1.pointcloud;
+      KdTreeFLANN<PointXYZRGBNormal>::Ptr input_tree = getSearchTree(frame0);
+      KdTreeFLANN<PointXYZRGBNormal>::Ptr output_tree = getSearchTree(frame1);
+
+      // Forward transform takes frame0 points into frame1, inverse goes back.
+      Matrix3f R = rot.toRotationMatrix().cast<float>();
+      Matrix3f Rt = R.transpose();
+      Vector3f t = trans.cast<float>();
+
+      int npts = input.points.size();
+      std::vector<int> nearest(npts, -1);
       
       // Iterate over the output tree looking for all the input points and finding
       // nearest neighbors.
-      #pragma omp parallel for shared( input_tree, output_tree )
-      for (unsigned int i = 0; i < input.points.size(); i++)
+      #pragma omp parallel for shared( input_tree, output_tree, nearest )
+      for (int i = 0; i < npts; i++)
       {
-        PointXYZRGBNormal input_pt = input.points[i];
         std::vector<int> input_indexvect(1), output_indexvect(1); // Create a vector of size 1.
         std::vector<float> input_distvect(1), output_distvect(1);
+
+        PointXYZRGBNormal input_pt;
+        input_pt.getVector3fMap() = Rt*input.points[i].getVector3fMap() - t;
         
         // Find the nearest neighbor of the input point in the output tree.
-        output_tree.nearestKSearch(input_pt, 1, input_indexvect, input_distvect);
+        if (output_tree->nearestKSearch(input_pt, 1, input_indexvect, input_distvect) <= 0)
+          continue;
         
-        PointXYZRGBNormal output_pt = output.points[input_indexvect[0]];
+        PointXYZRGBNormal output_pt;
+        output_pt.getVector3fMap() = R*(output.points[input_indexvect[0]].getVector3fMap() + t);
         
         // Find the nearest neighbor of the output point in the input tree.
-        input_tree.nearestKSearch(output_pt, 1, output_indexvect, output_distvect);
+        if (input_tree->nearestKSearch(output_pt, 1, output_indexvect, output_distvect) <= 0)
+          continue;
         
-        // If they match, add them to the match vectors.
-        #pragma omp critical
-        if (output_indexvect[0] == (int)i)
+        // If they match, keep the pair.
+        if (output_indexvect[0] == i)
+          nearest[i] = input_indexvect[0];
+      }
+
+      input_indices.clear();
+      output_indices.clear();
+      for (int i = 0; i < npts; i++)
+        if (nearest[i] >= 0)
         {
           input_indices.push_back(i);
-          output_indices.push_back(input_indexvect[0]);
+          output_indices.push_back(nearest[i]);
         }
-      }
     }
     
+    // Reduce the cloud in one pass over the input: drop NaNs and far points,
+    // bin into a hashed voxel grid while accumulating moments, then take
+    // normals from the moments of neighboring voxels.
+    void PointcloudProc::reduceCloudFused(const PointCloud<PointXYZRGB>& input, Frame &frame) const
+    {
+      double inv_leaf = 1.0/leafSize;
+      boost::unordered_map<uint64_t,int> voxel_index;
+      std::vector<VoxelMoments> voxels;
+      voxels.reserve(input.points.size()/16 + 1);
+
+      for (size_t i=0; i < input.points.size(); i++)
+      {
+        const PointXYZRGB &pt = input.points[i];
+        if (!pcl_isfinite(pt.x) || !pcl_isfinite(pt.y) || !pcl_isfinite(pt.z))
+          continue;
+        // same [200x200x200] box as reduceCloud
+        if (fabs(pt.x) > 100.0 || fabs(pt.y) > 100.0 || fabs(pt.z) > 100.0)
+          continue;
+
+        int ix = (int)floor(pt.x*inv_leaf);
+        int iy = (int)floor(pt.y*inv_leaf);
+        int iz = (int)floor(pt.z*inv_leaf);
+        std::pair<boost::unordered_map<uint64_t,int>::iterator,bool> ins =
+          voxel_index.insert(std::make_pair(voxelKey(ix,iy,iz), (int)voxels.size()));
+        if (ins.second)
+        {
+          VoxelMoments vm;
+          memset(&vm, 0, sizeof(vm));
+          vm.ix = ix; vm.iy = iy; vm.iz = iz;
+          voxels.push_back(vm);
+        }
+
+        VoxelMoments &vm = voxels[ins.first->second];
+        double x = pt.x, y = pt.y, z = pt.z;
+        vm.n++;
+        vm.sum[0] += x; vm.sum[1] += y; vm.sum[2] += z;
+        vm.sumsq[0] += x*x; vm.sumsq[1] += x*y; vm.sumsq[2] += x*z;
+        vm.sumsq[3] += y*y; vm.sumsq[4] += y*z; vm.sumsq[5] += z*z;
+        uint32_t rgb = *reinterpret_cast<const uint32_t*>(&pt.rgb);
+        vm.rgb[0] += (rgb >> 16) & 0xff;
+        vm.rgb[1] += (rgb >> 8) & 0xff;
+        vm.rgb[2] += rgb & 0xff;
+      }
+
+      // Normals and curvature for each voxel; lookups in the map are read-only.
+      int nvox = voxels.size();
+      std::vector<Eigen::Vector4f, Eigen::aligned_allocator<Eigen::Vector4f> > normals(nvox);
+      std::vector<char> keep(nvox, 0);
+      int r = normalVoxels;
+
+      #pragma omp parallel for shared( voxels, voxel_index, normals, keep )
+      for (int v=0; v < nvox; v++)
+      {
+        const VoxelMoments &vm = voxels[v];
+        double n = 0, sum[3] = {0,0,0}, sumsq[6] = {0,0,0,0,0,0};
+        for (int dx=-r; dx<=r; dx++)
+          for (int dy=-r; dy<=r; dy++)
+            for (int dz=-r; dz<=r; dz++)
+            {
+              boost::unordered_map<uint64_t,int>::const_iterator it =
+                voxel_index.find(voxelKey(vm.ix+dx, vm.iy+dy, vm.iz+dz));
+              if (it == voxel_index.end()) continue;
+              const VoxelMoments &nb = voxels[it->second];
+              n += nb.n;
+              for (int k=0; k<3; k++) sum[k] += nb.sum[k];
+              for (int k=0; k<6; k++) sumsq[k] += nb.sumsq[k];
+            }
+        if (n < 3) continue;
+
+        double mx = sum[0]/n, my = sum[1]/n, mz = sum[2]/n;
+        Eigen::Matrix3f covariance;
+        covariance(0,0) = sumsq[0]/n - mx*mx;
+        covariance(0,1) = covariance(1,0) = sumsq[1]/n - mx*my;
+        covariance(0,2) = covariance(2,0) = sumsq[2]/n - mx*mz;
+        covariance(1,1) = sumsq[3]/n - my*my;
+        covariance(1,2) = covariance(2,1) = sumsq[4]/n - my*mz;
+        covariance(2,2) = sumsq[5]/n - mz*mz;
+
+        float nx, ny, nz, curvature;
+        solvePlaneParameters(covariance, nx, ny, nz, curvature);
+        if (!pcl_isfinite(curvature) || curvature < 0.0 || curvature > maxCurvature)
+          continue;
+
+        PointXYZRGB centroid;
+        centroid.x = vm.sum[0]/vm.n;
+        centroid.y = vm.sum[1]/vm.n;
+        centroid.z = vm.sum[2]/vm.n;
+        flipNormalTowardsViewpoint(centroid, 0.0f, 0.0f, 0.0f, nx, ny, nz);
+
+        normals[v] = Eigen::Vector4f(nx, ny, nz, curvature);
+        keep[v] = 1;
+      }
+
+      // Write the kept voxels straight into the frame.
+      int nkeep = 0;
+      for (int v=0; v < nvox; v++)
+        nkeep += keep[v];
+
+      frame.pointcloud.points.resize(nkeep);
+      frame.pointcloud.width = nkeep;
+      frame.pointcloud.height = 1;
+      frame.pointcloud.is_dense = true;
+      frame.pointcloud.header = input.header;
+      frame.pl_pts.resize(nkeep);
+      frame.pl_kpts.resize(nkeep);
+      frame.pl_normals.resize(nkeep);
+      frame.pl_ipts.assign(nkeep, -1);
+
+      for (int v=0, i=0; v < nvox; v++)
+      {
+        if (!keep[v]) continue;
+        const VoxelMoments &vm = voxels[v];
+        PointXYZRGBNormal &pt = frame.pointcloud.points[i];
+        pt.x = vm.sum[0]/vm.n;
+        pt.y = vm.sum[1]/vm.n;
+        pt.z = vm.sum[2]/vm.n;
+        uint32_t rgb = ((uint32_t)(vm.rgb[0]/vm.n) << 16) | ((uint32_t)(vm.rgb[1]/vm.n) << 8)
+          | (uint32_t)(vm.rgb[2]/vm.n);
+        pt.rgb = *reinterpret_cast<float*>(&rgb);
+        pt.normal[0] = normals[v](0);
+        pt.normal[1] = normals[v](1);
+        pt.normal[2] = normals[v](2);
+        pt.curvature = normals[v](3);
+
+        frame.pl_pts[i] = Eigen::Vector4d(pt.x, pt.y, pt.z, 1.0);
+        frame.pl_normals[i] = Eigen::Vector4d(pt.normal[0], pt.normal[1], pt.normal[2], 1.0);
+        frame.pl_kpts[i] = projectPoint(frame.pl_pts[i], frame.cam);
+        i++;
+      }
+    }
+
     // Subsample cloud for faster matching and processing, while filling in normals.
     void PointcloudProc::reduceCloud(const PointCloud<PointXYZRGB>& input, PointCloud<PointXYZRGBNormal>& output) const
     {
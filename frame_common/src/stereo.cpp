@@ -34,6 +34,7 @@
 
 #include <frame_common/stereo.h>
 #include <xmmintrin.h>
+#include <algorithm>
 
 namespace frame_common
 {
@@ -130,6 +131,58 @@ namespace frame_common
       return v*(1.0/16.0);
   }
 
+  // stereo buffers
+
+  StereoWorkspace::StereoWorkspace()
+    : buf(NULL), flim(NULL), frim(NULL), labels(NULL), wbuf(NULL),
+      bufSize(0), imSize(0)
+  {
+  }
+
+  StereoWorkspace::StereoWorkspace(const StereoWorkspace &)
+    : buf(NULL), flim(NULL), frim(NULL), labels(NULL), wbuf(NULL),
+      bufSize(0), imSize(0)
+  {
+  }
+
+  StereoWorkspace &StereoWorkspace::operator=(const StereoWorkspace &)
+  {
+    return *this;
+  }
+
+  StereoWorkspace::~StereoWorkspace()
+  {
+    MEMFREE(buf);
+    MEMFREE(flim);
+    MEMFREE(frim);
+    MEMFREE(labels);
+    MEMFREE(wbuf);
+  }
+
+  void StereoWorkspace::reserve(int xim, int yim, size_t bufsize)
+  {
+    if (bufsize > bufSize)
+      {
+        MEMFREE(buf);
+        buf = (uint8_t *)MEMALIGN(bufsize);
+        bufSize = bufsize;
+      }
+    size_t imsize = (size_t)xim*yim;
+    if (imsize > imSize)
+      {
+        MEMFREE(flim);
+        MEMFREE(frim);
+        MEMFREE(labels);
+        MEMFREE(wbuf);
+        flim = (uint8_t *)MEMALIGN(imsize);
+        frim = (uint8_t *)MEMALIGN(imsize);
+        labels = (uint32_t *)MEMALIGN(imsize*sizeof(uint32_t));
+        wbuf = (uint32_t *)MEMALIGN(imsize*sizeof(uint32_t));
+        imSize = imsize;
+      }
+  }
+
+
   // dense stereo
   // more accurate, but takes longer
   // could outfit sparse stereo with same algorithm
@@ -137,10 +190,9 @@ namespace frame_common
   //   it gives the 
 
   DenseStereo::DenseStereo(const cv::Mat& leftImg, const cv::Mat& rightImg, 
-			   int nd, double frac)
+			   int nd, double frac, int meth, StereoWorkspace *ws)
   {
-    if (nd > 0)			// set number of disparities
-      ndisp = nd;
+    numDisp = nd > 0 ? nd : ndisp; // set number of disparities
 	
     //    printf("Doing dense stereo with ndisp = %d\n", ndisp);
 
@@ -154,47 +206,69 @@ namespace frame_common
     // clear disparity buffer - do we need to do this???
     imDisp = (int16_t *)MEMALIGN(xim*yim*2);
     memset(imDisp, 0, xim*yim*sizeof(int16_t));
+    imConf = NULL;
 
     // check for 
     if (frac > 0)		// set fractional disparities, if we pass in a
       {				//   disparity map
-        fdisp = frac;		
+        fracDisp = frac;		
         memcpy(imDisp,rim.data,xim*yim*sizeof(int16_t));
         return;
       }
 
 
     // some parameters
-    int dlen   = ndisp;         // number of disparities
+    int dlen   = numDisp;       // number of disparities
     int corr   = corrSize;      // correlation window size
     int tthresh = textureThresh; // texture threshold
     int uthresh = uniqueThresh;	// uniqueness threshold, percent
-    fdisp = 1.0/16.0;		// fixed for this algorithm
+    fracDisp = 1.0/16.0;	// fixed for this algorithm
 
-    // allocate buffers
-    // TODO: make these consistent with current values
+    if (meth < 0)
+      meth = method;
 
-    buf  = (uint8_t *)MEMALIGN(yim*2*dlen*(corr+5)); // local storage for the algorithm
-    flim = (uint8_t *)MEMALIGN(xim*yim); // feature image
-    frim = (uint8_t *)MEMALIGN(xim*yim); // feature image
+    // buffers, from the caller's workspace if there is one
+    StereoWorkspace local;
+    if (ws == NULL)
+      ws = &local;
+    size_t bufsize = yim*2*dlen*(corr+5);
+    if (meth == SGM)
+      bufsize = std::max(bufsize, do_stereo_sgm_bufsize(xim, yim, dlen, 0));
+    ws->reserve(xim, yim, bufsize);
+    uint8_t *buf = ws->buf;     // local storage for the algorithm
+    uint8_t *flim = ws->flim;   // feature images
+    uint8_t *frim = ws->frim;
 
     // prefilter
     do_prefilter(lim.data, flim, xim, yim, ftzero, buf);
     do_prefilter(rim.data, frim, xim, yim, ftzero, buf);
 
 
+    if (meth == SGM)
+      do_stereo_sgm(flim, frim, imDisp, xim, yim, ftzero, sgmCorrSize, sgmCorrSize,
+                    dlen, tthresh, uthresh, sgmP1, sgmP2, sgmPaths, sgmLRCheck, 0, buf);
+    else
+      {
+        if (confidence)
+          {
+            imConf = (int16_t *)MEMALIGN(xim*yim*2);
+            memset(imConf, 0, xim*yim*sizeof(int16_t));
+          }
+        do_stereo(flim, frim, imDisp, imConf, xim, yim,
+                  ftzero, corr, corr, dlen, tthresh, uthresh, buf);
+      }
 
-    do_stereo(flim, frim, imDisp, NULL, xim, yim,
-              ftzero, corr, corr, dlen, tthresh, uthresh, buf);
-
-    MEMFREE(buf);
-    MEMFREE(flim);
-    MEMFREE(frim);
+    // remove small regions of disparities
+    if (speckleSize > 0)
+      do_speckle_fast(imDisp, FILTEREDVAL, xim, yim, speckleDiff, speckleSize,
+                      ws->labels, ws->wbuf, 0);
   }
 
   DenseStereo::~DenseStereo()
   {
     MEMFREE(imDisp);
+    if (imConf)
+      MEMFREE(imConf);
   }
 
   // should look in a small area around x,y
@@ -206,17 +280,124 @@ namespace frame_common
       {
         double v = (double)(imDisp[y*w+x]);
         if (v > 0.0)
-          return v*fdisp;
+          return v*fracDisp;
       }
 
     return 0.0;
   }
 
+  double DenseStereo::lookup_disparity_subpix(double x, double y) const
+  {
+    int w = lim.cols;
+    int h = lim.rows;
+    int x0 = (int)x;
+    int y0 = (int)y;
+    if (x0 >= 0 && y0 >= 0 && x0 < w-1 && y0 < h-1)
+      {
+        const int16_t *dp = imDisp + y0*w + x0;
+        int d00 = dp[0], d01 = dp[1], d10 = dp[w], d11 = dp[w+1];
+        int dmin = std::min(std::min(d00,d01),std::min(d10,d11));
+        int dmax = std::max(std::max(d00,d01),std::max(d10,d11));
+        if (dmin > 0 && dmax - dmin <= (int)(1.0/fracDisp + 0.5))
+          {
+            double ax = x - x0, ay = y - y0;
+            double v = (1.0-ay)*((1.0-ax)*d00 + ax*d01) + ay*((1.0-ax)*d10 + ax*d11);
+            return v*fracDisp;
+          }
+      }
+
+    // nearest pixel
+    x0 = std::min(std::max((int)(x+0.5),0),w-1);
+    y0 = std::min(std::max((int)(y+0.5),0),h-1);
+    return lookup_disparity(x0,y0);
+  }
+
+  double DenseStereo::lookup_confidence(int x, int y) const
+  {
+    if (imConf == NULL)
+      return 1.0;
+    return (double)imConf[y*lim.cols+x]/(double)STEREO_CONF_ONE;
+  }
+
   int DenseStereo::ndisp = 64;
   int DenseStereo::textureThresh = 4;
   int DenseStereo::uniqueThresh = 28;
   int DenseStereo::corrSize = 11;
-  double DenseStereo::fdisp = 1.0/16.0;
+  int DenseStereo::method = DenseStereo::BLOCK_MATCHING;
+  int DenseStereo::sgmCorrSize = 5;
+  int DenseStereo::sgmPaths = 8;
+  int DenseStereo::sgmP1 = 100;
+  int DenseStereo::sgmP2 = 400;
+  bool DenseStereo::sgmLRCheck = true;
+  int DenseStereo::speckleSize = 0;
+  int DenseStereo::speckleDiff = 16;
+  bool DenseStereo::confidence = false;
+
+
+  void buildRectifyTable(inttab_t *rtab, int w, int h,
+                         const CamParams &cam, const Distortion &dist,
+                         const CamParams &rcam, const double *R)
+  {
+    static const double I[9] = {1,0,0, 0,1,0, 0,0,1};
+    if (R == NULL)
+      R = I;
+
+    for (int v=0; v<h; v++)
+      for (int u=0; u<w; u++, rtab++)
+        {
+          // ray of the rectified pixel, rotated back into the camera
+          double xr = (u - rcam.cx)/rcam.fx;
+          double yr = (v - rcam.cy)/rcam.fy;
+          double X = R[0]*xr + R[3]*yr + R[6];
+          double Y = R[1]*xr + R[4]*yr + R[7];
+          double Z = R[2]*xr + R[5]*yr + R[8];
+
+          rtab->addr = 0;
+          rtab->a1 = rtab->a2 = rtab->b1 = rtab->b2 = 0;
+          if (Z <= 0.0)
+            continue;
+
+          // distort and project into the source image
+          double x = X/Z, y = Y/Z;
+          double r2 = x*x + y*y;
+          double rad = 1.0 + r2*(dist.k1 + r2*(dist.k2 + r2*dist.k3));
+          double xd = x*rad + 2.0*dist.p1*x*y + dist.p2*(r2 + 2.0*x*x);
+          double yd = y*rad + dist.p1*(r2 + 2.0*y*y) + 2.0*dist.p2*x*y;
+          double us = cam.fx*xd + cam.cx;
+          double vs = cam.fy*yd + cam.cy;
+
+          // the interpolation reads the pixel to the right and below
+          if (!(us >= 0.0 && vs >= 0.0 && us < w-1 && vs < h-1))
+            continue;
+
+          int x0 = (int)us, y0 = (int)vs;
+          int ix = (int)((us - x0)*(1<<INTOFFSET) + 0.5);
+          int iy = (int)((vs - y0)*(1<<INTOFFSET) + 0.5);
+          if (ix == 1<<INTOFFSET && x0 < w-2)
+            { x0++; ix = 0; }
+          if (iy == 1<<INTOFFSET && y0 < h-2)
+            { y0++; iy = 0; }
+
+          // fixed-point weights summing to 1<<INTOFFSET; a whole pixel
+          //   doesn't fit in a byte, so it lends one to its neighbor
+          int one = 1<<INTOFFSET;
+          int a2 = (ix*(one-iy) + one/2) >> INTOFFSET;
+          int b1 = ((one-ix)*iy + one/2) >> INTOFFSET;
+          int b2 = (ix*iy + one/2) >> INTOFFSET;
+          int a1 = one - a2 - b1 - b2;
+          if (a1 < 0) { a1++; b2--; } // rounding, when b2 is large
+          if (a1 > 255) { a1--; a2++; }
+          if (a2 > 255) { a2--; a1++; }
+          if (b1 > 255) { b1--; b2++; }
+          if (b2 > 255) { b2--; b1++; }
+
+          rtab->addr = y0*w + x0;
+          rtab->a1 = a1;
+          rtab->a2 = a2;
+          rtab->b1 = b1;
+          rtab->b2 = b2;
+        }
+  }
 
 
 } // end namespace frame_common
@@ -40,6 +40,9 @@
 #include <frame_common/stereolib.h>
 #include <emmintrin.h>
 #include <stdio.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 // algorithm requires larger buffers to be passed in
 // using lib fns like "memset" can cause problems (?? not sure -
@@ -161,6 +164,93 @@ do_prefilter_norm(uint8_t *im,	// input image
 // feature output aligned at 16 bytes
 //
 
+// one row of the x-sobel prefilter, from the rows above, at and below
+// it; the last group of 4 runs past the end of the row, into the first
+// pixels of the next one
+// the bulk of the row is done 16 pixels at a time, with the same
+// arithmetic, and the rest in the original groups of 4
+static inline void
+xsobel_row(uint8_t *impp, uint8_t *impc, uint8_t *impn, uint8_t *ftimp,
+	   int xim, uint8_t ftzero)
+{
+  int i;
+  int v;
+  int iend = 1 + ((xim-2+3) & ~3); // end of the groups of 4
+  __m128i zero = _mm_setzero_si128();
+  __m128i fmin = _mm_set1_epi16(-ftzero);
+  __m128i fmax = _mm_set1_epi16(ftzero);
+
+  for (i=1; i+16<=iend; i+=16, impp+=16, impc+=16, impn+=16, ftimp+=16)
+    {
+      __m128i l, r, vl, vh;
+      l = _mm_loadu_si128((__m128i *)impc);
+      r = _mm_loadu_si128((__m128i *)(impc+2));
+      vl = _mm_sub_epi16(_mm_unpacklo_epi8(r,zero), _mm_unpacklo_epi8(l,zero));
+      vh = _mm_sub_epi16(_mm_unpackhi_epi8(r,zero), _mm_unpackhi_epi8(l,zero));
+      vl = _mm_add_epi16(vl,vl);
+      vh = _mm_add_epi16(vh,vh);
+      l = _mm_loadu_si128((__m128i *)impp);
+      r = _mm_loadu_si128((__m128i *)(impp+2));
+      vl = _mm_add_epi16(vl, _mm_sub_epi16(_mm_unpacklo_epi8(r,zero), _mm_unpacklo_epi8(l,zero)));
+      vh = _mm_add_epi16(vh, _mm_sub_epi16(_mm_unpackhi_epi8(r,zero), _mm_unpackhi_epi8(l,zero)));
+      l = _mm_loadu_si128((__m128i *)impn);
+      r = _mm_loadu_si128((__m128i *)(impn+2));
+      vl = _mm_add_epi16(vl, _mm_sub_epi16(_mm_unpacklo_epi8(r,zero), _mm_unpacklo_epi8(l,zero)));
+      vh = _mm_add_epi16(vh, _mm_sub_epi16(_mm_unpackhi_epi8(r,zero), _mm_unpackhi_epi8(l,zero)));
+      vl = _mm_sub_epi16(_mm_min_epi16(_mm_max_epi16(vl,fmin),fmax),fmin);
+      vh = _mm_sub_epi16(_mm_min_epi16(_mm_max_epi16(vh,fmin),fmax),fmin);
+      _mm_storeu_si128((__m128i *)ftimp, _mm_packus_epi16(vl,vh));
+    }
+
+  for (; i<xim-1; i+=4, impp+=4, impc+=4, impn+=4) // loop over line
+    {
+      // xsobel filter is -1 -2 -1; 0 0 0; 1 2 1
+      v = *(impc+2)*2 - *(impc)*2 + *(impp+2) -
+	*(impp) + *(impn+2) - *(impn);
+      v = v >> 0;	// normalize
+      if (v < -ftzero)
+	v = 0;
+      else if (v > ftzero)
+	v = ftzero+ftzero;
+      else
+	v = v + ftzero;
+      *ftimp++ = (uint8_t)v;
+
+      v = *(impc+3)*2 - *(impc+1)*2 + *(impp+3) -
+	*(impp+1) + *(impn+3) - *(impn+1);
+      v = v >> 0;	// normalize
+      if (v < -ftzero)
+	v = 0;
+      else if (v > ftzero)
+	v = ftzero+ftzero;
+      else
+	v = v + ftzero;
+      *ftimp++ = (uint8_t)v;
+
+      v = *(impc+4)*2 - *(impc+2)*2 + *(impp+4) -
+	*(impp+2) + *(impn+4) - *(impn+2);
+      v = v >> 0;	// normalize
+      if (v < -ftzero)
+	v = 0;
+      else if (v > ftzero)
+	v = ftzero+ftzero;
+      else
+	v = v + ftzero;
+      *ftimp++ = (uint8_t)v;
+
+      v = *(impc+5)*2 - *(impc+3)*2 + *(impp+5) -
+	*(impp+3) + *(impn+5) - *(impn+3);
+      v = v >> 0;	// normalize
+      if (v < -ftzero)
+	v = 0;
+      else if (v > ftzero)
+	v = ftzero+ftzero;
+      else
+	v = v + ftzero;
+      *ftimp++ = (uint8_t)v;
+    }
+}
+
 void
 do_prefilter_xsobel(uint8_t *im, // input image
 	  uint8_t *ftim,	// feature image output
@@ -169,69 +259,14 @@ do_prefilter_xsobel(uint8_t *im, // input image
 	  uint8_t *buf		// buffer storage
 	  )
 {
-  int i,j;
-  uint8_t *impp, *impc, *impn;
-  uint8_t *ftimp;
-  int v;
+  int j;
 
   // image ptrs
   ftim += xim + 1;		// do we offset output too????
 
   // loop over rows
   for (j=1; j<yim-1; j++, im+=xim, ftim+=xim)
-    {
-      impp = im;
-      impc = im+xim;
-      impn = im+xim+xim;
-      ftimp = ftim;
-      for (i=1; i<xim-1; i+=4, impp+=4, impc+=4, impn+=4) // loop over line
-	    {
-	      // xsobel filter is -1 -2 -1; 0 0 0; 1 2 1
-	      v = *(impc+2)*2 - *(impc)*2 + *(impp+2) -
-		*(impp) + *(impn+2) - *(impn);
-	      v = v >> 0;	// normalize
-	      if (v < -ftzero)
-		v = 0;
-	      else if (v > ftzero)
-		v = ftzero+ftzero;
-	      else
-		v = v + ftzero;
-	      *ftimp++ = (uint8_t)v;
-
-	      v = *(impc+3)*2 - *(impc+1)*2 + *(impp+3) -
-		*(impp+1) + *(impn+3) - *(impn+1);
-	      v = v >> 0;	// normalize
-	      if (v < -ftzero)
-		v = 0;
-	      else if (v > ftzero)
-		v = ftzero+ftzero;
-	      else
-		v = v + ftzero;
-	      *ftimp++ = (uint8_t)v;
-
-	      v = *(impc+4)*2 - *(impc+2)*2 + *(impp+4) -
-		*(impp+2) + *(impn+4) - *(impn+2);
-	      v = v >> 0;	// normalize
-	      if (v < -ftzero)
-		v = 0;
-	      else if (v > ftzero)
-		v = ftzero+ftzero;
-	      else
-		v = v + ftzero;
-	      *ftimp++ = (uint8_t)v;
-
-	      v = *(impc+5)*2 - *(impc+3)*2 + *(impp+5) -
-		*(impp+3) + *(impn+5) - *(impn+3);
-	      v = v >> 0;	// normalize
-	      if (v < -ftzero)
-		v = 0;
-	      else if (v > ftzero)
-		v = ftzero+ftzero;
-	      else
-		v = v + ftzero;
-	      *ftimp++ = (uint8_t)v;
-	    }
-    }
+    xsobel_row(im, im+xim, im+xim+xim, ftim, xim, ftzero);
 }
 
 
@@ -705,6 +740,14 @@ do_prefilter_fast(uint8_t *im,	// input image
 
   int FACCBUFSIZE = xim+64;
 
+#ifdef STEREO_AVX2
+  if (stereo_simd_level() >= STEREO_SIMD_AVX2)
+    {
+      do_prefilter_fast_avx2(im, ftim, xim, yim, ftzero, buf);
+      return;
+    }
+#endif
+
   if (bufp & 0xF)
     bufp = (bufp+15) & ~(uintptr_t)0xF;
   buf = (uint8_t *)bufp;
@@ -916,11 +959,58 @@ do_prefilter_fast(uint8_t *im,	// input image
 
 
 #define EXACTUNIQ   // set this to do exact uniqueness values
+#ifdef EXACTUNIQ
+#define UNIQLIMIT 2		// good matches have uniqueness counts below this
+#else
+#define UNIQLIMIT 3
+#endif
+
+// confidence of a match, from its correlation sum <c1>, the best sum
+//   <c2> away from it, and its texture <tex> against the threshold
+int
+stereo_confidence(int c1, int c2, int tex, int tthresh)
+{
+  int u, t;
+  if (c2 <= c1)			// not unique
+    return 0;
+  u = ((c2 - c1) << 8) / c2;	// uniqueness ratio, 1 - c1/c2
+  if (tthresh <= 0 || tex >= 2*tthresh)
+    t = 256;
+  else
+    t = (tex << 8) / (2*tthresh); // half at the texture threshold
+  return (u*t) >> 8;
+}
+
+// smallest of a row of <dlen> correlation sums, leaving out the
+//   minimum at <m> and its neighbors
+static inline int
+second_min(int16_t *accp, int dlen, int m)
+{
+  int d;
+  __m128i ind = _mm_set_epi16(7,6,5,4,3,2,1,0);
+  __m128i ind8 = _mm_set1_epi16(8);
+  __m128i lo = _mm_set1_epi16(m-2);
+  __m128i hi = _mm_set1_epi16(m+2);
+  __m128i maxv = _mm_set1_epi16(0x7fff);
+  __m128i secv = maxv;
+  __m128i excl;
+  for (d=0; d<dlen; d+=8, accp+=8)
+    {
+      excl = _mm_and_si128(_mm_cmpgt_epi16(ind,lo),_mm_cmpgt_epi16(hi,ind));
+      secv = _mm_min_epi16(secv,_mm_max_epi16(_mm_loadu_si128((__m128i *)accp),
+					       _mm_and_si128(excl,maxv)));
+      ind = _mm_add_epi16(ind,ind8);
+    }
+  secv = _mm_min_epi16(secv,_mm_shuffle_epi32(secv,0x4e));
+  secv = _mm_min_epi16(secv,_mm_shuffle_epi32(secv,0xb1));
+  secv = _mm_min_epi16(secv,_mm_shufflelo_epi16(secv,0xb1));
+  return _mm_extract_epi16(secv,0);
+}
 
 void
 do_stereo_d_fast(uint8_t *lim, uint8_t *rim, // input feature images
 	    int16_t *disp,	// disparity output
-	    int16_t *text,	// texture output
+	    int16_t *conf,	// confidence output, or NULL
 	    int xim, int yim,	// size of images
 	    uint8_t ftzero,	// feature offset from zero
 	    int xwin, int ywin,	// size of corr window, usually square
@@ -937,7 +1027,7 @@ do_stereo_d_fast(uint8_t *lim, uint8_t *rim, // input feature images
   int16_t *intp, *intpp;	// integration buffer pointers
   int16_t *textpp;		// texture buffer pointer
   int16_t *dispp, *disppp;	// disparity output pointer
-  int16_t *textp;		// texture output pointer
+  int16_t *confp, *confpp;	// confidence output pointer
   int16_t acc;
   int dval;			// disparity value
   int uniqthresh;		// fractional 16-bit threshold
@@ -984,6 +1074,15 @@ do_stereo_d_fast(uint8_t *lim, uint8_t *rim, // input feature images
   int16_t *intbuf, *textbuf, *accbuf, temp;
   int8_t *corrbuf;
 
+#ifdef STEREO_AVX2
+  if (stereo_simd_level() >= STEREO_SIMD_AVX2)
+    {
+      do_stereo_d_fast_avx2(lim, rim, disp, conf, xim, yim, ftzero, xwin, ywin, dlen,
+			    tfilter_thresh, ufilter_thresh, buf);
+      return;
+    }
+#endif
+
   if (bufp & 0xF)
     bufp = (bufp+15) & ~(uintptr_t)0xF;
   buf = (uint8_t *)bufp;
@@ -1032,9 +1131,9 @@ do_stereo_d_fast(uint8_t *lim, uint8_t *rim, // input feature images
   limp2 = limp;
   rimp = (int8_t *)rim;
   dispp = disp + xim*(ywin+YKERN-2)/2 + dlen + (xwin+XKERN-2)/2; 
-  textp = NULL;
-  if (text != NULL)		// optional texture buffer output
-    textp = text + dlen;
+  confp = NULL;
+  if (conf != NULL)		// optional confidence output, same layout
+    confp = conf + (dispp - disp);
 
   // normalize texture threshold
   tfilter_thresh = tfilter_thresh * xwin * ywin * ftzero;
@@ -1177,6 +1276,7 @@ do_stereo_d_fast(uint8_t *lim, uint8_t *rim, // input feature images
       if (i >= xwin)		// far enough along...
 	{
 	  disppp = dispp;
+	  confpp = confp;
 	  accp   = accbuf + (ywin-1)*dlen; // results within initial corr window are partial
 	  textpp = textbuf + (ywin-1); // texture measure
 
@@ -1259,6 +1359,17 @@ do_stereo_d_fast(uint8_t *lim, uint8_t *rim, // input feature images
 #endif
 		  if (*textpp < tfilter_thresh)
 		    uniqcnt = val_epi16_8; // cancel out this value
+
+		  // confidence of good matches, from the best sum away from the minimum
+		  if (confpp)
+		    {
+		      *confpp = 0;
+		      if (_mm_extract_epi16(uniqcnt,0) < UNIQLIMIT)
+			*confpp = stereo_confidence(_mm_extract_epi16(minv,0),
+						    second_min(accp-dlen, dlen, dlen-dval-1),
+						    *textpp, tfilter_thresh);
+		      confpp += xim;
+		    }
 		  uval = _mm_or_si128(_mm_and_si128(uval,p0xfffffff0),
 				      _mm_and_si128(uniqcnt,p0x0000000f));
 		}
@@ -1362,6 +1473,8 @@ do_stereo_d_fast(uint8_t *lim, uint8_t *rim, // input feature images
 	    } // end of row loop
 
 	  dispp++;		// go to next column of disparity output
+	  if (confp)
+	    confp++;
 	}
 
     } // end of outer column loop
@@ -1370,6 +1483,12 @@ do_stereo_d_fast(uint8_t *lim, uint8_t *rim, // input feature images
   dispp = disp + (yim - YKERN/2 - ywin/2)*xim;
   for (i=0; i<YKERN; i++, dispp+=xim)
     memclr_si128((__m128i *)dispp, xim*sizeof(int16_t));
+  if (conf != NULL)
+    {
+      confp = conf + (yim - YKERN/2 - ywin/2)*xim;
+      for (i=0; i<YKERN; i++, confp+=xim)
+	memclr_si128((__m128i *)confp, xim*sizeof(int16_t));
+    }
 
 }
 
@@ -1657,6 +1776,227 @@ do_speckle(int16_t *disp, int16_t badval, int width, int height,
 }
 
 
+//
+// parallel speckle filter, same result as do_speckle
+//
+// algorithm:
+//   regions are the connected pixels of do_speckle: neighbors are
+//     the next and previous pixels in memory order and the pixels
+//     above and below, within the rows 4 from the top and bottom
+//   row strips are labeled in parallel with union-find, the root of
+//     a region being its smallest pixel index, and regions in each
+//     strip are counted at their roots
+//   regions are joined across the strip boundaries, adding up counts
+//   pixels of regions smaller than <rcount> get <badval>, in parallel
+//
+// buffers:
+//   labels: pixel labels (32b), size is image
+//   wbuf:   region counts (32b), size is image
+//
+
+#define SPECKLE_JOINED(a,b) (disp[a] != badval && disp[b] != badval && \
+			     disp[a]-disp[b] < rdiff && disp[a]-disp[b] > -rdiff)
+
+// root of pixel <p>, compressing the path to it
+static inline uint32_t
+speckle_find(uint32_t *labels, uint32_t p)
+{
+  uint32_t r = p, n;
+  while (labels[r] != r)
+    r = labels[r];
+  while (labels[p] != r)
+    {
+      n = labels[p];
+      labels[p] = r;
+      p = n;
+    }
+  return r;
+}
+
+// join the regions of <a> and <b>, the larger root pointing at the
+// smaller one, which gets the count
+static inline void
+speckle_union(uint32_t *labels, uint32_t *counts, uint32_t a, uint32_t b)
+{
+  a = speckle_find(labels, a);
+  b = speckle_find(labels, b);
+  if (a == b)
+    return;
+  if (a < b)
+    {
+      labels[b] = a;
+      counts[a] += counts[b];
+    }
+  else
+    {
+      labels[a] = b;
+      counts[b] += counts[a];
+    }
+}
+
+void
+do_speckle_fast(int16_t *disp, int16_t badval, int width, int height,
+		int rdiff, int rcount, 
+		uint32_t *labels, uint32_t *wbuf, int nstrips)
+{
+  int s;
+  uint32_t *counts = wbuf;
+  const uint32_t MIN_P = 4*width+4; // pixel range, as in do_speckle
+  const uint32_t MAX_P = (height-4)*width-4;
+  int nrows = height-8;		// rows with pixels in the range
+
+  if (nrows <= 0 || width <= 8 || rcount <= 1) // no region is smaller
+    return;
+  if (nstrips <= 0)
+    {
+#ifdef _OPENMP
+      nstrips = omp_get_max_threads();
+#else
+      nstrips = 1;
+#endif
+    }
+  if (nstrips > nrows/16)	// at least a few rows in each strip
+    nstrips = nrows/16;
+  if (nstrips < 1)
+    nstrips = 1;
+
+  // label and count the regions of each strip; pixels are labeled
+  // with the root of their region at the time, and counted there a
+  // run at a time
+#pragma omp parallel for schedule(static,1) num_threads(nstrips)
+  for (s=0; s<nstrips; s++)
+    {
+      uint32_t p, a, r, n = 0;	// root of the run, and its pixels not yet counted
+      int l, u, ul = 0;		// joined to the pixels before and above
+      int16_t d, dl = badval;	// disparity of the pixel before
+      uint32_t p0 = (4 + (s*nrows)/nstrips)*width;
+      uint32_t p1 = (4 + ((s+1)*nrows)/nstrips)*width;
+      if (p0 < MIN_P) p0 = MIN_P;
+      if (p1 > MAX_P) p1 = MAX_P;
+      r = p0;
+
+      for (p=p0; p<p1; p++)
+	{
+	  d = disp[p];
+	  if (d == badval)
+	    {
+	      counts[r] += n;
+	      n = 0;
+	      dl = badval;
+	      ul = 0;
+	      continue;
+	    }
+	  l = dl != badval && d-dl < rdiff && d-dl > -rdiff;
+	  u = p >= p0+width && SPECKLE_JOINED(p, p-width);
+	  if (l)
+	    {
+	      // r is still the root of the previous pixel; the pixel above
+	      // is in its region already if it is joined to the pixel
+	      // before it, which is joined to the previous one
+	      if (u && !(ul && SPECKLE_JOINED(p-width, p-width-1)) &&
+		  (a = speckle_find(labels, p-width)) != r)
+		{
+		  counts[r] += n;
+		  n = 0;
+		  if (a < r)	// join, keeping the smaller root
+		    {
+		      labels[r] = a;
+		      counts[a] += counts[r];
+		      r = a;
+		    }
+		  else
+		    {
+		      labels[a] = r;
+		      counts[r] += counts[a];
+		    }
+		}
+	    }
+	  else
+	    {
+	      counts[r] += n;
+	      n = 0;
+	      if (u)
+		r = speckle_find(labels, p-width);
+	      else
+		{
+		  r = p;	// new region
+		  counts[p] = 0;
+		}
+	    }
+	  labels[p] = r;
+	  n++;
+	  dl = d;
+	  ul = u;
+	}
+      counts[r] += n;
+    }
+
+  // join regions across strip boundaries, then shorten the paths from
+  // the boundary pixels to the final roots
+  if (nstrips > 1)
+    {
+      uint32_t p, p0, p1;
+      for (s=1; s<nstrips; s++)
+	{
+	  p0 = (4 + (s*nrows)/nstrips)*width;
+	  p1 = p0 + width;
+	  if (p1 > MAX_P) p1 = MAX_P;
+	  if (SPECKLE_JOINED(p0, p0-1))
+	    speckle_union(labels, counts, p0, p0-1);
+	  for (p=p0; p<p1; p++)
+	    if (p-width >= MIN_P && SPECKLE_JOINED(p, p-width))
+	      speckle_union(labels, counts, p, p-width);
+	}
+      for (s=1; s<nstrips; s++)
+	{
+	  p0 = (4 + (s*nrows)/nstrips)*width - width;
+	  p1 = p0 + 2*width;
+	  if (p0 < MIN_P) p0 = MIN_P;
+	  if (p1 > MAX_P) p1 = MAX_P;
+	  for (p=p0; p<p1; p++)
+	    if (disp[p] != badval)
+	      speckle_find(labels, p);
+	}
+    }
+
+  // remove small regions, within the borders
+#pragma omp parallel for schedule(static,1) num_threads(nstrips)
+  for (s=0; s<nstrips; s++)
+    {
+      int i,j,small = 0;
+      int16_t d, dl;
+      int i0 = 4 + (s*nrows)/nstrips;
+      int i1 = 4 + ((s+1)*nrows)/nstrips;
+      for (i=i0; i<i1; i++)
+	{
+	  uint32_t p = i*width+4;
+	  dl = badval;
+	  for (j=4; j<width-4; j++, p++)
+	    {
+	      d = disp[p];
+	      if (d == badval)
+		{
+		  dl = badval;
+		  continue;
+		}
+	      // a pixel joined to the one before is in its region, so
+	      // the root is only looked up at the start of a run
+	      if (dl == badval || d-dl >= rdiff || d-dl <= -rdiff)
+		{
+		  uint32_t r = labels[p]; // labels are only read here
+		  while (labels[r] != r)
+		    r = labels[r];
+		  small = counts[r] < (uint32_t)rcount;
+		}
+	      dl = d;
+	      if (small)
+		disp[p] = badval;
+	    }
+	}
+    }
+}
+
+
 
 //
 // rectification algorithm
@@ -1701,3 +2041,97 @@ do_rectify_mono_fast(uint8_t *dest, uint8_t *src, int w, int h, inttab_t *rtab)
 	}
     }
 }
+
+
+//
+// rectification fused with the x-sobel prefilter
+// the images are split into strips of rows, run in parallel; each
+//   strip is rectified row by row straight into the output, and the
+//   prefilter follows two rows behind, while its input is in cache
+// rows next to strip boundaries need rows of the neighboring strip,
+//   and are prefiltered once all strips are rectified
+//
+
+static void
+rectify_row(uint8_t *dest, uint8_t *src, int w, inttab_t *rtab)
+{
+  int j;
+  uint8_t *p;
+  int val;
+  for (j=0; j<w; j++, dest++, rtab++)
+    {
+      p = src + rtab->addr;	// upper left pixel
+      val = (*p)*rtab->a1 + (*(p+1))*rtab->a2 + (*(p+w))*rtab->b1 + (*(p+w+1))*rtab->b2;
+      *dest = val >> INTOFFSET; // get rid of fractional offset
+    }
+}
+
+void
+do_rectify_prefilter(uint8_t *lsrc, uint8_t *rsrc, // source images
+		     inttab_t *ltab, inttab_t *rtab, // interpolation tables
+		     uint8_t *lrect, uint8_t *rrect, // rectified images
+		     uint8_t *lftim, uint8_t *rftim, // feature images
+		     int w, int h,	// image size
+		     uint8_t ftzero,	// feature offset from zero
+		     int nstrips	// row strips to run in parallel, 0 for one per thread
+		     )
+{
+  int s, i, k;
+
+  if (nstrips <= 0)
+    {
+#ifdef _OPENMP
+      nstrips = omp_get_max_threads();
+#else
+      nstrips = 1;
+#endif
+    }
+  if (nstrips > h/16)		// at least a few rows in each strip
+    nstrips = h/16;
+  if (nstrips < 1)
+    nstrips = 1;
+
+#pragma omp parallel for schedule(static,1) num_threads(nstrips)
+  for (s=0; s<nstrips; s++)
+    {
+      int y0 = (s*h)/nstrips;
+      int y1 = ((s+1)*h)/nstrips;
+      int r, j;
+      for (r=y0; r<y1; r++)
+	{
+	  rectify_row(lrect + r*w, lsrc, w, ltab + r*w);
+	  rectify_row(rrect + r*w, rsrc, w, rtab + r*w);
+
+	  // row j needs rows j-1 and j+1, and reads into row j+2
+	  j = r-2;
+	  if (j > y0 && j < h-1)
+	    {
+	      xsobel_row(lrect + (j-1)*w, lrect + j*w, lrect + (j+1)*w,
+			 lftim + j*w + 1, w, ftzero);
+	      xsobel_row(rrect + (j-1)*w, rrect + j*w, rrect + (j+1)*w,
+			 rftim + j*w + 1, w, ftzero);
+	    }
+	}
+    }
+
+  // first row and last two rows of each strip
+  for (s=0; s<nstrips; s++)
+    {
+      int y0 = (s*h)/nstrips;
+      int y1 = ((s+1)*h)/nstrips;
+      int rows[3];
+      rows[0] = y0;
+      rows[1] = y1-2;
+      rows[2] = y1-1;
+      for (k=0; k<3; k++)
+	{
+	  i = rows[k];
+	  if (i < 1 || i >= h-1)
+	    continue;
+	  xsobel_row(lrect + (i-1)*w, lrect + i*w, lrect + (i+1)*w,
+		     lftim + i*w + 1, w, ftzero);
+	  xsobel_row(rrect + (i-1)*w, rrect + i*w, rrect + (i+1)*w,
+		     rftim + i*w + 1, w, ftzero);
+	}
+    }
+}
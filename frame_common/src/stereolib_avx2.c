@@ -0,0 +1,691 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+* 
+*  Copyright (c) 2008, Willow Garage, Inc.
+*  All rights reserved.
+* 
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+* 
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+* 
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+//
+// AVX2 versions of the fast prefilter and block matching
+// Same algorithms and buffer layouts as the SSE2 versions in
+// stereolib.c, with 16 words per register in the inner loops, and
+// the same output
+//
+
+#include <frame_common/stereolib.h>
+#include <emmintrin.h>
+
+#ifdef STEREO_AVX2
+#include <immintrin.h>
+#define AVX2_TARGET __attribute__ ((target ("avx2")))
+#endif
+
+
+//
+// SIMD level
+//
+
+static int simd_cap = STEREO_SIMD_AVX2;
+
+int
+stereo_simd_level(void)
+{
+#ifdef STEREO_AVX2
+  static int have_avx2 = -1;
+  if (have_avx2 < 0)
+    {
+      __builtin_cpu_init();
+      have_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+  if (have_avx2 && simd_cap >= STEREO_SIMD_AVX2)
+    return STEREO_SIMD_AVX2;
+#endif
+  return STEREO_SIMD_SSE2;
+}
+
+void
+stereo_set_simd_level(int level)
+{
+  simd_cap = level;
+}
+
+
+#ifdef STEREO_AVX2
+
+static inline void
+memclr_si128(__m128i *buf, int n)
+{
+  int i;
+  __m128i zz;
+  zz = _mm_setzero_si128();
+  n = n>>4;			// divide by 16
+  for (i=0; i<n; i++, buf++)
+    _mm_store_si128(buf,zz);
+}
+
+// inclusive prefix sum of 16 words
+static inline AVX2_TARGET __m256i
+prefix_sum_epi16(__m256i v)
+{
+  __m256i t;
+  v = _mm256_add_epi16(v, _mm256_slli_si256(v, 2)); // within each half
+  v = _mm256_add_epi16(v, _mm256_slli_si256(v, 4));
+  v = _mm256_add_epi16(v, _mm256_slli_si256(v, 8));
+  t = _mm256_permute2x128_si256(v, v, 0x08); // low half into the high half, zeros below
+  t = _mm256_shufflehi_epi16(t, 0xff);	     // its last word...
+  t = _mm256_unpackhi_epi64(t, t);	     // ...across the half
+  return _mm256_add_epi16(v, t);
+}
+
+// last word of <v> in all words
+static inline AVX2_TARGET __m256i
+bcast_last_epi16(__m256i v)
+{
+  return _mm256_broadcastw_epi16(_mm_srli_si128(_mm256_extracti128_si256(v, 1), 14));
+}
+
+
+//
+// prefilter, as do_prefilter_fast
+// NOTE: output buffer <ftim> must be aligned on 16-byte boundary
+// NOTE: input image <im> must be aligned on 16-byte boundary
+//
+
+#define PXKERN 7
+#define PYKERN 7
+
+void AVX2_TARGET
+do_prefilter_fast_avx2(uint8_t *im,	// input image
+	  uint8_t *ftim,	// feature image output
+	  int xim, int yim,	// size of image
+	  uint8_t ftzero,	// feature offset from zero
+	  uint8_t *buf		// buffer storage
+	  )
+{
+  int i,j;
+
+  // set up buffers, first align to 16 bytes
+  uintptr_t bufp = (uintptr_t)buf;
+  int16_t *accbuf, *accp;
+  int16_t *intbuf, *intp;	// intbuf is size xim
+  uint8_t *imp, *impp, *ftimp;
+  __m256i acc, accs, acct, accc, zeros;
+  __m256i const_ftzero, const_ftzero_x2;
+
+  int FACCBUFSIZE = xim+64;
+
+  if (bufp & 0xF)
+    bufp = (bufp+15) & ~(uintptr_t)0xF;
+  buf = (uint8_t *)bufp;
+  accbuf = (int16_t *)buf;
+
+  intbuf = (int16_t *)&buf[FACCBUFSIZE*sizeof(int16_t)];	// integration buffer
+  bufp = (uintptr_t)intbuf;
+  if (bufp & 0xF)
+    bufp = (bufp+15) & ~(uintptr_t)0xF;
+  intbuf = (int16_t *)bufp;  
+
+  // clear buffers
+  memclr_si128((__m128i *)accbuf, FACCBUFSIZE*sizeof(int16_t));
+  memclr_si128((__m128i *)intbuf, 8*sizeof(uint16_t));
+
+  // constants
+  zeros = _mm256_setzero_si256();
+  const_ftzero     = _mm256_set1_epi16(ftzero);
+  const_ftzero_x2  = _mm256_set1_epi16(ftzero*2);
+
+  // loop over rows
+  for (j=0; j<yim; j++, im+=xim, ftim+=xim)
+    {
+      accp = accbuf;		// start at beginning of buf
+      intp = intbuf+8;
+      acc = zeros;
+      imp = im;			// new row window ptr
+      impp = im - PYKERN*xim;
+
+      // row integration of the new row, less the row leaving the
+      // window, 16 pixels at a time
+      for (i=0; i<xim; i+=16, imp+=16, impp+=16, intp+=16, accp+=16)
+	{
+	  accs = _mm256_cvtepu8_epi16(_mm_load_si128((__m128i *)imp)); // next 16 pixels
+	  if (j >= PYKERN)
+	    accs = _mm256_sub_epi16(accs, _mm256_cvtepu8_epi16(_mm_load_si128((__m128i *)impp)));
+	  accs = prefix_sum_epi16(accs); // sum horizontally
+	  acc = _mm256_add_epi16(accs, bcast_last_epi16(acc)); // carry in previous sum
+	  _mm256_storeu_si256((__m256i *)intp, acc); // stored
+
+	  // update acc buffer
+	  acct = _mm256_loadu_si256((__m256i *)(intp-7)); // previous int buffer values
+	  accs = _mm256_sub_epi16(acc, acct);
+	  acct = _mm256_loadu_si256((__m256i *)accp); // acc value
+	  _mm256_storeu_si256((__m256i *)accp, _mm256_add_epi16(accs, acct));
+	}
+
+      if (j < PYKERN)		// initial row accumulation
+	continue;
+
+      // now do normalization and saving of results
+      accp = accbuf+6;	// start at beginning of good values, off by 1 pixel
+      imp = im - (PYKERN/2)*xim + PXKERN/2;
+      ftimp = ftim - (PYKERN/2)*xim + PXKERN/2;
+      for (i=0; i<xim-8; i+=16, imp+=16, accp+=16, ftimp+=16)
+	{
+	  // sum up weighted pixels in a 4-square pattern
+	  accc = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *)imp)); // next 16 pixels
+	  accs = _mm256_slli_epi16(accc,2); // multiply by 4
+	  accs = _mm256_add_epi16(accs, _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *)(imp+1))));
+	  accs = _mm256_add_epi16(accs, _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *)(imp-1))));
+	  accs = _mm256_add_epi16(accs, _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *)(imp+xim))));
+	  accs = _mm256_add_epi16(accs, _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *)(imp-xim))));
+	  // times weighted center by 6, giving 48x single pixel value
+	  acct = _mm256_slli_epi16(accs,2); // multiply by 4
+	  accs = _mm256_add_epi16(accs,accs); // double
+	  accs = _mm256_add_epi16(accs,acct); // now x6
+	  accs = _mm256_add_epi16(accs,accc); // +1 is 49x
+	  // subtract from window sum
+	  accs = _mm256_sub_epi16(accs, _mm256_loadu_si256((__m256i *)accp));
+	  // normalize to ftzero and saturate, divide by 8
+	  accs = _mm256_srai_epi16(accs,3); // divide by 8
+	  accs = _mm256_adds_epi16(accs,const_ftzero); // normalize to ftzero
+	  // saturate to [0, ftzero*2]
+	  accs = _mm256_max_epi16(accs,zeros); // floor of 0
+	  accs = _mm256_min_epi16(accs,const_ftzero_x2);
+
+	  // pack results
+	  _mm_storeu_si128((__m128i *)ftimp,
+			   _mm_packus_epi16(_mm256_castsi256_si128(accs),
+					    _mm256_extracti128_si256(accs,1)));
+	}
+    }
+}
+
+
+//
+// block matching, as do_stereo_d_fast
+//
+
+#define EXACTUNIQ   // set this to do exact uniqueness values
+#ifdef EXACTUNIQ
+#define UNIQLIMIT 2		// good matches have uniqueness counts below this
+#else
+#define UNIQLIMIT 3
+#endif
+
+// new correlation values of 16 disparities, added into the
+// integration and window sums
+static inline AVX2_TARGET void
+corr_update_16(__m128i newpix, __m128i oldpix, int16_t *intp, int16_t *intpp,
+	       int16_t *accp, int dlen)
+{
+  __m256i newval;
+  newval = _mm256_cvtepu8_epi16(newpix); // unpack into words
+  newval = _mm256_add_epi16(newval, _mm256_loadu_si256((__m256i *)intp));
+  newval = _mm256_sub_epi16(newval, _mm256_cvtepu8_epi16(oldpix)); // subtract out old corr vals
+  _mm256_storeu_si256((__m256i *)(intp+dlen), newval); // save new acc values
+  // update windowed sum
+  newval = _mm256_sub_epi16(newval, _mm256_loadu_si256((__m256i *)intpp));
+  newval = _mm256_add_epi16(newval, _mm256_loadu_si256((__m256i *)accp));
+  _mm256_storeu_si256((__m256i *)accp, newval);
+}
+
+// smallest of a row of <dlen> correlation sums, leaving out the
+// minimum at <m> and its neighbors; as second_min in stereolib.c
+static inline AVX2_TARGET int
+second_min_16(int16_t *accp, int dlen, int m)
+{
+  int d;
+  __m256i ind = _mm256_set_epi16(15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0);
+  __m256i ind16 = _mm256_set1_epi16(16);
+  __m256i lo = _mm256_set1_epi16(m-2);
+  __m256i hi = _mm256_set1_epi16(m+2);
+  __m256i maxw = _mm256_set1_epi16(0x7fff);
+  __m256i secw = maxw;
+  __m256i excl;
+  __m128i secv;
+  for (d=0; d<dlen; d+=16, accp+=16)
+    {
+      excl = _mm256_and_si256(_mm256_cmpgt_epi16(ind,lo),_mm256_cmpgt_epi16(hi,ind));
+      secw = _mm256_min_epi16(secw,_mm256_max_epi16(_mm256_loadu_si256((__m256i *)accp),
+						    _mm256_and_si256(excl,maxw)));
+      ind = _mm256_add_epi16(ind,ind16);
+    }
+  secv = _mm_min_epi16(_mm256_castsi256_si128(secw), _mm256_extracti128_si256(secw,1));
+  secv = _mm_minpos_epu16(secv); // sums are positive
+  return _mm_extract_epi16(secv,0);
+}
+
+void AVX2_TARGET
+do_stereo_d_fast_avx2(uint8_t *lim, uint8_t *rim, // input feature images
+	    int16_t *disp,	// disparity output
+	    int16_t *conf,	// confidence output, or NULL
+	    int xim, int yim,	// size of images
+	    uint8_t ftzero,	// feature offset from zero
+	    int xwin, int ywin,	// size of corr window, usually square
+	    int dlen,		// size of disparity search, multiple of 16
+	    int tfilter_thresh,	// texture filter threshold
+	    int ufilter_thresh,	// uniqueness filter threshold, percent
+	    uint8_t *buf	// buffer storage
+	    )
+{
+  int i,j,k,d;			// iteration indices
+  int16_t *accp, *accpp;	// acc buffer ptrs
+  int8_t *limp, *rimp, *limpp, *rimpp, *limp2, *limpp2;	// feature image ptrs
+  int8_t *corrend, *corrp, *corrpp; // corr buffer ptrs
+  int16_t *intp, *intpp;	// integration buffer pointers
+  int16_t *textpp;		// texture buffer pointer
+  int16_t *dispp, *disppp;	// disparity output pointer
+  int16_t *confp, *confpp;	// confidence output pointer
+  int16_t acc;
+  int dval;			// disparity value
+  int uniqthresh;		// fractional 16-bit threshold
+  
+  // xmm variables
+  __m256i limpix, rimpix, newpix, tempix, oldpix;
+  __m256i minw, indw, indtopw, inddw, indmw, nexw, uniqthw, uniqcntw, unimw, accw;
+  __m128i minv, indv, temv, nexv;
+  __m128i cval, pval, nval, ival; // correlation values for subpixel disparity interpolation
+  __m128i denv, numv, intv, sgnv; // numerator, denominator, interpolation, sign of subpixel interp
+  __m128i uniqcnt, uniqth, uniqinit, unim, uval; // uniqueness count, uniqueness threshold
+
+  // xmm constants
+  const __m128i p0xfffffff0 = _mm_set_epi16(-1,-1,-1,-1,-1,-1,-1,0);
+  const __m128i p0x0000000f = _mm_set_epi16(0,0,0,0,0,0,0,-1);
+  const __m128i zeros = _mm_setzero_si128();
+  const __m128i val_epi16_1    = _mm_set1_epi16(1);
+  const __m128i val_epi16_2    = _mm_set1_epi16(2);
+  const __m128i val_epi16_8    = _mm_set1_epi16(8);
+  const __m256i valw_epi16_7fff = _mm256_set1_epi16(0x7fff);
+  const __m256i valw_epi16_16   = _mm256_set1_epi16(16);
+
+  // set up buffers, first align to 16 bytes
+  uintptr_t bufp = (uintptr_t)buf;
+  int16_t *intbuf, *textbuf, *accbuf, temp;
+  int8_t *corrbuf;
+
+  if (bufp & 0xF)
+    bufp = (bufp+15) & ~(uintptr_t)0xF;
+  buf = (uint8_t *)bufp;
+
+#define INTEBUFSIZE ((yim+16+ywin)*dlen)
+  intbuf  = (int16_t *)buf;	// integration buffer
+  bufp = (uintptr_t)intbuf;
+  if (bufp & 0xF)
+    bufp = (bufp+15) & ~(uintptr_t)0xF;
+  intbuf = (int16_t *)bufp;  
+
+#define TXTBUFSIZE (yim + 64)
+  textbuf = (int16_t *)&buf[INTEBUFSIZE*sizeof(int16_t)];	// texture buffer
+  bufp = (uintptr_t)textbuf;
+  if (bufp & 0xF)
+    bufp = (bufp+15) & ~(uintptr_t)0xF;
+  textbuf = (int16_t *)bufp;  
+
+
+#define ACCBUFSIZE (yim*dlen + 64)
+  accbuf  = (int16_t *)&buf[(INTEBUFSIZE+TXTBUFSIZE)*sizeof(int16_t)]; // accumulator buffer
+  bufp = (uintptr_t)accbuf;
+  if (bufp & 0xF)
+    bufp = (bufp+15) & ~(uintptr_t)0xF;
+  accbuf = (int16_t *)bufp;  
+
+
+  corrbuf = (int8_t *)&buf[(INTEBUFSIZE+TXTBUFSIZE+ACCBUFSIZE)*sizeof(int16_t)]; // correlation buffer
+  bufp = (uintptr_t)corrbuf;
+  if (bufp & 0xF)
+    bufp = (bufp+15) & ~(uintptr_t)0xF;
+  corrbuf = (int8_t *)bufp;  
+
+  // clear out buffers
+  memclr_si128((__m128i *)intbuf, dlen*yim*sizeof(int16_t));
+  memclr_si128((__m128i *)corrbuf, dlen*yim*xwin*sizeof(int8_t));
+  memclr_si128((__m128i *)accbuf, dlen*yim*sizeof(int16_t));
+  memclr_si128((__m128i *)textbuf, yim*sizeof(int16_t));
+
+  // set up corrbuf pointers
+  corrend = corrbuf + dlen*yim*xwin;
+  corrp = corrbuf;
+
+  // start further out on line to take care of disparity offsets
+  limp = (int8_t *)lim + dlen - 1;
+  limp2 = limp;
+  rimp = (int8_t *)rim;
+  dispp = disp + xim*(ywin+YKERN-2)/2 + dlen + (xwin+XKERN-2)/2; 
+  confp = NULL;
+  if (conf != NULL)		// optional confidence output, same layout
+    confp = conf + (dispp - disp);
+
+  // normalize texture threshold
+  tfilter_thresh = tfilter_thresh * xwin * ywin * ftzero;
+  tfilter_thresh = tfilter_thresh / 100; // now at percent of max
+
+  // set up some constants
+  // disparity index counters, decremented by 16 for each block of
+  // disparities, so lane <l> ends at dlen-1-d for the first minimum
+  indtopw = _mm256_set_epi16(dlen+0, dlen+1, dlen+2, dlen+3, dlen+4, dlen+5, dlen+6, dlen+7,
+			     dlen+8, dlen+9, dlen+10, dlen+11, dlen+12, dlen+13, dlen+14, dlen+15);
+  uniqthresh = (0x8000 * ufilter_thresh)/100; // fractional multiplication factor
+                                              // for uniqueness test
+  uniqinit = _mm_set1_epi16(uniqthresh);
+  // init variables so compiler doesn't complain
+  intv = zeros;
+  ival = zeros;
+  nval = zeros;
+  pval = zeros;
+  cval = zeros;
+  uval = zeros;
+
+  // iterate over columns first
+  // acc buffer is column-oriented, not line-oriented
+  // at each iteration, move across one column
+  for (i=0; i<xim-XKERN-dlen+2; i++, limp++, rimp++, corrp+=yim*dlen)
+    {    
+      accp = accbuf;
+      if (corrp >= corrend) corrp = corrbuf;
+      limpp = limp;
+      rimpp = rimp;
+      corrpp = corrp;
+      intp = intbuf+(ywin-1)*dlen; // intbuf current ptr
+      intpp = intbuf;	// intbuf old ptr
+          
+      // iterate over rows
+      for (j=0; j<yim-YKERN+1; j++, limpp+=xim, rimpp+=xim-dlen)
+	{
+	  // replicate left image pixel
+	  limpix = _mm256_set1_epi8(*limpp);
+
+	  // iterate over disparities, 32 at a time
+	  for (d=0; d+32<=dlen; d+=32, intp+=32, intpp+=32, accp+=32, corrpp+=32, rimpp+=32)
+	    {
+	      // do SAD calculation
+	      rimpix = _mm256_loadu_si256((__m256i *)rimpp);
+	      newpix = _mm256_subs_epu8(limpix,rimpix); // subtract pixel values, saturate
+	      tempix = _mm256_subs_epu8(rimpix,limpix); // subtract pixel values the other way, saturate
+	      newpix = _mm256_add_epi8(newpix,tempix); // holds abs value
+	      oldpix = _mm256_loadu_si256((__m256i *)corrpp);
+	      _mm256_storeu_si256((__m256i *)corrpp,newpix); // save new corr values
+
+	      corr_update_16(_mm256_castsi256_si128(newpix), _mm256_castsi256_si128(oldpix),
+			     intp, intpp, accp, dlen);
+	      corr_update_16(_mm256_extracti128_si256(newpix,1), _mm256_extracti128_si256(oldpix,1),
+			     intp+16, intpp+16, accp+16, dlen);
+	    }
+	  // last 16 disparities
+	  if (d < dlen)
+	    {
+	      __m128i lpix = _mm256_castsi256_si128(limpix);
+	      __m128i rpix = _mm_loadu_si128((__m128i *)rimpp);
+	      __m128i npix = _mm_add_epi8(_mm_subs_epu8(lpix,rpix), _mm_subs_epu8(rpix,lpix));
+	      __m128i opix = _mm_load_si128((__m128i *)corrpp);
+	      _mm_store_si128((__m128i *)corrpp,npix);
+	      corr_update_16(npix, opix, intp, intpp, accp, dlen);
+	      intp+=16; intpp+=16; accp+=16; corrpp+=16; rimpp+=16;
+	    }
+	} 
+
+      // average texture computation
+      // use full corr window
+      memclr_si128((__m128i *)intbuf, yim*sizeof(int16_t));
+      limpp = limp;
+      limpp2 = limp2;
+      intp = intbuf+ywin-1;
+      intpp = intbuf;
+      accpp = textbuf;
+      acc = 0;
+	  
+      // iterate over rows
+      // have to skip down a row each time...
+      // check for initial period
+      if (i < xwin)
+	{
+	  for (j=0; j<yim-YKERN+1; j++, limpp+=xim)
+	    {
+	      temp = abs(*limpp- ftzero); 
+	      *intp = temp;
+	      acc += *intp++ - *intpp++;
+	      *accpp++ += acc;
+	    }
+	}
+      else
+	{
+	  for (j=0; j<yim-YKERN+1; j++, limpp+=xim, limpp2+=xim)
+	    {
+	      temp = abs(*limpp-ftzero); 
+	      *intp = temp - abs(*limpp2-ftzero);
+	      acc += *intp++ - *intpp++;
+	      *accpp++ += acc;
+	    }
+          limp2++;
+	}
+          
+      // disparity extraction, find min of correlations
+      if (i >= xwin)		// far enough along...
+	{
+	  disppp = dispp;
+	  confpp = confp;
+	  accp   = accbuf + (ywin-1)*dlen; // results within initial corr window are partial
+	  textpp = textbuf + (ywin-1); // texture measure
+
+	  // start the minimum calc
+	  nexw = valw_epi16_7fff;
+	  for (d=0; d<dlen; d+=16)
+	    nexw = _mm256_min_epi16(nexw, _mm256_loadu_si256((__m256i *)(accp+d)));
+	  nexv = _mm_min_epi16(_mm256_castsi256_si128(nexw), _mm256_extracti128_si256(nexw,1));
+
+	  // iterate over rows
+	  for (j=0; j<yim-ywin-YKERN+2; j+=8) 
+	    {
+	      // 8 rows at a time
+	      for (k=0; k<8; k++, textpp++) // do 8 values at a time
+		{
+		  // shift all values left 2 bytes for next entry
+		  cval = _mm_slli_si128(cval,2);
+		  pval = _mm_slli_si128(pval,2);
+		  nval = _mm_slli_si128(nval,2);
+		  uval = _mm_slli_si128(uval,2);
+		  ival = _mm_slli_si128(ival,2);
+
+		  // propagate minimum value
+		  temv = _mm_shufflelo_epi16(nexv,0xb1); // shuffle words
+		  temv = _mm_shufflehi_epi16(temv,0xb1); // shuffle words
+		  minv = _mm_min_epi16(nexv,temv); // word mins propagated
+		  minv = _mm_min_epi16(minv,_mm_shuffle_epi32(minv,0xb1)); // shuffle dwords
+		  minv = _mm_min_epi16(minv,_mm_shuffle_epi32(minv,0x4e)); // shuffle dwords
+		  minw = _mm256_broadcastw_epi16(minv);
+		  // save center value
+		  cval = _mm_or_si128(_mm_and_si128(cval,p0xfffffff0),_mm_and_si128(minv,p0x0000000f)); 
+		  // uniqueness threshold
+		  uniqth = _mm_mulhi_epu16(uniqinit,minv);
+		  uniqth = _mm_add_epi16(uniqth,minv);
+		  uniqthw = _mm256_broadcastw_epi16(uniqth);
+
+		  // find index of min, and uniqueness count
+		  // also do next min
+		  indw = indtopw;
+		  inddw = valw_epi16_16;
+		  uniqcntw = _mm256_setzero_si256();
+		  nexw = valw_epi16_7fff; // initial min value for next 8 rows
+		  for (d=0; d<dlen; d+=16, accp+=16)
+		    {
+		      accw = _mm256_loadu_si256((__m256i *)accp);
+		      indmw = _mm256_cmpgt_epi16(accw,minw); // compare to min
+		      indw = _mm256_subs_epu16(indw,inddw); // decrement indices
+		      inddw = _mm256_and_si256(inddw,indmw); // wipe out decrement at min
+		      unimw = _mm256_cmpgt_epi16(uniqthw,accw); // compare to unique thresh
+		      nexw = _mm256_min_epi16(nexw,_mm256_loadu_si256((__m256i *)(accp+dlen))); // get min for next 8 rows
+		      uniqcntw = _mm256_sub_epi16(uniqcntw,unimw); // add in uniq count
+		    } 
+		  indw = _mm256_subs_epu16(indw,inddw); // decrement indices to saturate at 0
+		  nexv = _mm_min_epi16(_mm256_castsi256_si128(nexw), _mm256_extracti128_si256(nexw,1));
+		  // propagate max value
+		  indv = _mm_max_epi16(_mm256_castsi256_si128(indw), _mm256_extracti128_si256(indw,1));
+		  temv = _mm_shufflelo_epi16(indv,0xb1); // shuffle words
+		  temv = _mm_shufflehi_epi16(temv,0xb1); // shuffle words
+		  indv = _mm_max_epi16(indv,temv); // word maxs propagated
+		  indv = _mm_max_epi16(indv,_mm_shuffle_epi32(indv,0xb1)); // shuffle dwords
+		  indv = _mm_max_epi16(indv,_mm_shuffle_epi32(indv,0x4e)); // shuffle dwords
+
+		  // set up subpixel interpolation (center, previous, next correlation sums)
+		  dval = _mm_extract_epi16(indv,0);	// index of minimum
+		  nval = _mm_insert_epi16(nval,*(accp-dval),0);
+		  pval = _mm_insert_epi16(pval,*(accp-dval-2),0);
+		  // save disparity
+		  ival = _mm_or_si128(_mm_and_si128(ival,p0xfffffff0),_mm_and_si128(indv,p0x0000000f)); 
+
+		  // finish up uniqueness count
+		  uniqcnt = _mm_add_epi16(_mm256_castsi256_si128(uniqcntw), _mm256_extracti128_si256(uniqcntw,1));
+		  uniqcnt = _mm_sad_epu8(uniqcnt,zeros); // add up each half
+		  uniqcnt = _mm_add_epi32(uniqcnt, _mm_srli_si128(uniqcnt,8)); // add two halves
+#ifdef EXACTUNIQ
+		  unim = _mm_cmpgt_epi16(uniqth,nval); // compare to unique thresh
+		  uniqcnt = _mm_add_epi16(uniqcnt,unim); // subtract from uniq count
+		  unim = _mm_cmpgt_epi16(uniqth,pval); // compare to unique thresh
+		  uniqcnt = _mm_add_epi16(uniqcnt,unim); // subtract from uniq count
+#endif
+		  if (*textpp < tfilter_thresh)
+		    uniqcnt = val_epi16_8; // cancel out this value
+
+		  // confidence of good matches, from the best sum away from the minimum
+		  if (confpp)
+		    {
+		      *confpp = 0;
+		      if (_mm_extract_epi16(uniqcnt,0) < UNIQLIMIT)
+			*confpp = stereo_confidence(_mm_extract_epi16(minv,0),
+						    second_min_16(accp-dlen, dlen, dlen-dval-1),
+						    *textpp, tfilter_thresh);
+		      confpp += xim;
+		    }
+		  uval = _mm_or_si128(_mm_and_si128(uval,p0xfffffff0),
+				      _mm_and_si128(uniqcnt,p0x0000000f));
+		}
+
+	      // disparity interpolation (to 1/16 pixel), as in do_stereo_d_fast
+	      // use 16*|p-n| / 2*(p+n-2c)  [p = previous, c = center, n = next]
+
+	      // numerator
+	      numv = _mm_sub_epi16(pval,nval);
+	      sgnv = _mm_cmpgt_epi16(nval,pval); // sign, 0xffff for n>p
+	      numv = _mm_xor_si128(numv,sgnv);
+	      numv = _mm_sub_epi16(numv,sgnv);	// abs val here, |p-n|
+	      
+	      // denominator
+	      denv = _mm_add_epi16(pval,nval);
+	      denv = _mm_sub_epi16(denv,cval);
+	      denv = _mm_sub_epi16(denv,cval); // p+n-2c
+
+              // smoother interpolation
+              denv = _mm_add_epi16(denv,numv); // p+n-2c + |p-n|
+              numv = _mm_add_epi16(numv,numv);	// 2*|p-n|
+
+	      // multiply num by 2 for second bit
+	      numv = _mm_add_epi16(numv,numv);	
+	      // second bit
+	      temv = _mm_cmpgt_epi16(numv,denv); // 0xffff if n>d
+	      intv = _mm_srli_epi16(temv,15); // add 1 where n>d
+	      intv = _mm_slli_epi16(intv,1); // shift left
+	      numv = _mm_subs_epu16(numv,_mm_and_si128(temv,denv)); // sub out denominator
+	      numv = _mm_slli_epi16(numv,1); // shift left (x2)
+
+	      // third bit
+	      temv = _mm_cmpgt_epi16(numv,denv); // 0xffff if n>d
+	      intv = _mm_sub_epi16(intv,temv); // add 1 where n>d
+	      intv = _mm_slli_epi16(intv,1); // shift left
+	      numv = _mm_subs_epu16(numv,_mm_and_si128(temv,denv)); // sub out denominator
+	      numv = _mm_slli_epi16(numv,1); // shift left (x2)
+
+	      // fourth bit
+	      temv = _mm_cmpgt_epi16(numv,denv); // 0xffff if n>d
+	      intv = _mm_sub_epi16(intv,temv); // add 1 where n>d
+	      intv = _mm_slli_epi16(intv,1); // shift left
+	      numv = _mm_subs_epu16(numv,_mm_and_si128(temv,denv)); // sub out denominator
+	      numv = _mm_slli_epi16(numv,1); // shift left (x2)
+
+	      // fifth bit
+	      temv = _mm_cmpgt_epi16(numv,denv); // 0xffff if n>d
+	      intv = _mm_sub_epi16(intv,temv); // add 1 where n>d
+
+	      // round and do sign
+	      intv = _mm_add_epi16(intv,val_epi16_1);	// add in 1 to round
+	      intv = _mm_srli_epi16(intv,1);	// shift back
+	      intv = _mm_xor_si128(intv,sgnv); // get sign back
+	      intv = _mm_sub_epi16(intv,sgnv); // signed val here
+
+	      // add in increment, should be max +-8
+	      ival = _mm_slli_epi16(ival,4);
+	      ival = _mm_sub_epi16(ival,intv);
+	      
+	      // check uniq count
+#ifdef EXACTUNIQ
+	      uval = _mm_cmplt_epi16(uval,val_epi16_2);	// 0s where uniqcnt > 1
+#else
+	      uval = _mm_cmplt_epi16(uval,_mm_set1_epi16(3)); // 0s where uniqcnt > 2
+#endif
+	      ival = _mm_and_si128(uval,ival); // set to bad values to 0
+
+	      // store in output array
+	      *disppp = _mm_extract_epi16(ival,7);
+	      disppp += xim;
+	      *disppp = _mm_extract_epi16(ival,6);
+	      disppp += xim;
+	      *disppp = _mm_extract_epi16(ival,5);
+	      disppp += xim;
+	      *disppp = _mm_extract_epi16(ival,4);
+	      disppp += xim;
+	      *disppp = _mm_extract_epi16(ival,3);
+	      disppp += xim;
+	      *disppp = _mm_extract_epi16(ival,2);
+	      disppp += xim;
+	      *disppp = _mm_extract_epi16(ival,1);
+	      disppp += xim;
+	      *disppp = _mm_extract_epi16(ival,0);
+	      disppp += xim;
+
+	    } // end of row loop
+
+	  dispp++;		// go to next column of disparity output
+	  if (confp)
+	    confp++;
+	}
+
+    } // end of outer column loop
+
+  // clean up last few rows in case of overrun
+  dispp = disp + (yim - YKERN/2 - ywin/2)*xim;
+  for (i=0; i<YKERN; i++, dispp+=xim)
+    memclr_si128((__m128i *)dispp, xim*sizeof(int16_t));
+  if (conf != NULL)
+    {
+      confp = conf + (yim - YKERN/2 - ywin/2)*xim;
+      for (i=0; i<YKERN; i++, confp+=xim)
+	memclr_si128((__m128i *)confp, xim*sizeof(int16_t));
+    }
+
+}
+
+#endif // STEREO_AVX2
@@ -0,0 +1,730 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+* 
+*  Copyright (c) 2008, Willow Garage, Inc.
+*  All rights reserved.
+* 
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+* 
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+* 
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+//
+// Semi-global matching (Hirschmuller 2008), in a single top-down pass
+// Matching costs are window SADs of the feature images; they are
+// aggregated, 16-bit lanes over the disparities, along the paths that
+// reach a pixel from its row and the rows above: left, right, above,
+// and for the full path set the two upper diagonals.  This is the path
+// set of OpenCV's SGBM: it needs the costs and path sums of only the
+// current row, so memory doesn't grow with the image height.  Row
+// strips of the image run in parallel; each starts its vertical paths
+// SGM_OVERLAP rows above the strip so they have settled when they
+// reach it.
+//
+
+#include <frame_common/stereolib.h>
+#include <emmintrin.h>
+#include <stdio.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef STEREO_AVX2
+#include <immintrin.h>
+#define AVX2_TARGET __attribute__ ((target ("avx2")))
+#endif
+
+#define SGM_MAXCOST 1023	// matching costs are scaled to at most this
+#define SGM_BIG 0x3fff		// guard value around the path costs of a pixel
+#define SGM_PAD 16		// guard lanes on each side of a pixel's path costs
+#define SGM_OVERLAP 32		// rows run before a strip
+#define SGM_ALIGN(x) (((x) + 31) & ~(size_t)31)
+
+
+//
+// kernels
+//
+
+static inline int16_t
+hmin_epi16(__m128i v)
+{
+  v = _mm_min_epi16(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1,0,3,2)));
+  v = _mm_min_epi16(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2,3,0,1)));
+  v = _mm_min_epi16(v, _mm_shufflelo_epi16(v, _MM_SHUFFLE(2,3,0,1)));
+  return (int16_t)_mm_extract_epi16(v, 0);
+}
+
+// path costs of one pixel along <npaths> paths
+//   L(k) = C(k) + min(Lp(k), Lp(k-1)+P1, Lp(k+1)+P1, min(Lp)+P2) - min(Lp)
+// <prev> are the path costs of the previous pixel on each path, with
+// guard lanes around them, <pmin> their minima; <sum> gets the total
+// over the paths, added to what is there unless <first> is set
+typedef void (*sgm_pixel_fn)(const int16_t *cost, int16_t **prev, const int16_t *pmin,
+			     int16_t **cur, int16_t *cmin, int npaths,
+			     int16_t *sum, int first, int dlen, int p1, int p2);
+
+static void
+sgm_pixel_sse2(const int16_t *cost, int16_t **prev, const int16_t *pmin,
+	       int16_t **cur, int16_t *cmin, int npaths,
+	       int16_t *sum, int first, int dlen, int p1, int p2)
+{
+  int i,k;
+  __m128i vp1 = _mm_set1_epi16(p1);
+  __m128i vpm[4], vp2[4], vmin[4];
+  __m128i c, s, a, b, e;
+  const int16_t *lp;
+
+  for (i=0; i<npaths; i++)
+    {
+      vpm[i] = _mm_set1_epi16(pmin[i]);
+      vp2[i] = _mm_set1_epi16(pmin[i]+p2);
+      vmin[i] = _mm_set1_epi16(0x7fff);
+    }
+
+  for (k=0; k<dlen; k+=8)
+    {
+      c = _mm_load_si128((__m128i *)(cost+k));
+      s = first ? _mm_setzero_si128() : _mm_load_si128((__m128i *)(sum+k));
+      for (i=0; i<npaths; i++)
+	{
+	  lp = prev[i]+k;
+	  a = _mm_load_si128((__m128i *)lp);
+	  b = _mm_adds_epi16(_mm_loadu_si128((__m128i *)(lp-1)), vp1);
+	  e = _mm_adds_epi16(_mm_loadu_si128((__m128i *)(lp+1)), vp1);
+	  a = _mm_min_epi16(_mm_min_epi16(a, b), _mm_min_epi16(e, vp2[i]));
+	  a = _mm_add_epi16(c, _mm_sub_epi16(a, vpm[i]));
+	  _mm_store_si128((__m128i *)(cur[i]+k), a);
+	  vmin[i] = _mm_min_epi16(vmin[i], a);
+	  s = _mm_adds_epi16(s, a);
+	}
+      _mm_store_si128((__m128i *)(sum+k), s);
+    }
+
+  for (i=0; i<npaths; i++)
+    cmin[i] = hmin_epi16(vmin[i]);
+}
+
+// window SAD matching costs of row <y>, for each pixel at disparity
+// index k = dlen-1-d, scaled down by <shift>; pixels without a full
+// disparity range keep what is there.  The column sums over the window
+// rows are carried over from row y-1, unless <init> is set
+typedef void (*sgm_cost_fn)(const uint8_t *lim, const uint8_t *rim, int xim, int y,
+			    int xwin, int ywin, int dlen, int shift,
+			    int16_t *cost, int16_t *colsum, int init);
+
+// absolute differences of a left pixel and 8 right ones
+static inline __m128i
+sgm_ad8(const uint8_t *lp, const uint8_t *rp)
+{
+  __m128i l = _mm_set1_epi8((char)*lp);
+  __m128i r = _mm_loadl_epi64((__m128i *)rp);
+  return _mm_unpacklo_epi8(_mm_or_si128(_mm_subs_epu8(l, r), _mm_subs_epu8(r, l)),
+			   _mm_setzero_si128());
+}
+
+static void
+sgm_cost_row_sse2(const uint8_t *lim, const uint8_t *rim, int xim, int y,
+		  int xwin, int ywin, int dlen, int shift,
+		  int16_t *cost, int16_t *colsum, int init)
+{
+  int i,j,k;
+  int rx = xwin/2, ry = ywin/2;
+  int x0 = dlen-1+rx, x1 = xim-rx;
+  const uint8_t *lp, *rp;
+  __m128i vmax = _mm_set1_epi16(SGM_MAXCOST);
+  __m128i acc;
+
+  // column sums over the window rows
+  for (i=dlen-1; i<xim; i++)
+    {
+      int16_t *cs = colsum + i*dlen;
+      for (k=0; k<dlen; k+=8)
+	{
+	  rp = rim + i-(dlen-1)+k;
+	  if (init)
+	    {
+	      acc = _mm_setzero_si128();
+	      lp = lim + (y-ry)*xim + i;
+	      rp += (y-ry)*xim;
+	      for (j=0; j<ywin; j++, lp+=xim, rp+=xim)
+		acc = _mm_add_epi16(acc, sgm_ad8(lp, rp));
+	    }
+	  else			// add the new row, take out the old one
+	    {
+	      lp = lim + (y+ry)*xim + i;
+	      rp += (y+ry)*xim;
+	      acc = _mm_add_epi16(_mm_load_si128((__m128i *)(cs+k)), sgm_ad8(lp, rp));
+	      acc = _mm_sub_epi16(acc, sgm_ad8(lp - ywin*xim, rp - ywin*xim));
+	    }
+	  _mm_store_si128((__m128i *)(cs+k), acc);
+	}
+    }
+
+  // window sums along the row
+  for (k=0; k<dlen; k+=8)
+    {
+      acc = _mm_setzero_si128();
+      for (i=x0-rx; i<=x0+rx; i++)
+	acc = _mm_add_epi16(acc, _mm_load_si128((__m128i *)(colsum + i*dlen + k)));
+      for (i=x0; i<x1; i++)
+	{
+	  _mm_store_si128((__m128i *)(cost + i*dlen + k),
+			  _mm_min_epi16(_mm_srli_epi16(acc, shift), vmax));
+	  if (i+1 < x1)
+	    acc = _mm_sub_epi16(_mm_add_epi16(acc, _mm_load_si128((__m128i *)(colsum + (i+1+rx)*dlen + k))),
+				_mm_load_si128((__m128i *)(colsum + (i-rx)*dlen + k)));
+	}
+    }
+}
+
+#ifdef STEREO_AVX2
+
+static void AVX2_TARGET
+sgm_pixel_avx2(const int16_t *cost, int16_t **prev, const int16_t *pmin,
+	       int16_t **cur, int16_t *cmin, int npaths,
+	       int16_t *sum, int first, int dlen, int p1, int p2)
+{
+  int i,k;
+  __m256i vp1 = _mm256_set1_epi16(p1);
+  __m256i vpm[4], vp2[4], vmin[4];
+  __m256i c, s, a, b, e;
+  const int16_t *lp;
+
+  for (i=0; i<npaths; i++)
+    {
+      vpm[i] = _mm256_set1_epi16(pmin[i]);
+      vp2[i] = _mm256_set1_epi16(pmin[i]+p2);
+      vmin[i] = _mm256_set1_epi16(0x7fff);
+    }
+
+  for (k=0; k<dlen; k+=16)
+    {
+      c = _mm256_loadu_si256((__m256i *)(cost+k));
+      s = first ? _mm256_setzero_si256() : _mm256_loadu_si256((__m256i *)(sum+k));
+      for (i=0; i<npaths; i++)
+	{
+	  lp = prev[i]+k;
+	  a = _mm256_loadu_si256((__m256i *)lp);
+	  b = _mm256_adds_epi16(_mm256_loadu_si256((__m256i *)(lp-1)), vp1);
+	  e = _mm256_adds_epi16(_mm256_loadu_si256((__m256i *)(lp+1)), vp1);
+	  a = _mm256_min_epi16(_mm256_min_epi16(a, b), _mm256_min_epi16(e, vp2[i]));
+	  a = _mm256_add_epi16(c, _mm256_sub_epi16(a, vpm[i]));
+	  _mm256_storeu_si256((__m256i *)(cur[i]+k), a);
+	  vmin[i] = _mm256_min_epi16(vmin[i], a);
+	  s = _mm256_adds_epi16(s, a);
+	}
+      _mm256_storeu_si256((__m256i *)(sum+k), s);
+    }
+
+  for (i=0; i<npaths; i++)
+    cmin[i] = hmin_epi16(_mm_min_epi16(_mm256_castsi256_si128(vmin[i]),
+				       _mm256_extracti128_si256(vmin[i], 1)));
+}
+
+static inline __m256i AVX2_TARGET
+sgm_ad16(const uint8_t *lp, const uint8_t *rp)
+{
+  __m128i l = _mm_set1_epi8((char)*lp);
+  __m128i r = _mm_loadu_si128((__m128i *)rp);
+  return _mm256_cvtepu8_epi16(_mm_or_si128(_mm_subs_epu8(l, r), _mm_subs_epu8(r, l)));
+}
+
+static void AVX2_TARGET
+sgm_cost_row_avx2(const uint8_t *lim, const uint8_t *rim, int xim, int y,
+		  int xwin, int ywin, int dlen, int shift,
+		  int16_t *cost, int16_t *colsum, int init)
+{
+  int i,j,k;
+  int rx = xwin/2, ry = ywin/2;
+  int x0 = dlen-1+rx, x1 = xim-rx;
+  const uint8_t *lp, *rp;
+  __m256i vmax = _mm256_set1_epi16(SGM_MAXCOST);
+  __m256i acc;
+
+  for (i=dlen-1; i<xim; i++)
+    {
+      int16_t *cs = colsum + i*dlen;
+      for (k=0; k<dlen; k+=16)
+	{
+	  rp = rim + i-(dlen-1)+k;
+	  if (init)
+	    {
+	      acc = _mm256_setzero_si256();
+	      lp = lim + (y-ry)*xim + i;
+	      rp += (y-ry)*xim;
+	      for (j=0; j<ywin; j++, lp+=xim, rp+=xim)
+		acc = _mm256_add_epi16(acc, sgm_ad16(lp, rp));
+	    }
+	  else
+	    {
+	      lp = lim + (y+ry)*xim + i;
+	      rp += (y+ry)*xim;
+	      acc = _mm256_add_epi16(_mm256_loadu_si256((__m256i *)(cs+k)), sgm_ad16(lp, rp));
+	      acc = _mm256_sub_epi16(acc, sgm_ad16(lp - ywin*xim, rp - ywin*xim));
+	    }
+	  _mm256_storeu_si256((__m256i *)(cs+k), acc);
+	}
+    }
+
+  for (k=0; k<dlen; k+=16)
+    {
+      acc = _mm256_setzero_si256();
+      for (i=x0-rx; i<=x0+rx; i++)
+	acc = _mm256_add_epi16(acc, _mm256_loadu_si256((__m256i *)(colsum + i*dlen + k)));
+      for (i=x0; i<x1; i++)
+	{
+	  _mm256_storeu_si256((__m256i *)(cost + i*dlen + k),
+			      _mm256_min_epi16(_mm256_srli_epi16(acc, shift), vmax));
+	  if (i+1 < x1)
+	    acc = _mm256_sub_epi16(_mm256_add_epi16(acc, _mm256_loadu_si256((__m256i *)(colsum + (i+1+rx)*dlen + k))),
+				   _mm256_loadu_si256((__m256i *)(colsum + (i-rx)*dlen + k)));
+	}
+    }
+}
+
+#endif // STEREO_AVX2
+
+
+//
+// driver
+//
+
+// number of row strips actually used
+static int
+sgm_strips(int yim, int nstrips)
+{
+  if (nstrips <= 0)
+    {
+#ifdef _OPENMP
+      nstrips = omp_get_max_threads();
+#else
+      nstrips = 1;
+#endif
+    }
+  // strips much thinner than the overlap are mostly overhead
+  if (nstrips > yim/(2*SGM_OVERLAP))
+    nstrips = yim/(2*SGM_OVERLAP);
+  if (nstrips < 1)
+    nstrips = 1;
+  return nstrips;
+}
+
+// workspace of one strip
+typedef struct
+{
+  int16_t *cost;		// matching costs of the current row
+  int16_t *colsum;		// column sums for the matching costs
+  int16_t *sum;			// path sums of the current row
+  int16_t *rows[2][3];		// path costs of the previous/current row, per vertical path
+  int16_t *rowmin[2][3];	// their minima, per pixel
+  int16_t *horz;		// path costs along the row: a start slot and two alternating ones
+  int *kleft;			// best disparity indices of the row
+  int16_t *kright, *rmin;	// best disparity indices and sums of the right image row
+  int *tex;			// column sums of the texture
+} sgm_work_t;
+
+static size_t
+sgm_work_size(int xim, int dlen)
+{
+  int dstride = dlen + 2*SGM_PAD;
+  return 3*SGM_ALIGN(xim*dlen*sizeof(int16_t)) +
+    6*SGM_ALIGN((xim+2)*dstride*sizeof(int16_t)) +
+    6*SGM_ALIGN((xim+2)*sizeof(int16_t)) +
+    SGM_ALIGN(3*dstride*sizeof(int16_t)) +
+    2*SGM_ALIGN(xim*sizeof(int)) + 2*SGM_ALIGN(xim*sizeof(int16_t));
+}
+
+static void
+sgm_work_setup(sgm_work_t *w, uint8_t *p, int xim, int dlen)
+{
+  int i,j;
+  int dstride = dlen + 2*SGM_PAD;
+  w->cost = (int16_t *)p;    p += SGM_ALIGN(xim*dlen*sizeof(int16_t));
+  w->colsum = (int16_t *)p;  p += SGM_ALIGN(xim*dlen*sizeof(int16_t));
+  w->sum = (int16_t *)p;     p += SGM_ALIGN(xim*dlen*sizeof(int16_t));
+  for (i=0; i<2; i++)
+    for (j=0; j<3; j++)
+      {
+	w->rows[i][j] = (int16_t *)p;   p += SGM_ALIGN((xim+2)*dstride*sizeof(int16_t));
+	w->rowmin[i][j] = (int16_t *)p; p += SGM_ALIGN((xim+2)*sizeof(int16_t));
+      }
+  w->horz = (int16_t *)p;    p += SGM_ALIGN(3*dstride*sizeof(int16_t));
+  w->kleft = (int *)p;       p += SGM_ALIGN(xim*sizeof(int));
+  w->tex = (int *)p;         p += SGM_ALIGN(xim*sizeof(int));
+  w->kright = (int16_t *)p;  p += SGM_ALIGN(xim*sizeof(int16_t));
+  w->rmin = (int16_t *)p;
+}
+
+static void
+sgm_fill(int16_t *p, int n, int16_t v)
+{
+  int i;
+  for (i=0; i<n; i++)
+    p[i] = v;
+}
+
+// set path costs to the start of a path: zero costs inside each slot,
+// guards outside
+static void
+sgm_clear_slots(int16_t *slots, int n, int dlen)
+{
+  int i,k;
+  int dstride = dlen + 2*SGM_PAD;
+  for (i=0; i<n; i++, slots+=dstride)
+    {
+      for (k=0; k<SGM_PAD; k++)
+	slots[k] = slots[SGM_PAD+dlen+k] = SGM_BIG;
+      memset(slots+SGM_PAD, 0, dlen*sizeof(int16_t));
+    }
+}
+
+static void
+sgm_clear_rows(sgm_work_t *w, int xim, int dlen)
+{
+  int i,j;
+  for (i=0; i<2; i++)
+    for (j=0; j<3; j++)
+      {
+	sgm_clear_slots(w->rows[i][j], xim+2, dlen);
+	memset(w->rowmin[i][j], 0, (xim+2)*sizeof(int16_t));
+      }
+  sgm_clear_slots(w->horz, 3, dlen);
+}
+
+// one row of path aggregation, along the row in direction <dir> (1 for
+// left to right), and with <nvert> paths from the row above: none, the
+// straight one, or that and the two diagonals
+static void
+sgm_aggregate_row(sgm_work_t *w, int cur, int xim, int dlen, int nvert, int dir,
+		  int16_t *sum, int first, int p1, int p2, sgm_pixel_fn pixel)
+{
+  int i,x;
+  int dstride = dlen + 2*SGM_PAD;
+  int prv = 1-cur;
+  int16_t *prev[4], *curp[4], pmin[4], cmin[4];
+  int16_t *hprev = w->horz + SGM_PAD; // start slot
+  int16_t hmin = 0;
+  static const int off[3] = { 0, -1, 1 }; // previous-row pixel offsets of the vertical paths
+
+  for (i=0, x = dir > 0 ? 0 : xim-1; i<xim; i++, x+=dir)
+    {
+      int16_t *hcur = w->horz + SGM_PAD + (1 + (i&1))*dstride;
+      int j;
+      prev[0] = hprev;
+      pmin[0] = hmin;
+      curp[0] = hcur;
+      for (j=0; j<nvert; j++)
+	{
+	  int xs = x+1+off[j];	// slots are offset by one for the borders
+	  prev[j+1] = w->rows[prv][j] + SGM_PAD + xs*dstride;
+	  pmin[j+1] = w->rowmin[prv][j][xs];
+	  curp[j+1] = w->rows[cur][j] + SGM_PAD + (x+1)*dstride;
+	}
+      pixel(w->cost + x*dlen, prev, pmin, curp, cmin, nvert+1,
+	    sum + x*dlen, first, dlen, p1, p2);
+      for (j=0; j<nvert; j++)
+	w->rowmin[cur][j][x+1] = cmin[j+1];
+      hprev = hcur;
+      hmin = cmin[0];
+    }
+}
+
+// disparities of one row from the summed path costs
+static void
+sgm_disparity_row(sgm_work_t *w, const int16_t *sum, const uint8_t *lim, int16_t *disp,
+		  int xim, int yim, int y, uint8_t ftzero, int xwin, int ywin, int dlen,
+		  int tthresh, int ufilter_thresh, int lr_check)
+{
+  int i,j,k,x,m;
+  int rx = xwin/2, ry = ywin/2;
+  int x0 = dlen-1+rx, x1 = xim-rx;
+  int *kleft = w->kleft;
+  __m128i v, vmin;
+
+  for (x=0; x<xim; x++)
+    disp[x] = FILTEREDVAL;
+  if (y-ry < 0 || y+ry >= yim || x0 >= x1)
+    return;
+
+  // texture filter, as in block matching
+  if (tthresh > 0)
+    for (x=0; x<xim; x++)
+      {
+	int t = 0;
+	const uint8_t *lp = lim + (y-ry)*xim + x;
+	for (j=0; j<ywin; j++, lp+=xim)
+	  t += abs(*lp-ftzero);
+	w->tex[x] = t;
+      }
+
+  for (x=x0; x<x1; x++)
+    {
+      const int16_t *s = sum + x*dlen;
+      int best, smin;
+      kleft[x] = -1;
+
+      if (tthresh > 0)
+	{
+	  int t = 0;
+	  for (i=x-rx; i<=x+rx; i++)
+	    t += w->tex[i];
+	  if (t < tthresh)
+	    continue;
+	}
+
+      // best disparity index, the first of equal ones
+      vmin = _mm_load_si128((__m128i *)s);
+      for (k=8; k<dlen; k+=8)
+	vmin = _mm_min_epi16(vmin, _mm_load_si128((__m128i *)(s+k)));
+      smin = hmin_epi16(vmin);
+      vmin = _mm_set1_epi16(smin);
+      for (k=0; ; k+=8)
+	if ((m = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_load_si128((__m128i *)(s+k)), vmin))))
+	  break;
+      best = k + __builtin_ctz(m)/2;
+
+      // uniqueness filter: no other sum, away from the best, within
+      // the threshold.  Sums within it are counted 8 at a time, and
+      // the best and its neighbors taken out after
+      if (ufilter_thresh > 0)
+	{
+	  int uthresh = smin + (smin*ufilter_thresh)/100;
+	  __m128i cnt = _mm_setzero_si128();
+	  v = _mm_set1_epi16(uthresh > 0x7fff ? 0x7fff : uthresh);
+	  for (k=0; k<dlen; k+=8)
+	    cnt = _mm_sub_epi16(cnt, _mm_andnot_si128(_mm_cmpgt_epi16(_mm_load_si128((__m128i *)(s+k)), v),
+						      _mm_set1_epi16(-1)));
+	  cnt = _mm_sad_epu8(cnt, _mm_setzero_si128());
+	  m = _mm_cvtsi128_si32(cnt) + _mm_extract_epi16(cnt, 4);
+	  for (j=best-1; j<=best+1; j++)
+	    if (j >= 0 && j < dlen && s[j] <= uthresh)
+	      m--;
+	  if (m > 0)
+	    continue;
+	}
+
+      kleft[x] = best;
+    }
+
+  // left-right check: disparity of each right image pixel from the
+  // same path sums, must agree to a pixel.  The sums of a left pixel
+  // run over consecutive right pixels, so the right minima are taken
+  // 8 at a time
+  if (lr_check)
+    {
+      int16_t *kright = w->kright, *rmin = w->rmin;
+      __m128i kinit = _mm_setr_epi16(0,1,2,3,4,5,6,7);
+      __m128i eight = _mm_set1_epi16(8), none = _mm_set1_epi16(-1);
+      __m128i kv, r, kr, lt;
+      for (x=0; x<xim; x++)
+	{
+	  kright[x] = -1;
+	  rmin[x] = 0x7fff;
+	}
+      for (x=x0; x<x1; x++)
+	{
+	  const int16_t *s = sum + x*dlen;
+	  int16_t *rm = rmin + x-(dlen-1);
+	  int16_t *krp = kright + x-(dlen-1);
+	  kv = kinit;
+	  for (k=0; k<dlen; k+=8, kv=_mm_add_epi16(kv, eight))
+	    {
+	      v = _mm_load_si128((__m128i *)(s+k));
+	      r = _mm_loadu_si128((__m128i *)(rm+k));
+	      kr = _mm_loadu_si128((__m128i *)(krp+k));
+	      lt = _mm_or_si128(_mm_cmpgt_epi16(r, v), _mm_cmpeq_epi16(kr, none));
+	      _mm_storeu_si128((__m128i *)(rm+k), _mm_min_epi16(r, v));
+	      _mm_storeu_si128((__m128i *)(krp+k),
+			       _mm_or_si128(_mm_and_si128(lt, kv), _mm_andnot_si128(lt, kr)));
+	    }
+	}
+      for (x=x0; x<x1; x++)
+	{
+	  k = kleft[x];
+	  if (k >= 0 && abs(kright[x-(dlen-1)+k] - k) > 1)
+	    kleft[x] = -1;
+	}
+    }
+
+  // subpixel disparity from a parabola through the neighbors
+  for (x=x0; x<x1; x++)
+    {
+      const int16_t *s = sum + x*dlen;
+      double dv = 0.0;
+      k = kleft[x];
+      if (k < 0)
+	continue;
+      if (k > 0 && k < dlen-1)
+	{
+	  int c = s[k], p = s[k+1], n = s[k-1];
+	  int den = p + n - 2*c;
+	  if (den > 0)
+	    dv = 0.5*(double)(p-n)/(double)den;
+	}
+      dv = (double)(dlen-1-k) + dv;
+      if (dv > 0.0)
+	disp[x] = (int16_t)(0.5 + 16.0*dv);
+    }
+}
+
+size_t
+do_stereo_sgm_bufsize(int xim, int yim, int dlen, int nstrips)
+{
+  return sgm_strips(yim, nstrips)*sgm_work_size(xim, dlen) + 32;
+}
+
+void
+do_stereo_sgm(uint8_t *lim, uint8_t *rim, // input feature images
+	      int16_t *disp,	// disparity output
+	      int xim, int yim,	// size of images
+	      uint8_t ftzero,	// feature offset from zero
+	      int xwin, int ywin, // size of corr window, usually square
+	      int dlen,		// size of disparity search, multiple of 8
+	      int tfilter_thresh, // texture filter threshold
+	      int ufilter_thresh, // uniqueness filter threshold, percent
+	      int p1, int p2,	// penalties for disparity changes of one and more pixels
+	      int npaths,	// path set, 4 or 8
+	      int lr_check,	// left-right consistency check
+	      int nstrips,	// row strips to run in parallel, 0 for one per thread
+	      uint8_t *buf	// buffer storage
+	      )
+{
+  int s;
+  int maxdiff, shift, nvert;
+  sgm_pixel_fn pixel = sgm_pixel_sse2;
+  sgm_cost_fn cost = sgm_cost_row_sse2;
+
+#ifdef STEREO_AVX2
+  if (stereo_simd_level() >= STEREO_SIMD_AVX2 && dlen%16 == 0)
+    {
+      pixel = sgm_pixel_avx2;
+      cost = sgm_cost_row_avx2;
+    }
+#endif
+
+  xwin |= 1;			// windows are centered on the pixel
+  ywin |= 1;
+  nvert = npaths == 4 ? 1 : 3;
+  nstrips = sgm_strips(yim, nstrips);
+
+  // scale the costs so the sum over the paths fits in 15 bits; the
+  // penalties are in the same units as the window SADs
+  maxdiff = 2*ftzero+1;
+  if (maxdiff > 255) maxdiff = 255;
+  for (shift=0; (xwin*ywin*maxdiff) >> shift > SGM_MAXCOST; shift++) ;
+  p1 = p1 >> shift;
+  p2 = p2 >> shift;
+  if (p1 < 1) p1 = 1;
+  if (p2 > SGM_MAXCOST) p2 = SGM_MAXCOST;
+  if (p2 < p1) p2 = p1;
+
+  // texture threshold, normalized as in block matching
+  tfilter_thresh = tfilter_thresh * xwin * ywin * ftzero / 100;
+
+  buf = (uint8_t *)SGM_ALIGN((uintptr_t)buf);
+
+#pragma omp parallel for schedule(static,1) num_threads(nstrips)
+  for (s=0; s<nstrips; s++)
+    {
+      sgm_work_t w;
+      int y, cur, init = 1;
+      int y0 = (s*yim)/nstrips, y1 = ((s+1)*yim)/nstrips;
+      int ys = y0-SGM_OVERLAP;
+      if (ys < 0) ys = 0;
+
+      sgm_work_setup(&w, buf + s*sgm_work_size(xim, dlen), xim, dlen);
+      sgm_fill(w.cost, xim*dlen, SGM_MAXCOST);
+      sgm_clear_rows(&w, xim, dlen);
+
+      for (y=ys, cur=0; y<y1; y++, cur=1-cur)
+	{
+	  if (y >= ywin/2 && y+ywin/2 < yim)
+	    {
+	      cost(lim, rim, xim, y, xwin, ywin, dlen, shift, w.cost, w.colsum, init);
+	      init = 0;
+	    }
+	  else
+	    {
+	      sgm_fill(w.cost, xim*dlen, SGM_MAXCOST);
+	      init = 1;
+	    }
+
+	  // paths from the left and from above; rows above the strip only
+	  // need these, to get the vertical paths going
+	  sgm_aggregate_row(&w, cur, xim, dlen, nvert, 1, w.sum, 1, p1, p2, pixel);
+	  if (y < y0)
+	    continue;
+
+	  // path from the right, then the disparities
+	  sgm_aggregate_row(&w, cur, xim, dlen, 0, -1, w.sum, 0, p1, p2, pixel);
+	  sgm_disparity_row(&w, w.sum, lim, disp + y*xim, xim, yim, y, ftzero, xwin, ywin, dlen,
+			    tfilter_thresh, ufilter_thresh, lr_check);
+	}
+    }
+}
+
+
+//
+// scanline optimization and dynamic programming entry points, both
+// semi-global matching: the full path set and the 4-path one
+// <smooth_thresh> is the penalty for disparity jumps, in window SAD
+// units; changes of one pixel cost a quarter of that.  <unique_c>
+// turns on the left-right check; the uniqueness filter is
+// <ufilter_thresh>, applied either way
+//
+
+static void
+do_stereo_sgm_alloc(uint8_t *lim, uint8_t *rim, int16_t *disp, int xim, int yim,
+		    uint8_t ftzero, int xwin, int ywin, int dlen,
+		    int pfilter_thresh, int ufilter_thresh, int smooth_thresh,
+		    int lr_check, int npaths)
+{
+  uint8_t *buf = (uint8_t *)MEMALIGN(do_stereo_sgm_bufsize(xim, yim, dlen, 0));
+  if (buf == NULL)
+    return;
+  do_stereo_sgm(lim, rim, disp, xim, yim, ftzero, xwin, ywin, dlen,
+		pfilter_thresh, ufilter_thresh, smooth_thresh/4, smooth_thresh,
+		npaths, lr_check, 0, buf);
+  MEMFREE(buf);
+}
+
+void
+do_stereo_so(uint8_t *lim, uint8_t *rim, int16_t *disp, int xim, int yim,
+	     uint8_t ftzero, int xwin, int ywin, int dlen,
+	     int pfilter_thresh, int ufilter_thresh, int smooth_thresh, int unique_c)
+{
+  do_stereo_sgm_alloc(lim, rim, disp, xim, yim, ftzero, xwin, ywin, dlen,
+		      pfilter_thresh, ufilter_thresh, smooth_thresh, unique_c, 8);
+}
+
+void
+do_stereo_dp(uint8_t *lim, uint8_t *rim, int16_t *disp, int xim, int yim,
+	     uint8_t ftzero, int xwin, int ywin, int dlen,
+	     int pfilter_thresh, int ufilter_thresh, int smooth_thresh, int unique_c)
+{
+  do_stereo_sgm_alloc(lim, rim, disp, xim, yim, ftzero, xwin, ywin, dlen,
+		      pfilter_thresh, ufilter_thresh, smooth_thresh, unique_c, 4);
+}
@@ -70,6 +70,13 @@ namespace pe
 
     /// number of RANSAC iterations
     int numRansac;
+
+    /// RANSAC sample generator.  Each estimator owns one, so estimators
+    /// in different threads don't share state.
+    cv::RNG rng;
+
+    /// Reseed the RANSAC sample generator.
+    void setSeed(uint64 seed) { rng = cv::RNG(seed); }
     
     /// Whether to do windowed or whole-image matching.
     int windowed;
@@ -53,6 +53,7 @@ public:
   {
     usedMethod = SFM;
     initialized_ = false;
+    selectModel = false;
   };
   ~PoseEstimator2d() {};
 
@@ -61,6 +62,10 @@ public:
   virtual int estimate(const fc::Frame& frame1, const fc::Frame& frame2,
                        const std::vector<cv::DMatch> &matches);
 
+  /// Initialize from the better of a homography and an essential matrix
+  /// hypothesis, estimated in parallel, instead of the homography alone.
+  bool selectModel;
+
 protected:
   void setPose(const cv::Mat& rvec, const cv::Mat& tvec);
 
@@ -60,8 +60,9 @@ void planarSFM(const cv::Mat& intrinsics, const std::vector<cv::KeyPoint>& set1,
 double SFMwithSBA(const cv::Mat& intrinsics, const std::vector<cv::KeyPoint>& points1, const std::vector<cv::KeyPoint>& points2,
         const std::vector<int>& indices, cv::Mat& rvec, cv::Mat& T, double reprojectionError);
 
+//! @param selectModel Use SFMselect() instead of SFM()
 double SFMwithSBA(const cv::Mat& intrinsics, std::vector<cv::Point2f>& points1, std::vector<cv::Point2f>& points2,
-        cv::Mat& rvec, cv::Mat& T, double reprojectionError);
+        cv::Mat& rvec, cv::Mat& T, double reprojectionError, bool selectModel = false);
 
 double SFM(const cv::Mat& intrinsics, const std::vector<cv::KeyPoint>& set1, const std::vector<cv::KeyPoint>& set2, const std::vector<int>& indices,
                 cv::Mat& R, cv::Mat& T, double reprojectionError = 6.0);
@@ -69,6 +70,21 @@ double SFM(const cv::Mat& intrinsics, const std::vector<cv::KeyPoint>& set1, con
 double SFM(const cv::Mat& intrinsics, const std::vector<cv::Point2f>& points1, const std::vector<cv::Point2f>& points2,
         cv::Mat& R, cv::Mat& T, double reprojectionError = 6.0);
 
+//! Structure from motion from the essential matrix of a RANSAC fundamental matrix,
+//! with the rotation and translation that put most points in front of both cameras
+//! @param F Optional output fundamental matrix
+//! @return Average epipolar error, or negative if no fundamental matrix was found
+double essentialSFM(const cv::Mat& intrinsics, const std::vector<cv::Point2f>& points1, const std::vector<cv::Point2f>& points2,
+        cv::Mat& R, cv::Mat& T, double reprojectionError = 3.0, cv::Mat* F = 0);
+
+//! Structure from motion from a homography (as SFM()) and an essential matrix
+//! (as essentialSFM()) hypothesis, computed in parallel.  The homography is kept
+//! unless the epipolar geometry explains clearly more of the points.
+//! @param homography Optional output, true if the homography hypothesis was used
+//! @param verbose Print the scores of the two hypotheses
+double SFMselect(const cv::Mat& intrinsics, const std::vector<cv::Point2f>& points1, const std::vector<cv::Point2f>& points2,
+        cv::Mat& R, cv::Mat& T, double reprojectionError = 6.0, bool* homography = 0, bool verbose = false);
+
 double avgSampsonusError(const cv::Mat& essential, const std::vector<cv::Point2f>& points1, const std::vector<cv::Point2f>& points2,
                 double max_error = 1.0, bool verbose = false);
 
@@ -153,7 +169,7 @@ void vectorSubset(const std::vector<T>& src, const std::vector<int>& indices, st
     }
 };
 
-void sample(int max_index, int count, std::vector<int>& sample_indices);
+void sample(int max_index, int count, std::vector<int>& sample_indices, cv::RNG& rng);
 
 cv::Point3f mult(const cv::Mat& M, const cv::Point3f& p);
 
@@ -179,7 +179,7 @@ int PoseEstimator2d::estimate(const fc::Frame& frame1, const fc::Frame& frame2,
 #if 0
   Mat display;
   vector<int> sample_indices;
-  sample(matches.size(), 50, sample_indices);
+  sample(matches.size(), 50, sample_indices, rng);
   vector<Match> sample_matches;
   vectorSubset(matches, sample_indices, sample_matches);
   features_2d::drawMatches(frame1.img, frame1.kpts, frame2.img, frame2.kpts, sample_matches, display);
@@ -217,7 +217,7 @@ int PoseEstimator2d::estimate(const fc::Frame& frame1, const fc::Frame& frame2,
     //std::cout << "The number of 3d points " << imagePoints.size() << ", running SFM" << std::endl;
 //    printf("number of source points: %d\n", image_points1.size());
     std::cout << "Running SFM" << std::endl;
-    SFMwithSBA(intrinsics, image_points1, image_points2, rvec, tvec, 6.0);
+    SFMwithSBA(intrinsics, image_points1, image_points2, rvec, tvec, 6.0, selectModel);
 //    printf("number of inliers: %d\n", image_points1.size());
 
     // normalize translation vector
@@ -412,7 +412,7 @@ int PoseEstimator2d::estimate(const fc::Frame& frame1, const fc::Frame& frame2,
     Mat display1, display2;
     vector<cv::DMatch> match_samples;
     vector<int> match_indices;
-    sample(matches.size(), 100, match_indices);
+    sample(matches.size(), 100, match_indices, rng);
     vectorSubset(matches, match_indices, match_samples);
     drawMatches(frame1.img, frame1.kpts, frame2.img, frame2.kpts, match_samples, display1);
     //pe::drawMatches(frame1.img, frame1.kpts, frame2.kpts, inliers, display1);
@@ -434,7 +434,7 @@ int PoseEstimator2d::estimate(const fc::Frame& frame1, const fc::Frame& frame2,
     Mat img_matches;
     vector<cv::DMatch> inlier_sample;
     vector<int> inlier_indices;
-    sample(inliers.size(), 50, inlier_indices);
+    sample(inliers.size(), 50, inlier_indices, rng);
     vectorSubset(inliers, inlier_indices, inlier_sample);
 #if 1
     drawMatches(frame1.img, frame1.kpts, frame2.img, frame2.kpts, inlier_sample, img_matches);
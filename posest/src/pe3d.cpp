@@ -84,19 +84,26 @@ namespace pe
     if (nmatch < 3) return 0;   // can't do it...
 
     int bestinl = 0;
+    int bestiter = numRansac;
+
+    // each iteration seeds its own generator from one draw, so the
+    // samples don't depend on thread scheduling
+    uint64 base = rng.next();
 
     // RANSAC loop
-    #pragma omp parallel for shared( bestinl )
+    #pragma omp parallel for shared( bestinl, bestiter )
     for (int i=0; i<numRansac; i++) 
       {
+        cv::RNG irng(base + (uint64)(i+1)*CV_BIG_UINT(0x9E3779B97F4A7C15));
+
         // find a candidate
-        int a=rand()%nmatch;
+        int a=irng.uniform(0,nmatch);
         int b = a;
         while (a==b)
-          b=rand()%nmatch;
+          b=irng.uniform(0,nmatch);
         int c = a;
         while (a==c || b==c)
-          c=rand()%nmatch;
+          c=irng.uniform(0,nmatch);
 
         int i0a = m0[a];
         int i0b = m0[b];
@@ -189,9 +196,10 @@ namespace pe
           }
         
         #pragma omp critical
-        if (inl > bestinl) 
+        if (inl > bestinl || (inl == bestinl && inl > 0 && i < bestiter)) // ties go to the earliest sample
           {
             bestinl = inl;
+            bestiter = i;
             rot = R;
             trans = tr;
           }
@@ -629,7 +629,7 @@ bool operator<(const HomographyDecomposition lhs, const HomographyDecomposition
 }
 
 //selects a subset of indices without replacement in the region [0, max_index-1].
-void sample(int max_index, int count, vector<int>& sample_indices)
+void sample(int max_index, int count, vector<int>& sample_indices, RNG& rng)
 {
   sample_indices.clear();
   for(int i = 0; i < count; i++)
@@ -637,7 +637,7 @@ void sample(int max_index, int count, vector<int>& sample_indices)
     int index;
     while(1)
     {
-      index = rand()%max_index;
+      index = rng.uniform(0, max_index);
       if(std::find(sample_indices.begin(), sample_indices.end(), index) == sample_indices.end())
       {
         break;
@@ -654,11 +654,11 @@ void sample(int max_index, int count, vector<int>& sample_indices)
 
 // selects four random pair of points and runs homography calculation on them
 Mat randomHomography(const vector<Point2f>& points1, const vector<Point2f>& points2,
-                     vector<Point2f>& sample1, vector<Point2f>& sample2)
+                     vector<Point2f>& sample1, vector<Point2f>& sample2, RNG& rng)
 {
   vector<int> indices;
 
-  sample(points1.size(), 4, indices);
+  sample(points1.size(), 4, indices, rng);
   vectorSubset(points1, indices, sample1);
   vectorSubset(points2, indices, sample2);
 
@@ -719,7 +719,7 @@ void filterInliers(const vector<Point3f>& obj_pts, const vector<Point2f>& img1_p
 }
 
 double SFMwithSBA(const Mat& intrinsics, vector<Point2f>& points1, vector<Point2f>& points2,
-                  Mat& rvec, Mat& T, double reprojectionError)
+                  Mat& rvec, Mat& T, double reprojectionError, bool selectModel)
 {
   if(points1.size() < 4 || points2.size() < 4)
   {
@@ -728,7 +728,8 @@ double SFMwithSBA(const Mat& intrinsics, vector<Point2f>& points1, vector<Point2
   }
 
   Mat R, H;
-  double error = SFM(intrinsics, points1, points2, R, T);
+  double error = selectModel ? SFMselect(intrinsics, points1, points2, R, T) :
+    SFM(intrinsics, points1, points2, R, T);
   //    printf("SFM completed with reprojection error %f\n", error);
   T = T*10.0;
   Mat _r(3, 1, CV_32F);
@@ -809,11 +810,12 @@ double SFM(const Mat& intrinsics, const vector<Point2f>& points1, const vector<P
   HomographyDecomposition best_decomposition;
   vector<HomographyDecomposition> best_decompositions;
   int maxInlierCount = 0;
+  RNG rng;  // local generator, so concurrent calls don't share state
   for(int i = 0; i < ransac_count; i++)
   {
 //    int64 _t1 = cvGetTickCount();
     vector<Point2f> sample1, sample2;
-    Mat H = randomHomography(points1, points2, sample1, sample2);
+    Mat H = randomHomography(points1, points2, sample1, sample2, rng);
 
     //        dumpFltMat("H", H);
 
@@ -895,6 +897,163 @@ double SFM(const Mat& intrinsics, const vector<Point2f>& points1, const vector<P
   return min_error;
 }
 
+//! Scores a homography by the symmetric transfer errors of the points:
+//! each error under the inlier threshold adds its margin to the threshold
+static float scoreHomography(const Mat& H, const vector<Point2f>& points1, const vector<Point2f>& points2,
+                             float sigma)
+{
+  const float th = 5.991f*sigma*sigma; // chi-square, 2 dof, 95%
+  vector<Point2f> mapped1(points1.size()), mapped2(points2.size());
+  Mat _mapped1(mapped1), _mapped2(mapped2);
+  perspectiveTransform(Mat(points1), _mapped1, H);
+  perspectiveTransform(Mat(points2), _mapped2, H.inv());
+
+  float score = 0;
+  for(size_t i = 0; i < points1.size(); i++)
+  {
+    Point2f d1 = points2[i] - mapped1[i];
+    Point2f d2 = points1[i] - mapped2[i];
+    float e1 = d1.dot(d1), e2 = d2.dot(d2);
+    if(e1 < th) score += th - e1;
+    if(e2 < th) score += th - e2;
+  }
+  return score;
+}
+
+//! Scores a fundamental matrix by the distances of the points from their
+//! epipolar lines, on the same scale as scoreHomography()
+static float scoreFundamental(const Mat& _F, const vector<Point2f>& points1, const vector<Point2f>& points2,
+                              float sigma)
+{
+  const float th = 3.841f*sigma*sigma; // chi-square, 1 dof, 95%
+  const float thScore = 5.991f*sigma*sigma;
+  Mat F;
+  _F.convertTo(F, CV_32F);
+
+  float score = 0;
+  for(size_t i = 0; i < points1.size(); i++)
+  {
+    Point3f p1(points1[i].x, points1[i].y, 1.0f);
+    Point3f p2(points2[i].x, points2[i].y, 1.0f);
+    Point3f l2 = mult(F, p1);     // line in the second image
+    Point3f l1 = mult(F.t(), p2); // line in the first image
+    float e2 = p2.dot(l2);
+    float e1 = p1.dot(l1);
+    e2 = e2*e2/(l2.x*l2.x + l2.y*l2.y);
+    e1 = e1*e1/(l1.x*l1.x + l1.y*l1.y);
+    if(e2 < th) score += thScore - e2;
+    if(e1 < th) score += thScore - e1;
+  }
+  return score;
+}
+
+double essentialSFM(const Mat& intrinsics, const vector<Point2f>& points1, const vector<Point2f>& points2,
+                    Mat& R, Mat& T, double reprojectionError, Mat* F)
+{
+  if(points1.size() < 8)
+  {
+    return -1.0;
+  }
+
+  Mat _F = findFundamentalMat(Mat(points1), Mat(points2), FM_RANSAC, reprojectionError, 0.99);
+  if(_F.rows != 3 || _F.cols != 3)
+  {
+    return -1.0;
+  }
+
+  // E = U diag(1,1,0) V^t gives two rotations and two translation signs
+  Mat K;
+  intrinsics.convertTo(K, CV_64F);
+  Mat E = K.t()*_F*K;
+  SVD svd(E);
+  Mat U = svd.u, Vt = svd.vt;
+  if(determinant(U) < 0) U = -U;
+  if(determinant(Vt) < 0) Vt = -Vt;
+  Mat W = (Mat_<double>(3, 3) << 0, -1, 0, 1, 0, 0, 0, 0, 1);
+  Mat Rs[2] = {U*W*Vt, U*W.t()*Vt};
+
+  // pick the one with most points in front of both cameras
+  int maxFront = -1;
+  for(int i = 0; i < 4; i++)
+  {
+    Mat _R, _T;
+    Rs[i/2].convertTo(_R, CV_32F);
+    Mat(U.col(2)*(i%2 ? -1.0 : 1.0)).convertTo(_T, CV_32F);
+
+    vector<Point3f> cloud;
+    vector<bool> valid;
+    reprojectPoints(intrinsics, _R, _T, points1, points2, cloud, valid);
+    int front = 0;
+    for(size_t j = 0; j < cloud.size(); j++)
+    {
+      if(!valid[j]) continue;
+      Point3f p2 = mult(_R, cloud[j]) + *_T.ptr<Point3f>(0);
+      if(p2.z > 0) front++;
+    }
+    if(front > maxFront)
+    {
+      maxFront = front;
+      R = _R;
+      T = _T;
+    }
+  }
+
+  if(F)
+  {
+    _F.copyTo(*F);
+  }
+
+  Mat essential = calcEssentialMatrix(intrinsics.inv(), R, T);
+  return avgSampsonusError(essential, points1, points2, std::numeric_limits<double>::max());
+}
+
+double SFMselect(const Mat& intrinsics, const vector<Point2f>& points1, const vector<Point2f>& points2,
+                 Mat& R, Mat& T, double reprojectionError, bool* homography, bool verbose)
+{
+  Mat Rh, Th, Re, Te, F;
+  double errorH = -1.0, errorE = -1.0;
+  float scoreH = 0, scoreE = 0;
+
+#pragma omp parallel sections
+  {
+#pragma omp section
+    {
+      Mat H = findHomography(Mat(points1), Mat(points2), CV_RANSAC, reprojectionError);
+      if(!H.empty())
+      {
+        scoreH = scoreHomography(H, points1, points2, 1.0f);
+      }
+      errorH = SFM(intrinsics, points1, points2, Rh, Th, reprojectionError);
+    }
+#pragma omp section
+    {
+      errorE = essentialSFM(intrinsics, points1, points2, Re, Te, 3.0, &F);
+      if(errorE >= 0)
+      {
+        scoreE = scoreFundamental(F, points1, points2, 1.0f);
+      }
+    }
+  }
+
+  // a homography also fits the epipolar geometry of planar scenes and
+  // small baselines, so it wins unless clearly worse
+  float ratio = scoreH + scoreE > 0 ? scoreH/(scoreH + scoreE) : 1.0f;
+  bool useH = errorE < 0 || ratio > 0.45f;
+  if(verbose)
+  {
+    printf("SFMselect: homography score %f, fundamental score %f, using %s\n",
+           scoreH, scoreE, useH ? "homography" : "essential matrix");
+  }
+  if(homography)
+  {
+    *homography = useH;
+  }
+
+  R = useH ? Rh : Re;
+  T = useH ? Th : Te;
+  return useH ? errorH : errorE;
+}
+
 void planarSFM(Mat& intrinsics, const vector<KeyPoint>& set1, const vector<KeyPoint>& set2, const vector<int>& indices,
                Mat& H, Mat& R, Mat& T, double reprojectionError)
 {
@@ -1063,7 +1222,7 @@ inline double calcNodeErr(sba::Proj& prj, const sba::Node &nd, const sba::Point
     return 0.0;
   }
   //    printf("Projection: %f %f, gt: %f %f, ", prj.err(0), prj.err(1), prj.kp(0), prj.kp(1));
-  prj.err -= prj.kp;
+  prj.err -= prj.kp.cast<double>();
   //  printf("dist: %f\n", prj.err.squaredNorm());
   return prj.err.squaredNorm();
 }
@@ -1082,7 +1241,7 @@ double calcCamProjCost(sba::SysSBA& sba, int cam)
       if (!prj.isValid) continue;
       //            printf("ndi = %d\n", prj.ndi);
       if(prj.ndi != cam) continue;
-      double err = calcNodeErr(prj, sba.nodes[prj.ndi], sba.tracks[i].point);
+      double err = calcNodeErr(prj, sba.nodes[prj.ndi], sba.tracks[i].point.cast<double>());
       //          if (err < 0.0)
       //            prj.isValid = false;
       //          else
@@ -126,31 +126,32 @@ class Iterator
 	const int min_inlier_num;
 	vector<int>* inliers;
 	bool use_extrinsic_guess;
-	RNG* rng;
-	static mutex ResultsMutex;
+	uint64 seed;
+	mutex* ResultsMutex;
 public:
     void operator()( const blocked_range<size_t>& r ) const {
         for( size_t i=r.begin(); i!=r.end(); ++i )
         {
+        	// per-iteration generator: RNG isn't safe to share between tasks
+        	RNG rng(seed + (uint64)(i+1)*CV_BIG_UINT(0x9E3779B97F4A7C15));
         	Iterate(*object_points, *image_points, *camera_matrix, *dist_coeffs,
         	        *resultRvec, *resultTvec, max_dist, min_inlier_num,
-        	        inliers, use_extrinsic_guess, rvecInit, tvecInit, *rng, ResultsMutex);
+        	        inliers, use_extrinsic_guess, rvecInit, tvecInit, rng, *ResultsMutex);
         }
     }
     Iterator(const vector<Point3f>* tobject_points, const vector<Point2f>* timage_points,
             const Mat* tcamera_matrix, const Mat* tdist_coeffs, Mat* rvec, Mat* tvec,
             float tmax_dist, int tmin_inlier_num, vector<int>* tinliers,
-            bool tuse_extrinsic_guess, RNG* trng):
+            bool tuse_extrinsic_guess, uint64 tseed, mutex* tmutex):
             	object_points(tobject_points), image_points(timage_points),
             	camera_matrix(tcamera_matrix), dist_coeffs(tdist_coeffs), resultRvec(rvec), resultTvec(tvec),
             	max_dist(tmax_dist), min_inlier_num(tmin_inlier_num), inliers(tinliers),
-            	use_extrinsic_guess(tuse_extrinsic_guess), rng(trng)
+            	use_extrinsic_guess(tuse_extrinsic_guess), seed(tseed), ResultsMutex(tmutex)
     {
       resultRvec->copyTo(rvecInit);
       resultTvec->copyTo(tvecInit);
     }
 };
-mutex Iterator::ResultsMutex;
 
 bool solvePnPRansac(const vector<Point3f>& object_points, const vector<Point2f>& image_points,
                     const Mat& camera_matrix, const Mat& dist_coeffs, Mat& rvec, Mat& tvec, bool use_extrinsic_guess,
@@ -185,6 +186,7 @@ bool solvePnPRansac(const vector<Point3f>& object_points, const vector<Point2f>&
   }
 
   RNG rng;
+  mutex ResultsMutex;           // guards the results of this call only
   Mat rvecl(3, 1, CV_64FC1), tvecl(3, 1, CV_64FC1);
   rvec.copyTo(rvecl);
   tvec.copyTo(tvecl);
@@ -192,7 +194,7 @@ bool solvePnPRansac(const vector<Point3f>& object_points, const vector<Point2f>&
   task_scheduler_init TBBinit;
   parallel_for(blocked_range<size_t>(0,num_iterations), Iterator(&object_points, &image_points,
                &camera_matrix, &dist_coeffs, &rvecl, &tvecl, max_dist,
-               min_inlier_num, inliers, use_extrinsic_guess, &rng));
+               min_inlier_num, inliers, use_extrinsic_guess, rng.state, &ResultsMutex));
 
   if ((int)(*inliers).size() >= MIN_POINTS_COUNT)
   {
@@ -0,0 +1,4 @@
+test/bench_stereo data/newcollege-1-L.pnm data/newcollege-1-R.pnm \
+ data/newcollege-2-L.pnm data/newcollege-2-R.pnm \
+ data/images-00021-L.bmp data/images-00021-R.bmp \
+ data/images-00025-L.bmp data/images-00025-R.bmp
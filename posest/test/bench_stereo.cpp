@@ -0,0 +1,325 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+// timing of the SSE2 and AVX2 block matching kernels on stereo pairs,
+// with and without confidence output, of the speckle filters, and of
+// separate and fused rectification and prefiltering, checking that
+// they give the same output
+
+#include <frame_common/stereo.h>
+#include <opencv/highgui.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+// elapsed time in milliseconds
+#include <sys/time.h>
+static double mstime()
+{
+  timeval tv;
+  gettimeofday(&tv,NULL);
+  long long ts = tv.tv_sec;
+  ts *= 1000000;
+  ts += tv.tv_usec;
+  return (double)ts*.001;
+}
+
+// aligned copy of an image, width cut to a multiple of 16
+static uint8_t *alignedImage(const cv::Mat &img, int xim, int yim)
+{
+  uint8_t *im = (uint8_t *)MEMALIGN(xim*yim);
+  for (int y=0; y<yim; y++)
+    memcpy(im + y*xim, img.ptr<uint8_t>(y), xim);
+  return im;
+}
+
+static const char *levelName(int level)
+{
+  return level >= STEREO_SIMD_AVX2 ? "AVX2" : "SSE2";
+}
+
+
+int main(int argc, char** argv)
+{
+  vector<int> ndisps;
+  int niters = 20;
+  int ftzero = 31, corr = 11, tthresh = 4, uthresh = 28;
+
+  int arg = 1;
+  for (; arg < argc && argv[arg][0] == '-'; arg++)
+    {
+      if (!strcmp(argv[arg], "-d") && arg+1 < argc)
+        ndisps.push_back(atoi(argv[++arg]));
+      else if (!strcmp(argv[arg], "-n") && arg+1 < argc)
+        niters = atoi(argv[++arg]);
+      else
+        break;
+    }
+
+  if (argc - arg < 2 || (argc - arg) % 2 != 0)
+    {
+      printf("Args are: [-d <ndisp>]... [-n <iterations>] <left> <right> [<left> <right>]...\n");
+      exit(0);
+    }
+  if (ndisps.size() == 0)
+    {
+      ndisps.push_back(64);
+      ndisps.push_back(128);
+    }
+
+  // levels to compare
+  vector<int> levels;
+  levels.push_back(STEREO_SIMD_SSE2);
+  stereo_set_simd_level(STEREO_SIMD_AVX2);
+  if (stereo_simd_level() >= STEREO_SIMD_AVX2)
+    levels.push_back(STEREO_SIMD_AVX2);
+  else
+    printf("No AVX2 on this processor, timing SSE2 only\n");
+
+  bool same = true;
+  for (; arg+1 < argc; arg+=2)
+    {
+      cv::Mat left = cv::imread(argv[arg], 0);
+      cv::Mat right = cv::imread(argv[arg+1], 0);
+      if (left.rows == 0 || right.rows == 0 || left.size() != right.size())
+        {
+          printf("Can't read stereo pair %s %s\n", argv[arg], argv[arg+1]);
+          continue;
+        }
+
+      int xim = left.cols & ~15;
+      int yim = left.rows;
+      printf("\n%s %s, %d x %d\n", argv[arg], argv[arg+1], xim, yim);
+
+      uint8_t *lim = alignedImage(left, xim, yim);
+      uint8_t *rim = alignedImage(right, xim, yim);
+      uint8_t *flim = (uint8_t *)MEMALIGN(xim*yim);
+      uint8_t *frim = (uint8_t *)MEMALIGN(xim*yim);
+      uint8_t *ftim = (uint8_t *)MEMALIGN(xim*yim);
+      uint8_t *ftref = (uint8_t *)MEMALIGN(xim*yim);
+      int16_t *disp = (int16_t *)MEMALIGN(xim*yim*sizeof(int16_t));
+      int16_t *dref = (int16_t *)MEMALIGN(xim*yim*sizeof(int16_t));
+      int16_t *conf = (int16_t *)MEMALIGN(xim*yim*sizeof(int16_t));
+      int16_t *cref = (int16_t *)MEMALIGN(xim*yim*sizeof(int16_t));
+
+      int maxdisp = 0;
+      for (int i=0; i<(int)ndisps.size(); i++)
+        maxdisp = max(maxdisp, ndisps[i]);
+      uint8_t *buf = (uint8_t *)MEMALIGN(max(yim*2*maxdisp*(corr+5), (xim+64)*8));
+
+      // prefilter
+      for (int l=0; l<(int)levels.size(); l++)
+        {
+          stereo_set_simd_level(levels[l]);
+          uint8_t *out = l == 0 ? ftref : ftim;
+          memset(out, ftzero, xim*yim);
+          double t0 = mstime();
+          for (int i=0; i<niters; i++)
+            do_prefilter_fast(lim, out, xim, yim, ftzero, buf);
+          double t = (mstime() - t0)/niters;
+          printf("  prefilter      %s %8.2f ms", levelName(levels[l]), t);
+          if (l > 0)
+            {
+              bool eq = memcmp(ftref, ftim, xim*yim) == 0;
+              same = same && eq;
+              printf("  %s", eq ? "same" : "DIFFERENT");
+            }
+          printf("\n");
+        }
+
+      // block matching, on the feature images DenseStereo uses
+      memset(flim, ftzero, xim*yim);
+      memset(frim, ftzero, xim*yim);
+      do_prefilter(lim, flim, xim, yim, ftzero, buf);
+      do_prefilter(rim, frim, xim, yim, ftzero, buf);
+      for (int d=0; d<(int)ndisps.size(); d++)
+        {
+          int dlen = ndisps[d];
+          for (int l=0; l<(int)levels.size(); l++)
+            {
+              stereo_set_simd_level(levels[l]);
+              int16_t *out = l == 0 ? dref : disp;
+              memset(out, 0, xim*yim*sizeof(int16_t));
+              double t0 = mstime();
+              for (int i=0; i<niters; i++)
+                do_stereo_d_fast(flim, frim, out, NULL, xim, yim,
+                                 ftzero, corr, corr, dlen, tthresh, uthresh, buf);
+              double t = (mstime() - t0)/niters;
+              int nvalid = 0;
+              for (int i=0; i<xim*yim; i++)
+                if (out[i] != FILTEREDVAL) nvalid++;
+              printf("  %3d disparities %s %8.2f ms  %d valid", dlen, levelName(levels[l]), t, nvalid);
+              if (l > 0)
+                {
+                  bool eq = memcmp(dref, disp, xim*yim*sizeof(int16_t)) == 0;
+                  same = same && eq;
+                  printf("  %s", eq ? "same" : "DIFFERENT");
+                }
+              printf("\n");
+
+              // with the confidence output
+              int16_t *cout = l == 0 ? cref : conf;
+              memset(cout, 0, xim*yim*sizeof(int16_t));
+              t0 = mstime();
+              for (int i=0; i<niters; i++)
+                do_stereo_d_fast(flim, frim, out, cout, xim, yim,
+                                 ftzero, corr, corr, dlen, tthresh, uthresh, buf);
+              t = (mstime() - t0)/niters;
+              double csum = 0.0;
+              for (int i=0; i<xim*yim; i++)
+                if (out[i] != FILTEREDVAL) csum += cout[i];
+              printf("      +confidence %s %8.2f ms  mean %.2f", levelName(levels[l]), t,
+                     nvalid > 0 ? csum/(nvalid*STEREO_CONF_ONE) : 0.0);
+              if (l > 0)
+                {
+                  bool eq = memcmp(dref, disp, xim*yim*sizeof(int16_t)) == 0 &&
+                    memcmp(cref, conf, xim*yim*sizeof(int16_t)) == 0;
+                  same = same && eq;
+                  printf("  %s", eq ? "same" : "DIFFERENT");
+                }
+              printf("\n");
+            }
+        }
+
+      // speckle filters, on the last block matching output
+      {
+        int16_t *sref = (int16_t *)MEMALIGN(xim*yim*sizeof(int16_t));
+        uint32_t *labels = (uint32_t *)MEMALIGN(xim*yim*sizeof(uint32_t));
+        uint32_t *wbuf = (uint32_t *)MEMALIGN(xim*yim*sizeof(uint32_t));
+        uint8_t *rtype = (uint8_t *)MEMALIGN(xim*yim);
+        double t0, t1 = 0.0, t2 = 0.0, t3 = 0.0;
+        bool eq = true;
+        for (int i=0; i<niters; i++)
+          {
+            memcpy(sref, dref, xim*yim*sizeof(int16_t));
+            memcpy(disp, dref, xim*yim*sizeof(int16_t));
+            t0 = mstime();
+            do_speckle(sref, FILTEREDVAL, xim, yim, 16, 100, labels, wbuf, rtype);
+            t1 += mstime() - t0;
+            t0 = mstime();
+            do_speckle_fast(disp, FILTEREDVAL, xim, yim, 16, 100, labels, wbuf, 1);
+            t2 += mstime() - t0;
+            eq = eq && memcmp(sref, disp, xim*yim*sizeof(int16_t)) == 0;
+            memcpy(disp, dref, xim*yim*sizeof(int16_t));
+            t0 = mstime();
+            do_speckle_fast(disp, FILTEREDVAL, xim, yim, 16, 100, labels, wbuf, 0);
+            t3 += mstime() - t0;
+            eq = eq && memcmp(sref, disp, xim*yim*sizeof(int16_t)) == 0;
+          }
+        same = same && eq;
+        printf("  speckle  flood fill %8.2f ms\n", t1/niters);
+        printf("  speckle  union-find %8.2f ms, a strip per thread %8.2f ms  %s\n",
+               t2/niters, t3/niters, eq ? "same" : "DIFFERENT");
+        MEMFREE(sref);
+        MEMFREE(labels);
+        MEMFREE(wbuf);
+        MEMFREE(rtype);
+      }
+
+      // rectification and prefilter, separate and fused, through a
+      // made-up calibration with some distortion and a small rotation
+      {
+        using namespace frame_common;
+        CamParams cam = {0.8*xim, 0.8*xim, 0.5*xim, 0.5*yim, 0.0};
+        Distortion dist = {-0.25, 0.08, 0.001, -0.0005, 0.0};
+        double a = 0.01;
+        double R[9] = {cos(a),0,sin(a), 0,1,0, -sin(a),0,cos(a)};
+        inttab_t *ltab = (inttab_t *)MEMALIGN(xim*yim*sizeof(inttab_t));
+        inttab_t *rtab = (inttab_t *)MEMALIGN(xim*yim*sizeof(inttab_t));
+        buildRectifyTable(ltab, xim, yim, cam, dist, cam, R);
+        R[2] = -R[2]; R[6] = -R[6];
+        buildRectifyTable(rtab, xim, yim, cam, dist, cam, R);
+
+        uint8_t *lrect = (uint8_t *)MEMALIGN(xim*yim);
+        uint8_t *rrect = (uint8_t *)MEMALIGN(xim*yim);
+        uint8_t *lref = (uint8_t *)MEMALIGN(xim*yim);
+        uint8_t *rref = (uint8_t *)MEMALIGN(xim*yim);
+        memset(ftref, ftzero, xim*yim);
+        memset(flim, ftzero, xim*yim);
+        memset(ftim, ftzero, xim*yim);
+        memset(frim, ftzero, xim*yim);
+
+        double t0 = mstime();
+        for (int i=0; i<niters; i++)
+          {
+            do_rectify_mono(lref, lim, xim, yim, ltab);
+            do_rectify_mono(rref, rim, xim, yim, rtab);
+            do_prefilter_xsobel(lref, ftref, xim, yim, ftzero, buf);
+            do_prefilter_xsobel(rref, flim, xim, yim, ftzero, buf);
+          }
+        double t1 = (mstime() - t0)/niters;
+        t0 = mstime();
+        for (int i=0; i<niters; i++)
+          do_rectify_prefilter(lim, rim, ltab, rtab, lrect, rrect, ftim, frim,
+                               xim, yim, ftzero, 0);
+        double t2 = (mstime() - t0)/niters;
+
+        bool eq = memcmp(lref, lrect, xim*yim) == 0 && memcmp(rref, rrect, xim*yim) == 0 &&
+          memcmp(ftref, ftim, xim*yim) == 0 && memcmp(flim, frim, xim*yim) == 0;
+        same = same && eq;
+        printf("  rectify+prefilter  %8.2f ms\n", t1);
+        printf("  rectify+prefilter fused %8.2f ms  %s\n", t2, eq ? "same" : "DIFFERENT");
+        MEMFREE(ltab);
+        MEMFREE(rtab);
+        MEMFREE(lrect);
+        MEMFREE(rrect);
+        MEMFREE(lref);
+        MEMFREE(rref);
+      }
+
+      MEMFREE(lim);
+      MEMFREE(rim);
+      MEMFREE(flim);
+      MEMFREE(frim);
+      MEMFREE(ftim);
+      MEMFREE(ftref);
+      MEMFREE(disp);
+      MEMFREE(dref);
+      MEMFREE(conf);
+      MEMFREE(cref);
+      MEMFREE(buf);
+    }
+
+  stereo_set_simd_level(STEREO_SIMD_AVX2);
+  if (!same)
+    {
+      printf("\nOutputs differ\n");
+      return 1;
+    }
+  return 0;
+}
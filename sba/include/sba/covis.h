@@ -0,0 +1,124 @@
+#ifndef _COVIS_H_
+#define _COVIS_H_
+
+#include <vector>
+
+#include <sba/proj.h>
+
+namespace sba
+{
+  /// \brief An edge of the covisibility graph: a node that shares points
+  /// with the owning node, and how many.
+  struct CovisEdge
+  {
+    /// Index of the other node.
+    int node;
+
+    /// Number of tracks seen by both nodes.
+    int weight;
+
+    /// "true" for don't use this connection when setting up the
+    /// sparse system (see SysSBA::setConnMat()).
+    bool skip;
+  };
+
+  /// \brief CovisGraph holds the node-to-node covisibility of an SBA
+  /// system.  It is updated as projections are added to and removed from
+  /// tracks, rather than recomputed from all track pairs, so that local
+  /// windows, connectivity pruning and stats are cheap queries.
+  ///
+  /// Adjacency is kept per node in a small vector sorted by node index.
+  /// Projections with negative node indices (nodes already removed) are
+  /// ignored.
+  class CovisGraph
+  {
+    public:
+      CovisGraph() : nedges(0), nskips(0) {}
+
+      /// \brief Remove all nodes and edges.
+      void clear();
+
+      /// \brief Make room for <n> nodes; existing nodes are kept.
+      void resize(int n);
+
+      /// \brief Number of nodes in the graph.
+      int numNodes() const { return (int)adj.size(); }
+
+      /// \brief Number of (undirected) edges in the graph.
+      int numEdges() const { return nedges; }
+
+      /// \brief Number of projections into node <ni>.
+      int numObs(int ni) const { return ni < (int)nobs.size() ? nobs[ni] : 0; }
+
+      /// \brief Number of tracks shared by nodes <n0> and <n1>.
+      int weight(int n0, int n1) const;
+
+      /// \brief Edges of node <ni>, sorted by node index.
+      const std::vector<CovisEdge> &neighbors(int ni) const { return adj[ni]; }
+
+      /// \brief Up to <n> neighbors of node <ni> sharing at least <minpts>
+      /// tracks, strongest first.  Handy for picking a local window.
+      void bestNeighbors(int ni, int n, std::vector<int> &nbrs, int minpts = 1) const;
+
+      /// \brief Account for a new projection into node <ci> of the track
+      /// with projections <prjs>; call before inserting it.
+      void addObs(const ProjMap &prjs, int ci);
+
+      /// \brief Account for removing the projection into node <ci> from
+      /// the track with projections <prjs>; call before erasing it.
+      void removeObs(const ProjMap &prjs, int ci);
+
+      /// \brief Add all connections of a track.
+      void addTrack(const ProjMap &prjs);
+
+      /// \brief Remove all connections of a track.
+      void removeTrack(const ProjMap &prjs);
+
+      /// \brief Drop the first <n> nodes and their edges, shifting the
+      /// remaining node indices down by <n>.
+      void removeFront(int n);
+
+      /// \brief Renumber nodes with an old-to-new index map that keeps
+      /// their order; nodes mapped to -1 are dropped with their edges.
+      void remapNodes(const std::vector<int> &nidx);
+
+      /// \brief Whether the connection <n0>-<n1> is skipped.
+      bool isSkipped(int n0, int n1) const;
+
+      /// \brief Set the skip flag of connection <n0>-<n1>, if it exists.
+      void setSkip(int n0, int n1, bool skip);
+
+      /// \brief Set the skip flag of all connections.
+      void setAllSkips(bool skip);
+
+      /// \brief Clear all skip flags.
+      void clearSkips() { if (nskips > 0) setAllSkips(false); }
+
+      /// \brief Whether any connection is skipped.
+      bool hasSkips() const { return nskips > 0; }
+
+    protected:
+      /// Per-node edge lists, sorted by node index.
+      std::vector<std::vector<CovisEdge> > adj;
+
+      /// Per-node projection counts.
+      std::vector<int> nobs;
+
+      int nedges;
+      int nskips;
+
+      /// Find the edge to <n1> in the list of <n0>; NULL if none.
+      CovisEdge *findEdge_(int n0, int n1);
+      const CovisEdge *findEdge_(int n0, int n1) const;
+
+      /// Add <dw> to the directed edge <n0>-><n1>, creating or erasing it
+      /// as needed; returns true if the edge was created or erased.
+      bool bumpEdge_(int n0, int n1, int dw);
+
+      /// Add <dw> to the connection <n0>-<n1>.
+      void bump_(int n0, int n1, int dw);
+  };
+
+} // sba
+
+#endif // _COVIS_H_
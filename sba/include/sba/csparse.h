@@ -78,6 +78,56 @@ using namespace std;
 
 namespace sba
 {
+#ifdef SBA_CHOLMOD
+  // CHOLMOD solver state kept alive across solves: the matrix, the factor
+  // and the dense vectors.  The symbolic analysis is only redone when the
+  // sparsity pattern changes; otherwise the factor is refactorized
+  // numerically in place.
+  class CholmodSolver
+  {
+  public:
+    CholmodSolver();
+    ~CholmodSolver();
+
+    // copies start with an empty solver
+    CholmodSolver(const CholmodSolver &s);
+    CholmodSolver &operator=(const CholmodSolver &s);
+
+    // upper triangular <n>x<n> matrix with room for <nnz> entries; reused 
+    //   if the size is the same, so the caller can overwrite the pattern
+    cholmod_sparse *reserve(int n, int nnz);
+
+    // call after filling in the column pointers and row indices; drops
+    //   the symbolic analysis if the pattern differs from the last one
+    void setPattern();
+
+    // solve Ax=b in place, <b> has n entries
+    bool solve(double *b);
+
+    // free everything
+    void clear();
+
+    // do one step of iterative refinement after the solve (default true)
+    bool refine;
+
+    // matrix, NULL until reserved
+    cholmod_sparse *A;
+
+    // counts of symbolic analyses and numeric factorizations, for timing
+    int nanalyze, nfactor;
+
+    cholmod_common Common;
+
+  protected:
+    void init_();
+
+    cholmod_factor *L;          // factor, NULL if the pattern changed
+    cholmod_dense *X, *R, *D;   // solution, residual, correction
+    cholmod_dense *Y, *E;       // cholmod_solve2 workspace
+    std::vector<int> ap, ai;    // pattern of the last analysis
+  };
+#endif
+
   class CSparse
   {
   public:
@@ -133,10 +183,8 @@ namespace sba
     jacobiBPCG<6> bpcg;
 
 #ifdef SBA_CHOLMOD
-    // CHOLMOD structures
-    cholmod_sparse *chA;        // linear problem matrix
-    cholmod_common *chc;
-    cholmod_common Common;
+    // CHOLMOD matrix, factor and workspace
+    CholmodSolver chol;
 #endif
 
   };
@@ -201,10 +249,8 @@ namespace sba
     jacobiBPCG<3> bpcg;
 
 #ifdef SBA_CHOLMOD
-    // CHOLMOD structures
-    cholmod_sparse *chA;        // linear problem matrix
-    cholmod_common *chc;
-    cholmod_common Common;
+    // CHOLMOD matrix, factor and workspace
+    CholmodSolver chol;
 #endif
 
   };
@@ -43,6 +43,23 @@ namespace sba
   typedef Eigen::Vector4d Point;
 
 
+  /// \brief Scalar type for the map data stored per track and per
+  /// projection (points and keypoints).  Define SBA_FLOAT_STORAGE to keep
+  /// them in single precision, halving their memory; they are promoted to
+  /// double for cost and Jacobian evaluation and in the linear solver.
+#ifdef SBA_FLOAT_STORAGE
+  typedef float StoreScalar;
+#else
+  typedef double StoreScalar;
+#endif
+
+  /// \brief Stored form of a Point.
+  typedef Eigen::Matrix<StoreScalar,4,1> StoredPoint;
+
+  /// \brief Stored form of a Keypoint.
+  typedef Eigen::Matrix<StoreScalar,3,1> StoredKeypoint;
+
+
   /// \brief NODE holds graph nodes corresponding to frames, for use in
   /// sparse bundle adjustment.
   /// Each node has a 6DOF pose, encoded as a translation vector and
@@ -125,13 +142,11 @@ namespace sba
     /// used for calculating Jacobian wrt pose of a projection.
     Eigen::Matrix<double,3,3> dRdx, dRdy, dRdz;
     
-    /// \brief Constant matrices for derivatives.
-    static Eigen::Matrix3d dRidx, dRidy, dRidz; // these are constant
-    
-    /// \brief Sets up constant matrices for derivatives.
-    static void initDr();       // call this to set up constant matrices
+    /// \brief No longer needed: local angle derivatives are computed in
+    /// closed form, without static tables.  Kept for old callers.
+    static void initDr() {}
 
-    /// \brief Set angle derivates.
+    /// \brief Set angle derivates.  Thread-safe; touches only this node.
     void setDr(bool local = false);
     
     /// \brief Set local angle derivatives.
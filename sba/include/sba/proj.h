@@ -51,9 +51,29 @@ namespace sba
   /// projections in tracks.
   typedef std::map<const int, Proj, std::less<int>, Eigen::aligned_allocator<Proj> > ProjMap;
 
+  /// \brief ProjExt holds the data that only some projections carry: a
+  /// covariance matrix and the plane of a point-plane match.  It lives
+  /// outside Proj so that plain projections stay small.
+  class ProjExt
+  {
+    public:
+      EIGEN_MAKE_ALIGNED_OPERATOR_NEW // needed for 16B alignment
+
+      /// Covariance matrix for cost calculation.
+      Eigen::Matrix<double,3,3> covarmat;
+
+      /// Normal for point-plane projections
+      Eigen::Vector3d plane_normal;
+
+      /// Point for point-plane projections
+      Eigen::Vector3d plane_point;
+  };
+
   /// \brief Proj holds a projection measurement of a point onto a
   /// frame. They are a repository for the link between the frame and
-  /// the point, with auxillary info such as Jacobians.
+  /// the point: the measurement, node index, flags and the last
+  /// reprojection error.  Jacobians and Schur complement blocks are
+  /// solver scratch and live in SysSBA's workspace during an optimization.
   class Proj
   {
     public:
@@ -73,19 +93,33 @@ namespace sba
       /// \brief Default constructor. Initializes to default values, 
       /// kp = <0 0 0> and ndi = <0>. Also sets the projection to be invalid.
       Proj();
+
+      /// Copies, including the extra data if any.
+      Proj(const Proj &prj);
+      Proj &operator=(const Proj &prj);
+      ~Proj();
       
       /// Node index, the camera node for this projection.
       int ndi;
       
+      /// Whether the projection is Stereo (True) or Monocular (False).
+      bool stereo;
+      
+      /// valid or not (could be out of bounds)
+      bool isValid;
+      
+      /// Use a covariance matrix?
+      bool useCovar;
+      
+      /// Whether this is a point-plane match (true) or a point-point match (false).
+      bool pointPlane;
+      
       /// Keypoint, u,v,u-d vector
-      Eigen::Vector3d kp;
+      StoredKeypoint kp;
       
       /// Reprojection error.
       Eigen::Vector3d err;
       
-      /// Whether the projection is Stereo (True) or Monocular (False).
-      bool stereo;
-      
       /// Calculates re-projection error and stores it in #err.
      double calcErr(const Node &nd, const Point &pt, double huber = 0.0);
       
@@ -116,43 +150,28 @@ namespace sba
           only change for right cam is px += b */
       void setJacobians(const Node &nd, const Point &pt, JacobProds *jpp);
       
-      /// Jacobian products
-      JacobProds *jp;
-      
-      /// Point-to-camera matrix (HpcT*Hpp^-1)
-      /// Need to save this
-      Eigen::Matrix<double,6,3> Tpc;
-      
-      /// valid or not (could be out of bounds)
-      bool isValid;
-      
       /// scaling factor for quaternion derivatives relative to translational ones;
       /// not sure if this is needed, it's close to 1.0
       const static double qScale = 1.0;
+
+      /// Extra data, NULL until a covariance or plane is set.
+      ProjExt *ext;
+
+      /// Extra data, allocated on first use.
+      ProjExt &extra();
       
-      /// Use a covariance matrix?
-      bool useCovar;
-      
-      /// Covariance matrix for cost calculation.
-      Eigen::Matrix<double,3,3> covarmat;
-      
-      /// Whether this is a point-plane match (true) or a point-point match (false).
-      bool pointPlane;
-      
-      /// Normal for point-plane projections
-      Eigen::Vector3d plane_normal;
-      
-      /// Point for point-plane projections
-      Eigen::Vector3d plane_point;
-      
-      /// Point-plane match point index in SBA.
-      int plane_point_index;
+      /// Covariance matrix for cost calculation; only if #useCovar.
+      const Eigen::Matrix3d &covarmat() const { return ext->covarmat; }
       
-      /// Point-plane node index in SBA.
-      int plane_node_index;
+      /// Plane normal of a point-plane projection; only if #pointPlane.
+      const Eigen::Vector3d &planeNormal() const { return ext->plane_normal; }
       
-      /// Original normal in #plane_node_index coordinate's frame.
-      Eigen::Vector3d plane_local_normal;
+      /// Plane point of a point-plane projection; only if #pointPlane.
+      const Eigen::Vector3d &planePoint() const { return ext->plane_point; }
+
+      /// Make this a point-plane projection onto the plane through <point>
+      /// with normal <normal>, in world coordinates.
+      void setPlane(const Eigen::Vector3d &point, const Eigen::Vector3d &normal);
 
       /// \brief Set the covariance matrix to use for cost calculation.
       /// Without the covariance matrix, cost is calculated by:
@@ -193,8 +212,48 @@ namespace sba
       ProjMap projections;
       
       /// \brief An Eigen 4-vector containing the <x, y, z, w> coordinates of 
-      /// the point associated with the track.
-      Point point;
+      /// the point associated with the track.  Use point.cast<double>()
+      /// where a Point is needed.
+      StoredPoint point;
+  };
+
+
+  /// \brief PointPlaneCon holds a point-plane constraint. The projection of
+  /// point #pti into node #ndi is taken onto the plane through the anchor
+  /// point #plane_pti, with normal #local_normal in node #ndi's frame.
+  /// The constraints are kept in their own table so that refreshing the
+  /// planes doesn't need a sweep over all tracks.
+  class PointPlaneCon
+  {
+    public:
+      EIGEN_MAKE_ALIGNED_OPERATOR_NEW // needed for 16B alignment
+
+      PointPlaneCon() : pti(-1), ndi(-1), plane_pti(-1), plane_ndi(-1),
+                        isValid(false) {}
+
+      PointPlaneCon(int pti, int ndi, int plane_pti, int plane_ndi,
+                    const Eigen::Vector3d &local_normal)
+        : pti(pti), ndi(ndi), plane_pti(plane_pti), plane_ndi(plane_ndi),
+          local_normal(local_normal), isValid(true) {}
+
+      /// Track index of the constrained point; its projection into #ndi
+      /// holds the plane.
+      int pti;
+
+      /// Node index of the point-plane projection.
+      int ndi;
+
+      /// Track index of the anchor point on the plane.
+      int plane_pti;
+
+      /// Node index the anchor point was matched from.
+      int plane_ndi;
+
+      /// Plane normal in node #ndi's coordinate frame.
+      Eigen::Vector3d local_normal;
+
+      /// Valid or not (anchor point or nodes removed).
+      bool isValid;
   };
   
   
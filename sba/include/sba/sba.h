@@ -61,6 +61,8 @@
 #include <sba/csparse.h>
 // block jacobian pcg
 #include <bpcg/bpcg.h>
+// node covisibility
+#include <sba/covis.h>
 
 // Defines for methods to use with doSBA().
 #define SBA_DENSE_CHOLESKY 0
@@ -70,6 +72,22 @@
 
 namespace sba
 {
+  /// \brief A projection measurement, for adding projections in bulk with
+  /// SysSBA::addProjs().
+  struct ProjEntry
+  {
+    int ci;                     ///< Camera/node index.
+    int pi;                     ///< Point/track index.
+    Eigen::Vector3d kp;         ///< Keypoint as u,v,u-d; u,v,0 for monocular.
+    bool stereo;                ///< Stereo or monocular projection.
+    /// Weight of the disparity (u-d) error of a stereo projection, from
+    /// the stereo confidence; below 1 it is set as the projection's
+    /// covariance.
+    double weight;
+
+    ProjEntry() : weight(1.0) {}
+  };
+
   /// SysSBA holds a set of nodes and points for sparse bundle adjustment
 
   class SysSBA
@@ -82,7 +100,7 @@ namespace sba
       long long t0, t1, t2, t3, t4; // save timing
 
       /// \brief Default constructor.
-        SysSBA() { nFixed = 1; useLocalAngles = true; Node::initDr(); 
+        SysSBA() { nFixed = 1; useLocalAngles = true;
           verbose = 1; huber = 0.0; }
 
       /// \brief Set of nodes (camera frames) for SBA system, indexed by node number.
@@ -213,6 +231,16 @@ namespace sba
       /// in an image).
       bool addStereoProj(int ci, int pi, Eigen::Vector3d &q);
       
+      /// \brief Add many projections at once.  Duplicates are found with a
+      /// hash on (camera, point) instead of track lookups, and projections
+      /// are inserted in track order.  As with addProj(), a projection
+      /// that repeats an existing one is skipped, and one that puts a
+      /// different keypoint on the same camera and point is rejected; the
+      /// first one seen wins.  Entries with bad indices are rejected too.
+      /// \param prjs Projections to add.
+      /// \return Number of projections added.
+      int addProjs(const std::vector<ProjEntry> &prjs);
+
       /// \brief Sets the covariance matrix of a projection.
       /// \param ci camera/node index (same as in nodes structure).
       /// \param pi point index (same as in tracks structure).
@@ -233,22 +261,43 @@ namespace sba
       /// \param normal1 3D normal for the second point in camera1's coordinate frame.
       void addPointPlaneMatch(int ci0, int pi0, Eigen::Vector3d normal0, int ci1, int pi1, Eigen::Vector3d normal1);
       
-      /// \brief Update normals in point-plane matches, if any.
-      void updateNormals();
+      /// \brief Update planes of point-plane matches, if any.
+      /// \param all If false, normals are only rotated for free nodes,
+      /// since fixed ones haven't moved.
+      void updateNormals(bool all = true);
+
+      /// \brief Point-plane constraints, one per point-plane projection.
+      std::vector<PointPlaneCon, Eigen::aligned_allocator<PointPlaneCon> > ppcons;
+
+      /// \brief Re-index point-plane constraints after tracks and nodes have
+      /// been compacted; constraints referring to removed points or nodes
+      /// are dropped and their projections invalidated.
+      /// \param pidx Old-to-new track index map, -1 for removed tracks; 
+      /// empty if tracks were not changed.
+      /// \param ndshift Number of nodes removed from the front of #nodes.
+      /// \param nidx Optional old-to-new node index map, -1 for removed
+      /// nodes; used instead of <ndshift> if given.
+      void reindexPointPlaneCons(const std::vector<int> &pidx, int ndshift = 0,
+                                 const std::vector<int> *nidx = NULL);
       
       /// linear system matrix and vector
       Eigen::MatrixXd A;
       Eigen::VectorXd B;
 
-      /// sparse connectivity matrix
-      /// for each node, holds vector of connecting nodes
-      /// "true" for don't use connection
-      std::vector<std::vector<bool> > connMat;
+      /// \brief Covisibility graph of the nodes, kept up to date by
+      /// addProj() and the track removal and merging functions.  Edges
+      /// marked as skipped are left out of the sparse system.
+      /// Code that edits #tracks directly should update it too, or call
+      /// rebuildCovis().
+      CovisGraph covis;
 
-      /// Sets up the connectivity matrix by clearing connections with 
+      /// \brief Recompute the covisibility graph from all tracks.
+      void rebuildCovis();
+
+      /// Sets up the connectivity by skipping connections with 
       /// less than minpts.
       void setConnMat(int minpts);
-      /// sets up connectivity matrix by greedy spanning tree
+      /// sets up connectivity by greedy spanning tree
       void setConnMatReduced(int maxconns);
       /// removes tracks that aren't needed
       int remExcessTracks(int minpts);
@@ -256,11 +305,60 @@ namespace sba
       /// get rid of long tracks
       int reduceLongTracks(double pct);
 
-      /// merge tracks based on identity pairs
-      void mergeTracks(std::vector<std::pair<int,int> > &prs);
+      /// \brief Find nodes whose points are mostly seen elsewhere, so the
+      /// node adds little to the map.  A point counts as redundant for a
+      /// node if at least <minobs> other nodes see it.  Fixed nodes and
+      /// the last <nkeep> nodes are never picked.  Candidates are taken
+      /// from the covisibility counts in #covis, so these must be current.
+      /// \param ratio  Fraction of a node's points that must be redundant.
+      /// \param minobs Number of other nodes that must see a point.
+      /// \param nkeep  Number of most recent nodes to leave alone.
+      /// \param nds    Redundant nodes, in ascending order.
+      void findRedundantNodes(double ratio, int minobs, int nkeep, 
+                              std::vector<int> &nds);
+
+      /// \brief Remove nodes and their projections; tracks left with fewer
+      /// than two projections are removed too.  Tracks that end before the
+      /// first removed node are left alone.
+      /// \param nds  Nodes to remove, in ascending order.
+      /// \param nidx Old-to-new node index map, -1 for removed nodes.
+      /// \param pidx Old-to-new track index map, -1 for removed tracks.
+      /// \return Number of tracks removed.
+      int removeNodes(const std::vector<int> &nds, std::vector<int> &nidx,
+                      std::vector<int> &pidx);
+
+      /// \brief Remove low-value points: tracks with fewer than <minprojs>
+      /// good projections, none of them in the last <nkeep> nodes (so
+      /// tracks still growing are kept).  Projections with error over
+      /// <maxerr> pixels are dropped first, if <maxerr> is positive.
+      /// \param pidx Old-to-new track index map, -1 for removed tracks.
+      /// \return Number of tracks removed.
+      int cullPoints(int minprojs, double maxerr, int nkeep, 
+                     std::vector<int> &pidx);
+
+      /// \brief Remove empty tracks, keeping the order of the rest.
+      /// \param pidx Old-to-new track index map, -1 for removed tracks.
+      /// \return Number of tracks removed.
+      int compactTracks(std::vector<int> &pidx);
+
+      /// \brief Merge tracks based on identity pairs, in bulk.
+      /// Merge sets are resolved transitively; a merge that would put two
+      /// different keypoints of one node on a track is skipped.  Tracks
+      /// are compacted afterwards, each set kept at its lowest index.
+      /// \param prs  Pairs of track indices that are the same point.
+      /// \param pidx Optional old-to-new track index map, filled in.
+      /// \return Number of merges done.
+      int  mergeTracks(const std::vector<std::pair<int,int> > &prs, 
+                       std::vector<int> *pidx = NULL);
       /// merge two tracks if possible (no conflicts)
       int  mergeTracksSt(int tr0, int tr1);
 
+      /// \brief Free the solver workspace (Jacobian products, Schur
+      /// complement blocks, point updates).  It is sized again by the next
+      /// optimization; useful for keeping a large map resident between
+      /// optimizations.
+      void releaseWorkspace();
+
       /// use CHOLMOD or CSparse
       void useCholmod(bool yes)
       { csp.useCholmod = yes; }
@@ -271,15 +369,16 @@ namespace sba
     
     // Private helper functions
     protected:
-      /// Generate a connections map, used for setConnMat() and 
-      /// setConnMatReduced().
-      vector<map<int,int> > generateConns_();
-      
-      /// Split a track into random tracks. (What is len?)
-      void tsplit(int tri, int len);
+      /// Split a track into random tracks of at most <len> projections;
+      /// <seed> is the rand_r() state for picking projections.
+      void tsplit(int tri, int len, unsigned int *seed);
+
+      /// Move the projections of track <tri1> into track <tri0>, unless
+      /// they conflict; returns false on conflict.
+      bool moveTrack_(int tri0, int tri1);
       
       /// Storage for old points, for checking LM step and reverting 
-      std::vector<Point, Eigen::aligned_allocator<Point> > oldpoints;
+      std::vector<StoredPoint, Eigen::aligned_allocator<StoredPoint> > oldpoints;
       
       /// variables for each track
       std::vector<Eigen::Vector3d, Eigen::aligned_allocator<Eigen::Vector3d> > tps;
@@ -287,6 +386,18 @@ namespace sba
       /// storage for Jacobian products
         std::vector<JacobProds, Eigen::aligned_allocator<JacobProds> > jps;
 
+      /// Point-to-camera matrices (HpcT*Hpp^-1) for all projections,
+      /// in track order; track <pi> starts at tpcoff[pi].
+      std::vector<Eigen::Matrix<double,6,3>, Eigen::aligned_allocator<Eigen::Matrix<double,6,3> > > tpcws;
+      std::vector<int> tpcoff;
+
+      /// Size the solver workspace for the current tracks; reuses storage.
+      void setupWorkspace_();
+
+      /// Refresh node transforms and rotation derivatives in one pass;
+      /// fixed nodes are skipped unless <all> is set.
+      void setupNodes_(bool all);
+
     };
 
 
@@ -443,7 +554,7 @@ namespace sba
       EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
       /// constructor
-        SysSPA() { nFixed = 1; useLocalAngles = true; Node::initDr(); lambda = 1.0e-4; 
+        SysSPA() { nFixed = 1; useLocalAngles = true; lambda = 1.0e-4; 
                    verbose = false;}
 
       /// print info
@@ -476,12 +587,46 @@ namespace sba
       /// set of scale for SPA system, indexed by position;
       std::vector<double> scales;
 
-      /// Number of fixed nodes
+      /// Number of fixed nodes; not used once sessions are started
       int nFixed;               
 
       /// Set of P2 constraints
       std::vector<ConP2,Eigen::aligned_allocator<ConP2> >  p2cons;
 
+      /// \brief Starts a new mapping session.  Nodes added from now on
+      /// belong to it, and the first of them is its anchor.  Nodes
+      /// added before the first session belong to session 0, anchored
+      /// at node 0.
+      /// \return the index of the new session.
+      int addSession();
+
+      /// Session of each node; empty if sessions aren't used.
+      std::vector<int> nodeSession;
+
+      /// Anchor node of each session, -1 until the session has a node.
+      /// The anchor fixes the session's frame when nothing else does: a
+      /// group of sessions joined by constraints is held by its first
+      /// anchor, or by any sessions in it that aren't being optimized.
+      std::vector<int> anchors;
+
+      /// Sessions with nodes or constraints added since they were last
+      /// optimized.
+      std::vector<char> changedSessions;
+
+      /// \brief Optimizes one session, with the nodes of all other
+      /// sessions fixed; <session> -1 optimizes all sessions.  Other
+      /// arguments and the return value are as for doSPA().
+      int doSessionSPA(int session, int niter, double sLambda = 1.0e-4,
+                       int useCSparse = SBA_SPARSE_CHOLESKY,
+                       double initTol = 1.0e-8, int CGiters = 50);
+
+      /// \brief Optimizes the changed sessions together, with the nodes
+      /// of all other sessions fixed.  Sessions that haven't changed
+      /// keep their last solution.
+      int doChangedSPA(int niter, double sLambda = 1.0e-4,
+                       int useCSparse = SBA_SPARSE_CHOLESKY,
+                       double initTol = 1.0e-8, int CGiters = 50);
+
       /// Set of scale constraints
       std::vector<ConScale,Eigen::aligned_allocator<ConScale> >  scons;
 
@@ -533,6 +678,25 @@ namespace sba
       Eigen::Matrix<double,4,1> oldtrans; // homogeneous coordinates, last element is 1.0
       Eigen::Matrix<double,4,1> oldqrot;  // this is the quaternion as coefficients, note xyzw order
 
+    protected:
+      /// Sets the fixed flags of the nodes, and the index of each free
+      /// node in the linear system (-1 if fixed); returns the number of
+      /// free nodes.
+      int setupVars_();
+      std::vector<int> varIndex_;
+
+      /// Sessions being optimized, all if empty.
+      std::vector<char> activeSessions_;
+
+      /// Groups of sessions joined by constraints, as a union-find forest
+      /// whose roots are the lowest session of each group.
+      std::vector<int> sessionParent_;
+      int sessionRoot_(int s);
+
+      /// Moves the group of sessions of one end of a new constraint
+      /// between separate groups rigidly, so that the constraint holds.
+      void joinSessions_(int nd0, int nd1, const Eigen::Vector3d &tmean,
+                         const Eigen::Quaterniond &qpmean);
     };
 
   /// constraint files
@@ -12,6 +12,10 @@
 #include <iostream>
 #include <fstream>
 #include <iomanip>
+#include <string>
+#include <deque>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
 
 #include "sba/sba.h"
 
@@ -91,6 +95,116 @@ namespace sba
   int writeGraphFile(const char *filename, SysSBA& sba, bool mono=false);
 
 
+  /// \brief A flat copy of the nodes, points and projections of an SBA
+  /// system, with just what the graph writers need.  Taking one is a few
+  /// array copies, much cheaper than copying the tracks, so it can be
+  /// done in a processing loop and written out elsewhere.
+  struct GraphSnapshot
+  {
+    /// \brief A projection of a point into a camera.
+    struct Projection
+    {
+      int ci;                   ///< Camera/node index.
+      double kp[3];             ///< Keypoint as u,v,u-d; u,v,0 for monocular.
+      bool stereo;              ///< Stereo or monocular projection.
+      bool isValid;             ///< Copied from Proj::isValid.
+    };
+
+    /// \brief Copy the current state of <sba>.
+    void take(const SysSBA &sba);
+
+    /// Per node: x y z, qx qy qz qw, fx fy cx cy, baseline.
+    std::vector<double> cams;
+    /// Per point: x y z.
+    std::vector<double> points;
+    /// The projections of point i are prjs[prjStart[i]] up to prjs[prjStart[i+1]].
+    std::vector<int> prjStart;
+    std::vector<Projection> prjs;
+  };
+
+  /// \brief File formats for GraphWriter.
+  enum GraphFormat
+  {
+    GRAPH_TEXT,                 ///< ascii graph file, as writeGraphFile().
+    GRAPH_TEXT_MONO,            ///< ascii graph file, monocular projections only.
+    GRAPH_BINARY,               ///< binary graph file, as writeBinaryGraphFile().
+    GRAPH_BUNDLER,              ///< Bundler file, as writeBundlerFile().
+    GRAPH_LOURAKIS              ///< Lourakis SBA files, as writeLourakisFile().
+  };
+
+  /// \brief Writes a snapshot as an ascii graph file, in the format of
+  /// writeGraphFile().
+  int writeGraphFile(const char *filename, const GraphSnapshot &snap, bool mono=false);
+
+  /**
+   * \brief Writes out the current SBA system as a binary graph file.
+   * The file holds a header ("SBAG", version, number of cameras, points
+   * and projections as 32-bit ints), then 12 doubles per camera as in
+   * GraphSnapshot::cams, then each point as 3 doubles and a projection
+   * count, followed by its projections as camera index, 3 floats for the
+   * keypoint, and a flag byte (1 for stereo, 2 for valid).  All values
+   * are in native byte order.  It is several times smaller and faster
+   * than the ascii graph format.
+   */
+  int writeBinaryGraphFile(const char *filename, const SysSBA& sba);
+  int writeBinaryGraphFile(const char *filename, const GraphSnapshot &snap);
+
+  /// \brief Reads a binary graph file written by writeBinaryGraphFile().
+  /// Returns -1 for a bad or truncated file, or one with projections into
+  /// cameras it doesn't have.
+  int readBinaryGraphFile(const char *filename, SysSBA& sbaout);
+
+  /**
+   * \brief Writes graph files on a background thread.  write() only takes
+   * a GraphSnapshot of the system; formatting and disk I/O happen on the
+   * writer thread, so periodic map dumps don't stall the caller.  Files
+   * are written in the order they are queued.  The destructor writes out
+   * anything still queued.
+   */
+  class GraphWriter
+  {
+    public:
+      /// \param maxPending Number of files that can be queued.
+      GraphWriter(int maxPending = 4);
+      ~GraphWriter();
+
+      /// \brief Queue the current state of <sba> to be written to <filename>.
+      /// \param wait If the queue is full, wait for room; otherwise the file
+      /// is skipped.
+      /// \return whether the file was queued.
+      bool write(const char *filename, const SysSBA &sba,
+                 GraphFormat format = GRAPH_TEXT, bool wait = false);
+
+      /// \brief Queue a snapshot, which can be shared between several files.
+      bool write(const char *filename, const boost::shared_ptr<const GraphSnapshot> &snap,
+                 GraphFormat format = GRAPH_TEXT, bool wait = false);
+
+      /// \brief Wait until all queued files have been written.
+      void flush();
+
+      /// \brief Number of files queued or being written.
+      int pending();
+
+    private:
+      struct Job
+      {
+        std::string filename;
+        boost::shared_ptr<const GraphSnapshot> snap;
+        GraphFormat format;
+      };
+
+      void run();
+
+      int maxPending;
+      int busy;                 // jobs taken off the queue but not yet written
+      bool stopping;
+      std::deque<Job> jobs;
+      boost::mutex mutex;
+      boost::condition_variable notEmpty, changed;
+      boost::thread thread;
+  };
+
+
   /** \brief Reads 3D pose graph data from a graph-type file to an instance of SysSPA.
    *
    * \param filename The name of the bundler-formatted file to read from.
@@ -88,4 +88,44 @@ spa2d_spiral_setup(SysSPA2d &spa,
                  double pnoise, double qnoise, double snoise, double dpnoise, double dqnoise);
 
 
+// parameters of the synthetic large-scale problems (synth_setup.cpp);
+// nodes go round laps of a circuit, closing loops with the previous lap
+struct SynthParams
+{
+  int nnodes;                   // number of nodes
+  int lapNodes;                 // nodes in a lap of the circuit
+  double nodeDist;              // distance between nodes (m)
+  double lapShift;              // outward displacement of each lap (m)
+  double loopRate;              // fraction of nodes with a loop closure
+  int ptsPerNode;               // new points per node (SBA)
+  int trackLen;                 // maximum run of nodes seeing a point (SBA)
+  double s_near, s_far;         // range of new point depths (SBA)
+  bool stereo;                  // stereo or monocular projections (SBA)
+  double inoise;                // image noise, std dev (pixels)
+  double pnoise, qnoise;        // pose noise, std dev (m, radians)
+  double outlierRate;           // fraction of bad projections and loop closures
+  unsigned int seed;            // random seed; same seed, same problem
+
+  SynthParams()
+    : nnodes(1000), lapNodes(200), nodeDist(0.5), lapShift(0.2), loopRate(0.2),
+      ptsPerNode(20), trackLen(6), s_near(2.0), s_far(20.0), stereo(true),
+      inoise(0.5), pnoise(0.02), qnoise(0.005), outlierRate(0.0), seed(1) {}
+};
+
+void
+synth_sba_setup(SysSBA &sba, CamParams &cpars,
+                vector<Matrix<double,6,1>, Eigen::aligned_allocator<Matrix<double,6,1> > > &cps,
+                const SynthParams &sp);
+
+void
+synth_spa_setup(SysSPA &spa,
+                vector<Matrix<double,6,1>, Eigen::aligned_allocator<Matrix<double,6,1> > > &cps,
+                const SynthParams &sp);
+
+void
+synth_spa2d_setup(SysSPA2d &spa,
+                  vector<Matrix<double,3,1>, Eigen::aligned_allocator<Matrix<double,3,1> > > &cps,
+                  const SynthParams &sp);
+
+
 #endif  // _VO_SETUP_H_
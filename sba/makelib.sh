@@ -7,10 +7,10 @@ mkdir -p ${DISTDIR} ${DISTDIR}/src ${DISTDIR}/include/ ${DISTDIR}/include/sba \
          ${DISTDIR}/include/bpcg ${DISTDIR}/obj ${DISTDIR}/lib \
          ${DISTDIR}/examples ${DISTDIR}/data ${DISTDIR}/bin
 
-cp src/spa2d.cpp src/csparse.cpp src/proj.cpp src/sba.cpp src/spa.cpp src/node.cpp src/sba_file_io.cpp ${DISTDIR}/src
+cp src/spa2d.cpp src/csparse.cpp src/proj.cpp src/sba.cpp src/spa.cpp src/node.cpp src/covis.cpp src/sba_file_io.cpp ${DISTDIR}/src
 cp ../bpcg/include/bpcg/bpcg.h ${DISTDIR}/include/bpcg
 cp include/sba/sba.h include/sba/csparse.h include/sba/proj.h include/sba/sba_file_io.h \
-   include/sba/node.h include/sba/spa2d.h include/sba/sba_setup.h include/sba/read_spa.h ${DISTDIR}/include/sba
+   include/sba/node.h include/sba/covis.h include/sba/spa2d.h include/sba/sba_setup.h include/sba/read_spa.h ${DISTDIR}/include/sba
 cp test/run_sba_graph_file.cpp ${DISTDIR}/examples/run_sba.cpp
 cp test/run_spa_graph_file.cpp ${DISTDIR}/examples/run_spa.cpp
 cp data/*.graph ${DISTDIR}/data
@@ -0,0 +1,241 @@
+#include <sba/covis.h>
+#include <algorithm>
+
+using namespace std;
+
+namespace sba
+{
+  // order edges by node index, for lower_bound()
+  static inline bool edgeLess(const CovisEdge &e, int node)
+  { return e.node < node; }
+
+  // order candidates by weight, largest first
+  static inline bool pairGreater(const pair<int,int> &a, const pair<int,int> &b)
+  { return a.first > b.first; }
+
+  void CovisGraph::clear()
+  {
+    adj.clear();
+    nobs.clear();
+    nedges = 0;
+    nskips = 0;
+  }
+
+  void CovisGraph::resize(int n)
+  {
+    if (n <= (int)adj.size()) return;
+    adj.resize(n);
+    nobs.resize(n,0);
+  }
+
+  CovisEdge *CovisGraph::findEdge_(int n0, int n1)
+  {
+    if (n0 >= (int)adj.size()) return NULL;
+    vector<CovisEdge> &es = adj[n0];
+    vector<CovisEdge>::iterator it = lower_bound(es.begin(), es.end(), n1, edgeLess);
+    if (it == es.end() || it->node != n1) return NULL;
+    return &(*it);
+  }
+
+  const CovisEdge *CovisGraph::findEdge_(int n0, int n1) const
+  {
+    if (n0 >= (int)adj.size()) return NULL;
+    const vector<CovisEdge> &es = adj[n0];
+    vector<CovisEdge>::const_iterator it = lower_bound(es.begin(), es.end(), n1, edgeLess);
+    if (it == es.end() || it->node != n1) return NULL;
+    return &(*it);
+  }
+
+  int CovisGraph::weight(int n0, int n1) const
+  {
+    const CovisEdge *e = findEdge_(n0,n1);
+    return e ? e->weight : 0;
+  }
+
+  bool CovisGraph::isSkipped(int n0, int n1) const
+  {
+    const CovisEdge *e = findEdge_(n0,n1);
+    return e && e->skip;
+  }
+
+  void CovisGraph::setSkip(int n0, int n1, bool skip)
+  {
+    CovisEdge *e0 = findEdge_(n0,n1);
+    CovisEdge *e1 = findEdge_(n1,n0);
+    if (!e0 || !e1 || e0->skip == skip) return;
+    e0->skip = skip;
+    e1->skip = skip;
+    nskips += skip ? 1 : -1;
+  }
+
+  void CovisGraph::setAllSkips(bool skip)
+  {
+    for (size_t i=0; i<adj.size(); i++)
+      for (size_t j=0; j<adj[i].size(); j++)
+        adj[i][j].skip = skip;
+    nskips = skip ? nedges : 0;
+  }
+
+  bool CovisGraph::bumpEdge_(int n0, int n1, int dw)
+  {
+    vector<CovisEdge> &es = adj[n0];
+    vector<CovisEdge>::iterator it = lower_bound(es.begin(), es.end(), n1, edgeLess);
+    if (it == es.end() || it->node != n1)
+      {
+        if (dw <= 0) return false; // nothing to remove
+        CovisEdge e;
+        e.node = n1;
+        e.weight = dw;
+        e.skip = false;
+        es.insert(it,e);
+        return true;
+      }
+    it->weight += dw;
+    if (it->weight > 0) return false;
+    if (it->skip && n0 < n1) nskips--; // count undirected edges once
+    es.erase(it);
+    return true;
+  }
+
+  void CovisGraph::bump_(int n0, int n1, int dw)
+  {
+    if (n0 < 0 || n1 < 0 || n0 == n1) return;
+    resize(max(n0,n1)+1);
+    bool changed = bumpEdge_(n0,n1,dw);
+    bumpEdge_(n1,n0,dw);
+    if (changed)
+      nedges += dw > 0 ? 1 : -1;
+  }
+
+  void CovisGraph::addObs(const ProjMap &prjs, int ci)
+  {
+    if (ci < 0) return;
+    resize(ci+1);
+    nobs[ci]++;
+    for (ProjMap::const_iterator itr = prjs.begin(); itr != prjs.end(); itr++)
+      bump_(ci, itr->second.ndi, 1);
+  }
+
+  void CovisGraph::removeObs(const ProjMap &prjs, int ci)
+  {
+    if (ci < 0 || ci >= (int)adj.size()) return;
+    nobs[ci]--;
+    for (ProjMap::const_iterator itr = prjs.begin(); itr != prjs.end(); itr++)
+      bump_(ci, itr->second.ndi, -1);
+  }
+
+  void CovisGraph::addTrack(const ProjMap &prjs)
+  {
+    for (ProjMap::const_iterator itr = prjs.begin(); itr != prjs.end(); itr++)
+      {
+        int c0 = itr->second.ndi;
+        if (c0 < 0) continue;
+        resize(c0+1);
+        nobs[c0]++;
+        ProjMap::const_iterator itr2 = itr;
+        for (itr2++; itr2 != prjs.end(); itr2++)
+          bump_(c0, itr2->second.ndi, 1);
+      }
+  }
+
+  void CovisGraph::removeTrack(const ProjMap &prjs)
+  {
+    for (ProjMap::const_iterator itr = prjs.begin(); itr != prjs.end(); itr++)
+      {
+        int c0 = itr->second.ndi;
+        if (c0 < 0 || c0 >= (int)adj.size()) continue;
+        nobs[c0]--;
+        ProjMap::const_iterator itr2 = itr;
+        for (itr2++; itr2 != prjs.end(); itr2++)
+          bump_(c0, itr2->second.ndi, -1);
+      }
+  }
+
+  void CovisGraph::removeFront(int n)
+  {
+    n = min(n, (int)adj.size());
+    if (n <= 0) return;
+
+    // edges between dropped nodes and the rest
+    for (int i=0; i<n; i++)
+      {
+        const vector<CovisEdge> &es = adj[i];
+        for (size_t j=0; j<es.size(); j++)
+          if (es[j].node > i)   // count undirected edges once
+            {
+              nedges--;
+              if (es[j].skip) nskips--;
+            }
+      }
+
+    adj.erase(adj.begin(), adj.begin()+n);
+    nobs.erase(nobs.begin(), nobs.begin()+n);
+
+    // edge lists are sorted, so the dropped nodes are at the front
+    for (size_t i=0; i<adj.size(); i++)
+      {
+        vector<CovisEdge> &es = adj[i];
+        vector<CovisEdge>::iterator it = lower_bound(es.begin(), es.end(), n, edgeLess);
+        es.erase(es.begin(), it);
+        for (size_t j=0; j<es.size(); j++)
+          es[j].node -= n;
+      }
+  }
+
+  void CovisGraph::remapNodes(const vector<int> &nidx)
+  {
+    int n = 0;
+    nedges = 0;
+    nskips = 0;
+    for (int i=0; i<(int)adj.size(); i++)
+      {
+        int ni = i < (int)nidx.size() ? nidx[i] : -1;
+        if (ni < 0) continue;
+
+        // renumber edges, dropping removed nodes
+        vector<CovisEdge> &es = adj[i];
+        int m = 0;
+        for (size_t j=0; j<es.size(); j++)
+          {
+            int nj = es[j].node < (int)nidx.size() ? nidx[es[j].node] : -1;
+            if (nj < 0) continue;
+            es[m] = es[j];
+            es[m].node = nj;
+            if (nj > ni)        // count undirected edges once
+              {
+                nedges++;
+                if (es[m].skip) nskips++;
+              }
+            m++;
+          }
+        es.resize(m);
+
+        // the map keeps node order, so ni <= i and slot ni is done with
+        if (ni != i)
+          {
+            adj[ni].swap(es);
+            nobs[ni] = nobs[i];
+          }
+        n = ni+1;
+      }
+    adj.resize(n);
+    nobs.resize(n);
+  }
+
+  void CovisGraph::bestNeighbors(int ni, int n, vector<int> &nbrs, int minpts) const
+  {
+    nbrs.clear();
+    if (ni < 0 || ni >= (int)adj.size()) return;
+    const vector<CovisEdge> &es = adj[ni];
+    vector<pair<int,int> > cands;
+    cands.reserve(es.size());
+    for (size_t j=0; j<es.size(); j++)
+      if (es[j].weight >= minpts)
+        cands.push_back(pair<int,int>(es[j].weight, es[j].node));
+    n = min(n, (int)cands.size());
+    partial_sort(cands.begin(), cands.begin()+n, cands.end(), pairGreater);
+    for (int j=0; j<n; j++)
+      nbrs.push_back(cands[j].second);
+  }
+
+} // sba
@@ -46,6 +46,7 @@ using namespace Eigen;
 #include <fstream>
 #include <sys/time.h>
 #include <algorithm>
+#include <string.h>
 
 using namespace std;
 
@@ -68,17 +69,169 @@ using namespace std;
 //  vals    has NNZ entries corresponding to the row_ptr entries
 //  
 
+// cholmod_solve2() solves into preallocated vectors
+#if defined(SBA_CHOLMOD) && defined(CHOLMOD_VER_CODE)
+#if CHOLMOD_VERSION >= CHOLMOD_VER_CODE(2,0)
+#define SBA_CHOLMOD_SOLVE2
+#endif
+#endif
+
 namespace sba
 {
 
-  CSparse::CSparse()
-  {
-    A = NULL;
 #ifdef SBA_CHOLMOD
-    cholmod_start (&Common) ;    // start it up ???
+  CholmodSolver::CholmodSolver()
+  {
+    init_();
+  }
+
+  CholmodSolver::CholmodSolver(const CholmodSolver &s)
+  {
+    init_();
+    refine = s.refine;
+  }
+
+  CholmodSolver &CholmodSolver::operator=(const CholmodSolver &s)
+  {
+    if (this != &s)
+      {
+        clear();
+        refine = s.refine;
+      }
+    return *this;
+  }
+
+  CholmodSolver::~CholmodSolver()
+  {
+    clear();
+    cholmod_finish (&Common) ;
+  }
+
+  void CholmodSolver::init_()
+  {
+    cholmod_start (&Common) ;
     Common.print = 0;
-    chA = NULL;
+    A = NULL;
+    L = NULL;
+    X = R = D = Y = E = NULL;
+    refine = true;
+    nanalyze = 0;
+    nfactor = 0;
+  }
+
+  void CholmodSolver::clear()
+  {
+    cholmod_free_factor (&L, &Common) ;
+    cholmod_free_dense (&X, &Common) ;
+    cholmod_free_dense (&R, &Common) ;
+    cholmod_free_dense (&D, &Common) ;
+    cholmod_free_dense (&Y, &Common) ;
+    cholmod_free_dense (&E, &Common) ;
+    cholmod_free_sparse (&A, &Common) ;
+    ap.clear();
+    ai.clear();
+  }
+
+  cholmod_sparse *CholmodSolver::reserve(int n, int nnz)
+  {
+    if (A && (int)A->nrow == n && (int)A->nzmax == nnz)
+      return A;
+    clear();                    // new size, new everything
+    A = cholmod_allocate_sparse(n,n,nnz,true,true,1,CHOLMOD_REAL,&Common);
+    return A;
+  }
+
+  void CholmodSolver::setPattern()
+  {
+    int n = A->ncol;
+    int nnz = A->nzmax;
+    int *Ap = (int *)A->p;
+    int *Ai = (int *)A->i;
+    if (L && (int)ap.size() == n+1 && (int)ai.size() == nnz &&
+        equal(ap.begin(), ap.end(), Ap) && equal(ai.begin(), ai.end(), Ai))
+      return;                   // same pattern, keep the analysis
+    cholmod_free_factor (&L, &Common) ;
+    ap.assign(Ap, Ap+n+1);
+    ai.assign(Ai, Ai+nnz);
+  }
+
+  bool CholmodSolver::solve(double *b)
+  {
+    if (!A) return false;
+    int n = A->nrow;
+
+    if (!L)
+      {
+        L = cholmod_analyze (A, &Common) ; // analyze 
+        if (!L) return false;
+        nanalyze++;
+      }
+    cholmod_factorize (A, L, &Common) ; // numeric factorization only
+    nfactor++;
+
+    cholmod_dense bd;           // wrap the RHS
+    bd.nrow = n;
+    bd.ncol = 1;
+    bd.d = n;                   // leading dimension
+    bd.nzmax = n;
+    bd.xtype = CHOLMOD_REAL;
+    bd.dtype = CHOLMOD_DOUBLE;
+    bd.x = b;
+    bd.z = NULL;
+
+#ifdef SBA_CHOLMOD_SOLVE2
+    if (!cholmod_solve2 (CHOLMOD_A, L, &bd, NULL, &X, NULL, &Y, &E, &Common))
+      return false;
+#else
+    cholmod_free_dense (&X, &Common) ;
+    X = cholmod_solve (CHOLMOD_A, L, &bd, &Common) ; // solve Ax=b
+    if (!X) return false;
+#endif
+    double *Xx = (double *)X->x;
+
+    if (refine)
+      {
+        // one step of iterative refinement, cheap
+        double one [2], minusone [2];
+        one [0] = 1 ;
+        one [1] = 0 ;
+        minusone [0] = -1 ;
+        minusone [1] = 0 ;
+
+        /* R = B-A*X */
+        if (!R || (int)R->nrow != n)
+          {
+            cholmod_free_dense (&R, &Common) ;
+            R = cholmod_allocate_dense (n, 1, n, CHOLMOD_REAL, &Common) ;
+          }
+        memcpy(R->x, b, n*sizeof(double));
+        cholmod_sdmult (A, 0, minusone, one, X, R, &Common) ;
+
+        /* D = A\(B-A*X) */
+#ifdef SBA_CHOLMOD_SOLVE2
+        if (!cholmod_solve2 (CHOLMOD_A, L, R, NULL, &D, NULL, &Y, &E, &Common))
+          return false;
+#else
+        cholmod_free_dense (&D, &Common) ;
+        D = cholmod_solve (CHOLMOD_A, L, R, &Common) ;
+        if (!D) return false;
+#endif
+
+        /* X = X + A\(B-A*X) */
+        double *Dx = (double *)D->x;
+        for (int i=0; i<n; i++)
+          Xx[i] += Dx[i];
+      }
+
+    memcpy(b, Xx, n*sizeof(double)); // transfer answer
+    return true;
+  }
 #endif
+
+
+  CSparse::CSparse()
+  {
+    A = NULL;
     useCholmod = false;
     asize = 0;
     csize = 0;
@@ -88,9 +241,6 @@ namespace sba
   CSparse::~CSparse()
   {
     if (A) cs_spfree(A);        // free any previous structure
-#ifdef SBA_CHOLMOD
-    cholmod_finish (&Common) ;   // finish it ???
-#endif
   }
 
 
@@ -154,23 +304,31 @@ namespace sba
   // this version sets upper triangular matrix,
   void CSparse::setupCSstructure(double diaginc, bool init)
   {
+    // count entries for cs allocation
+    // blocks are only added between inits, so the same count means 
+    //   the same structure
+    int nz = 21*asize;          // diagonal entries, just upper triangle
+    for (int i=0; i<(int)cols.size(); i++)
+      {
+        map<int,Matrix<double,6,6>, less<int>, 
+          aligned_allocator<Matrix<double,6,6> > > &col = cols[i];
+        nz += 36 * col.size();  // 6x6 matrix
+      }
+
+#ifdef SBA_CHOLMOD
+    if (useCholmod && !chol.A) init = true;
+    else
+#endif
+    if (!useCholmod && !A) init = true;
+
     // reserve space and set things up
-    if (init || useCholmod)
+    if (init || nz != nnz)
       {
-        // count entries for cs allocation
-        nnz = 21*asize;         // diagonal entries, just upper triangle
-        for (int i=0; i<(int)cols.size(); i++)
-          {
-            map<int,Matrix<double,6,6>, less<int>, 
-              aligned_allocator<Matrix<double,6,6> > > &col = cols[i];
-            nnz += 36 * col.size(); // 6x6 matrix
-          }
+        nnz = nz;
 
 #ifdef SBA_CHOLMOD
         if (useCholmod)
-          {
-            chA = cholmod_allocate_sparse(csize,csize,nnz,true,true,1,CHOLMOD_REAL,&Common);
-          }
+          chol.reserve(csize,nnz);
         else
 #endif
           {
@@ -184,8 +342,8 @@ namespace sba
 #ifdef SBA_CHOLMOD
         if (useCholmod)
           {
-            Ap = (int *)chA->p; // column pointer
-            Ai = (int *)chA->i; // row indices
+            Ap = (int *)chol.A->p; // column pointer
+            Ai = (int *)chol.A->i; // row indices
           }
         else
 #endif
@@ -228,6 +386,11 @@ namespace sba
               }
            }        
           *Ap = nnz;            // last entry
+
+#ifdef SBA_CHOLMOD
+        if (useCholmod)
+          chol.setPattern();    // keeps the analysis if nothing changed
+#endif
        }
 
 
@@ -237,7 +400,7 @@ namespace sba
      double *Ax;
 #ifdef SBA_CHOLMOD
      if (useCholmod)
-       Ax = (double *)chA->x;   // values
+       Ax = (double *)chol.A->x; // values
      else
 #endif
        Ax = A->x;               // values
@@ -302,58 +465,7 @@ namespace sba
   {
 #ifdef SBA_CHOLMOD
       if (useCholmod)
-      {
-          cholmod_dense *x, b, *R, *R2;
-          cholmod_factor *L ;
-          double *Xx, *Rx, *bb;
-          double one [2], minusone [2];
-          one [0] = 1 ;
-          one [1] = 0 ;
-          minusone [0] = -1 ;
-          minusone [1] = 0 ;
-
-          cholmod_print_sparse (chA, (char *)"A", &Common) ; // print simple stats
-          b.nrow = csize;
-          b.ncol = 1;
-          b.d = csize;                // leading dimension (???)
-          b.nzmax = csize;
-          b.xtype = CHOLMOD_REAL;
-          b.dtype = CHOLMOD_DOUBLE;
-          b.x = B.data();
-          //cout << "CHOLMOD analyze..." << flush;
-          L = cholmod_analyze (chA, &Common) ; // analyze 
-          //cout << "factorize..." << flush;
-          cholmod_factorize (chA, L, &Common) ; // factorize 
-          //cout << "solve..." << flush;
-          x = cholmod_solve (CHOLMOD_A, L, &b, &Common) ; // solve Ax=b
-          //        cholmod_print_factor (L, (char *)"L", &Common) ;
-
-          //cout << "refine" << endl;
-          // one step of iterative refinement, cheap
-          /* Ax=b was factorized and solved, R = B-A*X */
-          R = cholmod_copy_dense (&b, &Common) ;
-          cholmod_sdmult(chA, 0, minusone, one, x, R, &Common) ;
-          /* R2 = A\(B-A*X) */
-          R2 = cholmod_solve (CHOLMOD_A, L, R, &Common) ;
-          /* compute X = X + A\(B-A*X) */
-          Xx = (double *)x->x ;
-          Rx = (double *)R2->x ;
-          for (int i=0 ; i<csize ; i++)
-          {
-              Xx[i] = Xx[i] + Rx[i] ;
-          }
-          cholmod_free_dense (&R2, &Common) ;
-          cholmod_free_dense (&R, &Common) ;
-
-          bb = B.data();
-          for (int i=0; i<csize; i++) // transfer answer
-              *bb++ = *Xx++;
-          cholmod_free_factor (&L, &Common) ; // free matrices 
-          cholmod_free_dense (&x, &Common) ;
-          cholmod_free_sparse(&chA, &Common);
-
-          return true;
-      }
+          return chol.solve(B.data());
       else
 #endif
       {
@@ -395,11 +507,6 @@ namespace sba
   {
     A = NULL;
     AF = NULL;
-#ifdef SBA_CHOLMOD
-    cholmod_start (&Common) ;    // start it up ???
-    Common.print = 0;
-    chA = NULL;
-#endif
     asize = 0;
     csize = 0;
     nnz = 0;
@@ -410,9 +517,6 @@ namespace sba
   {
     if (A) cs_spfree(A);        // free any previous structure
     if (AF) cs_spfree(AF);      // free any previous structure
-#ifdef SBA_CHOLMOD
-    cholmod_finish (&Common) ;   // finish it ???
-#endif
   }
 
 
@@ -495,27 +599,35 @@ namespace sba
 
   void CSparse2d::setupCSstructure(double diaginc, bool init)
   {
+    // count entries for cs allocation
+    // blocks are only added between inits, so the same count means 
+    //   the same structure
+    int nz = 6*asize;           // diagonal entries, just upper triangle
+    for (int i=0; i<(int)cols.size(); i++)
+      {
+        map<int,Matrix<double,3,3>, less<int>, 
+          aligned_allocator<Matrix<double,3,3> > > &col = cols[i];
+        nz += 9 * col.size();   // 3x3 matrix
+      }
+
+#ifdef SBA_CHOLMOD
+    if (useCholmod && !chol.A) init = true;
+    else
+#endif
+    if (!useCholmod && !A) init = true;
+
     // reserve space and set things up
-    if (init || useCholmod)
+    if (init || nz != nnz)
       {
-        if (A) cs_spfree(A);    // free any previous structure
+        nnz = nz;
 
-        // count entries for cs allocation
-        nnz = 6*asize;         // diagonal entries, just upper triangle
-        for (int i=0; i<(int)cols.size(); i++)
-          {
-            map<int,Matrix<double,3,3>, less<int>, 
-              aligned_allocator<Matrix<double,3,3> > > &col = cols[i];
-            nnz += 9 * col.size(); // 3x3 matrix
-          }
 #ifdef SBA_CHOLMOD
         if (useCholmod)
-          {
-            chA = cholmod_allocate_sparse(csize,csize,nnz,true,true,1,CHOLMOD_REAL,&Common);
-          }
+          chol.reserve(csize,nnz);
         else
 #endif
 	  {
+            if (A) cs_spfree(A);    // free any previous structure
 	    A = cs_spalloc(csize,csize,nnz,1,0); // allocate sparse matrix
 	  }
         
@@ -525,8 +637,8 @@ namespace sba
 #ifdef SBA_CHOLMOD
         if (useCholmod)
           {
-            Ap = (int *)chA->p; // column pointer
-            Ai = (int *)chA->i; // row indices
+            Ap = (int *)chol.A->p; // column pointer
+            Ai = (int *)chol.A->i; // row indices
           }
         else
 #endif
@@ -570,6 +682,11 @@ namespace sba
               }
            }        
           *Ap = nnz;       // last entry
+
+#ifdef SBA_CHOLMOD
+        if (useCholmod)
+          chol.setPattern();    // keeps the analysis if nothing changed
+#endif
        }
 
      // now put the entries in place
@@ -577,7 +694,7 @@ namespace sba
      double *Ax;
 #ifdef SBA_CHOLMOD
      if (useCholmod)
-       Ax = (double *)chA->x;   // values
+       Ax = (double *)chol.A->x; // values
      else
 #endif
        Ax = A->x;               // values
@@ -646,58 +763,7 @@ namespace sba
   {
 #ifdef SBA_CHOLMOD
     if (useCholmod)
-      {
-        cholmod_dense *x, b, *R, *R2;
-        cholmod_factor *L ;
-        double *Xx, *Rx, *bb;
-        double one [2], minusone [2];
-        one [0] = 1 ;
-        one [1] = 0 ;
-        minusone [0] = -1 ;
-        minusone [1] = 0 ;
-
-        cholmod_print_sparse (chA, (char *)"A", &Common) ; // print simple stats
-        b.nrow = csize;
-        b.ncol = 1;
-        b.d = csize;                // leading dimension (???)
-        b.nzmax = csize;
-        b.xtype = CHOLMOD_REAL;
-        b.dtype = CHOLMOD_DOUBLE;
-        b.x = B.data();
-        //cout << "CHOLMOD analyze..." << flush;
-        L = cholmod_analyze (chA, &Common) ; // analyze 
-        //cout << "factorize..." << flush;
-        cholmod_factorize (chA, L, &Common) ; // factorize 
-        //cout << "solve..." << flush;
-        x = cholmod_solve (CHOLMOD_A, L, &b, &Common) ; // solve Ax=b
-        //        cholmod_print_factor (L, (char *)"L", &Common) ;
-
-        //cout << "refine" << endl;
-        // one step of iterative refinement, cheap
-	/* Ax=b was factorized and solved, R = B-A*X */
-	R = cholmod_copy_dense (&b, &Common) ;
-	cholmod_sdmult(chA, 0, minusone, one, x, R, &Common) ;
-	/* R2 = A\(B-A*X) */
-	R2 = cholmod_solve (CHOLMOD_A, L, R, &Common) ;
-	/* compute X = X + A\(B-A*X) */
-	Xx = (double *)x->x ;
-	Rx = (double *)R2->x ;
-	for (int i=0 ; i<csize ; i++)
-	{
-          Xx[i] = Xx[i] + Rx[i] ;
-	}
-	cholmod_free_dense (&R2, &Common) ;
-	cholmod_free_dense (&R, &Common) ;
-
-        bb = B.data();
-        for (int i=0; i<csize; i++) // transfer answer
-          *bb++ = *Xx++;
-        cholmod_free_factor (&L, &Common) ; // free matrices 
-        cholmod_free_dense (&x, &Common) ;
-        cholmod_free_sparse(&chA, &Common);
-
-        return true;
-      }
+      return chol.solve(B.data());
     else
 #endif
       {
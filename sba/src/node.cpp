@@ -16,24 +16,6 @@ namespace sba
     setDr(true);
   }
 
-  // constant derivative matrices
-  // these are the derivatives of the *inverse* rotation
-  Eigen::Matrix3d Node::dRidx, Node::dRidy, Node::dRidz;
-
-  void Node::initDr()
-  {
-    dRidx  << 0.0,0.0,0.0,  
-              0.0,0.0,2.0,
-              0.0,-2.0,0.0;
-    dRidy  << 0.0,0.0,-2.0,
-              0.0,0.0,0.0,
-              2.0,0.0,0.0;
-    dRidz  << 0.0,2.0,0.0,  
-              -2.0,0.0,0.0,
-              0.0,0.0,0.0;
-  }
-
-
   void Node::normRot()
   { 
     //      std::cout << "[NormRot] qrot start = " << qrot.transpose() << std::endl;
@@ -58,14 +40,21 @@ namespace sba
     // for dS'*R', with dS the incremental change
     if (local)
       {
-#if 0
-        dRdx = w2n.block<3,3>(0,0) * dRidx;
-        dRdy = w2n.block<3,3>(0,0) * dRidy;
-        dRdz = w2n.block<3,3>(0,0) * dRidz;
-#endif
-        dRdx = dRidx * w2n.block<3,3>(0,0);
-        dRdy = dRidy * w2n.block<3,3>(0,0);
-        dRdz = dRidz * w2n.block<3,3>(0,0);
+        // dRi * R', with dRi the derivative of the *inverse* incremental
+        // rotation at zero; these are just scaled rows of R':
+        //   dRix = [0 0 0; 0 0 2; 0 -2 0]
+        //   dRiy = [0 0 -2; 0 0 0; 2 0 0]
+        //   dRiz = [0 2 0; -2 0 0; 0 0 0]
+        const Eigen::Matrix<double,3,4> &R = w2n;
+        dRdx.row(0).setZero();
+        dRdx.row(1) = 2.0*R.block<1,3>(2,0);
+        dRdx.row(2) = -2.0*R.block<1,3>(1,0);
+        dRdy.row(0) = -2.0*R.block<1,3>(2,0);
+        dRdy.row(1).setZero();
+        dRdy.row(2) = 2.0*R.block<1,3>(0,0);
+        dRdz.row(0) = 2.0*R.block<1,3>(1,0);
+        dRdz.row(1) = -2.0*R.block<1,3>(0,0);
+        dRdz.row(2).setZero();
 
       }
     else
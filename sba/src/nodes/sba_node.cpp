@@ -10,12 +10,21 @@
 #include <sba/visualization.h>
 
 #include <map>
+#include <deque>
+#include <vector>
+#include <algorithm>
 
 #include <ros/callback_queue.h>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
 
 
 using namespace sba;
 
+// Frames are taken off the subscription as they come in and queued; a
+// worker thread adds everything queued in one batch, and runs SBA on
+// the batched system within a time budget, so a fast publisher is never
+// held up by the optimization.
 class SBANode
 {
   public:
@@ -33,53 +42,154 @@ class SBANode
     
     // Mapping from external node index to internal (sba) node index
     std::map<unsigned int, unsigned int> node_indices;
+
+    // Number of projections in the system, kept up as they are added
+    int nprojs;
+
+    // Optimize after this many new nodes
+    int sba_interval;
+    // Wall time (s) allowed for each optimization
+    double sba_time_budget;
+    // Maximum LM iterations for each optimization, and how many are
+    // run between checks on the time budget
+    int sba_max_iters;
+    int sba_chunk_iters;
     
     void addFrame(const sba::Frame::ConstPtr& msg);
+    void addFrames(const std::vector<sba::Frame::ConstPtr>& msgs);
     void addNode(const sba::CameraNode& msg);
     void addPoint(const sba::WorldPoint& msg);
-    void addProj(const sba::Projection& msg);
+    bool addProj(const sba::Projection& msg, std::vector<ProjEntry>& prjs);
     void doSBA(/*const ros::TimerEvent& event*/);
     void publishTopics(/*const ros::TimerEvent& event*/);
     SBANode();
+    ~SBANode();
+
+  private:
+    void run();
+
+    // frames waiting for the worker
+    std::deque<sba::Frame::ConstPtr> frames;
+    boost::mutex frame_mutex;
+    boost::condition_variable frame_cond;
+    bool stopping;
+    boost::thread worker;
 };
     
 void SBANode::addFrame(const sba::Frame::ConstPtr& msg)
 {
-  unsigned int i = 0;
+  boost::mutex::scoped_lock lock(frame_mutex);
+  frames.push_back(msg);
+  frame_cond.notify_one();
+}
+
+void SBANode::run()
+{
+  unsigned int sba_nodes = 0;   // system size at the last optimization
+  std::vector<sba::Frame::ConstPtr> msgs;
+
+  while (1)
+  {
+    {
+      boost::mutex::scoped_lock lock(frame_mutex);
+      while (frames.empty() && !stopping)
+        frame_cond.wait(lock);
+      if (stopping)
+        return;
+      msgs.assign(frames.begin(), frames.end());
+      frames.clear();
+    }
+
+    addFrames(msgs);
+    msgs.clear();
   
-  ros::Time beginning = ros::Time::now();
+    publishTopics();
   
-  // Add all nodes
-  for (i=0; i < msg->nodes.size(); i++)
-  {
-    addNode(msg->nodes[i]);
+    // Do SBA every few nodes.
+    if (sba.nodes.size() >= sba_nodes + sba_interval)
+    {
+      doSBA();
+      sba_nodes = sba.nodes.size();
+      publishTopics();
+    }
   }
+}
+
+// grow a vector for <n> more elements, keeping amortized growth
+template <typename T>
+static void reserveMore(T &v, size_t n)
+{
+  if (v.size() + n > v.capacity())
+    v.reserve(std::max(v.size() + n, 2*v.capacity()));
+}
+
+void SBANode::addFrames(const std::vector<sba::Frame::ConstPtr>& msgs)
+{
+  unsigned int i = 0, j = 0;
   
-  // Add all points
-  for (i=0; i < msg->points.size(); i++)
+  ros::Time beginning = ros::Time::now();
+
+  size_t nnodes = 0, npoints = 0, nprjs = 0;
+  for (i=0; i < msgs.size(); i++)
   {
-    addPoint(msg->points[i]);
+    nnodes += msgs[i]->nodes.size();
+    npoints += msgs[i]->points.size();
+    nprjs += msgs[i]->projections.size();
   }
+  reserveMore(sba.nodes, nnodes);
+  reserveMore(sba.tracks, npoints);
+
+  // Projections are looked up frame by frame, since indices can be
+  // reused, but go into the system all at once.
+  std::vector<ProjEntry> prjs;
+  std::vector<std::pair<int, const sba::Projection *> > covars;
+  prjs.reserve(nprjs);
   
-  // Add all projections
-  for (i=0; i < msg->projections.size(); i++)
-  { 
-    addProj(msg->projections[i]);
-  }
+  for (i=0; i < msgs.size(); i++)
+  {
+    const sba::Frame &msg = *msgs[i];
+
+    // Add all nodes
+    for (j=0; j < msg.nodes.size(); j++)
+    {
+      addNode(msg.nodes[j]);
+    }
   
-  publishTopics();
+    // Add all points
+    for (j=0; j < msg.points.size(); j++)
+    {
+      addPoint(msg.points[j]);
+    }
   
-  // Do SBA Every 10 frames.
-  if (sba.nodes.size() % 5 == 0)
+    // Add all projections
+    for (j=0; j < msg.projections.size(); j++)
+    { 
+      if (addProj(msg.projections[j], prjs) && msg.projections[j].usecovariance)
+        covars.push_back(std::make_pair((int)prjs.size()-1, &msg.projections[j]));
+    }
+  }
+
+  nprojs += sba.addProjs(prjs);
+
+  for (i=0; i < covars.size(); i++)
   {
-    doSBA();
+    const ProjEntry &pe = prjs[covars[i].first];
+    const sba::Projection &msg = *covars[i].second;
+    // skip projections that addProjs() rejected
+    if (sba.tracks[pe.pi].projections.count(pe.ci) == 0)
+      continue;
+    Eigen::Matrix3d covariance;
+    covariance << msg.covariance[0], msg.covariance[1], msg.covariance[2],
+                  msg.covariance[3], msg.covariance[4], msg.covariance[5],
+                  msg.covariance[6], msg.covariance[7], msg.covariance[8];
+    sba.setProjCovariance(pe.ci, pe.pi, covariance);
   }
   
   ros::Time end = ros::Time::now();
   
-  printf("[SBA] Added frame with %u nodes, %u points, and %u projections (%f s)\n", 
-          (unsigned int)msg->nodes.size(), (unsigned int)msg->points.size(), 
-          (unsigned int)msg->projections.size(), (end-beginning).toSec());
+  printf("[SBA] Added %u frames with %u nodes, %u points, and %u projections (%f s)\n", 
+          (unsigned int)msgs.size(), (unsigned int)nnodes, (unsigned int)npoints, 
+          (unsigned int)nprjs, (end-beginning).toSec());
 }
 
 void SBANode::addNode(const sba::CameraNode& msg)
@@ -109,62 +219,73 @@ void SBANode::addPoint(const sba::WorldPoint& msg)
   point_indices[msg.index] = newindex;
 }
 
-void SBANode::addProj(const sba::Projection& msg)
+bool SBANode::addProj(const sba::Projection& msg, std::vector<ProjEntry>& prjs)
 {
-  int camindex = node_indices[msg.camindex];
-  int pointindex = point_indices[msg.pointindex];
-  Vector3d keypoint(msg.u, msg.v, msg.d);
-  bool stereo = msg.stereo;
-  bool usecovariance = msg.usecovariance;
-  Eigen::Matrix3d covariance;
-  covariance << msg.covariance[0], msg.covariance[1], msg.covariance[2],
-                msg.covariance[3], msg.covariance[4], msg.covariance[5],
-                msg.covariance[6], msg.covariance[7], msg.covariance[8];
+  std::map<unsigned int, unsigned int>::iterator cam = node_indices.find(msg.camindex);
+  std::map<unsigned int, unsigned int>::iterator point = point_indices.find(msg.pointindex);
   
   // Make sure it's valid before adding it.
-  if (pointindex < (int)sba.tracks.size() && camindex < (int)sba.nodes.size())
+  if (cam != node_indices.end() && point != point_indices.end())
   {
-    sba.addProj(camindex, pointindex, keypoint, stereo);
-    if (usecovariance)
-      sba.setProjCovariance(camindex, pointindex, covariance);
+    ProjEntry pe;
+    pe.ci = cam->second;
+    pe.pi = point->second;
+    pe.kp = Vector3d(msg.u, msg.v, msg.d);
+    pe.stereo = msg.stereo;
+    prjs.push_back(pe);
+    return true;
   }
   else
   {
     ROS_INFO("Failed to add projection: C: %d, P: %d, Csize: %d, Psize: %d", 
-            camindex, pointindex,(int)sba.nodes.size(),(int)sba.tracks.size());       
+            msg.camindex, msg.pointindex,(int)sba.nodes.size(),(int)sba.tracks.size());       
+    return false;
   }
 }
 
 void SBANode::doSBA(/*const ros::TimerEvent& event*/)
 {
-  unsigned int projs = 0;
-  // For debugging.
-  for (int i = 0; i < (int)sba.tracks.size(); i++)
-  {
-    projs += sba.tracks[i].projections.size();
-  }
   ROS_INFO("SBA Nodes: %d, Points: %d, Projections: %d", (int)sba.nodes.size(),
-    (int)sba.tracks.size(), projs);
+    (int)sba.tracks.size(), nprojs);
   
-  if (sba.nodes.size() > 0)
+  if (sba.nodes.size() == 0)
+    return;
+
+  // Copied from vslam.cpp: refine(), at least 10 iterations and more while
+  // the error is high.  LM runs in short stretches, carrying lambda over,
+  // and stops when the next stretch would overrun the time budget.
+  ros::WallTime start = ros::WallTime::now();
+  double lambda = 1.0e-4;
+  double chunk_time = 0.0;
+  int iters = 0;
+  while (iters < sba_max_iters)
   {
-    // Copied from vslam.cpp: refine()
-    sba.doSBA(10, 1.0e-4, SBA_SPARSE_CHOLESKY);
+    ros::WallTime chunk_start = ros::WallTime::now();
+    int niter = std::min(sba_chunk_iters, sba_max_iters - iters);
+    int done = sba.doSBA(niter, lambda, SBA_SPARSE_CHOLESKY);
+    lambda = 0.0;               // continue with the last lambda
+    if (done < 0)
+      break;
+    iters += done;
+    if (done < niter)           // converged
+      break;
     
     double cost = sba.calcRMSCost();
-    
     if (isnan(cost) || isinf(cost)) // is NaN?
     {
       ROS_INFO("NaN cost!");  
+      break;
     }
-    else
-    { 
-      if (sba.calcRMSCost() > 4.0)
-        sba.doSBA(10, 1.0e-4, SBA_SPARSE_CHOLESKY);  // do more
-      if (sba.calcRMSCost() > 4.0)
-        sba.doSBA(10, 1.0e-4, SBA_SPARSE_CHOLESKY);  // do more
-    }
+    if (iters >= 10 && cost <= 4.0)
+      break;
+
+    ros::WallTime now = ros::WallTime::now();
+    chunk_time = std::max(chunk_time, (now - chunk_start).toSec());
+    if ((now - start).toSec() + chunk_time > sba_time_budget)
+      break;
   }
+
+  ROS_INFO("SBA: %d iterations in %f s", iters, (ros::WallTime::now() - start).toSec());
 }
 
 void SBANode::publishTopics(/*const ros::TimerEvent& event*/)
@@ -185,14 +306,36 @@ SBANode::SBANode()
   //timer_sba = n.createTimer(ros::Duration(5.0), &SBANode::doSBA, this);
   //timer_vis = n.createTimer(ros::Duration(1.0), &SBANode::publishTopics, this);
   
+  ros::NodeHandle pn("~");
+  pn.param("sba_interval", sba_interval, 5);
+  pn.param("sba_time_budget", sba_time_budget, 1.0);
+  pn.param("sba_max_iterations", sba_max_iters, 30);
+  pn.param("sba_chunk_iterations", sba_chunk_iters, 5);
+  sba_interval = std::max(1, sba_interval);
+  sba_chunk_iters = std::max(1, sba_chunk_iters);
+
+  nprojs = 0;
+  sba.useCholmod(true);
+
+  stopping = false;
+  worker = boost::thread(boost::bind(&SBANode::run, this));
+  
   // Subscribe to topics.
   frame_sub = n.subscribe<sba::Frame>("/sba/frames", 5000, &SBANode::addFrame, this);
   
-  sba.useCholmod(true);
-  
   printf("[SBA] Initialization complete.\n");
 }
 
+SBANode::~SBANode()
+{
+  {
+    boost::mutex::scoped_lock lock(frame_mutex);
+    stopping = true;
+    frame_cond.notify_all();
+  }
+  worker.join();
+}
+
 int main(int argc, char** argv)
 {
   ros::init(argc, argv, "sba_node");
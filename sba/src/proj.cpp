@@ -3,16 +3,64 @@
 namespace sba
 {
   Proj::Proj(int ci, Eigen::Vector3d &q, bool stereo)
-      : ndi(ci), kp(q), stereo(stereo), 
-        isValid(true), useCovar(false), pointPlane(false) {}
+      : ndi(ci), stereo(stereo), isValid(true), useCovar(false), 
+        pointPlane(false), kp(q.cast<StoreScalar>()), ext(NULL) {}
       
   Proj::Proj(int ci, Eigen::Vector2d &q) 
-      : ndi(ci), kp(q(0), q(1), 0), 
-        stereo(false), isValid(true), useCovar(false), pointPlane(false) {}
+      : ndi(ci), stereo(false), isValid(true), useCovar(false), 
+        pointPlane(false), kp(q(0), q(1), 0), ext(NULL) {}
   
   Proj::Proj() 
-      : ndi(0), kp(0, 0, 0), 
-        stereo(false), isValid(false), useCovar(false), pointPlane(false) {}
+      : ndi(0), stereo(false), isValid(false), useCovar(false), 
+        pointPlane(false), kp(0, 0, 0), ext(NULL) {}
+
+  Proj::Proj(const Proj &prj)
+      : ndi(prj.ndi), stereo(prj.stereo), isValid(prj.isValid), 
+        useCovar(prj.useCovar), pointPlane(prj.pointPlane), 
+        kp(prj.kp), err(prj.err), ext(NULL)
+  {
+    if (prj.ext)
+      ext = new ProjExt(*prj.ext);
+  }
+
+  Proj &Proj::operator=(const Proj &prj)
+  {
+    if (this == &prj) return *this;
+    ndi = prj.ndi;
+    stereo = prj.stereo;
+    isValid = prj.isValid;
+    useCovar = prj.useCovar;
+    pointPlane = prj.pointPlane;
+    kp = prj.kp;
+    err = prj.err;
+    if (prj.ext)
+      extra() = *prj.ext;
+    else
+      {
+        delete ext;
+        ext = NULL;
+      }
+    return *this;
+  }
+
+  Proj::~Proj()
+  {
+    delete ext;
+  }
+
+  ProjExt &Proj::extra()
+  {
+    if (!ext)
+      ext = new ProjExt;
+    return *ext;
+  }
+
+  void Proj::setPlane(const Eigen::Vector3d &point, const Eigen::Vector3d &normal)
+  {
+    pointPlane = true;
+    extra().plane_point = point;
+    ext->plane_normal = normal;
+  }
 
   void Proj::setJacobians(const Node &nd, const Point &pt, JacobProds *jpp)
   {
@@ -49,7 +97,7 @@ namespace sba
   void Proj::setCovariance(const Eigen::Matrix3d &covar)
   {
     useCovar = true;
-    covarmat = covar;
+    extra().covarmat = covar;
   }
   
   void Proj::clearCovariance()
@@ -68,8 +116,6 @@ namespace sba
     /// jacobian with respect to point
     Eigen::Matrix<double,2,3> jacp;
 
-    // Jacobians wrt camera parameters
-    // set d(quat-x) values [ pz*dpx/dx - px*dpz/dx ] / pz^2
     double px = pc(0);
     double py = pc(1);
     double pz = pc(2);
@@ -83,11 +129,31 @@ namespace sba
     double ipz2fyq = qScale*ipz2fy;
     Eigen::Matrix<double,3,1> pwt;
 
+    // Jacobians wrt point parameters
+    // set d(t) values [ pz*dpx/dx - px*dpz/dx ] / pz^2
+    Eigen::Matrix<double,3,1> dp = nd.w2n.col(0); // dpc / dx
+    jacp(0,0) = (pz*dp(0) - px*dp(2))*ipz2fx;
+    jacp(1,0) = (pz*dp(1) - py*dp(2))*ipz2fy;
+    dp = nd.w2n.col(1); // dpc / dy
+    jacp(0,1) = (pz*dp(0) - px*dp(2))*ipz2fx;
+    jacp(1,1) = (pz*dp(1) - py*dp(2))*ipz2fy;
+    dp = nd.w2n.col(2); // dpc / dz
+    jacp(0,2) = (pz*dp(0) - px*dp(2))*ipz2fx;
+    jacp(1,2) = (pz*dp(1) - py*dp(2))*ipz2fy;
+
+    jpp->Hpp = jacp.transpose() * jacp;
+    jpp->Bp = jacp.transpose() * err.head<2>();
+
+    // fixed nodes only contribute the point blocks
+    if (nd.isFixed) return;
+
+    // Jacobians wrt camera parameters
+    // set d(quat-x) values [ pz*dpx/dx - px*dpz/dx ] / pz^2
     // check for local vars
     pwt = (pt-nd.trans).head<3>(); // transform translations, use differential rotation
 
     // dx
-    Eigen::Matrix<double,3,1> dp = nd.dRdx * pwt; // dR'/dq * [pw - t]
+    dp = nd.dRdx * pwt; // dR'/dq * [pw - t]
     jacc(0,3) = (pz*dp(0) - px*dp(2))*ipz2fxq;
     jacc(1,3) = (pz*dp(1) - py*dp(2))*ipz2fyq;
     // dy
@@ -110,18 +176,6 @@ namespace sba
     jacc(0,2) = (pz*dp(0) - px*dp(2))*ipz2fx;
     jacc(1,2) = (pz*dp(1) - py*dp(2))*ipz2fy;
 
-    // Jacobians wrt point parameters
-    // set d(t) values [ pz*dpx/dx - px*dpz/dx ] / pz^2
-    dp = nd.w2n.col(0); // dpc / dx
-    jacp(0,0) = (pz*dp(0) - px*dp(2))*ipz2fx;
-    jacp(1,0) = (pz*dp(1) - py*dp(2))*ipz2fy;
-    dp = nd.w2n.col(1); // dpc / dy
-    jacp(0,1) = (pz*dp(0) - px*dp(2))*ipz2fx;
-    jacp(1,1) = (pz*dp(1) - py*dp(2))*ipz2fy;
-    dp = nd.w2n.col(2); // dpc / dz
-    jacp(0,2) = (pz*dp(0) - px*dp(2))*ipz2fx;
-    jacp(1,2) = (pz*dp(1) - py*dp(2))*ipz2fy;
-
 #ifdef DEBUG
     for (int i=0; i<2; i++)
       for (int j=0; j<6; j++)
@@ -129,13 +183,9 @@ namespace sba
 #endif
     
     // Set Hessians + extras.
-    jpp->Hpp = jacp.transpose() * jacp;
     jpp->Hcc = jacc.transpose() * jacc;
     jpp->Hpc = jacp.transpose() * jacc;
     jpp->JcTE = jacc.transpose() * err.head<2>();
-    jpp->Bp = jacp.transpose() * err.head<2>();
-
-    jp = jpp;
   }
 
   // calculate error of a projection
@@ -156,7 +206,7 @@ namespace sba
     else
       err.head<2>() = p1.head<2>()/p1(2); 
 
-    err -= kp;
+    err -= kp.cast<double>();
 
     // pseudo-Huber weighting
     // C(e) = 2*s^2*[sqrt(1+(e/s)^2)-1]
@@ -198,8 +248,6 @@ namespace sba
     /// jacobian with respect to frame; uses dR'/dq from Node calculation
     Eigen::Matrix<double,3,6> jacc;
 
-    // Jacobians wrt camera parameters
-    // set d(quat-x) values [ pz*dpx/dx - px*dpz/dx ] / pz^2
     double px = pc(0);
     double py = pc(1);
     double pz = pc(2);
@@ -214,11 +262,37 @@ namespace sba
     double ipz2fyq = qScale*ipz2fy;
     Eigen::Matrix<double,3,1> pwt;
 
+    // Jacobians wrt point parameters
+    // set d(t) values [ pz*dpx/dx - px*dpz/dx ] / pz^2
+    Eigen::Matrix<double,3,1> dp = nd.w2n.col(0); // dpc / dx
+    jacp(0,0) = (pz*dp(0) - px*dp(2))*ipz2fxq;
+    jacp(1,0) = (pz*dp(1) - py*dp(2))*ipz2fy;
+    jacp(2,0) = (pz*dp(0) - (px-b)*dp(2))*ipz2fxq; // right image px
+    dp = nd.w2n.col(1); // dpc / dy
+    jacp(0,1) = (pz*dp(0) - px*dp(2))*ipz2fxq;
+    jacp(1,1) = (pz*dp(1) - py*dp(2))*ipz2fy;
+    jacp(2,1) = (pz*dp(0) - (px-b)*dp(2))*ipz2fxq; // right image px
+    dp = nd.w2n.col(2); // dpc / dz
+    jacp(0,2) = (pz*dp(0) - px*dp(2))*ipz2fxq;
+    jacp(1,2) = (pz*dp(1) - py*dp(2))*ipz2fy;
+    jacp(2,2) = (pz*dp(0) - (px-b)*dp(2))*ipz2fxq; // right image px
+
+    if (useCovar)
+      jacp = ext->covarmat * jacp;
+
+    jpp->Hpp = jacp.transpose() * jacp;
+    jpp->Bp = jacp.transpose() * err;
+
+    // fixed nodes only contribute the point blocks
+    if (nd.isFixed) return;
+
+    // Jacobians wrt camera parameters
+    // set d(quat-x) values [ pz*dpx/dx - px*dpz/dx ] / pz^2
     // check for local vars
     pwt = (pt-nd.trans).head(3); // transform translations, use differential rotation
 
     // dx
-    Eigen::Matrix<double,3,1> dp = nd.dRdx * pwt; // dR'/dq * [pw - t]
+    dp = nd.dRdx * pwt; // dR'/dq * [pw - t]
     jacc(0,3) = (pz*dp(0) - px*dp(2))*ipz2fxq;
     jacc(1,3) = (pz*dp(1) - py*dp(2))*ipz2fyq;
     jacc(2,3) = (pz*dp(0) - (px-b)*dp(2))*ipz2fxq; // right image px
@@ -247,40 +321,18 @@ namespace sba
     jacc(1,2) = (pz*dp(1) - py*dp(2))*ipz2fy;
     jacc(2,2) = (pz*dp(0) - (px-b)*dp(2))*ipz2fxq; // right image px
 
-    // Jacobians wrt point parameters
-    // set d(t) values [ pz*dpx/dx - px*dpz/dx ] / pz^2
-    dp = nd.w2n.col(0); // dpc / dx
-    jacp(0,0) = (pz*dp(0) - px*dp(2))*ipz2fxq;
-    jacp(1,0) = (pz*dp(1) - py*dp(2))*ipz2fy;
-    jacp(2,0) = (pz*dp(0) - (px-b)*dp(2))*ipz2fxq; // right image px
-    dp = nd.w2n.col(1); // dpc / dy
-    jacp(0,1) = (pz*dp(0) - px*dp(2))*ipz2fxq;
-    jacp(1,1) = (pz*dp(1) - py*dp(2))*ipz2fy;
-    jacp(2,1) = (pz*dp(0) - (px-b)*dp(2))*ipz2fxq; // right image px
-    dp = nd.w2n.col(2); // dpc / dz
-    jacp(0,2) = (pz*dp(0) - px*dp(2))*ipz2fxq;
-    jacp(1,2) = (pz*dp(1) - py*dp(2))*ipz2fy;
-    jacp(2,2) = (pz*dp(0) - (px-b)*dp(2))*ipz2fxq; // right image px
-
 #ifdef DEBUG
     for (int i=0; i<2; i++)
       for (int j=0; j<6; j++)
         if (isnan(jacc(i,j)) ) { printf("[SetJac] NaN in jacc(%d,%d)\n", i, j);  *(int *)0x0 = 0; }
 #endif
     if (useCovar)
-    {
-      jacc = covarmat * jacc;
-      jacp = covarmat * jacp;
-    }
+      jacc = ext->covarmat * jacc;
 
     // Set Hessians + extras.
-    jpp->Hpp = jacp.transpose() * jacp;
     jpp->Hcc = jacc.transpose() * jacc;
     jpp->Hpc = jacp.transpose() * jacc;
     jpp->JcTE = jacc.transpose() * err;
-    jpp->Bp = jacp.transpose() * err;
-    
-    jp = jpp;
   }
 
   // calculate error of a projection
@@ -294,6 +346,9 @@ namespace sba
     // TODO: Clean this up a bit. 
     if (pointPlane)
     {
+      const Eigen::Vector3d &plane_point = ext->plane_point;
+      const Eigen::Vector3d &plane_normal = ext->plane_normal;
+
       // Project point onto plane.
       Eigen::Vector3d w = pt.head<3>()-plane_point;
 
@@ -323,7 +378,7 @@ namespace sba
       
       return 0.0;
     }
-    err -= kp;
+    err -= kp.cast<double>();
     
     if (abs(err(0)) > 1e6 || abs(err(1)) > 1e6 || abs(err(2)) > 1e6)
     {
@@ -333,7 +388,7 @@ namespace sba
     }
     
     if (useCovar)
-      err = covarmat*err;
+      err = ext->covarmat*err;
      
     // Huber kernel weighting
     if (huber > 0.0)
@@ -354,7 +409,7 @@ namespace sba
   
   // Constructors for track.
   Track::Track() : point() { }
-  Track::Track(Point p) : point(p) { }
+  Track::Track(Point p) : point(p.cast<StoreScalar>()) { }
       
 } // sba
 
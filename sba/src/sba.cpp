@@ -37,6 +37,7 @@
 //
 
 #include "sba/sba.h"
+#include <queue>
 
 using namespace Eigen;
 using namespace std;
@@ -96,6 +97,7 @@ namespace sba
     // Should this be local or global?
     nd.normRot();//Local();
     nodes.push_back(nd);
+    covis.resize(nodes.size());
     return nodes.size()-1;
   }
 
@@ -119,10 +121,11 @@ namespace sba
     
     if (tracks[pi].projections.count(ci) > 0)
     {
-      if (tracks[pi].projections[ci].kp == q)
+      if (tracks[pi].projections[ci].kp == q.cast<StoreScalar>())
         return true;
       return false;
     }
+    covis.addObs(tracks[pi].projections, ci);
     tracks[pi].projections[ci] = Proj(ci, q, stereo);
 
 #if 0
@@ -146,10 +149,11 @@ namespace sba
   {
     if (tracks[pi].projections.count(ci) > 0)
     {
-      if (tracks[pi].projections[ci].kp.head(2) == q)
+      if (tracks[pi].projections[ci].kp.head(2) == q.cast<StoreScalar>())
         return true;
       return false;
     }
+    covis.addObs(tracks[pi].projections, ci);
     tracks[pi].projections[ci] = Proj(ci, q);
     return true;
   }
@@ -161,10 +165,11 @@ namespace sba
   {
     if (tracks[pi].projections.count(ci) > 0)
     {
-      if (tracks[pi].projections[ci].kp == q)
+      if (tracks[pi].projections[ci].kp == q.cast<StoreScalar>())
         return true;
       return false;
     }
+    covis.addObs(tracks[pi].projections, ci);
     tracks[pi].projections[ci] = Proj(ci, q, true);
 
 #if 0
@@ -180,6 +185,108 @@ namespace sba
     return true;
   }
   
+  // hash of a (camera, point) pair, for the open-addressing table below
+  static inline unsigned int projHash(int ci, int pi)
+  {
+    unsigned long long k = ((unsigned long long)(unsigned int)ci << 32) | (unsigned int)pi;
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    return (unsigned int)k;
+  }
+
+  // order entries by point, then camera
+  struct ProjEntryLess
+  {
+    const std::vector<ProjEntry> *prjs;
+    bool operator()(int a, int b) const
+    {
+      const ProjEntry &pa = (*prjs)[a];
+      const ProjEntry &pb = (*prjs)[b];
+      if (pa.pi != pb.pi) return pa.pi < pb.pi;
+      return pa.ci < pb.ci;
+    }
+  };
+
+  // Add projections in bulk.
+  int SysSBA::addProjs(const std::vector<ProjEntry> &prjs)
+  {
+    int n = prjs.size();
+    int ncams = nodes.size();
+    int npts = tracks.size();
+
+    // open-addressing table of entry indices, at most half full
+    unsigned int cap = 16;
+    while (cap < 2*(unsigned int)n) cap <<= 1;
+    vector<int> table(cap,-1);
+    unsigned int mask = cap-1;
+
+    vector<int> keep;
+    keep.reserve(n);
+    for (int i=0; i<n; i++)
+      {
+        const ProjEntry &e = prjs[i];
+        if (e.ci < 0 || e.ci >= ncams || e.pi < 0 || e.pi >= npts)
+          continue;
+
+        // against the batch
+        unsigned int h = projHash(e.ci,e.pi) & mask;
+        bool found = false;
+        while (table[h] >= 0)
+          {
+            const ProjEntry &e2 = prjs[table[h]];
+            if (e2.ci == e.ci && e2.pi == e.pi)
+              {
+                found = true;
+                break;
+              }
+            h = (h+1) & mask;
+          }
+        if (found) continue;    // repeat or conflict, first one wins
+        table[h] = i;
+
+        // against the system
+        ProjMap &tprjs = tracks[e.pi].projections;
+        if (tprjs.size() > 0 && tprjs.find(e.ci) != tprjs.end())
+          continue;
+
+        keep.push_back(i);
+      }
+
+    // insert in (point, camera) order, so each map insert is at a hint
+    ProjEntryLess less;
+    less.prjs = &prjs;
+    std::sort(keep.begin(),keep.end(),less);
+
+    covis.resize(ncams);
+    int k = 0;
+    while (k < (int)keep.size())
+      {
+        int pi = prjs[keep[k]].pi;
+        ProjMap &tprjs = tracks[pi].projections;
+        for (; k < (int)keep.size() && prjs[keep[k]].pi == pi; k++)
+          {
+            const ProjEntry &e = prjs[keep[k]];
+            Vector3d kp = e.kp;
+            if (!e.stereo) kp[2] = 0.0;
+            ProjMap::iterator hint = tprjs.end(); // usual case, appending
+            if (tprjs.size() > 0 && tprjs.rbegin()->first > e.ci)
+              hint = tprjs.lower_bound(e.ci);
+            covis.addObs(tprjs, e.ci);
+            ProjMap::iterator it = tprjs.insert(hint, ProjMap::value_type(e.ci, Proj(e.ci, kp, e.stereo)));
+            if (e.stereo && e.weight < 1.0)
+              {
+                // the covariance scales the error, so it gets the square root
+                Matrix3d covar = Matrix3d::Identity();
+                covar(2,2) = sqrt(std::max(e.weight, 0.0));
+                it->second.setCovariance(covar);
+              }
+          }
+      }
+
+    return keep.size();
+  }
+
   // Sets the covariance matrix of a projection.
   void SysSBA::setProjCovariance(int ci, int pi, Eigen::Matrix3d &covar)
   {
@@ -190,30 +297,27 @@ namespace sba
   // Add a point-plane match, forward and backward.
   void SysSBA::addPointPlaneMatch(int ci0, int pi0, Eigen::Vector3d normal0, int ci1, int pi1, Eigen::Vector3d normal1)
   {
-    Point pt0 = tracks[pi0].point;
-    Point pt1 = tracks[pi1].point;
+    Point pt0 = tracks[pi0].point.cast<double>();
+    Point pt1 = tracks[pi1].point.cast<double>();
     
     // works best with single constraint
 #if 1
     // Forward: point 0 into camera 1.
     Vector3d proj_forward;
-    proj_forward = tracks[pi1].projections[ci1].kp;
+    proj_forward = tracks[pi1].projections[ci1].kp.cast<double>();
     //nodes[ci1].projectStereo(pt0, proj_forward);
     addStereoProj(ci1, pi0, proj_forward);
     
     Proj &forward_proj = tracks[pi0].projections[ci1];
-    forward_proj.pointPlane = true;
-    forward_proj.plane_point = pt1.head<3>();
-    forward_proj.plane_local_normal = normal1;
-    forward_proj.plane_point_index = pi1;
-    forward_proj.plane_node_index = ci0;
+    forward_proj.setPlane(pt1.head<3>(), nodes[ci1].qrot.toRotationMatrix() * normal1);
+    ppcons.push_back(PointPlaneCon(pi0, ci1, pi1, ci0, normal1));
 #endif
     
 #if 0
  // Peter: to avoid removeFrame() removing pi1 because it only has a single projection (according to projections of pi1)
    // Note that if we do point to plane projections both directions this should not be done
    Vector3d proj_fake;
-   proj_fake = tracks[pi0].projections[ci0].kp;
+   proj_fake = tracks[pi0].projections[ci0].kp.cast<double>();
    addStereoProj(ci0, pi1, proj_fake);
    Proj &fake_proj = tracks[pi1].projections[ci0];
    fake_proj.isValid = false;
@@ -223,52 +327,82 @@ namespace sba
     // Backward: point 1 into camera 0. 
     Vector3d proj_backward;
     //nodes[ci0].projectStereo(pt1, proj_backward);
-    proj_backward = tracks[pi0].projections[ci0].kp;
+    proj_backward = tracks[pi0].projections[ci0].kp.cast<double>();
     addStereoProj(ci0, pi1, proj_backward);
     
     Proj &backward_proj = tracks[pi1].projections[ci0];
-    backward_proj.pointPlane = true;
-    backward_proj.plane_point = pt0.head<3>();
-    backward_proj.plane_local_normal = normal0;
-    backward_proj.plane_point_index = pi0;
-    backward_proj.plane_node_index = ci1;
+    backward_proj.setPlane(pt0.head<3>(), nodes[ci0].qrot.toRotationMatrix() * normal0);
+    ppcons.push_back(PointPlaneCon(pi1, ci0, pi0, ci1, normal0));
 #endif
   }
 
-  // Update the normals for point-plane matches.
-  void SysSBA::updateNormals()
+  // Update the planes for point-plane matches.
+  // Only walks the constraint table; anchor points move every iteration,
+  // but normals only change for nodes that are free.
+  void SysSBA::updateNormals(bool all)
   {
-    for(size_t i=0; i<tracks.size(); i++)
+    for (size_t i=0; i<ppcons.size(); i++)
       {
-        ProjMap &prjs = tracks[i].projections;
-        if (prjs.size() == 0) continue;
+        PointPlaneCon &con = ppcons[i];
+        if (!con.isValid) continue;
 
-        for(ProjMap::iterator itr = prjs.begin(); itr != prjs.end(); itr++)
+        ProjMap &prjs = tracks[con.pti].projections;
+        ProjMap::iterator itr = prjs.find(con.ndi);
+        if (itr == prjs.end()) continue;
+        Proj &prj = itr->second;
+        if (!prj.isValid) continue;
+
+        ProjExt &ext = prj.extra();
+        ext.plane_point = tracks[con.plane_pti].point.head<3>().cast<double>();
+
+        // Rotate the normal into the world frame
+        if (all || !nodes[con.ndi].isFixed)
+          ext.plane_normal = nodes[con.ndi].qrot.toRotationMatrix() * con.local_normal;
+      }
+  }
+
+  // Re-index point-plane constraints after removing tracks and/or nodes.
+  void SysSBA::reindexPointPlaneCons(const std::vector<int> &pidx, int ndshift,
+                                     const std::vector<int> *nidx)
+  {
+    int n = 0;
+    for (size_t i=0; i<ppcons.size(); i++)
+      {
+        PointPlaneCon con = ppcons[i];
+        if (!con.isValid) continue;
+
+        if (pidx.size() > 0)
           {
-            Proj &prj = itr->second;      
-            if (!prj.pointPlane || !prj.isValid) continue;
-            
-            prj.plane_point = tracks[prj.plane_point_index].point.head<3>();
-            
-            // Rotation between nodes into the projection's image plane
-            Quaterniond qrot = nodes[prj.ndi].qrot;
-            // Vector4d trans;
-            
-            // transformN2N(trans, qrot, nodes[prj.plane_node_index], nodes[itr->first]);
-            
-            prj.plane_normal = qrot.toRotationMatrix() * prj.plane_local_normal;
-            //printf("Global normal: %f %f %f\n", prj.plane_normal.x(), prj.plane_normal.y(), prj.plane_normal.z()); 
-            
-            // Update projections
-            //nodes[prj.ndi].projectStereo(tracks[prj.plane_point_index].point, prj.kp);
-            Point &pt0 = tracks[i].point;
-            Vector3d &plane_point = prj.plane_point;
-            Vector3d &plane_normal = prj.plane_normal;
-            Vector3d w = pt0.head<3>()-plane_point;
-            Vector3d projpt = pt0.head<3>() - (w.dot(plane_normal))*plane_normal;
-            
+            con.pti = pidx[con.pti];
+            con.plane_pti = pidx[con.plane_pti];
           }
+        if (nidx)
+          {
+            con.ndi = (*nidx)[con.ndi];
+            con.plane_ndi = (*nidx)[con.plane_ndi];
+          }
+        else
+          {
+            con.ndi -= ndshift;
+            con.plane_ndi -= ndshift;
+          }
+
+        if (con.pti < 0 || con.ndi < 0)
+          continue;             // projection went with its track or node
+
+        if (con.plane_pti < 0 || con.plane_ndi < 0)
+          {
+            // anchor is gone, so is the plane
+            ProjMap &prjs = tracks[con.pti].projections;
+            ProjMap::iterator itr = prjs.find(con.ndi);
+            if (itr != prjs.end())
+              itr->second.isValid = false;
+            continue;
+          }
+
+        ppcons[n++] = con;
       }
+    ppcons.resize(n);
   }
 
   // help function
@@ -297,7 +431,7 @@ namespace sba
           {
             Proj &prj = itr->second;      
             if (!prj.isValid) continue;
-            double err = prj.calcErr(nodes[prj.ndi],tracks[i].point,huber);
+            double err = prj.calcErr(nodes[prj.ndi],tracks[i].point.cast<double>(),huber);
             cost += err;
           }
       }
@@ -320,7 +454,7 @@ namespace sba
           {
             Proj &prj = itr->second;      
             if (!prj.isValid) continue;
-            double err = prj.calcErr(nodes[prj.ndi],tracks[i].point);
+            double err = prj.calcErr(nodes[prj.ndi],tracks[i].point.cast<double>());
             if (err < dist)
               cost += err;
           }
@@ -347,7 +481,7 @@ namespace sba
           {
             Proj &prj = itr->second;      
             if (!prj.isValid) continue;
-            double err = prj.calcErr(nodes[prj.ndi],tracks[i].point,huber);
+            double err = prj.calcErr(nodes[prj.ndi],tracks[i].point.cast<double>(),huber);
             if (err < dist)
             {
               cost += err;
@@ -375,7 +509,7 @@ namespace sba
           {
             Proj &prj = itr->second;      
             if (!prj.isValid) continue;
-            prj.calcErr(nodes[prj.ndi],tracks[i].point,huber);
+            prj.calcErr(nodes[prj.ndi],tracks[i].point.cast<double>(),huber);
             cost += prj.getErrNorm();
             nprjs++;
           }
@@ -398,7 +532,7 @@ namespace sba
           {
             Proj &prj = itr->second;      
             if (!prj.isValid) continue;
-            prj.calcErr(nodes[prj.ndi],tracks[i].point);
+            prj.calcErr(nodes[prj.ndi],tracks[i].point.cast<double>());
             if (prj.err[0] == 0.0 && prj.err[1] == 0.0 && prj.err[2] == 0.0)
               count++;
           }
@@ -488,12 +622,14 @@ namespace sba
         }
         else
         {
+          covis.removeObs(prjs, prj.ndi);
           prjs.erase(itr++); // Erase bad projections
         }
       }
       // Clear out tracks with too few good projections.
       if (ngood < 2)
       {
+        covis.removeTrack(prjs);
         prjs.clear();
         ret++;
       }
@@ -505,8 +641,6 @@ namespace sba
   void SysSBA::printStats()
   {
     int ncams = nodes.size();
-    vector<map<int,int>, Eigen::aligned_allocator<map<int,int> > > conns; // connections between cameras - key is camera, val is count
-    conns.resize(ncams);
     VectorXi dcnt(ncams);
     dcnt.setZero(ncams);
 
@@ -540,11 +674,9 @@ namespace sba
             // track
             ProjMap &prjs = tracks[i].projections;
             int n = 0;
-            int j = 0;
             
             for(ProjMap::iterator itr = prjs.begin(); itr != prjs.end(); itr++)
               {
-                j++;
                 Proj &prj = itr->second;
                 // projection
                 int cami = prj.ndi;
@@ -558,30 +690,6 @@ namespace sba
                     continue;
                   }
                 n++;
-
-                // add to camera connection matrix
-                if (j < (int)prjs.size()-1)
-                  {
-                    map<int,int> &pm = conns[cami];
-                    map<int,int>::iterator it;
-                    for(ProjMap::iterator itr2 = itr; itr2 != prjs.end(); itr2++)
-                      {
-                        Proj &prj2 = itr2->second;
-                        int cami2 = prj2.ndi;
-                        map<int,int> &pm2 = conns[cami2];
-                        it = pm.find(cami2);
-                        if (it == pm.end()) // not here yet
-                          {
-                            pm[cami2] = 1; // create entry
-                            pm2[cami] = 1;
-                          }
-                        else
-                          {
-                            it->second++; // increment
-                            pm2.find(cami)->second++;
-                          }
-                      }
-                  }
               }
 
             // stats on tracks
@@ -613,7 +721,7 @@ namespace sba
 
 
 #if 1
-    // connection stats
+    // connection stats, from the covisibility graph
     int nconns = 0;
     int ntot = 0;
     int nmin = 1000000;
@@ -624,16 +732,16 @@ namespace sba
     int nc50 = 0;
     n0 = 0;
     n1 = 1;
-    for (int i=0; i<ncams; i++)
+    for (int i=0; i<ncams && i<covis.numNodes(); i++)
       {
-        int nc = conns[i].size();
+        const vector<CovisEdge> &es = covis.neighbors(i);
+        int nc = es.size();
         nconns += nc;
         if (nc == 0) n0++;
         if (nc == 1) n1++;
-        map<int,int>::iterator it;      
-        for (it = conns[i].begin(); it != conns[i].end(); it++)
+        for (size_t j=0; j<es.size(); j++)
           {
-            int np = (*it).second;
+            int np = es[j].weight;
             ntot += np;
             if (np < nmin) nmin = np;
             if (np > nmax) nmax = np;
@@ -656,84 +764,34 @@ namespace sba
 
   }
 
-  vector<map<int,int> > SysSBA::generateConns_()
+  // recompute the covisibility graph from scratch
+  void SysSBA::rebuildCovis()
   {
-    int ncams = nodes.size();
-    vector<map<int,int> > conns; // connections between cameras - key is camera, val is count
-    conns.resize(ncams);
-
-    // reset bit maps
-    connMat.resize(ncams);
-    for (int i=0; i<ncams; i++)
-      {
-        vector<bool> &bm = connMat[i];
-        bm.assign(ncams,false);
-      }
-
-    // set up sparse connectivity matrix
+    covis.clear();
+    covis.resize(nodes.size());
     for (int i=0; i<(int)tracks.size(); i++)
-      {
-        int j = 0;
-        ProjMap &prjs = tracks[i].projections;
-        for(ProjMap::iterator itr = prjs.begin(); itr != prjs.end(); itr++)
-          {
-            Proj &prj = itr->second;
-            j++; 
-            int cami = prj.ndi;
-
-            // check validity
-            if (!prj.isValid) 
-              continue;
-
-            // add to camera connection matrix
-            if (j < (int)prjs.size()-1)
-              {
-                map<int,int> &pm = conns[cami];
-                map<int,int>::iterator it;
-                for(ProjMap::iterator itr2 = itr; itr2 != prjs.end(); itr2++)
-                  {
-                    Proj &prj2 = itr2->second;
-                    int cami2 = prj2.ndi;
-                    map<int,int> &pm2 = conns[cami2];
-                    it = pm.find(cami2);
-                    if (it == pm.end()) // not here yet
-                      {
-                        pm[cami2] = 1; // create entry
-                        pm2[cami] = 1;
-                      }
-                    else
-                      {
-                        it->second++; // increment
-                        pm2.find(cami)->second++;
-                      }
-                  }
-              }
-          }
-      }
-      
-    return conns;
+      covis.addTrack(tracks[i].projections);
   }
 
 
-  // set the connectivity matrix based on a minimum number of points
+  // set the connectivity based on a minimum number of points
   // greedy algorithm, heads with lowest and preserves connectivity
   void SysSBA::setConnMat(int minpts)
   {
-    // data structures
-    int ncams = nodes.size();
-    // connections between cameras - key is camera, val is count
-    vector<map<int,int> > conns = generateConns_();
+    int ncams = covis.numNodes();
+    covis.clearSkips();
 
-    // get ordered list of connections
+    // get ordered list of connections, and node degrees
     multimap<int,pair<int,int> > weakcs;
+    vector<int> ncs(ncams);
     for (int i=0; i<ncams; i++)
       {
-        map<int,int> cs = conns[i];
-        map<int,int>::iterator it;
-        for (it = cs.begin(); it != cs.end(); it++)
+        const vector<CovisEdge> &es = covis.neighbors(i);
+        ncs[i] = es.size();
+        for (size_t j=0; j<es.size(); j++)
           {
-            if (it->second < minpts && it->first > i) // upper triangle
-              weakcs.insert(pair<int,pair<int,int> >(it->second, pair<int,int>(i,it->first)));
+            if (es[j].weight < minpts && es[j].node > i) // upper triangle
+              weakcs.insert(pair<int,pair<int,int> >(es[j].weight, pair<int,int>(i,es[j].node)));
           }
       }
     
@@ -747,14 +805,12 @@ namespace sba
       {
         int c0 = it->second.first;
         int c1 = it->second.second;
-        if (conns[c0].size() > 1 && conns[c1].size() > 1)
+        if (ncs[c0] > 1 && ncs[c1] > 1)
           {
             n++;
-            conns[c0].erase(conns[c0].find(c1)); // erase entry
-            conns[c1].erase(conns[c1].find(c0)); // erase entry
-            // set correct bits
-            connMat[c0][c1] = true;
-            connMat[c1][c0] = true;
+            ncs[c0]--;
+            ncs[c1]--;
+            covis.setSkip(c0,c1,true);
           }
       }
 
@@ -763,25 +819,22 @@ namespace sba
   }
 
 
-  // set the connectivity matrix based on a spanning tree
+  // set the connectivity based on a spanning tree
   // greedy algorithm, strings together best matches first
   void SysSBA::setConnMatReduced(int maxconns)
   {
-    // data structures
-    int ncams = nodes.size();
-    // connections between cameras - key is camera, val is count
-    vector<map<int,int> > conns = generateConns_();
+    int ncams = covis.numNodes();
+    covis.setAllSkips(true);    // start with no connections
     
     // get ordered list of connections
     multimap<int,pair<int,int> > weakcs;
     for (int i=0; i<ncams; i++)
       {
-        map<int,int> cs = conns[i];
-        map<int,int>::iterator it;
-        for (it = cs.begin(); it != cs.end(); it++)
+        const vector<CovisEdge> &es = covis.neighbors(i);
+        for (size_t j=0; j<es.size(); j++)
           {
-            if (it->first > i) // upper triangle, order by biggest matches first
-              weakcs.insert(pair<int,pair<int,int> >(-it->second, pair<int,int>(i,it->first)));
+            if (es[j].node > i) // upper triangle, order by biggest matches first
+              weakcs.insert(pair<int,pair<int,int> >(-es[j].weight, pair<int,int>(i,es[j].node)));
           }
        }
     
@@ -797,11 +850,9 @@ namespace sba
         if (found[c0] < maxconns || found[c1] < maxconns)
           {
             n++;
-            // set correct bits
             found[c0]++;
             found[c1]++;
-            connMat[c0][c1] = false; // assign this connection
-            connMat[c1][c0] = false;
+            covis.setSkip(c0,c1,false); // assign this connection
           }
       }
 
@@ -812,9 +863,10 @@ namespace sba
   // helper fn
   // split into random tracks
   void
-  SysSBA::tsplit(int tri, int len)
+  SysSBA::tsplit(int tri, int len, unsigned int *seed)
   {
     ProjMap prjs = tracks[tri].projections;
+    covis.removeTrack(prjs);
     tracks[tri].projections.clear();
 
     // first reset current track
@@ -827,11 +879,12 @@ namespace sba
       {
         // Pick a random projection to add back.
         ProjMap::iterator randomitr = prjs.begin();
-        std::advance( randomitr, rand() % prjs.size());
+        std::advance( randomitr, rand_r(seed) % prjs.size());
         Proj &prj = randomitr->second;
 
         // Add it back to the original track.
-        addProj(prj.ndi, tri, prj.kp, prj.stereo);
+        Vector3d kp = prj.kp.cast<double>();
+        addProj(prj.ndi, tri, kp, prj.stereo);
         prjs.erase(randomitr);
         i++;
       }
@@ -842,20 +895,21 @@ namespace sba
       {
         i = 0;
         if ((int)prjs.size() == len+1) len = len+1; // get rid of single tracks
+        tracks.push_back(Track(tracks[tri].point.cast<double>()));
         while (prjs.size() > 0 && i < len)
           {
             // Pick a random projection to add to a new track.
             ProjMap::iterator randomitr = prjs.begin();
-            std::advance( randomitr, rand() % prjs.size());
+            std::advance( randomitr, rand_r(seed) % prjs.size());
             Proj &prj = randomitr->second;
             
             // Add it to the new track and erase it from the list of projections
             // remaining.
-            addProj(prj.ndi, pti, prj.kp, prj.stereo);
+            Vector3d kp = prj.kp.cast<double>();
+            addProj(prj.ndi, pti, kp, prj.stereo);
             prjs.erase(randomitr);
             i++;
           }
-        tracks[pti].point = tracks[tri].point;
         pti++;
       }
   }
@@ -873,7 +927,7 @@ namespace sba
 #if 1  // this algorithm splits tracks
     // algorithm: for a long track, break it into enough pieces to get it under 
     // the required length.  Randomzed point picking.
-    srand(time(NULL));
+    unsigned int seed = time(NULL); // local state, not the global rand()
     int nn = 0;
     for (int i=0; i<npts; i++)
       {
@@ -883,7 +937,7 @@ namespace sba
             nn++;
             int ts = tracks[i].projections.size()+1;
             int tn = ts/ilen;
-            tsplit(i,ts/tn);
+            tsplit(i,ts/tn,&seed);
           }
       }
     
@@ -952,8 +1006,6 @@ namespace sba
     // data structures
     //int ncams = nodes.size();
     int npts = tracks.size();
-    // connections between cameras - key is camera, val is count
-    vector<map<int,int> > conns = generateConns_();
     
     // get ordered list of tracks
     multimap<int,int> ordtrs;
@@ -973,11 +1025,12 @@ namespace sba
             Proj &prj = itr->second;
           
             int c0 = prj.ndi;
-            for(ProjMap::iterator itr2 = itr; itr2 != prjs.end(); itr2++)
+            ProjMap::iterator itr2 = itr;
+            for(itr2++; itr2 != prjs.end(); itr2++)
               {
                 Proj &prj2 = itr2->second;
                 int c1 = prj2.ndi;
-                if (conns[c0].find(c1)->second <= minpts) // can't reduce this connection
+                if (covis.weight(c0,c1) <= minpts) // can't reduce this connection
                   {
                     isgood = false;
                     break;
@@ -988,18 +1041,7 @@ namespace sba
 
         if (isgood)             // found a deletable track, change connection values
           {
-            for(ProjMap::iterator itr = prjs.begin(); itr != prjs.end(); itr++)
-              {
-                Proj &prj = itr->second;
-                int c0 = prj.ndi;
-                for(ProjMap::iterator itr2 = itr; itr2 != prjs.end(); itr2++)
-                  {
-                    Proj &prj2 = itr2->second;
-                    int c1 = prj2.ndi;
-                    conns[c0].find(c1)->second--;
-                    conns[c1].find(c0)->second--;
-                  }
-              }
+            covis.removeTrack(prjs);
             remtrs.push_back(tri); // save for deletion
           }
       }
@@ -1016,6 +1058,7 @@ namespace sba
     std::sort(remtrs.begin(),remtrs.end()); // sort into ascending order
 
     std::vector<Track, Eigen::aligned_allocator<Track> > trs;
+    vector<int> pidx(npts);     // point index for re-indexing
 
     // delete elements into new vectors
     int n = 0;                  // index into rem()
@@ -1025,13 +1068,11 @@ namespace sba
         if ((int)remtrs.size()>n && i == remtrs[n]) // skip this element
           {
             n++;
+            pidx[i] = -1;
             continue;
           }
-        // vector<MonoProj, Eigen::aligned_allocator<MonoProj> > &prjs = tracks[i];
-        /*for (int j=0; j<(int)prjs.size(); j++)
-          prjs[j].pti = ii; */
         trs.push_back(tracks[i]);
-        ii++;
+        pidx[i] = ii++;
       }
 
     cout << "[RemExcessTracks] Erased " << n << " tracks" << endl;
@@ -1039,10 +1080,299 @@ namespace sba
     // transfer vectors
     tracks.resize(trs.size());
     tracks = trs;
+    reindexPointPlaneCons(pidx);
 
     return remtrs.size();
   }
   
+  // fraction of the tracks <trs> of a node that at least <minobs> other
+  //   nodes see
+  static double redundancy(const vector<int> &trs, const vector<int> &tcnt, int minobs)
+  {
+    if (trs.size() == 0) return 0.0;
+    int nred = 0;
+    for (size_t j=0; j<trs.size(); j++)
+      if (tcnt[trs[j]] - 1 >= minobs)
+        nred++;
+    return (double)nred / (double)trs.size();
+  }
+
+  // find nodes whose points are mostly seen by other nodes
+  // candidates come from the covisibility counts: each redundant point of
+  //   a node is shared with at least <minobs> others, so the node's edge
+  //   weights bound how many it can have.  The pick is greedy, most
+  //   redundant first; removing a node only lowers the scores of the
+  //   rest, so scores are refreshed lazily, when a node comes up
+  void SysSBA::findRedundantNodes(double ratio, int minobs, int nkeep, 
+                                  std::vector<int> &nds)
+  {
+    int ncams = min((int)nodes.size(), covis.numNodes());
+    int nlast = (int)nodes.size() - nkeep;  // first protected node
+    nds.clear();
+    if (nlast <= nFixed) return;
+    nlast = min(nlast, ncams);
+
+    vector<int> cand(ncams,-1); // candidate slot of each node
+    int ncand = 0;
+    for (int i=nFixed; i<nlast; i++)
+      {
+        int nobs = covis.numObs(i);
+        if (nodes[i].isFixed || nobs <= 0) continue;
+        if (minobs > 0)
+          {
+            const vector<CovisEdge> &es = covis.neighbors(i);
+            double wsum = 0.0;
+            for (size_t j=0; j<es.size(); j++)
+              wsum += es[j].weight;
+            if (wsum < ratio*minobs*nobs) continue;
+          }
+        cand[i] = ncand++;
+      }
+    if (ncand == 0) return;
+
+    // per-candidate track lists, and per-track projection counts
+    vector<vector<int> > ntrs(ncand);
+    vector<int> tcnt(tracks.size(),0);
+    for (int i=0; i<(int)tracks.size(); i++)
+      {
+        ProjMap &prjs = tracks[i].projections;
+        tcnt[i] = prjs.size();
+        for(ProjMap::iterator itr = prjs.begin(); itr != prjs.end(); itr++)
+          {
+            int ndi = itr->second.ndi;
+            if (ndi >= 0 && ndi < ncams && cand[ndi] >= 0)
+              ntrs[cand[ndi]].push_back(i);
+          }
+      }
+
+    // initial scores; ties go to the later node
+    priority_queue<pair<double,int> > que;
+    for (int i=nFixed; i<nlast; i++)
+      if (cand[i] >= 0)
+        {
+          double r = redundancy(ntrs[cand[i]], tcnt, minobs);
+          if (r >= ratio)
+            que.push(pair<double,int>(r,i));
+        }
+
+    while (!que.empty())
+      {
+        pair<double,int> top = que.top();
+        que.pop();
+        vector<int> &trs = ntrs[cand[top.second]];
+        double r = redundancy(trs, tcnt, minobs);
+        if (r < top.first)      // stale, requeue with the current score
+          {
+            if (r >= ratio)
+              que.push(pair<double,int>(r,top.second));
+            continue;
+          }
+
+        for (size_t j=0; j<trs.size(); j++)
+          tcnt[trs[j]]--;
+        nds.push_back(top.second);
+      }
+
+    std::sort(nds.begin(),nds.end());
+  }
+
+  // remove nodes and their projections, renumbering the rest
+  // tracks entirely before the first removed node are untouched; the
+  //   others lose their projections into removed nodes in place, and
+  //   only projections past the first removed node are re-keyed
+  int SysSBA::removeNodes(const std::vector<int> &nds, std::vector<int> &nidx,
+                          std::vector<int> &pidx)
+  {
+    int ncams = nodes.size();
+    nidx.resize(ncams);
+    for (int i=0; i<ncams; i++)
+      nidx[i] = 0;
+    int nfx = 0;
+    for (int i=0; i<(int)nds.size(); i++)
+      {
+        nidx[nds[i]] = -1;
+        if (nds[i] < nFixed) nfx++;
+      }
+    nFixed -= nfx;
+    int n = 0;
+    for (int i=0; i<ncams; i++)
+      if (nidx[i] >= 0)
+        {
+          if (n != i) nodes[n] = nodes[i];
+          nidx[i] = n++;
+        }
+    nodes.resize(n);
+    int nfirst = nds.size() > 0 ? nds[0] : ncams;
+
+    // tracks that lose all but one projection go away; their
+    //   connections are taken out in the old node indices.  Connections
+    //   to removed nodes are dropped with the nodes, by remapNodes()
+    vector<Proj, Eigen::aligned_allocator<Proj> > tail;
+    for (int i=0; i<(int)tracks.size(); i++)
+      {
+        ProjMap &prjs = tracks[i].projections;
+        if (prjs.size() == 0 || prjs.rbegin()->first < nfirst) continue;
+
+        ProjMap::iterator first = prjs.lower_bound(nfirst);
+        int nleft = 0;
+        for(ProjMap::iterator itr = prjs.begin(); itr != prjs.end(); itr++)
+          {
+            int ndi = itr->second.ndi;
+            if (ndi >= 0 && ndi < ncams && nidx[ndi] >= 0)
+              nleft++;
+          }
+        if (nleft < 2)
+          {
+            covis.removeTrack(prjs);
+            prjs.clear();
+            continue;
+          }
+
+        // node order is kept, so the renumbered tail goes back in order
+        tail.clear();
+        for(ProjMap::iterator itr = first; itr != prjs.end(); itr++)
+          {
+            Proj &prj = itr->second;
+            if (prj.ndi < 0 || prj.ndi >= ncams || nidx[prj.ndi] < 0) continue;
+            tail.push_back(prj);
+            tail.back().ndi = nidx[prj.ndi];
+          }
+        prjs.erase(first, prjs.end());
+        for (size_t j=0; j<tail.size(); j++)
+          prjs.insert(prjs.end(), ProjMap::value_type(tail[j].ndi, tail[j]));
+      }
+    covis.remapNodes(nidx);
+
+    int nrem = compactTracks(pidx);
+    reindexPointPlaneCons(pidx, 0, &nidx);
+    return nrem;
+  }
+
+
+  // remove short tracks that are no longer growing
+  int SysSBA::cullPoints(int minprojs, double maxerr, int nkeep, 
+                         std::vector<int> &pidx)
+  {
+    int nlast = (int)nodes.size() - nkeep;
+
+    // drop bad projections
+    if (maxerr > 0.0)
+      {
+        calcCost();
+        removeBad(maxerr);
+      }
+
+    for (int i=0; i<(int)tracks.size(); i++)
+      {
+        ProjMap &prjs = tracks[i].projections;
+        if (prjs.size() == 0) continue;
+
+        // track is still growing?
+        if (prjs.rbegin()->second.ndi >= nlast)
+          continue;
+
+        int ngood = 0;
+        for(ProjMap::iterator itr = prjs.begin(); itr != prjs.end(); )
+          {
+            Proj &prj = itr->second;
+            if (prj.isValid)
+              {
+                ngood++;
+                ++itr;
+              }
+            else
+              {
+                covis.removeObs(prjs, prj.ndi);
+                prjs.erase(itr++);
+              }
+          }
+        if (ngood < minprojs)
+          {
+            covis.removeTrack(prjs);
+            prjs.clear();
+          }
+      }
+
+    int nrem = compactTracks(pidx);
+    reindexPointPlaneCons(pidx);
+    return nrem;
+  }
+
+
+  // get rid of empty tracks
+  int SysSBA::compactTracks(std::vector<int> &pidx)
+  {
+    int ntrs = tracks.size();
+    pidx.resize(ntrs);
+    int n = 0;
+    for (int i=0; i<ntrs; i++)
+      {
+        if (tracks[i].projections.size() == 0)
+          {
+            pidx[i] = -1;
+            continue;
+          }
+        pidx[i] = n;
+        if (n != i)
+          {
+            tracks[n].projections.swap(tracks[i].projections);
+            tracks[n].point = tracks[i].point;
+          }
+        n++;
+      }
+    tracks.resize(n);
+    return ntrs - n;
+  }
+
+  // Size the per-optimization scratch: one Tpc block per projection,
+  // and Jacobian products for the longest track.
+  void SysSBA::setupWorkspace_()
+  {
+    tpcoff.resize(tracks.size()+1);
+    size_t n = 0, maxlen = 0;
+    for (size_t i=0; i<tracks.size(); i++)
+      {
+        tpcoff[i] = n;
+        size_t len = tracks[i].projections.size();
+        n += len;
+        maxlen = max(maxlen, len);
+      }
+    tpcoff[tracks.size()] = n;
+    if (tpcws.size() < n)
+      tpcws.resize(n);
+    if (jps.size() < maxlen)
+      jps.resize(maxlen);
+    if (tps.size() < tracks.size())
+      tps.resize(tracks.size());
+  }
+
+  // Set transforms and rotation derivatives for the nodes.  Each node
+  // only touches its own state, so large systems split the work across threads.
+  void SysSBA::setupNodes_(bool all)
+  {
+    int n = nodes.size();
+#pragma omp parallel for schedule(static) if(n > 256)
+    for (int i=0; i<n; i++)
+      {
+        Node &nd = nodes[i];
+        if (nd.isFixed && !all) continue;
+        nd.setTransform();      // set up projection matrix for cost calculation
+        nd.setProjection();
+        if (!nd.isFixed)        // derivatives only used for free nodes
+          nd.setDr(useLocalAngles);
+      }
+  }
+
+  // Free the solver scratch.
+  void SysSBA::releaseWorkspace()
+  {
+    std::vector<JacobProds, Eigen::aligned_allocator<JacobProds> >().swap(jps);
+    std::vector<Eigen::Matrix<double,6,3>, Eigen::aligned_allocator<Eigen::Matrix<double,6,3> > >().swap(tpcws);
+    std::vector<int>().swap(tpcoff);
+    std::vector<Eigen::Vector3d, Eigen::aligned_allocator<Eigen::Vector3d> >().swap(tps);
+    std::vector<StoredPoint, Eigen::aligned_allocator<StoredPoint> >().swap(oldpoints);
+  }
+
   // Set up linear system, from Engels and Nister 2006, Table 1, steps 3 and 4
   // This is a relatively compact version of the algorithm! 
   // Assumes camera transforms and derivatives have already been computed,
@@ -1060,15 +1390,15 @@ void SysSBA::setupSys(double sLambda)
     // lambda augmentation
     double lam = 1.0 + sLambda;
 
+    // solver scratch
+    setupWorkspace_();
+
     // loop over tracks (step 4)
     for(size_t pi=0; pi<tracks.size(); pi++)
       {
         ProjMap &prjs = tracks[pi].projections;
         if (prjs.size() < 1) continue; // this catches some problems with bad tracks
-
-	// Jacobian product storage
-	if (prjs.size() > jps.size())
-	  jps.resize(prjs.size());
+        Matrix<double,6,3> *tpcs = &tpcws[tpcoff[pi]];
 
 	// local storage
         Matrix3d Hpp;
@@ -1085,16 +1415,17 @@ void SysSBA::setupSys(double sLambda)
             if (!prj.isValid) continue;
             int ci = (prj.ndi - nFixed) * 6; // index of camera params (6DOF)
                                              // NOTE: assumes fixed cams are at beginning
-            prj.setJacobians(nodes[prj.ndi],tracks[pi].point,&jps[ii]); // calculate derivatives
-            Hpp += prj.jp->Hpp; // add in JpT*Jp
-            bp  -= prj.jp->Bp; // subtract JcT*f from bp; compute transpose twice???
+            JacobProds &jp = jps[ii];
+            prj.setJacobians(nodes[prj.ndi],tracks[pi].point.cast<double>(),&jp); // calculate derivatives
+            Hpp += jp.Hpp; // add in JpT*Jp
+            bp  -= jp.Bp; // subtract JcT*f from bp; compute transpose twice???
 
             if (!nodes[prj.ndi].isFixed)  // if not a fixed camera, do more
               {
                 dcnt(prj.ndi - nFixed)++;
                 // NOTE: A is symmetric, only need the upper/lower triangular part
-                A.block<6,6>(ci,ci) += prj.jp->Hcc; // add JcT*Jc to A; diagonal augmented????
-                B.block<6,1>(ci,0) -= prj.jp->JcTE;
+                A.block<6,6>(ci,ci) += jp.Hcc; // add JcT*Jc to A; diagonal augmented????
+                B.block<6,1>(ci,0) -= jp.JcTE;
               }
           }
 
@@ -1107,18 +1438,21 @@ void SysSBA::setupSys(double sLambda)
         tp = Hppi * bp;           
 
         // "outer product of track" in Step 4
-        for(ProjMap::iterator itr = prjs.begin(); itr != prjs.end(); itr++)
+        ii=0;
+        for(ProjMap::iterator itr = prjs.begin(); itr != prjs.end(); itr++, ii++)
           {
             Proj &prj = itr->second;
             if (!prj.isValid) continue;
             if (nodes[prj.ndi].isFixed) continue; // skip fixed cameras
             int ci = (prj.ndi - nFixed) * 6; // index of camera params (6DOF)
                                              // NOTE: assumes fixed cams are at beginning
-            B.block<6,1>(ci,0) -= prj.jp->Hpc.transpose() * tp; // Hpc * tp subtracted from B
-            prj.Tpc = prj.jp->Hpc.transpose() * Hppi;
+            B.block<6,1>(ci,0) -= jps[ii].Hpc.transpose() * tp; // Hpc * tp subtracted from B
+            Matrix<double,6,3> &Tpc = tpcs[ii];
+            Tpc = jps[ii].Hpc.transpose() * Hppi;
 
             // iterate over nodes left on the track, plus yourself
-            for(ProjMap::iterator itr2 = itr; itr2 != prjs.end(); itr2++)
+            int jj=ii;
+            for(ProjMap::iterator itr2 = itr; itr2 != prjs.end(); itr2++, jj++)
               {
                 Proj &prj2 = itr2->second;
                 if (!prj2.isValid) continue;
@@ -1126,7 +1460,7 @@ void SysSBA::setupSys(double sLambda)
                 int ci2 = (prj2.ndi - nFixed) * 6; // index of camera params (6DOF)
                                                // NOTE: assumes fixed cams are at beginning
                 // NOTE: this only does upper triangular part
-                A.block<6,6>(ci,ci2) -= prj.Tpc * prj2.jp->Hpc; // Tpc * Hpc2 subtracted from A(c,c2)
+                A.block<6,6>(ci,ci2) -= Tpc * jps[jj].Hpc; // Tpc * Hpc2 subtracted from A(c,c2)
                 // lower triangular part - this can be dropped for CSparse, uses ~30% of setup time
                 if (ci != ci2)
                   A.block<6,6>(ci2,ci) = A.block<6,6>(ci,ci2).transpose();
@@ -1183,19 +1517,19 @@ void SysSBA::setupSys(double sLambda)
     // lambda augmentation
     double lam = 1.0 + sLambda;
 
-    // use connection matrix?
-    bool useConnMat = connMat.size() > 0;
+    // use connection filter?
+    bool useConnMat = covis.hasSkips();
     int nskip = 0;
 
+    // solver scratch
+    setupWorkspace_();
+
     // loop over tracks (step 4)
     for(size_t pi=0; pi<tracks.size(); pi++)
     {
         ProjMap &prjs = tracks[pi].projections;
         if (prjs.size() < 1) continue; // this catches some problems with bad tracks
-
-        // set up vector storage of Jacobian products
-        if (prjs.size() > jps.size())
-            jps.resize(prjs.size());
+        Matrix<double,6,3> *tpcs = &tpcws[tpcoff[pi]];
 
         // local storage
         Matrix3d Hpp;
@@ -1213,17 +1547,18 @@ void SysSBA::setupSys(double sLambda)
             int ni = prj.ndi - nFixed;
             int ci = ni * 6;    // index of camera params (6DOF)
             // NOTE: assumes fixed cams are at beginning
-            prj.setJacobians(nodes[prj.ndi],tracks[pi].point,&jps[ii]); // calculate derivatives
-            Hpp += prj.jp->Hpp; // add in JpT*Jp
-            bp  -= prj.jp->Bp; // subtract JpT*f from bp; compute transpose twice???
+            JacobProds &jp = jps[ii];
+            prj.setJacobians(nodes[prj.ndi],tracks[pi].point.cast<double>(),&jp); // calculate derivatives
+            Hpp += jp.Hpp; // add in JpT*Jp
+            bp  -= jp.Bp; // subtract JpT*f from bp; compute transpose twice???
 
             if (!nodes[prj.ndi].isFixed)  // if not a fixed camera, do more
             {
                 dcnt(prj.ndi - nFixed)++;
                 // NOTE: A is symmetric, only need the upper/lower triangular part
                 //                jctjc.diagonal() *= lam;  // now done at end
-                csp.addDiagBlock(prj.jp->Hcc,ni);
-                csp.B.block<6,1>(ci,0) -= prj.jp->JcTE;
+                csp.addDiagBlock(jp.Hcc,ni);
+                csp.B.block<6,1>(ci,0) -= jp.JcTE;
             }
         }
 
@@ -1236,7 +1571,8 @@ void SysSBA::setupSys(double sLambda)
         tp = Hppi * bp;
 
         // "outer product of track" in Step 4
-        for(ProjMap::iterator itr = prjs.begin(); itr != prjs.end(); itr++)
+        ii=0;
+        for(ProjMap::iterator itr = prjs.begin(); itr != prjs.end(); itr++, ii++)
         {
             Proj &prj = itr->second;
             if (!prj.isValid) continue;
@@ -1244,31 +1580,35 @@ void SysSBA::setupSys(double sLambda)
             int ni = prj.ndi - nFixed;
             int ci = ni * 6;    // index of camera params (6DOF)
             // NOTE: assumes fixed cams are at beginning
-            csp.B.block<6,1>(ci,0) -= prj.jp->Hpc.transpose() * tp; // Hpc * tp subtracted from B
-            prj.Tpc = prj.jp->Hpc.transpose() * Hppi;
+            csp.B.block<6,1>(ci,0) -= jps[ii].Hpc.transpose() * tp; // Hpc * tp subtracted from B
+            Matrix<double,6,3> &Tpc = tpcs[ii];
+            Tpc = jps[ii].Hpc.transpose() * Hppi;
 
             // iterate over nodes left on the track, plus yourself
             if (sparseType != SBA_GRADIENT)
-                for(ProjMap::iterator itr2 = itr; itr2 != prjs.end(); itr2++)
+            {
+                int jj=ii;
+                for(ProjMap::iterator itr2 = itr; itr2 != prjs.end(); itr2++, jj++)
                 {
                     Proj &prj2 = itr2->second;
                     if (!prj2.isValid) continue;
                     if (nodes[prj2.ndi].isFixed) continue; // skip fixed cameras
                     int ni2 = prj2.ndi - nFixed; // NOTE: assumes fixed cams are at beginning
-                    if (useConnMat && connMat[prj.ndi][prj2.ndi]) // check connection matrix filter
+                    if (useConnMat && covis.isSkipped(prj.ndi,prj2.ndi)) // check connection filter
                     {
                         nskip++;
                         continue;
                     }
-                    Matrix<double,6,6> m = -prj.Tpc * prj2.jp->Hpc;
+                    Matrix<double,6,6> m = -Tpc * jps[jj].Hpc;
                     if (ni == ni2)
                         csp.addDiagBlock(m,ni);
                     else
                         csp.addOffdiagBlock(m,ni,ni2);
                 }
+            }
             else                // gradient calculation
             {
-                Matrix<double,6,6> m = -prj.Tpc * prj.jp->Hpc;
+                Matrix<double,6,6> m = -Tpc * jps[ii].Hpc;
                 csp.addDiagBlock(m,ni);
             }
 
@@ -1351,10 +1691,8 @@ void SysSBA::setupSys(double sLambda)
               nd.isFixed = false;
           else 
               nd.isFixed = true;
-          nd.setTransform(); // set up projection matrix for cost calculation
-          nd.setProjection();
-          nd.setDr(useLocalAngles);
       }
+      setupNodes_(true);
 
       // initialize vars
       double laminc = 2.0;        // how much to increment lambda if we fail
@@ -1379,7 +1717,7 @@ void SysSBA::setupSys(double sLambda)
           //   got here from a bad update
 
           // If we have point-plane matches, should update normals here.
-          updateNormals();
+          updateNormals(false);
 
           t0 = utime();
           if (useCSparse)
@@ -1419,7 +1757,8 @@ void SysSBA::setupSys(double sLambda)
               if (csp.B.rows() != 0)
               {
                   int iters = csp.doBPCG(maxCGiter,initTol,iter);
-                  cout << "[Block PCG] " << iters << " iterations" << endl;
+                  if (verbose)
+                    cout << "[Block PCG] " << iters << " iterations" << endl;
               }
           }
           else if (useCSparse > 0)
@@ -1491,11 +1830,9 @@ void SysSBA::setupSys(double sLambda)
                   nd.normRot();
               }
 
-              nd.setTransform();  // set up projection matrix for cost calculation
-              nd.setProjection();
-              nd.setDr(useLocalAngles); // set rotational derivatives
               ci += 6;
           }
+          setupNodes_(false);   // set up projections and rotational derivatives
 
           // update the points (step 7)
           // loop over tracks
@@ -1506,25 +1843,27 @@ void SysSBA::setupSys(double sLambda)
               ProjMap &prjs = itr->projections;
               if (prjs.size() < 1) continue;
               Vector3d tp = tps[pi]; // copy to preserve the original
+              const Matrix<double,6,3> *tpcs = &tpcws[tpcoff[pi]];
               // loop over cameras in each track
-              for(ProjMap::iterator pitr = prjs.begin(); pitr != prjs.end(); pitr++)
+              int ii = 0;
+              for(ProjMap::iterator pitr = prjs.begin(); pitr != prjs.end(); pitr++, ii++)
               {
                   Proj &prj = pitr->second;
                   if (!prj.isValid) continue;
                   if (nodes[prj.ndi].isFixed) continue; // only update with non-fixed cameras
                   int ci = (prj.ndi - nFixed) * 6; // index of camera params (6DOF)
                   // NOTE: assumes fixed cams are at beginning
-                  tp -= prj.Tpc.transpose() * BB.segment<6>(ci);
+                  tp -= tpcs[ii].transpose() * BB.segment<6>(ci);
               }  
               // update point
               oldpoints[pi] = tracks[pi].point; // save for backing out
-              tracks[pi].point.head(3) += tp;
+              tracks[pi].point.head(3) += tp.cast<StoreScalar>();
           }
 
           t3 = utime();
 
           // new cost
-          updateNormals();
+          updateNormals(false);
           double newcost = calcCost();
 
           // average reprojection error (for Lourakis test)
@@ -1559,12 +1898,10 @@ void SysSBA::setupSys(double sLambda)
                   if (nd.isFixed) continue; // not to be updated
                   nd.trans = nd.oldtrans;
                   nd.qrot = nd.oldqrot;
-                  nd.setTransform(); // set up projection matrix for cost calculation
-                  nd.setProjection();
-                  nd.setDr(useLocalAngles);
               }
+              setupNodes_(false);
 
-              updateNormals();
+              updateNormals(false);
               cost = calcCost();  // need to reset errors
               if (verbose > 0)
                   cout << iter << " Downdated cost: " << cost << endl;
@@ -1587,94 +1924,117 @@ void SysSBA::setupSys(double sLambda)
   }
 
 
+  // union-find root, with path halving
+  static inline int findRoot(vector<int> &par, int i)
+  {
+    while (par[i] != i)
+      {
+        par[i] = par[par[i]];
+        i = par[i];
+      }
+    return i;
+  }
+
   /// merge tracks based on identity pairs
-  /// this can be expensive
-  void SysSBA::mergeTracks(std::vector<std::pair<int,int> > &prs)
+  /// sets are joined with union-find, smaller track into larger, so each
+  ///   projection is moved only a few times; then one compaction pass
+  int SysSBA::mergeTracks(const std::vector<std::pair<int,int> > &prs, 
+                          std::vector<int> *pidx)
   {
-    // first form an ordered index of tracks
     int ntrs = tracks.size();
-    vector<int> tris;
-    tris.resize(ntrs);
-
+    vector<int> par(ntrs);
     for (int i=0; i<ntrs; i++)
-      tris[i] = i;
-    
-    // go over pairs and insert equalities
+      par[i] = i;
+
+    // join sets, keeping each root at the lowest index of its set
+    int nm = 0;
     for (int i=0; i<(int)prs.size(); i++)
       {
-        pair<int,int> &pr = prs[i];
-        int p0 = min(pr.first,pr.second);
-        int p1 = max(pr.first,pr.second);
-        tris[p1] = p0;
+        int r0 = findRoot(par,prs[i].first);
+        int r1 = findRoot(par,prs[i].second);
+        if (r0 == r1) continue;
+        if (r0 > r1) swap(r0,r1);
+
+        // move the smaller track into the larger, and keep the result at r0
+        if (tracks[r0].projections.size() < tracks[r1].projections.size())
+          {
+            if (!moveTrack_(r1,r0)) continue;
+            tracks[r0].projections.swap(tracks[r1].projections);
+          }
+        else if (!moveTrack_(r0,r1)) 
+          continue;
+
+        par[r1] = r0;
+        nm++;
       }
 
-    // do transitive closure
+    // fill up holes, reset point indices
+    vector<int> tidx;
+    vector<int> &idx = pidx ? *pidx : tidx;
+    idx.resize(ntrs);
+    int n = 0;
     for (int i=0; i<ntrs; i++)
-      tris[i] = tris[tris[i]];
-
-    // fix up tracks, monocular
-    if (tracks.size() > 0)
       {
-        for (int i=0; i<(int)tracks.size(); i++)
+        int r = findRoot(par,i);
+        if (r != i)             // roots come first, so already placed
           {
-            if (tris[i] == i) continue;
-
-            ProjMap &tr0 = tracks[tris[i]].projections;
-            ProjMap &tr1 = tracks[i].projections;
-
-            for(ProjMap::iterator itr1 = tr1.begin(); itr1 != tr1.end(); itr1++)
-              {
-                Proj &prj = itr1->second;
-                int ci = prj.ndi;
-                
-                // Insert the projection into the original track
-                tr0[ci] = prj;
-              }
-            tr1.clear();
+            idx[i] = idx[r];
+            continue;
           }
-
-        // fill up holes, reset point indices
-        int n = 0;
-        for (int i=0; i<(int)tracks.size(); i++)
+        idx[i] = n;
+        if (n != i)
           {
-            if (tris[i] != i) continue;
-            if (n == i) continue;
-            tracks[n] = tracks[i];
+            tracks[n].projections.swap(tracks[i].projections);
             tracks[n].point = tracks[i].point;
-            
-            // We don't really do anything here? Should this be uncommented?
-            // std::ProjMap &tr = tracks[n].projections;
-            /*for (int j=0; j<(int)tr.size(); j++)
-              tr[j].pti = n; */
-            n++;
           }
-        tracks.resize(n);
+        n++;
       }
+    tracks.resize(n);
+
+    if (nm > 0)
+      reindexPointPlaneCons(idx);
+    return nm;
   }
 
 
-  /// merge 2 tracks
-  /// leave 2nd track null; eventually need to clean up null tracks
-  /// returns merged track index if successful, -1 if tracks are redundant 
-  ///     (same cam found on both with different keypts)
-  int SysSBA::mergeTracksSt(int tri0, int tri1)
+  // move track <tri1> into <tri0>, if no node has different keypoints
+  //   on the two; leaves <tri1> empty
+  bool SysSBA::moveTrack_(int tri0, int tri1)
   {
-    // loop through track tr1, adding projections to tr0 and checking for redundancy
-    ProjMap tr0 = tracks[tri0].projections; // duplicate this track, for undo
+    ProjMap &tr0 = tracks[tri0].projections;
     ProjMap &tr1 = tracks[tri1].projections;
-    
+
+    // check first, so there's nothing to undo
     for(ProjMap::iterator itr = tr1.begin(); itr != tr1.end(); itr++)
       {
-        Proj &prj = itr->second;
-        bool ok = addProj(prj.ndi, tri0, prj.kp, prj.stereo);
-        if (!ok)
-          {
-            tracks[tri0].projections = tr0; // reset to original track
-            return -1;
-          }
+        ProjMap::iterator itr0 = tr0.find(itr->first);
+        if (itr0 != tr0.end() && itr0->second.kp != itr->second.kp)
+          return false;
       }
 
+    covis.removeTrack(tr1);
+    for(ProjMap::iterator itr = tr1.begin(); itr != tr1.end(); itr++)
+      {
+        Proj &prj = itr->second;
+        ProjMap::iterator hint = tr0.lower_bound(itr->first);
+        if (hint != tr0.end() && hint->first == itr->first)
+          continue;             // duplicate
+        covis.addObs(tr0, prj.ndi);
+        tr0.insert(hint, ProjMap::value_type(itr->first, prj));
+      }
     tr1.clear();
+    return true;
+  }
+
+
+  /// merge 2 tracks
+  /// leave 2nd track null; eventually need to clean up null tracks
+  /// returns merged track index if successful, -1 if tracks are redundant 
+  ///     (same cam found on both with different keypts)
+  int SysSBA::mergeTracksSt(int tri0, int tri1)
+  {
+    if (!moveTrack_(tri0, tri1))
+      return -1;
     return tri0;
   }
 
@@ -1,5 +1,8 @@
 #include "sba/sba_file_io.h"
 #include <map>
+#include <cstring>
+#include <cmath>
+#include <boost/bind.hpp>
 
 using namespace sba;
 using namespace Eigen;
@@ -28,6 +31,9 @@ int sba::readBundlerFile(const char *filename, SysSBA& sbaout)
     /* cout << "Points: " << npts << "  Tracks: " << ptts.size() 
          << "  Projections: " << nprjs << endl; */
          
+    sbaout.nodes.reserve(ncams);
+    sbaout.tracks.reserve(npts);
+
     cout << "Setting up nodes..." << flush;
     for (int i=0; i<ncams; i++)
     {
@@ -85,8 +91,10 @@ int sba::readBundlerFile(const char *filename, SysSBA& sbaout)
     sbaout.useLocalAngles = true;    // use local angles
     sbaout.nFixed = 1;
 
-    // set up projections
+    // set up projections, all at once
     int ntot = 0;
+    vector<ProjEntry> prjs;
+    prjs.reserve(nprjs);
     cout << "Setting up projections..." << flush;
     for (int i=0; i<npts; i++)
     {
@@ -98,14 +106,18 @@ int sba::readBundlerFile(const char *filename, SysSBA& sbaout)
 	  // projection
 	  Vector4d &prj = ptt[j];
 	  int cami = (int)prj[0];
-	  Vector2d pt = prj.segment<2>(2);
-	  pt[1] = -pt[1];	// NOTE: Bundler image Y is reversed
 	  if (cami >= ncams)
 	    cout << "*** Cam index exceeds bounds: " << cami << endl;
-	  sbaout.addMonoProj(cami,i,pt); // Monocular projections
+	  ProjEntry pe;
+	  pe.ci = cami;
+	  pe.pi = i;
+	  pe.kp << prj[2], -prj[3], 0.0; // NOTE: Bundler image Y is reversed
+	  pe.stereo = false;	// Monocular projections
+	  prjs.push_back(pe);
 	  ntot++;
         }
     }
+    sbaout.addProjs(prjs);
     cout << "done" << endl;
     
     return 0;
@@ -360,7 +372,7 @@ void sba::writeLourakisFile(const char *fname, SysSBA& sba)
       {
         ProjMap &prjs = sba.tracks[i].projections;
         // Write out point
-        Point &pt = sba.tracks[i].point;
+        const Point &pt = sba.tracks[i].point.cast<double>();
         
         fprintf(fn,"%f %f %f  ", pt.x(), pt.y(), pt.z());
         fprintf(fn,"%d  ",(int)prjs.size());
@@ -506,6 +518,9 @@ int sba::readGraphFile(const char *filename, SysSBA& sbaout)
     //    cout << "Points: " << npts << "  Tracks: " << ptts.size() 
     //         << "  Projections: " << nprjs << endl; 
          
+    sbaout.nodes.reserve(ncams);
+    sbaout.tracks.reserve(npts);
+
     // cout << "Setting up nodes..." << flush;
     for (int i=0; i<ncams; i++)
     {
@@ -557,8 +572,10 @@ int sba::readGraphFile(const char *filename, SysSBA& sbaout)
     sbaout.useLocalAngles = true;    // use local angles
     sbaout.nFixed = 1;
 
-    // set up projections
+    // set up projections, all at once
     int ntot = 0;
+    vector<ProjEntry> prjs;
+    prjs.reserve(nprjs);
     // cout << "Setting up projections..." << flush;
     for (int i=0; i<npts; i++)
     {
@@ -572,20 +589,17 @@ int sba::readGraphFile(const char *filename, SysSBA& sbaout)
             int cami = (int)prj[0];
 	    if (cami >= ncams)
 	      cout << "*** Cam index exceeds bounds: " << cami << endl;
-	    if (prj[4] > 0)	// stereo
-	      {
-		Vector3d pt = prj.segment<3>(2);
-		sbaout.addStereoProj(cami,i,pt); // Monocular projections
-	      }
-	    else		// mono
-	      {
-		Vector2d pt = prj.segment<2>(2);
-		sbaout.addMonoProj(cami,i,pt); // Monocular projections
-	      }
+	    ProjEntry pe;
+	    pe.ci = cami;
+	    pe.pi = i;
+	    pe.kp = prj.segment<3>(2);
+	    pe.stereo = prj[4] > 0; // stereo or mono
+	    prjs.push_back(pe);
 
             ntot++;
         }
     }
+    sbaout.addProjs(prjs);
     // cout << "done" << endl;
     
     return 0;
@@ -782,79 +796,595 @@ int  sba::ParseGraphFile(const char *fin,	// input file
 
 int sba::writeGraphFile(const char *filename, SysSBA& sba, bool mono)
 {
-    ofstream outfile(filename, ios_base::trunc);
-    if (outfile == NULL)
+    GraphSnapshot snap;
+    snap.take(sba);
+    return writeGraphFile(filename, snap, mono);
+}
+
+
+//
+// graph snapshots and fast output
+//
+
+void sba::GraphSnapshot::take(const SysSBA &sba)
+{
+    int ncams = sba.nodes.size();
+    cams.resize(12*ncams);
+    for (int i = 0; i < ncams; i++)
+    {
+        const Node &nd = sba.nodes[i];
+        double *c = &cams[12*i];
+        c[0] = nd.trans(0);
+        c[1] = nd.trans(1);
+        c[2] = nd.trans(2);
+        c[3] = nd.qrot.x();
+        c[4] = nd.qrot.y();
+        c[5] = nd.qrot.z();
+        c[6] = nd.qrot.w();
+        c[7] = nd.Kcam(0,0);
+        c[8] = nd.Kcam(1,1);
+        c[9] = nd.Kcam(0,2);
+        c[10] = nd.Kcam(1,2);
+        c[11] = nd.baseline;
+    }
+
+    int npts = sba.tracks.size();
+    points.resize(3*npts);
+    prjStart.resize(npts+1);
+    prjs.clear();
+    for (int i = 0; i < npts; i++)
+    {
+        const Track &trk = sba.tracks[i];
+        points[3*i] = trk.point(0);
+        points[3*i+1] = trk.point(1);
+        points[3*i+2] = trk.point(2);
+        prjStart[i] = prjs.size();
+        for (ProjMap::const_iterator itr = trk.projections.begin(); itr != trk.projections.end(); itr++)
+        {
+            const Proj &prj = itr->second;
+            Projection p;
+            p.ci = prj.ndi;
+            p.kp[0] = prj.kp(0);
+            p.kp[1] = prj.kp(1);
+            p.kp[2] = prj.kp(2);
+            p.stereo = prj.stereo;
+            p.isValid = prj.isValid;
+            prjs.push_back(p);
+        }
+    }
+    prjStart[npts] = prjs.size();
+}
+
+namespace
+{
+  // buffered stdio output with fast number formatting
+  class OutBuf
+  {
+    public:
+      OutBuf(FILE *fp) : fp(fp), buf(1<<16), n(0) {}
+      ~OutBuf() { flush(); }
+
+      void flush()
+      {
+        if (n > 0)
+          fwrite(&buf[0], 1, n, fp);
+        n = 0;
+      }
+
+      void str(const char *s)
+      {
+        room(strlen(s));
+        while (*s)
+          buf[n++] = *s++;
+      }
+
+      void chr(char c)
+      {
+        room(1);
+        buf[n++] = c;
+      }
+
+      void integer(long long v)
+      {
+        room(24);
+        char tmp[24];
+        int k = 0;
+        unsigned long long u = v < 0 ? -(unsigned long long)v : v;
+        do { tmp[k++] = '0' + u%10; u /= 10; } while (u);
+        if (v < 0)
+          buf[n++] = '-';
+        while (k > 0)
+          buf[n++] = tmp[--k];
+      }
+
+      // fixed-point with <prec> decimals, exactly as printf("%.*f") would
+      // give.  Scaling by 10^prec is exact to well under 1e-6 of a digit
+      // below 1e9, so only values that close to a tie go to sprintf
+      void fixed(double v, int prec)
+      {
+        static const double scale[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+        room(400);
+        double s = fabs(v*scale[prec]);
+        if (!(s < 1.0e9) || fabs(s - floor(s) - 0.5) < 1.0e-6) // nan, inf, big, or a near tie
+        {
+          n += sprintf(&buf[n], "%.*f", prec, v);
+          return;
+        }
+        if (v < 0 || (v == 0 && 1.0/v < 0)) // -0 prints its sign too
+          buf[n++] = '-';
+        unsigned long long u = (unsigned long long)(s + 0.5);
+        char tmp[24];
+        int k = 0;
+        for (int i = 0; i < prec; i++)
+        {
+          tmp[k++] = '0' + u%10;
+          u /= 10;
+        }
+        do { tmp[k++] = '0' + u%10; u /= 10; } while (u);
+        while (k > prec)
+          buf[n++] = tmp[--k];
+        if (prec > 0)
+          buf[n++] = '.';
+        while (k > 0)
+          buf[n++] = tmp[--k];
+      }
+
+      void raw(const void *p, size_t k)
+      {
+        if (k > buf.size())
+        {
+          flush();
+          fwrite(p, 1, k, fp);
+          return;
+        }
+        room(k);
+        memcpy(&buf[n], p, k);
+        n += k;
+      }
+
+      template <typename T>
+      void bin(T v) { raw(&v, sizeof(T)); }
+
+    private:
+      void room(size_t k)
+      {
+        if (n + k > buf.size())
+          flush();
+      }
+
+      FILE *fp;
+      vector<char> buf;
+      size_t n;
+  };
+}
+
+int sba::writeGraphFile(const char *filename, const GraphSnapshot &snap, bool mono)
+{
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL)
     {
         cout << "Can't open file " << filename << endl;
         return -1;
     }
-    
-    outfile.precision(5);
-    //    outfile.setf(ios_base::scientific);
-    outfile.setf(ios_base::fixed);
-    
-    unsigned int i = 0;
-    
-    // header, but we skip for now
-    //    outfile << "# Bundle file v0.3" << endl;
-    
-    // Info about each camera
-    //   VERTEX_CAM n x y z qx qy qz qw fx fy cx cy baseline
-    //   <baseline> is 0 for monocular data
-    //   <n> is the camera index, heading at 0
-    int ncams = sba.nodes.size();
-    for (i = 0; i < (unsigned int)ncams; i++)
+
+    {
+      OutBuf out(fp);
+      const int prec = 5;
+
+      // Info about each camera
+      //   VERTEX_CAM n x y z qx qy qz qw fx fy cx cy baseline
+      //   <baseline> is 0 for monocular data
+      //   <n> is the camera index, heading at 0
+      int ncams = snap.cams.size()/12;
+      for (int i = 0; i < ncams; i++)
+      {
+        const double *c = &snap.cams[12*i];
+        out.str("VERTEX_CAM ");
+        out.integer(i);
+        for (int k = 0; k < 12; k++)
+        {
+          out.chr(' ');
+          out.fixed(c[k], prec);
+        }
+        out.chr('\n');
+      }
+
+      // Info about each point
+      //  point indices are sba indices plus ncams (so they're unique in the file)
+      //    VERTEX_POINT n x y z
+      //  after each point comes the projections
+      //    EDGE_PROJECT_P2C pt_ind cam_ind u v
+      int npts = snap.points.size()/3;
+      for (int i = 0; i < npts; i++)
+      {
+        out.str("VERTEX_XYZ ");
+        out.integer(ncams+i);
+        for (int k = 0; k < 3; k++)
+        {
+          out.chr(' ');
+          out.fixed(snap.points[3*i+k], prec);
+        }
+        out.chr('\n');
+
+        // Output all projections
+        //   Mono projections have 0 for the disparity
+        for (int j = snap.prjStart[i]; j < snap.prjStart[i+1]; j++)
+        {
+          // TODO: output real covariance, if available
+          const GraphSnapshot::Projection &prj = snap.prjs[j];
+          bool stereo = prj.stereo && !mono;
+          out.str(stereo ? "EDGE_PROJECT_P2SC " : "EDGE_PROJECT_P2MC ");
+          out.integer(ncams+i);
+          out.chr(' ');
+          out.integer(prj.ci);
+          int nk = stereo ? 3 : 2;
+          for (int k = 0; k < nk; k++)
+          {
+            out.chr(' ');
+            out.fixed(prj.kp[k], prec);
+          }
+          out.str(stereo ? " 1 0 0 0 1 1\n" : " 1 0 1\n"); // covariance
+        }
+      }
+    }
+
+    int ret = ferror(fp) ? -1 : 0;
+    fclose(fp);
+    return ret;
+}
+
+
+//
+// binary graph files
+//
+
+static const char binaryGraphMagic[4] = { 'S', 'B', 'A', 'G' };
+static const int binaryGraphVersion = 1;
+
+int sba::writeBinaryGraphFile(const char *filename, const SysSBA& sba)
+{
+    GraphSnapshot snap;
+    snap.take(sba);
+    return writeBinaryGraphFile(filename, snap);
+}
+
+int sba::writeBinaryGraphFile(const char *filename, const GraphSnapshot &snap)
+{
+    FILE *fp = fopen(filename, "wb");
+    if (fp == NULL)
     {
-      outfile << "VERTEX_CAM" << " ";
-      outfile << i << " ";      // node number
-      Vector3d trans = sba.nodes[i].trans.head<3>(); // position
-      outfile << trans(0) << ' ' << trans(1) << ' ' << trans(2) << ' ';
-      Vector4d rot = sba.nodes[i].qrot.coeffs(); // rotation
-      outfile << rot(0) << ' ' << rot(1) << ' ' << rot(2) << ' ' << rot(3) << ' ';
-      // cam params
-      outfile << sba.nodes[i].Kcam(0,0) << ' ' << sba.nodes[i].Kcam(1,1) << ' ' << 
-        sba.nodes[i].Kcam(0,2) << ' ' << sba.nodes[i].Kcam(1,2) << ' ' << sba.nodes[i].baseline << endl;
+        cout << "Can't open file " << filename << endl;
+        return -1;
     }
-    
-    // Info about each point
-    //  point indices are sba indices plus ncams (so they're unique in the file)
-    //    VERTEX_POINT n x y z
-    //  after each point comes the projections
-    //    EDGE_PROJECT_P2C pt_ind cam_ind u v
-    for (i = 0; i < sba.tracks.size(); i++)
+
     {
-      outfile << "VERTEX_XYZ" << ' ' << ncams+i << ' '; // index
-      // World <x y z>
-      outfile << sba.tracks[i].point(0) << ' ' << sba.tracks[i].point(1) 
-              << ' ' << sba.tracks[i].point(2) << endl;
-        
-      ProjMap &prjs = sba.tracks[i].projections;
-        
-      // Output all projections
-      //   Mono projections have 0 for the disparity
-      for(ProjMap::iterator itr = prjs.begin(); itr != prjs.end(); itr++)
+      OutBuf out(fp);
+      int ncams = snap.cams.size()/12;
+      int npts = snap.points.size()/3;
+      out.raw(binaryGraphMagic, 4);
+      out.bin<int>(binaryGraphVersion);
+      out.bin<int>(ncams);
+      out.bin<int>(npts);
+      out.bin<int>(snap.prjs.size());
+
+      if (ncams > 0)
+        out.raw(&snap.cams[0], snap.cams.size()*sizeof(double));
+
+      for (int i = 0; i < npts; i++)
+      {
+        out.raw(&snap.points[3*i], 3*sizeof(double));
+        out.bin<int>(snap.prjStart[i+1] - snap.prjStart[i]);
+        for (int j = snap.prjStart[i]; j < snap.prjStart[i+1]; j++)
         {
-	  // TODO: output real covariance, if available
-          Proj &prj = itr->second;
-	  if (prj.stereo && !mono)
-	    {
-	      outfile << "EDGE_PROJECT_P2SC "; // stereo edge
-	      outfile << ncams+i << ' ' << prj.ndi << ' ' << prj.kp(0) << ' ' 
-		      << prj.kp(1) << ' ' << prj.kp(2) << ' ';
-	      outfile << "1 0 0 0 1 1" << endl;	// covariance
-	    }
-	  else
-	    {
-	      outfile << "EDGE_PROJECT_P2MC "; // mono edge
-	      outfile << ncams+i << ' ' << prj.ndi << ' ' << prj.kp(0) << ' ' 
-		      << prj.kp(1) << ' ';
-	      outfile << "1 0 1" << endl; // covariance
-	    }
+          const GraphSnapshot::Projection &prj = snap.prjs[j];
+          out.bin<int>(prj.ci);
+          out.bin<float>(prj.kp[0]);
+          out.bin<float>(prj.kp[1]);
+          out.bin<float>(prj.kp[2]);
+          out.bin<unsigned char>((prj.stereo ? 1 : 0) | (prj.isValid ? 2 : 0));
+        }
+      }
+    }
+
+    int ret = ferror(fp) ? -1 : 0;
+    fclose(fp);
+    return ret;
+}
+
+template <typename T>
+static bool readBin(FILE *fp, T *v, size_t n = 1)
+{
+    return fread(v, sizeof(T), n, fp) == n;
+}
+
+int sba::readBinaryGraphFile(const char *filename, SysSBA& sbaout)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL)
+    {
+        cout << "Can't open file " << filename << endl;
+        return -1;
+    }
+
+    char magic[4];
+    int version, ncams, npts, nprjs;
+    if (!readBin(fp, magic, 4) || memcmp(magic, binaryGraphMagic, 4) ||
+        !readBin(fp, &version) || version != binaryGraphVersion ||
+        !readBin(fp, &ncams) || !readBin(fp, &npts) || !readBin(fp, &nprjs) ||
+        ncams < 0 || npts < 0 || nprjs < 0)
+    {
+        cout << "Bad binary graph file " << filename << endl;
+        fclose(fp);
+        return -1;
+    }
+
+    // the counts have to fit in the rest of the file, which also
+    // bounds the storage reserved for them
+    long start = ftell(fp);
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, start, SEEK_SET);
+    const double camSize = 12*sizeof(double);
+    const double pointSize = 3*sizeof(double) + sizeof(int);
+    const double prjSize = sizeof(int) + 3*sizeof(float) + 1;
+    if (start < 0 || size < 0 ||
+        ncams*camSize + npts*pointSize + nprjs*prjSize > (double)(size - start))
+    {
+        cout << "Truncated binary graph file " << filename << endl;
+        fclose(fp);
+        return -1;
+    }
+
+    // read everything before adding to the system, so it is left as
+    // it was if the file is bad
+    int firstNode = sbaout.nodes.size();
+    int firstPoint = sbaout.tracks.size();
+    vector<double> cams(12*ncams);
+    vector<double> points(3*npts);
+    vector<ProjEntry> prjs;
+    prjs.reserve(nprjs);
+    vector<pair<int,int> > invalid;
+
+    if (ncams > 0 && !readBin(fp, &cams[0], cams.size()))
+    {
+        cout << "Truncated binary graph file " << filename << endl;
+        fclose(fp);
+        return -1;
+    }
+
+    for (int i = 0; i < npts; i++)
+    {
+        int np;
+        if (!readBin(fp, &points[3*i], 3) || !readBin(fp, &np) || np < 0)
+        {
+            cout << "Truncated binary graph file " << filename << endl;
+            fclose(fp);
+            return -1;
+        }
+
+        for (int j = 0; j < np; j++)
+        {
+            int ci;
+            float kp[3];
+            unsigned char flags;
+            if (!readBin(fp, &ci) || !readBin(fp, kp, 3) || !readBin(fp, &flags))
+            {
+                cout << "Truncated binary graph file " << filename << endl;
+                fclose(fp);
+                return -1;
+            }
+            if (ci < 0 || ci >= ncams)
+            {
+                cout << "Bad camera index " << ci << " in binary graph file " << filename << endl;
+                fclose(fp);
+                return -1;
+            }
+            ProjEntry pe;
+            pe.ci = firstNode + ci;
+            pe.pi = firstPoint + i;
+            pe.kp = Vector3d(kp[0], kp[1], kp[2]);
+            pe.stereo = flags & 1;
+            prjs.push_back(pe);
+            if (!(flags & 2))
+              invalid.push_back(make_pair(pe.pi, pe.ci));
         }
     }
+    fclose(fp);
+
+    sbaout.nodes.reserve(firstNode + ncams);
+    sbaout.tracks.reserve(firstPoint + npts);
+    for (int i = 0; i < ncams; i++)
+    {
+        const double *c = &cams[12*i];
+        Vector4d frt(c[0], c[1], c[2], 1.0);
+        Quaternion<double> frq(c[6], c[3], c[4], c[5]);
+        CamParams cpars = {c[7], c[8], c[9], c[10], c[11]};
+        sbaout.addNode(frt, frq, cpars);
+    }
+    for (int i = 0; i < npts; i++)
+    {
+        Point pt;
+        pt << points[3*i], points[3*i+1], points[3*i+2], 1.0;
+        sbaout.addPoint(pt);
+    }
+
+    sbaout.useLocalAngles = true;    // use local angles
+    sbaout.nFixed = 1;
+    sbaout.addProjs(prjs);
+    for (size_t i = 0; i < invalid.size(); i++)
+    {
+        ProjMap &pm = sbaout.tracks[invalid[i].first].projections;
+        ProjMap::iterator itr = pm.find(invalid[i].second);
+        if (itr != pm.end())
+          itr->second.isValid = false;
+    }
 
     return 0;
-} 
+}
+
+
+//
+// background graph writer
+//
+
+// rebuild a system from a snapshot, for the writers that need one
+static void snapshotSystem(const GraphSnapshot &snap, SysSBA &sba)
+{
+    int ncams = snap.cams.size()/12;
+    int npts = snap.points.size()/3;
+    sba.nodes.reserve(ncams);
+    sba.tracks.reserve(npts);
+    for (int i = 0; i < ncams; i++)
+    {
+        const double *c = &snap.cams[12*i];
+        Vector4d frt(c[0], c[1], c[2], 1.0);
+        Quaternion<double> frq(c[6], c[3], c[4], c[5]);
+        CamParams cpars = {c[7], c[8], c[9], c[10], c[11]};
+        sba.addNode(frt, frq, cpars);
+    }
+
+    vector<ProjEntry> prjs;
+    prjs.reserve(snap.prjs.size());
+    for (int i = 0; i < npts; i++)
+    {
+        Point pt;
+        pt << snap.points[3*i], snap.points[3*i+1], snap.points[3*i+2], 1.0;
+        sba.addPoint(pt);
+        for (int j = snap.prjStart[i]; j < snap.prjStart[i+1]; j++)
+        {
+            const GraphSnapshot::Projection &prj = snap.prjs[j];
+            ProjEntry pe;
+            pe.ci = prj.ci;
+            pe.pi = i;
+            pe.kp = Vector3d(prj.kp[0], prj.kp[1], prj.kp[2]);
+            pe.stereo = prj.stereo;
+            prjs.push_back(pe);
+        }
+    }
+    sba.addProjs(prjs);
+
+    for (int i = 0; i < npts; i++)
+      for (int j = snap.prjStart[i]; j < snap.prjStart[i+1]; j++)
+        if (!snap.prjs[j].isValid)
+          sba.tracks[i].projections[snap.prjs[j].ci].isValid = false;
+}
+
+sba::GraphWriter::GraphWriter(int maxPending)
+  : maxPending(max(1, maxPending)), busy(0), stopping(false)
+{
+    thread = boost::thread(boost::bind(&GraphWriter::run, this));
+}
+
+sba::GraphWriter::~GraphWriter()
+{
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      stopping = true;
+      notEmpty.notify_all();
+    }
+    thread.join();
+}
+
+bool sba::GraphWriter::write(const char *filename, const SysSBA &sba, GraphFormat format, bool wait)
+{
+    // check for room before paying for the snapshot
+    if (!wait)
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      if ((int)jobs.size() >= maxPending)
+      {
+        printf("[GraphWriter] Queue full, skipping %s\n", filename);
+        return false;
+      }
+    }
+
+    boost::shared_ptr<GraphSnapshot> snap(new GraphSnapshot);
+    snap->take(sba);
+    return write(filename, boost::shared_ptr<const GraphSnapshot>(snap), format, wait);
+}
+
+bool sba::GraphWriter::write(const char *filename, const boost::shared_ptr<const GraphSnapshot> &snap,
+                             GraphFormat format, bool wait)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    while (wait && (int)jobs.size() >= maxPending)
+      changed.wait(lock);
+    if ((int)jobs.size() >= maxPending)
+    {
+      printf("[GraphWriter] Queue full, skipping %s\n", filename);
+      return false;
+    }
+
+    Job job;
+    job.filename = filename;
+    job.snap = snap;
+    job.format = format;
+    jobs.push_back(job);
+    notEmpty.notify_one();
+    return true;
+}
+
+void sba::GraphWriter::flush()
+{
+    boost::mutex::scoped_lock lock(mutex);
+    while (!jobs.empty() || busy > 0)
+      changed.wait(lock);
+}
+
+int sba::GraphWriter::pending()
+{
+    boost::mutex::scoped_lock lock(mutex);
+    return jobs.size() + busy;
+}
+
+void sba::GraphWriter::run()
+{
+    while (1)
+    {
+      Job job;
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        while (jobs.empty() && !stopping)
+          notEmpty.wait(lock);
+        if (jobs.empty())
+          return;
+        job = jobs.front();
+        jobs.pop_front();
+        busy++;
+        changed.notify_all();
+      }
+
+      const char *fname = job.filename.c_str();
+      switch (job.format)
+      {
+        case GRAPH_TEXT:
+          writeGraphFile(fname, *job.snap);
+          break;
+        case GRAPH_TEXT_MONO:
+          writeGraphFile(fname, *job.snap, true);
+          break;
+        case GRAPH_BINARY:
+          writeBinaryGraphFile(fname, *job.snap);
+          break;
+        case GRAPH_BUNDLER:
+        case GRAPH_LOURAKIS:
+        {
+          SysSBA sba;
+          snapshotSystem(*job.snap, sba);
+          if (job.format == GRAPH_BUNDLER)
+            writeBundlerFile(fname, sba);
+          else
+            writeLourakisFile(fname, sba);
+          break;
+        }
+      }
+      job.snap.reset();
+
+      boost::mutex::scoped_lock lock(mutex);
+      busy--;
+      changed.notify_all();
+    }
+}
 
 
 //
@@ -59,6 +59,7 @@ using namespace std;
 #include <iostream>
 #include <iomanip>
 #include <fstream>
+#include <algorithm>
 #include <sys/time.h>
 
 // elapsed time in microseconds
@@ -655,7 +656,97 @@ namespace sba
     // Should this be local or global?
     nd.normRot();//Local();
     nodes.push_back(nd);
-    return nodes.size()-1;
+    int ni = nodes.size()-1;
+
+    // session bookkeeping
+    if (!anchors.empty())
+      {
+        int s = anchors.size()-1;
+        nodeSession.resize(ni, s);
+        nodeSession.push_back(s);
+        if (anchors[s] < 0)
+          anchors[s] = ni;
+        changedSessions[s] = 1;
+      }
+    return ni;
+  }
+
+
+  // Start a new session; nodes already present make up session 0
+  int SysSPA::addSession()
+  {
+    if (anchors.empty() && !nodes.empty())
+      {
+        nodeSession.assign(nodes.size(), 0);
+        anchors.push_back(0);
+        changedSessions.push_back(1);
+        sessionParent_.push_back(0);
+      }
+    int s = anchors.size();
+    anchors.push_back(-1);
+    changedSessions.push_back(1);
+    sessionParent_.push_back(s);
+    return s;
+  }
+
+
+  // lowest session joined to <s>
+  int SysSPA::sessionRoot_(int s)
+  {
+    while (sessionParent_[s] != s)
+      {
+        sessionParent_[s] = sessionParent_[sessionParent_[s]]; // path halving
+        s = sessionParent_[s];
+      }
+    return s;
+  }
+
+
+  // First constraint between two groups of sessions: the frames of the
+  // groups are unrelated, so move the later group rigidly to agree with
+  // the constraint, then join them.
+  void SysSPA::joinSessions_(int nd0, int nd1, const Vector3d &tmean,
+                             const Quaterniond &qpmean)
+  {
+    int r0 = sessionRoot_(nodeSession[nd0]);
+    int r1 = sessionRoot_(nodeSession[nd1]);
+    if (r0 == r1) return;
+
+    // target pose of the node in the moved group, and its current pose
+    Node &n0 = nodes[nd0];
+    Node &n1 = nodes[nd1];
+    Quaterniond q0 = n0.qrot, q1 = n1.qrot;
+    Vector3d t0 = n0.trans.head<3>(), t1 = n1.trans.head<3>();
+    Quaterniond qt, qc;
+    Vector3d tt, tc;
+    int moved = r1 > r0 ? r1 : r0;
+    if (moved == r1)
+      {
+        qt = q0*qpmean;
+        tt = t0 + q0*tmean;
+        qc = qt*q1.inverse();
+        tc = tt - qc*t1;
+      }
+    else
+      {
+        qt = q1*qpmean.inverse();
+        tt = t1 - qt*tmean;
+        qc = qt*q0.inverse();
+        tc = tt - qc*t0;
+      }
+    qc.normalize();
+
+    for (int i=0; i<(int)nodes.size(); i++)
+      {
+        if (sessionRoot_(nodeSession[i]) != moved) continue;
+        Node &nd = nodes[i];
+        nd.trans.head<3>() = qc*nd.trans.head<3>() + tc;
+        nd.qrot = qc*nd.qrot;
+        nd.normRot();
+        nd.setTransform();
+      }
+
+    sessionParent_[moved] = moved == r1 ? r0 : r1;
   }
 
 
@@ -684,10 +775,113 @@ namespace sba
     con.prec = prec;            
 
     p2cons.push_back(con);
+
+    if (!anchors.empty())
+      {
+        nodeSession.resize(nodes.size(), anchors.size()-1);
+        int s0 = nodeSession[nd0], s1 = nodeSession[nd1];
+        changedSessions[s0] = 1;
+        changedSessions[s1] = 1;
+        if (s0 != s1)
+          joinSessions_(nd0, nd1, tmean, qr);
+      }
     return true;
   }
 
 
+  // Set up the free variables.  Without sessions the first <nFixed>
+  // nodes are fixed.  With sessions, nodes of sessions not being
+  // optimized are fixed, and so is the first anchor of each group of
+  // joined sessions that isn't held by a fixed session.
+  int SysSPA::setupVars_()
+  {
+    int ncams = nodes.size();
+    varIndex_.resize(ncams);
+
+    if (anchors.empty())
+      {
+        for (int i=0; i<ncams; i++)
+          nodes[i].isFixed = i < nFixed;
+      }
+    else
+      {
+        int nsess = anchors.size();
+        nodeSession.resize(ncams, nsess-1);
+        bool all = activeSessions_.empty();
+
+        // groups of sessions joined by the current constraints
+        vector<int> root(nsess);
+        for (int s=0; s<nsess; s++)
+          root[s] = s;
+        for (size_t i=0; i<p2cons.size(); i++)
+          {
+            int a = nodeSession[p2cons[i].ndr], b = nodeSession[p2cons[i].nd1];
+            while (root[a] != a) a = root[a];
+            while (root[b] != b) b = root[b];
+            if (a < b) root[b] = a;
+            else if (b < a) root[a] = b;
+          }
+
+        // does each group have a fixed session?  if not, hold its
+        // first anchor
+        vector<char> held(nsess, 0);
+        for (int s=0; s<nsess; s++)
+          {
+            int r = s;
+            while (root[r] != r) r = root[r];
+            root[s] = r;
+            if (!all && !activeSessions_[s])
+              held[r] = 1;
+          }
+        for (int i=0; i<ncams; i++)
+          {
+            int s = nodeSession[i];
+            nodes[i].isFixed = !all && !activeSessions_[s];
+          }
+        for (int s=0; s<nsess; s++)
+          if (anchors[s] >= 0 && !held[root[s]])
+            {
+              nodes[anchors[s]].isFixed = true;
+              held[root[s]] = 1;
+            }
+      }
+
+    int nFree = 0;
+    for (int i=0; i<ncams; i++)
+      varIndex_[i] = nodes[i].isFixed ? -1 : nFree++;
+    return nFree;
+  }
+
+
+  // Optimize one session, or all of them
+  int SysSPA::doSessionSPA(int session, int niter, double sLambda, int useCSparse,
+                           double initTol, int CGiters)
+  {
+    if (session >= 0)
+      {
+        activeSessions_.assign(anchors.size(), 0);
+        if (session < (int)anchors.size())
+          activeSessions_[session] = 1;
+      }
+    int n = doSPA(niter, sLambda, useCSparse, initTol, CGiters);
+    activeSessions_.clear();
+    return n;
+  }
+
+
+  // Optimize the sessions that changed since their last optimization
+  int SysSPA::doChangedSPA(int niter, double sLambda, int useCSparse,
+                           double initTol, int CGiters)
+  {
+    if (find(changedSessions.begin(), changedSessions.end(), 1) == changedSessions.end())
+      return 0;
+    activeSessions_ = changedSessions;
+    int n = doSPA(niter, sLambda, useCSparse, initTol, CGiters);
+    activeSessions_.clear();
+    return n;
+  }
+
+
   // error measure, squared
   // assumes node transforms have already been calculated
   // <tcost> is true if we just want the distance offsets
@@ -736,7 +930,7 @@ namespace sba
   {
     // set matrix sizes and clear
     // assumes scales vars are all free
-    int nFree = nodes.size() - nFixed;
+    int nFree = setupVars_();
     int nscales = scales.size();
     A.setZero(6*nFree+nscales,6*nFree+nscales);
     B.setZero(6*nFree+nscales);
@@ -754,17 +948,17 @@ namespace sba
 
         // add in 4 blocks of A; actually just need upper triangular
         // i0 < i1
-        int i0 = 6*(con.ndr-nFixed); // will be negative if fixed
-        int i1 = 6*(con.nd1-nFixed); // will be negative if fixed
+        int i0 = 6*varIndex_[con.ndr]; // will be negative if fixed
+        int i1 = 6*varIndex_[con.nd1]; // will be negative if fixed
         
         if (i0>=0)
           {
             A.block<6,6>(i0,i0) += con.J0t * con.prec * con.J0;
-            dcnt(con.ndr - nFixed)++;
+            dcnt(i0/6)++;
           }
         if (i1>=0)
           {
-            dcnt(con.nd1 - nFixed)++;
+            dcnt(i1/6)++;
             Matrix<double,6,6> tp = con.prec * con.J1;
             A.block<6,6>(i1,i1) += con.J1t * tp;
             if (i0>=0)
@@ -789,8 +983,8 @@ namespace sba
           con.setJacobians(nodes);
         // add in 4 blocks of A for t0, t1; actually just need upper triangular
         // i0 < i1
-        int i0 = 6*(con.nd0-nFixed); // will be negative if fixed
-        int i1 = 6*(con.nd1-nFixed); // will be negative if fixed
+        int i0 = 6*varIndex_[con.nd0]; // will be negative if fixed
+        int i1 = 6*varIndex_[con.nd1]; // will be negative if fixed
         
         if (i0>=0)
           {
@@ -858,7 +1052,7 @@ namespace sba
   {
     // set matrix sizes and clear
     // assumes scales vars are all free
-    int nFree = nodes.size() - nFixed;
+    int nFree = setupVars_();
 
     //    long long t0, t1, t2, t3;
     //    t0 = utime();
@@ -883,18 +1077,19 @@ namespace sba
         con.setJacobians(nodes);
 
         // add in 4 blocks of A; actually just need upper triangular
-        int i0 = con.ndr-nFixed; // will be negative if fixed
-        int i1 = con.nd1-nFixed; // will be negative if fixed
+        int i0 = varIndex_[con.ndr]; // will be negative if fixed
+        int i1 = varIndex_[con.nd1]; // will be negative if fixed
+        if (i0<0 && i1<0) continue; // nothing to do
         
         if (i0>=0)
           {
            Matrix<double,6,6> m = con.J0t*con.prec*con.J0;
             csp.addDiagBlock(m,i0);
-            dcnt(con.ndr - nFixed)++;
+            dcnt(i0)++;
           }
         if (i1>=0)
           {
-            dcnt(con.nd1 - nFixed)++;
+            dcnt(i1)++;
             Matrix<double,6,6> tp = con.prec * con.J1;
             Matrix<double,6,6> m = con.J1t * tp;
             csp.addDiagBlock(m,i1);
@@ -952,8 +1147,8 @@ namespace sba
   int SysSPA::doSPA(int niter, double sLambda, int useCSparse, double initTol,
                       int maxCGiters)
   {
-    Node::initDr();
-    int nFree = nodes.size() - nFixed; // number of free nodes
+    // check for fixed frames
+    int nFree = setupVars_();   // number of free nodes
 
     // number of nodes
     int ncams = nodes.size();
@@ -971,14 +1166,9 @@ namespace sba
     // set number of constraints
     int ncons = p2cons.size();
 
-    // check for fixed frames
     for (int i=0; i<ncams; i++)
       {
         Node &nd = nodes[i];
-        if (i >= nFixed)
-          nd.isFixed = false;
-        else 
-          nd.isFixed = true;
         nd.setTransform();      // set up world-to-node transform for cost calculation
         nd.setDr(true);         // always use local angles
       }
@@ -1119,6 +1309,11 @@ namespace sba
         }
       }
 
+    // optimized sessions are up to date
+    for (int s=0; s<(int)changedSessions.size(); s++)
+      if (activeSessions_.empty() || activeSessions_[s])
+        changedSessions[s] = 0;
+
     // return number of iterations performed
     return good_iter;
 
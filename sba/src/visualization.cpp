@@ -47,7 +47,7 @@ void drawGraph(const SysSBA &sba, const ros::Publisher &camera_pub,
   point_marker.colors.resize((int)(num_points/(double)decimation + 0.5));
   for (int i=0, ii=0; i < num_points; i += decimation, ii++)
     {
-      const Vector4d &pt = sba.tracks[i].point;
+      const Vector4d &pt = sba.tracks[i].point.cast<double>();
       point_marker.colors[ii].r = 1.0f;
       if (bicolor > 0 && i >= bicolor)
 	point_marker.colors[ii].g = 1.0f;
@@ -106,9 +106,9 @@ void drawGraph(const SysSBA &sba, const ros::Publisher &camera_pub,
           if (prj.pointPlane)	// have a ptp projection
             {
               camera_marker.points.resize(ii+2);
-              Point pt0 = sba.tracks[i].point;
-              Vector3d plane_point = prj.plane_point;
-              Vector3d plane_normal = prj.plane_normal;
+              Point pt0 = sba.tracks[i].point.cast<double>();
+              Vector3d plane_point = prj.planePoint();
+              Vector3d plane_normal = prj.planeNormal();
               Eigen::Vector3d w = pt0.head<3>()-plane_point;
               //              Eigen::Vector3d projpt = plane_point+(w.dot(plane_normal))*plane_normal;
               Eigen::Vector3d projpt = pt0.head<3>() - (w.dot(plane_normal))*plane_normal;
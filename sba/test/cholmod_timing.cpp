@@ -35,8 +35,30 @@
 #include "suitesparse/cholmod.h"
 #include "sba/sba.h"
 #include <time.h>
+#include <string.h>
 #define CPUTIME ((double) (clock ( )) / CLOCKS_PER_SEC)
 
+// Times repeated solves of the same system, as in the LM iterations of 
+// SBA/SPA:
+//   full      - analyze, factorize, solve and refine each time, freeing
+//               everything (the old CSparse::doChol path)
+//   reuse     - sba::CholmodSolver, analysis and vectors kept, with
+//               iterative refinement
+//   norefine  - sba::CholmodSolver without refinement
+
+// residual norm |b-Ax|
+static double resid(cholmod_sparse *A, cholmod_dense *b, double *x, cholmod_common *c)
+{
+  double one [2] = {1,0}, m1 [2] = {-1,0} ;
+  cholmod_dense xd = *b;
+  xd.x = x;
+  cholmod_dense *r = cholmod_copy_dense (b, c) ;
+  cholmod_sdmult (A, 0, m1, one, &xd, r, c) ;
+  double nr = cholmod_norm_dense (r, 0, c) ;
+  cholmod_free_dense (&r, c) ;
+  return nr;
+}
+
 int main (int argc, char **argv)
 {
     /* ---------------------------------------------------------------------- */
@@ -47,50 +69,94 @@ int main (int argc, char **argv)
     FILE *fb = NULL ;
     if (argc <= 1)
       {
-        printf("Usage is: cholmod_simple A.tri [B.txt (dense)]\n");
+        printf("Usage is: cholmod_timing A.tri [B.txt (dense)] [repetitions]\n");
         exit(0);
       }
     if (argc > 1)
       ff = fopen(argv[1],"r");
     if (argc > 2)
       fb = fopen(argv[2], "r");
+    int nreps = 10;
+    if (argc > 3)
+      nreps = atoi(argv[3]);
+    if (nreps < 1) nreps = 1;
 
     cholmod_sparse *A ;
-    cholmod_dense *x, *b, *r ;
+    cholmod_dense *x, *b, *r, *r2 ;
     cholmod_factor *L ;
     double one [2] = {1,0}, m1 [2] = {-1,0} ; // basic scalars 
     cholmod_common c ;
     cholmod_start (&c) ;			    /* start CHOLMOD */
+    c.print = 0;
     A = cholmod_read_sparse (ff, &c) ;              /* read in a matrix */
-    cholmod_print_sparse (A, (char *)"A", &c) ; /* print the matrix */
-    if (A->dtype) printf("A is float\n");
-    else printf("A is double\n");
     if (A == NULL || A->stype == 0)		    /* A must be symmetric */
     {
 	cholmod_free_sparse (&A, &c) ;
 	cholmod_finish (&c) ;
 	return (0) ;
     }
+    if (A->stype < 0)                               /* want upper triangle */
+      {
+        cholmod_sparse *AU = cholmod_copy (A, 1, 1, &c) ;
+        cholmod_free_sparse (&A, &c) ;
+        A = AU;
+      }
+    int n = A->nrow;
+    int nnz = ((int *)A->p)[n];
+    printf("A is %d x %d with %d nonzeros\n", n, n, nnz);
+
     if (fb)
       b = cholmod_read_dense(fb, &c);
     else
       b = cholmod_ones (A->nrow, 1, A->xtype, &c) ; /* b = ones(n,1) */
+    double *bx = (double *)b->x;
+    double *xx = new double[n];
+
+    // full path
     double t0 = CPUTIME;
-    L = cholmod_analyze (A, &c) ;		    /* analyze */
-    cholmod_factorize (A, L, &c) ;		    /* factorize */
-    x = cholmod_solve (CHOLMOD_A, L, b, &c) ;	    /* solve Ax=b */
+    for (int k=0; k<nreps; k++)
+      {
+        L = cholmod_analyze (A, &c) ;		    /* analyze */
+        cholmod_factorize (A, L, &c) ;		    /* factorize */
+        x = cholmod_solve (CHOLMOD_A, L, b, &c) ;   /* solve Ax=b */
+        r = cholmod_copy_dense (b, &c) ;	    /* r = b */
+        cholmod_sdmult (A, 0, m1, one, x, r, &c) ;  /* r = r-Ax */
+        r2 = cholmod_solve (CHOLMOD_A, L, r, &c) ;  /* refine */
+        for (int i=0; i<n; i++)
+          xx[i] = ((double *)x->x)[i] + ((double *)r2->x)[i];
+        cholmod_free_dense (&r2, &c) ;
+        cholmod_free_dense (&r, &c) ;
+        cholmod_free_dense (&x, &c) ;
+        cholmod_free_factor (&L, &c) ;
+      }
     double t1 = CPUTIME;
-    if (c.dtype) printf("Compute is float\n");
-    else printf("Compute is double\n");
-    printf("Time: %12.4f \n", t1-t0);
-    r = cholmod_copy_dense (b, &c) ;		    /* r = b */
-    cholmod_sdmult (A, 0, m1, one, x, r, &c) ;	    /* r = r-Ax */
-    printf ("norm(b-Ax) %8.1e\n",
-	    cholmod_norm_dense (r, 0, &c)) ;	    /* print norm(r) */
-    cholmod_free_factor (&L, &c) ;		    /* free matrices */
+    printf("full      %10.4f ms/solve  norm(b-Ax) %8.1e\n", 
+           1000.0*(t1-t0)/nreps, resid(A,b,xx,&c));
+
+    // solver object, with and without refinement
+    for (int refine=1; refine>=0; refine--)
+      {
+        sba::CholmodSolver chol;
+        chol.refine = refine;
+        cholmod_sparse *AS = chol.reserve(n,nnz);
+        memcpy(AS->p, A->p, (n+1)*sizeof(int));
+        memcpy(AS->i, A->i, nnz*sizeof(int));
+        memcpy(AS->x, A->x, nnz*sizeof(double));
+        t0 = CPUTIME;
+        for (int k=0; k<nreps; k++)
+          {
+            chol.setPattern();
+            memcpy(xx, bx, n*sizeof(double));
+            chol.solve(xx);
+          }
+        t1 = CPUTIME;
+        printf("%-9s %10.4f ms/solve  norm(b-Ax) %8.1e  analyses %d  factorizations %d\n",
+               refine ? "reuse" : "norefine", 1000.0*(t1-t0)/nreps, 
+               resid(A,b,xx,&c), chol.nanalyze, chol.nfactor);
+      }
+
+    delete [] xx;
     cholmod_free_sparse (&A, &c) ;
-    cholmod_free_dense (&r, &c) ;
-    cholmod_free_dense (&x, &c) ;
     cholmod_free_dense (&b, &c) ;
     cholmod_finish (&c) ;			    /* finish CHOLMOD */
     return (0) ;
@@ -0,0 +1,143 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+// map culling: high-error projections, short tracks, and redundant nodes
+
+#include <vector>
+using namespace std;
+
+#include <sba/sba.h>
+
+// Bring in gtest
+#include <gtest/gtest.h>
+
+using namespace Eigen;
+using namespace sba;
+
+static const int nnodes = 5;
+static const int npts = 20;
+
+// nodes along x, all seeing a wall of points, with exact projections
+static void setup(SysSBA &sys)
+{
+  frame_common::CamParams cpars = {430,430,320,240,0};
+  for (int i=0; i<nnodes; i++)
+    {
+      Vector4d trans(0.2*i, 0, 0, 1);
+      Quaterniond rot(1, 0, 0, 0);
+      sys.addNode(trans, rot, cpars, i == 0);
+    }
+  sys.nFixed = 1;
+
+  for (int i=0; i<npts; i++)
+    {
+      Point pt(0.2*(i%5) - 0.4, 0.2*(i/5) - 0.3, 5.0, 1.0);
+      int pi = sys.addPoint(pt);
+      for (int j=0; j<nnodes; j++)
+        {
+          Vector2d kp;
+          sys.nodes[j].project2im(kp, pt);
+          sys.addMonoProj(j, pi, kp);
+        }
+    }
+}
+
+// cullPoints() drops projections with more than <maxerr> pixels of error
+TEST(TestCull, CullPointsMaxErr)
+{
+  SysSBA sys;
+  setup(sys);
+  double maxerr = 4.0;
+  sys.tracks[3].projections[2].kp.x() += 1.1*maxerr;
+  sys.tracks[5].projections[1].kp.y() += 0.9*maxerr;
+
+  vector<int> pidx;
+  EXPECT_EQ(0, sys.cullPoints(2, maxerr, 0, pidx));
+  ASSERT_EQ(npts, (int)sys.tracks.size());
+  EXPECT_EQ(0, (int)sys.tracks[3].projections.count(2));
+  EXPECT_EQ(nnodes-1, (int)sys.tracks[3].projections.size());
+  EXPECT_EQ(nnodes, (int)sys.tracks[5].projections.size());
+  EXPECT_EQ(nnodes*npts-1, sys.covis.numObs(0) + sys.covis.numObs(1) +
+            sys.covis.numObs(2) + sys.covis.numObs(3) + sys.covis.numObs(4));
+}
+
+// redundant nodes are picked greedily, and scores drop as nodes go
+TEST(TestCull, RedundantNodes)
+{
+  SysSBA sys;
+  setup(sys);
+
+  vector<int> nds;
+  sys.findRedundantNodes(0.9, 2, 1, nds); // node 0 is fixed, 4 is kept
+  ASSERT_EQ(3, (int)nds.size());
+  EXPECT_EQ(1, nds[0]);
+  EXPECT_EQ(3, nds[2]);
+
+  sys.findRedundantNodes(0.9, 3, 1, nds); // 3 goes, then 2; 1 is needed
+  ASSERT_EQ(2, (int)nds.size());
+  EXPECT_EQ(2, nds[0]);
+  EXPECT_EQ(3, nds[1]);
+
+  vector<int> nidx, pidx;
+  EXPECT_EQ(0, sys.removeNodes(nds, nidx, pidx));
+  ASSERT_EQ(3, (int)sys.nodes.size());
+  EXPECT_EQ(-1, nidx[3]);
+  EXPECT_EQ(2, nidx[4]);
+  ASSERT_EQ(npts, (int)sys.tracks.size());
+  for (int i=0; i<npts; i++)
+    {
+      ProjMap &prjs = sys.tracks[i].projections;
+      ASSERT_EQ(3, (int)prjs.size());
+      for (ProjMap::iterator itr = prjs.begin(); itr != prjs.end(); itr++)
+        EXPECT_EQ(itr->first, itr->second.ndi);
+    }
+  EXPECT_EQ(3, sys.covis.numNodes());
+  EXPECT_EQ(npts, sys.covis.weight(0,2));
+  EXPECT_EQ(npts, sys.covis.numObs(2));
+
+  // removing a node can leave tracks with a single projection
+  nds[0] = 1;
+  nds[1] = 2;
+  EXPECT_EQ(npts, sys.removeNodes(nds, nidx, pidx));
+  EXPECT_EQ(1, (int)sys.nodes.size());
+  EXPECT_EQ(0, (int)sys.tracks.size());
+  EXPECT_EQ(0, sys.covis.numEdges());
+  EXPECT_EQ(0, sys.covis.numObs(0));
+}
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -44,6 +44,10 @@
 // For random seed.
 #include <time.h>
 
+#include <sstream>
+#include <fstream>
+#include <cmath>
+
 using namespace sba;
 using namespace std;
 
@@ -204,6 +208,209 @@ TEST_F(SBAFileIOTest, WriteRead)
     // Don't check nodes yet because we don't store node information. To do!    
 }
 
+TEST_F(SBAFileIOTest, BinaryGraph)
+{
+    SysSBA testsys;
+    const char *filename = "file_io_test.bin";
+
+    sys.tracks[0].projections.begin()->second.isValid = false;
+    EXPECT_EQ(0, writeBinaryGraphFile(filename, sys));
+    EXPECT_EQ(0, readBinaryGraphFile(filename, testsys));
+
+    ASSERT_EQ(sys.nodes.size(), testsys.nodes.size());
+    ASSERT_EQ(sys.tracks.size(), testsys.tracks.size());
+    for (unsigned int i = 0; i < sys.nodes.size(); i++)
+    {
+      EXPECT_TRUE(sys.nodes[i].trans == testsys.nodes[i].trans);
+      EXPECT_TRUE(sys.nodes[i].qrot.coeffs() == testsys.nodes[i].qrot.coeffs());
+      EXPECT_TRUE(sys.nodes[i].Kcam == testsys.nodes[i].Kcam);
+    }
+    for (unsigned int i = 0; i < sys.tracks.size(); i++)
+    {
+      EXPECT_TRUE(sys.tracks[i].point == testsys.tracks[i].point);
+      ProjMap &prjs = sys.tracks[i].projections;
+      ProjMap &testprjs = testsys.tracks[i].projections;
+      ASSERT_EQ(prjs.size(), testprjs.size());
+      for (ProjMap::iterator itr = prjs.begin(); itr != prjs.end(); itr++)
+      {
+        Proj &prj = testprjs[itr->first];
+        // keypoints are stored as floats
+        EXPECT_NEAR(itr->second.kp(0), prj.kp(0), 1e-4);
+        EXPECT_NEAR(itr->second.kp(1), prj.kp(1), 1e-4);
+        EXPECT_EQ(itr->second.stereo, prj.stereo);
+        EXPECT_EQ(itr->second.isValid, prj.isValid);
+      }
+    }
+}
+
+// files from the background writer are the same as the direct ones
+TEST_F(SBAFileIOTest, GraphWriter)
+{
+    writeGraphFile("file_io_test.g2o", sys);
+    writeGraphFile("file_io_test_m.g2o", sys, true);
+    {
+      GraphWriter writer;
+      EXPECT_TRUE(writer.write("file_io_test_bg.g2o", sys, GRAPH_TEXT, true));
+      EXPECT_TRUE(writer.write("file_io_test_bg_m.g2o", sys, GRAPH_TEXT_MONO, true));
+      writer.flush();
+      EXPECT_EQ(0, writer.pending());
+    }
+
+    const char *files[2][2] = { { "file_io_test.g2o", "file_io_test_bg.g2o" },
+                                { "file_io_test_m.g2o", "file_io_test_bg_m.g2o" } };
+    for (int i = 0; i < 2; i++)
+    {
+      ifstream f0(files[i][0]), f1(files[i][1]);
+      stringstream s0, s1;
+      s0 << f0.rdbuf();
+      s1 << f1.rdbuf();
+      EXPECT_FALSE(s0.str().empty());
+      EXPECT_EQ(s0.str(), s1.str());
+    }
+}
+
+// the graph file writer as it was, on iostreams
+static void writeGraphFileStream(const char *filename, SysSBA &sba, bool mono)
+{
+    ofstream outfile(filename, ios_base::trunc);
+    outfile.precision(5);
+    outfile.setf(ios_base::fixed);
+
+    int ncams = sba.nodes.size();
+    for (int i = 0; i < ncams; i++)
+    {
+      outfile << "VERTEX_CAM" << " ";
+      outfile << i << " ";
+      Eigen::Vector3d trans = sba.nodes[i].trans.head<3>();
+      outfile << trans(0) << ' ' << trans(1) << ' ' << trans(2) << ' ';
+      Eigen::Vector4d rot = sba.nodes[i].qrot.coeffs();
+      outfile << rot(0) << ' ' << rot(1) << ' ' << rot(2) << ' ' << rot(3) << ' ';
+      outfile << sba.nodes[i].Kcam(0,0) << ' ' << sba.nodes[i].Kcam(1,1) << ' ' << 
+        sba.nodes[i].Kcam(0,2) << ' ' << sba.nodes[i].Kcam(1,2) << ' ' << sba.nodes[i].baseline << endl;
+    }
+
+    for (int i = 0; i < (int)sba.tracks.size(); i++)
+    {
+      outfile << "VERTEX_XYZ" << ' ' << ncams+i << ' ';
+      outfile << sba.tracks[i].point(0) << ' ' << sba.tracks[i].point(1) 
+              << ' ' << sba.tracks[i].point(2) << endl;
+      ProjMap &prjs = sba.tracks[i].projections;
+      for(ProjMap::iterator itr = prjs.begin(); itr != prjs.end(); itr++)
+      {
+        Proj &prj = itr->second;
+        if (prj.stereo && !mono)
+        {
+          outfile << "EDGE_PROJECT_P2SC ";
+          outfile << ncams+i << ' ' << prj.ndi << ' ' << prj.kp(0) << ' ' 
+                  << prj.kp(1) << ' ' << prj.kp(2) << ' ';
+          outfile << "1 0 0 0 1 1" << endl;
+        }
+        else
+        {
+          outfile << "EDGE_PROJECT_P2MC ";
+          outfile << ncams+i << ' ' << prj.ndi << ' ' << prj.kp(0) << ' ' 
+                  << prj.kp(1) << ' ';
+          outfile << "1 0 1" << endl;
+        }
+      }
+    }
+}
+
+static string readFile(const char *filename)
+{
+    ifstream f(filename);
+    stringstream ss;
+    ss << f.rdbuf();
+    return ss.str();
+}
+
+// the fast text output is byte for byte what the iostream writer gave,
+// including negative zeros, values that round to zero, near ties and
+// large values
+TEST_F(SBAFileIOTest, GraphWriterMatchesStream)
+{
+    sys.nodes[1].trans(1) = -0.0;
+    sys.nodes[2].trans(2) = -1.0e-7;
+    sys.nodes[3].qrot.x() = -0.000004;
+    sys.nodes[4].trans(0) = 123456789.123456;
+    sys.tracks[0].point(0) = -0.0;
+    sys.tracks[0].point(1) = -0.000005;
+    sys.tracks[0].point(2) = 1.000005;
+    sys.tracks[1].point(0) = -2.5e-6;
+    sys.tracks[1].point(1) = 0.125;
+    sys.tracks[1].point(2) = -0.999999999;
+    for (unsigned int i = 2; i < sys.tracks.size(); i++)
+      for (int k = 0; k < 3; k++)
+        sys.tracks[i].point(k) = (drand48() - 0.5) * pow(10.0, (int)(drand48()*12) - 6);
+    for (unsigned int i = 0; i < sys.tracks.size(); i++)
+    {
+      ProjMap &prjs = sys.tracks[i].projections;
+      for (ProjMap::iterator itr = prjs.begin(); itr != prjs.end(); itr++)
+      {
+        itr->second.stereo = i%2 == 0;
+        itr->second.kp(2) = i%3 == 0 ? -1.0e-9 : (drand48() - 0.5) * 100.0;
+      }
+    }
+
+    {
+      GraphWriter writer;
+      EXPECT_TRUE(writer.write("file_io_test_fast.g2o", sys, GRAPH_TEXT, true));
+      EXPECT_TRUE(writer.write("file_io_test_fast_m.g2o", sys, GRAPH_TEXT_MONO, true));
+    }
+    writeGraphFileStream("file_io_test_stream.g2o", sys, false);
+    writeGraphFileStream("file_io_test_stream_m.g2o", sys, true);
+
+    string s0 = readFile("file_io_test_stream.g2o");
+    EXPECT_FALSE(s0.empty());
+    EXPECT_NE(string::npos, s0.find(" -0.00000 "));
+    EXPECT_EQ(s0, readFile("file_io_test_fast.g2o"));
+    EXPECT_EQ(readFile("file_io_test_stream_m.g2o"), readFile("file_io_test_fast_m.g2o"));
+}
+
+// projections into cameras that aren't in the file are rejected
+TEST_F(SBAFileIOTest, BinaryGraphBadCamera)
+{
+    const char *filename = "file_io_test_bad.bin";
+    ASSERT_LT(0, (int)sys.tracks[0].projections.size());
+    EXPECT_EQ(0, writeBinaryGraphFile(filename, sys));
+
+    // header, cameras, then the first point and its projection count
+    long pos = 4 + 4*sizeof(int) + sys.nodes.size()*12*sizeof(double) +
+      3*sizeof(double) + sizeof(int);
+    FILE *fp = fopen(filename, "r+b");
+    ASSERT_TRUE(fp != NULL);
+    int ci = sys.nodes.size();
+    fseek(fp, pos, SEEK_SET);
+    fwrite(&ci, sizeof(int), 1, fp);
+    fclose(fp);
+
+    // the system is left as it was
+    SysSBA testsys;
+    EXPECT_EQ(-1, readBinaryGraphFile(filename, testsys));
+    EXPECT_EQ(0u, testsys.nodes.size());
+    EXPECT_EQ(0u, testsys.tracks.size());
+}
+
+// counts that don't fit in the file are rejected before anything is read
+TEST_F(SBAFileIOTest, BinaryGraphBadCounts)
+{
+    const char *filename = "file_io_test_bad.bin";
+    EXPECT_EQ(0, writeBinaryGraphFile(filename, sys));
+
+    // the point count, after the magic, version and camera count
+    FILE *fp = fopen(filename, "r+b");
+    ASSERT_TRUE(fp != NULL);
+    int npts = 0x7fffffff;
+    fseek(fp, 4 + 2*sizeof(int), SEEK_SET);
+    fwrite(&npts, sizeof(int), 1, fp);
+    fclose(fp);
+
+    SysSBA testsys;
+    EXPECT_EQ(-1, readBinaryGraphFile(filename, testsys));
+    EXPECT_EQ(0u, testsys.nodes.size());
+    EXPECT_EQ(0u, testsys.tracks.size());
+}
+
 int main(int argc, char **argv)
 {
     testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,267 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+// scaling benchmark: solve synthetic problems of increasing size with
+// each solver method, to see which method to use at which map size
+// not using gtest here
+
+#include "sba/sba.h"
+#include "sba/sba_setup.h"
+using namespace Eigen;
+using namespace sba;
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <sys/time.h>
+
+using namespace std;
+
+#define SAVE_RESULTS
+
+// largest dense system to attempt, in variables
+static const int maxDenseVars = 3000;
+
+// stop sweeping a method once a solve takes longer than this (ms)
+static const double maxSolveTime = 300000.0;
+
+// solver methods
+struct Method
+{
+  const char *name;
+  int type;
+  bool cholmod;
+};
+
+static const Method methods[] = {
+  {"dense",   SBA_DENSE_CHOLESKY,     false},
+  {"sparse",  SBA_SPARSE_CHOLESKY,    false},
+  {"cholmod", SBA_SPARSE_CHOLESKY,    true},
+  {"pcg",     SBA_BLOCK_JACOBIAN_PCG, false}
+};
+static const int nmethods = sizeof(methods)/sizeof(methods[0]);
+
+// result of one run
+struct Result
+{
+  int npts, nmeas;
+  int iters;
+  double setup, solve;          // ms
+  double cost0, cost;
+  double err;                   // RMS node position error (m)
+};
+
+// RMS distance of node positions from the true ones
+template <class NodeVec, class PosVec>
+static double posError(const NodeVec &nodes, const PosVec &cps, int dim)
+{
+  double sum = 0.0;
+  for (int i=0; i<(int)nodes.size(); i++)
+    for (int j=0; j<dim; j++)
+      {
+        double d = nodes[i].trans[j] - cps[i][j];
+        sum += d*d;
+      }
+  return nodes.size() > 0 ? sqrt(sum/nodes.size()) : 0.0;
+}
+
+// each run generates its problem again; the generator is
+// deterministic, so every method sees the same problem
+static void runSBA(const SynthParams &sp, const Method &m, int niters, Result &res)
+{
+  CamParams cpars = {300,300,320,240,0.1}; // 300 pix focal length, 10 cm baseline
+  vector<Matrix<double,6,1>, Eigen::aligned_allocator<Matrix<double,6,1> > > cps;
+  SysSBA sba;
+  sba.verbose = 0;
+  sba.nFixed = sp.stereo ? 1 : 2;
+  sba.useCholmod(m.cholmod);
+
+  long long t0 = utime();
+  synth_sba_setup(sba, cpars, cps, sp);
+  long long t1 = utime();
+  res.npts = sba.tracks.size();
+  res.nmeas = sba.countProjs();
+  res.cost0 = sba.calcCost();
+  res.iters = sba.doSBA(niters, 1.0e-4, m.type);
+  long long t2 = utime();
+  res.cost = sba.calcCost();
+  res.setup = (t1-t0)*0.001;
+  res.solve = (t2-t1)*0.001;
+  res.err = posError(sba.nodes, cps, 3);
+}
+
+static void runSPA(const SynthParams &sp, const Method &m, int niters, Result &res)
+{
+  vector<Matrix<double,6,1>, Eigen::aligned_allocator<Matrix<double,6,1> > > cps;
+  SysSPA spa;
+  spa.verbose = 0;
+  spa.csp.useCholmod = m.cholmod;
+
+  long long t0 = utime();
+  synth_spa_setup(spa, cps, sp);
+  long long t1 = utime();
+  res.npts = 0;
+  res.nmeas = spa.p2cons.size();
+  res.cost0 = spa.calcCost();
+  res.iters = spa.doSPA(niters, 1.0e-4, m.type);
+  long long t2 = utime();
+  res.cost = spa.calcCost();
+  res.setup = (t1-t0)*0.001;
+  res.solve = (t2-t1)*0.001;
+  res.err = posError(spa.nodes, cps, 3);
+}
+
+static void runSPA2d(const SynthParams &sp, const Method &m, int niters, Result &res)
+{
+  vector<Matrix<double,3,1>, Eigen::aligned_allocator<Matrix<double,3,1> > > cps;
+  SysSPA2d spa;
+  spa.verbose = 0;
+  spa.useCholmod(m.cholmod);
+
+  long long t0 = utime();
+  synth_spa2d_setup(spa, cps, sp);
+  long long t1 = utime();
+  res.npts = 0;
+  res.nmeas = spa.p2cons.size();
+  res.cost0 = spa.calcCost();
+  res.iters = spa.doSPA(niters, 1.0e-4, m.type);
+  long long t2 = utime();
+  res.cost = spa.calcCost();
+  res.setup = (t1-t0)*0.001;
+  res.solve = (t2-t1)*0.001;
+  res.err = posError(spa.nodes, cps, 2);
+}
+
+
+int main(int argc, char **argv)
+{
+  printf("Args are: <sba|mono|spa|spa2d> [max nodes 100000] [methods dense,sparse,cholmod,pcg] "
+         "[iterations 10] [loop closure rate 0.2] [outlier rate 0.0] [points per node 20] "
+         "[track length 6] [seed 1]\n");
+
+  if (argc < 2)
+    return 0;
+
+  string type = argv[1];
+  int dof = 6;
+  if (type == "spa2d")
+    dof = 3;
+  else if (type != "sba" && type != "mono" && type != "spa")
+    {
+      printf("[Scaling] Unknown problem type %s\n", argv[1]);
+      return 1;
+    }
+
+  int maxNodes = argc > 2 ? atoi(argv[2]) : 100000;
+  string mlist = argc > 3 ? argv[3] : "dense,sparse,cholmod,pcg";
+  int niters = argc > 4 ? atoi(argv[4]) : 10;
+
+  SynthParams sp;
+  sp.stereo = type != "mono";
+  if (argc > 5) sp.loopRate = atof(argv[5]);
+  if (argc > 6) sp.outlierRate = atof(argv[6]);
+  if (argc > 7) sp.ptsPerNode = atoi(argv[7]);
+  if (argc > 8) sp.trackLen = atoi(argv[8]);
+  if (argc > 9) sp.seed = atoi(argv[9]);
+
+  // methods asked for
+  bool use[nmethods];
+  for (int k=0; k<nmethods; k++)
+    {
+      string name = methods[k].name;
+      size_t pos = (","+mlist+",").find(","+name+",");
+      use[k] = pos != string::npos;
+#ifndef SBA_CHOLMOD
+      if (methods[k].cholmod) use[k] = false;
+#endif
+    }
+
+#ifdef SAVE_RESULTS
+  FILE *fd = fopen("scaling.txt","a");
+#endif
+
+  printf("%-6s %-8s %8s %9s %10s %9s %5s %11s %10s %12s %12s %9s\n",
+         "type", "method", "nodes", "points", "meas", "setup ms", "iter",
+         "solve ms", "ms/iter", "init cost", "final cost", "err m");
+
+  // sizes 1, 2, 5 x 10^k
+  static const int steps[3] = {1, 2, 5};
+  for (int scale = 100; scale <= maxNodes; scale *= 10)
+    for (int f = 0; f < 3; f++)
+      {
+        int nnodes = scale*steps[f];
+        if (nnodes > maxNodes) break;
+        sp.nnodes = nnodes;
+
+        for (int k=0; k<nmethods; k++)
+          {
+            const Method &m = methods[k];
+            if (!use[k]) continue;
+            if (m.type == SBA_DENSE_CHOLESKY && nnodes*dof > maxDenseVars) continue;
+
+            Result res;
+            if (type == "spa")
+              runSPA(sp, m, niters, res);
+            else if (type == "spa2d")
+              runSPA2d(sp, m, niters, res);
+            else
+              runSBA(sp, m, niters, res);
+
+            double msIter = res.iters > 0 ? res.solve/res.iters : 0.0;
+            printf("%-6s %-8s %8d %9d %10d %9.1f %5d %11.1f %10.2f %12.5g %12.5g %9.4f\n",
+                   type.c_str(), m.name, nnodes, res.npts, res.nmeas, res.setup,
+                   res.iters, res.solve, msIter, res.cost0, res.cost, res.err);
+            fflush(stdout);
+#ifdef SAVE_RESULTS
+            if (fd)
+              {
+                fprintf(fd, "%s %s %d %d %d %f %d %f %f %g %g %f\n",
+                        type.c_str(), m.name, nnodes, res.npts, res.nmeas, res.setup,
+                        res.iters, res.solve, msIter, res.cost0, res.cost, res.err);
+                fflush(fd);
+              }
+#endif
+
+            // too slow to go on
+            if (res.solve > maxSolveTime)
+              use[k] = false;
+          }
+      }
+
+#ifdef SAVE_RESULTS
+  if (fd) fclose(fd);
+#endif
+  return 0;
+}
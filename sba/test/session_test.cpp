@@ -0,0 +1,187 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+// multi-session pose graphs: sessions built in their own frames, joined
+// by loop closures, and optimized together or one at a time
+
+#include <iostream>
+#include <vector>
+using namespace std;
+
+#include "sba/sba_setup.h"
+
+// Bring in gtest
+#include <gtest/gtest.h>
+
+using namespace Eigen;
+using namespace sba;
+
+// solver for all tests
+static const int method = SBA_SPARSE_CHOLESKY;
+
+// rotation measurement of a constraint, as given to addConstraint()
+static Quaterniond conRot(const ConP2 &con)
+{
+  return con.qpmean.inverse();
+}
+
+// Split a synthetic problem in two sessions at node <split>; the second
+// session starts in its own frame, shifted and turned from the first.
+// Constraints between the sessions are added last.
+static void twoSessions(const SysSPA &ref, SysSPA &spa, int split)
+{
+  Quaterniond qs(AngleAxisd(1.0, Vector3d(0.2, 0.3, 1.0).normalized()));
+  Vector3d ts(5.0, -3.0, 1.0);
+
+  EXPECT_EQ(0, spa.addSession());
+  for (int i=0; i<(int)ref.nodes.size(); i++)
+    {
+      if (i == split)
+        EXPECT_EQ(1, spa.addSession());
+      Vector4d trans = ref.nodes[i].trans;
+      Quaterniond q = ref.nodes[i].qrot;
+      if (i >= split)
+        {
+          trans.head(3) = qs*trans.head<3>() + ts;
+          q = qs*q;
+        }
+      spa.addNode(trans, q);
+    }
+  EXPECT_EQ(0, spa.anchors[0]);
+  EXPECT_EQ(split, spa.anchors[1]);
+
+  for (int k=0; k<2; k++)
+    for (int i=0; i<(int)ref.p2cons.size(); i++)
+      {
+        ConP2 con = ref.p2cons[i];
+        bool cross = (con.ndr < split) != (con.nd1 < split);
+        if (cross != (k == 1)) continue;
+        Quaterniond q = conRot(con);
+        spa.addConstraint(con.ndr, con.nd1, con.tmean, q, con.prec);
+      }
+}
+
+static void makeProblem(SysSPA &ref)
+{
+  vector<Matrix<double,6,1>, Eigen::aligned_allocator<Matrix<double,6,1> > > cps;
+  SynthParams sp;
+  sp.nnodes = 300;
+  sp.lapNodes = 100;
+  sp.loopRate = 0.3;
+  synth_spa_setup(ref, cps, sp);
+}
+
+
+// joined sessions optimize to the same answer as a single graph
+TEST(TestSessions, JoinedSessions)
+{
+  SysSPA ref;
+  makeProblem(ref);
+
+  SysSPA spa;
+  twoSessions(ref, spa, 150);
+
+  // the join brings the second session into the frame of the first
+  EXPECT_LT((spa.nodes[150].trans - ref.nodes[150].trans).norm(), 0.5);
+
+  ref.doSPA(20, 1.0e-4, method);
+  spa.doSessionSPA(-1, 20, 1.0e-4, method);
+
+  EXPECT_NEAR(ref.calcCost(), spa.calcCost(), 1.0e-3*ref.calcCost());
+  for (int i=0; i<(int)ref.nodes.size(); i++)
+    EXPECT_LT((spa.nodes[i].trans - ref.nodes[i].trans).norm(), 1.0e-3);
+  EXPECT_EQ(0, spa.changedSessions[0]);
+  EXPECT_EQ(0, spa.changedSessions[1]);
+}
+
+
+// optimizing one session leaves the others alone
+TEST(TestSessions, OneSession)
+{
+  SysSPA ref;
+  makeProblem(ref);
+  SysSPA spa;
+  twoSessions(ref, spa, 150);
+
+  vector<Vector4d, Eigen::aligned_allocator<Vector4d> > before;
+  for (int i=0; i<150; i++)
+    before.push_back(spa.nodes[i].trans);
+
+  double cost0 = spa.calcCost();
+  spa.doSessionSPA(1, 20, 1.0e-4, method);
+  EXPECT_LT(spa.calcCost(), cost0);
+  for (int i=0; i<150; i++)
+    EXPECT_TRUE(before[i] == spa.nodes[i].trans);
+  EXPECT_EQ(1, spa.changedSessions[0]);
+  EXPECT_EQ(0, spa.changedSessions[1]);
+}
+
+
+// only sessions with new constraints are optimized again
+TEST(TestSessions, ChangedSessions)
+{
+  SysSPA ref;
+  makeProblem(ref);
+  SysSPA spa;
+  twoSessions(ref, spa, 150);
+  spa.doSessionSPA(-1, 20, 1.0e-4, method);
+  EXPECT_EQ(0, spa.doChangedSPA(20, 1.0e-4, method)); // nothing to do
+
+  vector<Vector4d, Eigen::aligned_allocator<Vector4d> > before;
+  for (int i=0; i<(int)spa.nodes.size(); i++)
+    before.push_back(spa.nodes[i].trans);
+
+  // disturbed loop closure inside the second session
+  ConP2 con = ref.p2cons[250];
+  ASSERT_GE(con.ndr, 150);
+  Vector3d tm = con.tmean + Vector3d(0.3, 0.0, 0.0);
+  Quaterniond q = conRot(con);
+  spa.addConstraint(con.ndr, con.nd1, tm, q, con.prec);
+  EXPECT_EQ(0, spa.changedSessions[0]);
+  EXPECT_EQ(1, spa.changedSessions[1]);
+
+  spa.doChangedSPA(20, 1.0e-4, method);
+  for (int i=0; i<150; i++)
+    EXPECT_TRUE(before[i] == spa.nodes[i].trans);
+  bool moved = false;
+  for (int i=150; i<(int)spa.nodes.size(); i++)
+    moved |= before[i] != spa.nodes[i].trans;
+  EXPECT_TRUE(moved);
+}
+
+
+int main(int argc, char **argv){
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
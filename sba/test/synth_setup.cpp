@@ -0,0 +1,437 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+//
+// synthetic large-scale SBA and SPA problems, for scaling benchmarks
+//
+// Nodes travel laps of a circuit of <lapNodes> nodes; each lap is
+// displaced outwards by <lapShift>, so revisits give loop closures to
+// the previous lap.  All randomness comes from a private generator
+// seeded from the parameters, so the same parameters always give the
+// same problem, and generation time is linear in the number of nodes.
+//
+
+#include "sba/sba_setup.h"
+#include <stdlib.h>
+
+// random numbers; erand48 keeps its own state, so the global
+// drand48 sequence used by the other setups is untouched
+class SynthRand
+{
+  public:
+    SynthRand(unsigned int seed)
+    { xs[0] = 0x330e; xs[1] = seed & 0xffff; xs[2] = seed >> 16; }
+
+    // uniform in [0,1)
+    double uniform()
+    { return erand48(xs); }
+
+    // normal with std dev <s>, Box-Muller
+    double gauss(double s)
+    {
+      double u = 1.0 - uniform(); // (0,1]
+      return s * sqrt(-2.0*log(u)) * cos(2.0*M_PI*uniform());
+    }
+
+    // small rotation, with std dev <s> radians about each axis
+    Quaternion<double> rotation(double s)
+    {
+      Vector3d v(gauss(s), gauss(s), gauss(s));
+      double ang = v.norm();
+      if (ang == 0.0) return Quaternion<double>::Identity();
+      return Quaternion<double>(AngleAxis<double>(ang, v/ang));
+    }
+
+  private:
+    unsigned short xs[3];
+};
+
+
+// true position and heading of node <i>, on the plane z = 0
+static void
+synth_pose(const SynthParams &sp, int i, Vector3d &pos, double &th)
+{
+  int lap = i / sp.lapNodes;
+  double a = 2.0*M_PI*(i % sp.lapNodes)/sp.lapNodes;
+  double r = sp.lapNodes*sp.nodeDist/(2.0*M_PI) + lap*sp.lapShift;
+  pos = Vector3d(r*cos(a), r*sin(a), 0.0);
+  th = a + M_PI/2.0;            // moving counterclockwise
+}
+
+// camera looking along heading <th>, y axis down, as a rotation to the world
+static Quaternion<double>
+synth_rot(double th)
+{
+  Matrix3d R;
+  R.col(0) = Vector3d(sin(th), -cos(th), 0.0); // to the right, outwards
+  R.col(1) = Vector3d(0.0, 0.0, -1.0);
+  R.col(2) = Vector3d(cos(th), sin(th), 0.0);
+  Quaternion<double> q(R);
+  q.normalize();
+  if (q.w() < 0.0) q.coeffs() = -q.coeffs();
+  return q;
+}
+
+// node that <i> closes a loop with, or -1 if there is none
+static int
+synth_loop(const SynthParams &sp, int i, SynthRand &rnd)
+{
+  if (i < sp.lapNodes || rnd.uniform() >= sp.loopRate)
+    return -1;
+  if (rnd.uniform() < sp.outlierRate) // false place recognition
+    return (int)(rnd.uniform()*(i-1));
+  return i - sp.lapNodes;
+}
+
+// precision for a measurement noise, or unit if there is no noise
+static inline double
+synth_prec(double s)
+{
+  return s > 0.0 ? 1.0/(s*s) : 1.0;
+}
+
+
+//
+// SysSPA, 6DOF pose constraints
+// initial poses are dead reckoned from the noisy odometry constraints
+//
+
+// relative pose of <j> in the frame of <i>
+static void
+synth_rel(const Vector3d &pi, const Quaternion<double> &qi,
+          const Vector3d &pj, const Quaternion<double> &qj,
+          Vector3d &tm, Quaternion<double> &qm)
+{
+  tm = qi.inverse()*(pj - pi);
+  qm = qi.inverse()*qj;
+}
+
+void
+synth_spa_setup(SysSPA &spa,
+                vector<Matrix<double,6,1>, Eigen::aligned_allocator<Matrix<double,6,1> > > &cps,
+                const SynthParams &sp)
+{
+  SynthRand rnd(sp.seed);
+  int n = sp.nnodes;
+
+  // true poses
+  vector<Vector3d, Eigen::aligned_allocator<Vector3d> > tpos(n);
+  vector<Quaternion<double>, Eigen::aligned_allocator<Quaternion<double> > > trot(n);
+  cps.resize(n);
+  for (int i=0; i<n; i++)
+    {
+      double th;
+      synth_pose(sp, i, tpos[i], th);
+      trot[i] = synth_rot(th);
+      cps[i].head(3) = tpos[i];
+      cps[i].segment<3>(3) = trot[i].vec();
+    }
+
+  // quaternion residuals are half angles
+  Matrix<double,6,6> prec;
+  prec.setZero();
+  prec.diagonal().head(3).setConstant(synth_prec(sp.pnoise));
+  prec.diagonal().tail(3).setConstant(synth_prec(0.5*sp.qnoise));
+
+  spa.nodes.reserve(n);
+  spa.p2cons.reserve((int)(n*(1.0+sp.loopRate)));
+
+  Vector4d trans(tpos[0][0], tpos[0][1], tpos[0][2], 1.0);
+  Quaternion<double> q = trot[0];
+  spa.addNode(trans, q);
+
+  for (int i=1; i<n; i++)
+    {
+      // odometry from the previous node
+      Vector3d tm;
+      Quaternion<double> qm;
+      synth_rel(tpos[i-1], trot[i-1], tpos[i], trot[i], tm, qm);
+      tm += Vector3d(rnd.gauss(sp.pnoise), rnd.gauss(sp.pnoise), rnd.gauss(sp.pnoise));
+      qm = qm*rnd.rotation(sp.qnoise);
+      qm.normalize();
+
+      // dead reckoning
+      const Node &nd = spa.nodes[i-1];
+      trans.head(3) = nd.trans.head(3) + nd.qrot*tm;
+      q = nd.qrot*qm;
+      q.normalize();
+      if (q.w() < 0.0) q.coeffs() = -q.coeffs();
+      spa.addNode(trans, q);
+      spa.addConstraint(i-1, i, tm, qm, prec);
+
+      // loop closure, measured from the true relative pose of the
+      // previous lap, even for false ones
+      int j = synth_loop(sp, i, rnd);
+      if (j >= 0)
+        {
+          synth_rel(tpos[i-sp.lapNodes], trot[i-sp.lapNodes], tpos[i], trot[i], tm, qm);
+          tm += Vector3d(rnd.gauss(sp.pnoise), rnd.gauss(sp.pnoise), rnd.gauss(sp.pnoise));
+          qm = qm*rnd.rotation(sp.qnoise);
+          qm.normalize();
+          spa.addConstraint(j, i, tm, qm, prec);
+        }
+    }
+}
+
+
+//
+// SysSPA2d, planar pose constraints
+//
+
+// relative pose of <j> in the frame of <i>, as x,y,th
+static Vector3d
+synth_rel2d(const Vector3d &pi, const Vector3d &pj)
+{
+  double c = cos(pi[2]), s = sin(pi[2]);
+  double dx = pj[0]-pi[0], dy = pj[1]-pi[1];
+  double da = pj[2]-pi[2];
+  while (da > M_PI) da -= 2.0*M_PI;
+  while (da < -M_PI) da += 2.0*M_PI;
+  return Vector3d(c*dx + s*dy, -s*dx + c*dy, da);
+}
+
+// node <pi> moved by <m> in its own frame
+static Vector3d
+synth_compose2d(const Vector3d &pi, const Vector3d &m)
+{
+  double c = cos(pi[2]), s = sin(pi[2]);
+  double a = pi[2] + m[2];
+  while (a > M_PI) a -= 2.0*M_PI;
+  while (a < -M_PI) a += 2.0*M_PI;
+  return Vector3d(pi[0] + c*m[0] - s*m[1], pi[1] + s*m[0] + c*m[1], a);
+}
+
+void
+synth_spa2d_setup(SysSPA2d &spa,
+                  vector<Matrix<double,3,1>, Eigen::aligned_allocator<Matrix<double,3,1> > > &cps,
+                  const SynthParams &sp)
+{
+  SynthRand rnd(sp.seed);
+  int n = sp.nnodes;
+
+  cps.resize(n);
+  for (int i=0; i<n; i++)
+    {
+      Vector3d pos;
+      double th;
+      synth_pose(sp, i, pos, th);
+      cps[i] = Vector3d(pos[0], pos[1], atan2(sin(th), cos(th)));
+    }
+
+  Matrix3d prec;
+  prec.setZero();
+  prec(0,0) = prec(1,1) = synth_prec(sp.pnoise);
+  prec(2,2) = synth_prec(sp.qnoise);
+
+  // constraints are added directly, SysSPA2d::addConstraint() looks
+  // up node ids linearly
+  spa.nodes.reserve(n);
+  spa.p2cons.reserve((int)(n*(1.0+sp.loopRate)));
+  Vector3d pos = cps[0];
+  spa.addNode(pos, 0);
+
+  for (int i=1; i<n; i++)
+    {
+      Con2dP2 con;
+      con.prec = prec;
+
+      // odometry, and dead reckoning
+      Vector3d m = synth_rel2d(cps[i-1], cps[i]);
+      m += Vector3d(rnd.gauss(sp.pnoise), rnd.gauss(sp.pnoise), rnd.gauss(sp.qnoise));
+      pos = synth_compose2d(pos, m);
+      spa.addNode(pos, i);
+      con.ndr = i-1;
+      con.nd1 = i;
+      con.tmean = m.head(2);
+      con.amean = m[2];
+      spa.p2cons.push_back(con);
+
+      int j = synth_loop(sp, i, rnd);
+      if (j >= 0)
+        {
+          m = synth_rel2d(cps[i-sp.lapNodes], cps[i]);
+          m += Vector3d(rnd.gauss(sp.pnoise), rnd.gauss(sp.pnoise), rnd.gauss(sp.qnoise));
+          con.ndr = j;
+          con.nd1 = i;
+          con.tmean = m.head(2);
+          con.amean = m[2];
+          spa.p2cons.push_back(con);
+        }
+    }
+}
+
+
+//
+// SysSBA, points seen by runs of <trackLen> consecutive nodes, plus the
+// nodes of the previous lap at loop closures
+//
+
+// project <pt> into node <nd>; false if it isn't in view
+static bool
+synth_project(const Node &nd, const Point &pt, const SynthParams &sp, Vector3d &q)
+{
+  Vector3d pc = nd.w2n * pt;
+  if (pc[2] < 0.5*sp.s_near)
+    return false;
+  Vector2d qi;
+  nd.project2im(qi, pt);
+  if (qi[0] < 0.5 || qi[0] > 2.0*nd.Kcam(0,2) ||
+      qi[1] < 0.5 || qi[1] > 2.0*nd.Kcam(1,2))
+    return false;
+  q = Vector3d(qi[0], qi[1], qi[0] - nd.Kcam(0,0)*nd.baseline/pc[2]);
+  return true;
+}
+
+// add a projection with noise, or an outlier
+static void
+synth_add_proj(SysSBA &sba, const SynthParams &sp, SynthRand &rnd,
+               int ci, int pi, Vector3d q)
+{
+  const Node &nd = sba.nodes[ci];
+  if (rnd.uniform() < sp.outlierRate)
+    {
+      q[0] = rnd.uniform()*2.0*nd.Kcam(0,2);
+      q[1] = rnd.uniform()*2.0*nd.Kcam(1,2);
+      q[2] = q[0] - rnd.uniform()*nd.Kcam(0,0)*nd.baseline/sp.s_near;
+    }
+  else
+    {
+      q[0] += rnd.gauss(sp.inoise);
+      q[1] += rnd.gauss(sp.inoise);
+      q[2] += rnd.gauss(sp.inoise);
+    }
+
+  if (sp.stereo)
+    sba.addStereoProj(ci, pi, q);
+  else
+    {
+      Vector2d qm = q.head(2);
+      sba.addMonoProj(ci, pi, qm);
+    }
+}
+
+void
+synth_sba_setup(SysSBA &sba, CamParams &cpars,
+                vector<Matrix<double,6,1>, Eigen::aligned_allocator<Matrix<double,6,1> > > &cps,
+                const SynthParams &sp)
+{
+  SynthRand rnd(sp.seed);
+  int n = sp.nnodes;
+
+  // nodes at their true poses for now
+  sba.nodes.reserve(n);
+  cps.resize(n);
+  for (int i=0; i<n; i++)
+    {
+      Vector3d pos;
+      double th;
+      synth_pose(sp, i, pos, th);
+      Quaternion<double> q = synth_rot(th);
+      Vector4d trans(pos[0], pos[1], pos[2], 1.0);
+      sba.addNode(trans, q, cpars);
+      cps[i].head(3) = pos;
+      cps[i].segment<3>(3) = q.vec();
+    }
+  sba.tracks.reserve((size_t)n*sp.ptsPerNode);
+
+  // monocular points need two views to be determined
+  int minViews = sp.stereo ? 1 : 2;
+  vector<int> views;
+  vector<Vector3d, Eigen::aligned_allocator<Vector3d> > qs;
+
+  for (int i=0; i<n; i++)
+    {
+      const Node &nd = sba.nodes[i];
+      int loop = synth_loop(sp, i, rnd);
+
+      for (int k=0; k<sp.ptsPerNode; k++)
+        {
+          // new point somewhere in the view of node <i>
+          double d = sp.s_near + rnd.uniform()*(sp.s_far - sp.s_near);
+          Vector3d pc((rnd.uniform()*2.0*cpars.cx - cpars.cx)/cpars.fx,
+                      (rnd.uniform()*2.0*cpars.cy - cpars.cy)/cpars.fy,
+                      1.0);
+          pc *= d;
+          Point pt;
+          pt.head(3) = nd.qrot*pc + nd.trans.head(3);
+          pt[3] = 1.0;
+
+          // track through the following nodes, until it leaves the view
+          views.clear();
+          qs.clear();
+          Vector3d q;
+          for (int j=i; j<n && j<i+sp.trackLen; j++)
+            {
+              if (!synth_project(sba.nodes[j], pt, sp, q))
+                break;
+              views.push_back(j);
+              qs.push_back(q);
+            }
+
+          // seen again from the other end of the loop closure
+          if (loop >= 0)
+            for (int j=loop; j<n && j<loop+sp.trackLen; j++)
+              if (j < i && synth_project(sba.nodes[j], pt, sp, q))
+                {
+                  views.push_back(j);
+                  qs.push_back(q);
+                }
+
+          if ((int)views.size() < minViews)
+            continue;
+
+          // initial point position with the same error as the nodes
+          Point pn = pt;
+          pn.head(3) += Vector3d(rnd.gauss(sp.pnoise), rnd.gauss(sp.pnoise), rnd.gauss(sp.pnoise));
+          int pi = sba.addPoint(pn);
+          for (int v=0; v<(int)views.size(); v++)
+            synth_add_proj(sba, sp, rnd, views[v], pi, qs[v]);
+        }
+    }
+
+  // initial node error
+  for (int i=1; i<n; i++)
+    {
+      Node &nd = sba.nodes[i];
+      nd.trans.head(3) += Vector3d(rnd.gauss(sp.pnoise), rnd.gauss(sp.pnoise), rnd.gauss(sp.pnoise));
+      Quaternion<double> q = nd.qrot*rnd.rotation(sp.qnoise);
+      q.normalize();
+      if (q.w() < 0.0) q.coeffs() = -q.coeffs();
+      nd.qrot = q;
+      nd.normRot();
+      nd.setTransform();
+      nd.setProjection();
+      nd.setDr(sba.useLocalAngles);
+    }
+}
@@ -0,0 +1,214 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+// stress test: independent solvers running concurrently in separate
+// threads must give exactly the same answers as serial runs
+
+#include <iostream>
+#include <vector>
+using namespace std;
+
+#include "sba/sba_setup.h"
+
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+// Bring in gtest
+#include <gtest/gtest.h>
+
+using namespace Eigen;
+using namespace sba;
+using namespace frame_common;
+
+// number of concurrent solvers
+static const int nthreads = 8;
+
+static void runSBA(SysSBA *sba, int method)
+{
+  sba->doSBA(10, 1.0e-4, method);
+}
+
+static void runSPA(SysSPA *spa, int method)
+{
+  spa->doSPA(10, 1.0e-4, method);
+}
+
+static void runSPA2d(SysSPA2d *spa, int method)
+{
+  spa->doSPA(10, 1.0e-4, method);
+}
+
+
+// the problems are set up once, serially, since the setup functions
+// use the global random generator; only the solves are concurrent
+void testSBA(int method)
+{
+  SysSBA sba0;
+  sba0.verbose = 0;
+  vector<Matrix<double,6,1>,Eigen::aligned_allocator<Matrix<double,6,1> > > cps;
+
+  double kfang = 5.0;
+  CamParams cpars = {300,300,320,240,0}; // 300 pix focal length
+
+  spiral_setup(sba0, cpars, cps, 2.0, 10.0, // system, saved initial positions, near, far
+               0.6, kfang, 0.0, 20*kfang/360.0, // point density, angle per frame,
+                                                // initial angle, number of cycles (frames),
+               0.5, 0.05, 0.01); // image noise (pixels), frame noise (meters)
+  sba0.nFixed = 1;
+
+  // serial reference
+  SysSBA ref(sba0);
+  runSBA(&ref, method);
+
+  vector<SysSBA *> sys(nthreads);
+  for (int i=0; i<nthreads; i++)
+    sys[i] = new SysSBA(sba0);
+
+  boost::thread_group threads;
+  for (int i=0; i<nthreads; i++)
+    threads.create_thread(boost::bind(runSBA, sys[i], method));
+  threads.join_all();
+
+  for (int i=0; i<nthreads; i++)
+    {
+      SysSBA &sba = *sys[i];
+      EXPECT_EQ(ref.calcCost(), sba.calcCost());
+      for (int j=0; j<(int)ref.nodes.size(); j++)
+        {
+          EXPECT_TRUE(ref.nodes[j].trans == sba.nodes[j].trans);
+          EXPECT_TRUE(ref.nodes[j].qrot.coeffs() == sba.nodes[j].qrot.coeffs());
+        }
+      for (int j=0; j<(int)ref.tracks.size(); j++)
+        EXPECT_TRUE(ref.tracks[j].point == sba.tracks[j].point);
+      delete sys[i];
+    }
+}
+
+TEST(TestThreads, ConcurrentSBA)
+{
+  testSBA(SBA_SPARSE_CHOLESKY);
+}
+
+TEST(TestThreads, ConcurrentSBAdense)
+{
+  testSBA(SBA_DENSE_CHOLESKY);
+}
+
+
+TEST(TestThreads, ConcurrentSPA)
+{
+  SysSPA spa0;
+  vector<Matrix<double,6,1>, Eigen::aligned_allocator<Matrix<double,6,1> > > cps;
+  Matrix<double,6,6> prec;
+  prec.setIdentity();
+
+  double kfang = 5.0;
+  double kfrad = kfang*M_PI/180.0;
+  spa_spiral_setup(spa0, true, cps,
+                   prec, prec, prec, prec,
+                   kfang, M_PI/2.0-3*kfrad, 60*kfang/360.0, // angle per node, init angle, total nodes
+                   0.02, 2.0, 0.01, 0.05, 1.0); // node noise (m,deg), scale noise, displacement (m,deg)
+  spa0.nFixed = 1;
+
+  SysSPA ref(spa0);
+  runSPA(&ref, SBA_SPARSE_CHOLESKY);
+
+  vector<SysSPA *> sys(nthreads);
+  for (int i=0; i<nthreads; i++)
+    sys[i] = new SysSPA(spa0);
+
+  boost::thread_group threads;
+  for (int i=0; i<nthreads; i++)
+    threads.create_thread(boost::bind(runSPA, sys[i], SBA_SPARSE_CHOLESKY));
+  threads.join_all();
+
+  for (int i=0; i<nthreads; i++)
+    {
+      SysSPA &spa = *sys[i];
+      EXPECT_EQ(ref.calcCost(), spa.calcCost());
+      for (int j=0; j<(int)ref.nodes.size(); j++)
+        {
+          EXPECT_TRUE(ref.nodes[j].trans == spa.nodes[j].trans);
+          EXPECT_TRUE(ref.nodes[j].qrot.coeffs() == spa.nodes[j].qrot.coeffs());
+        }
+      delete sys[i];
+    }
+}
+
+
+TEST(TestThreads, ConcurrentSPA2d)
+{
+  SysSPA2d spa0;
+  vector<Matrix<double,3,1>, Eigen::aligned_allocator<Matrix<double,3,1> > > cps;
+  Matrix<double,3,3> prec;
+  prec.setIdentity();
+
+  double kfang = 5.0;
+  double kfrad = kfang*M_PI/180.0;
+  spa2d_spiral_setup(spa0, cps,
+                     prec, prec, prec, prec,
+                     kfang, M_PI/2-3*kfrad, 60*kfang/360.0, // angle per node, init angle, total nodes
+                     0.02, 1.0, 0.02, 0.02, 1.0); // node noise (m,deg), scale noise (%), displacement (m,deg)
+  spa0.nFixed = 1;
+
+  SysSPA2d ref(spa0);
+  runSPA2d(&ref, SBA_SPARSE_CHOLESKY);
+
+  vector<SysSPA2d *> sys(nthreads);
+  for (int i=0; i<nthreads; i++)
+    sys[i] = new SysSPA2d(spa0);
+
+  boost::thread_group threads;
+  for (int i=0; i<nthreads; i++)
+    threads.create_thread(boost::bind(runSPA2d, sys[i], SBA_SPARSE_CHOLESKY));
+  threads.join_all();
+
+  for (int i=0; i<nthreads; i++)
+    {
+      SysSPA2d &spa = *sys[i];
+      EXPECT_EQ(ref.calcCost(), spa.calcCost());
+      for (int j=0; j<(int)ref.nodes.size(); j++)
+        {
+          EXPECT_TRUE(ref.nodes[j].trans == spa.nodes[j].trans);
+          EXPECT_EQ(ref.nodes[j].arot, spa.nodes[j].arot);
+        }
+      delete sys[i];
+    }
+}
+
+
+int main(int argc, char **argv){
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
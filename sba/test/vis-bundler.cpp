@@ -358,7 +358,7 @@ int main(int argc, char **argv)
     }
 
   cout << endl << "Switch to full system" << endl;
-  sys.connMat.resize(0);
+  sys.covis.clearSkips();
 
 
   // reset projections here
@@ -367,6 +367,7 @@ int main(int argc, char **argv)
 
   // set up projections
   sys.tracks.resize(0);
+  sys.rebuildCovis();
   cout << "Setting up projections..." << flush;
   for (int i=0; i<npts; i++)
     {
@@ -76,6 +76,15 @@ public:
    */
   DocId findAndInsert(const std::vector<Word>& document, size_t N, std::vector<Match>& matches);
 
+  /**
+   * \brief Remove a document, so it is no longer returned as a match.
+   *
+   * Document IDs are not reused; the IDs of other documents are unchanged.
+   *
+   * \param id The ID of the document to remove.
+   */
+  void erase(DocId id);
+
   /**
    * \brief Compute the TF-IDF weights of all the words. To be called after inserting a corpus of
    * training examples into the database.
@@ -112,6 +121,7 @@ private:
   std::vector<InvertedFile> word_files_;
   std::vector<float> word_weights_;
   std::vector<DocumentVector> database_vectors_; // Precomputed for inserted documents
+  std::vector<bool> erased_; // Removed documents, skipped when matching
 
   void computeVector(const std::vector<Word>& document, DocumentVector& v) const;
   
@@ -32,6 +32,7 @@ DocId Database::insert(const std::vector<Word>& document)
   // Precompute the document vector to compare queries against.
   database_vectors_.resize(doc_id + 1);
   computeVector(document, database_vectors_.back());
+  erased_.push_back(false);
   
   return doc_id;
 }
@@ -47,13 +48,17 @@ void Database::find(const std::vector<Word>& document, size_t N, std::vector<Mat
   accumulator_set<Match, features<bestN_tag> > acc(bestN_tag::cache_size = N);
 
   /// @todo Try only computing distances against documents sharing at least one word
+  size_t num_docs = 0;
   for (DocId i = 0; i < (DocId)database_vectors_.size(); ++i) {
+    if (erased_[i])
+      continue;
+    ++num_docs;
     float distance = sparseDistance(query, database_vectors_[i]);
     acc( Match(i, distance) );
   }
 
   extractor<bestN_tag> bestN;
-  matches.resize( std::min(N, database_vectors_.size()) );
+  matches.resize( std::min(N, num_docs) );
   std::copy(bestN(acc).begin(), bestN(acc).end(), matches.begin());
 }
 
@@ -64,6 +69,27 @@ DocId Database::findAndInsert(const std::vector<Word>& document, size_t N, std::
   return insert(document);
 }
 
+void Database::erase(DocId id)
+{
+  if (id >= (DocId)database_vectors_.size() || erased_[id])
+    return;
+
+  // Take the document out of the inverted files of its words.
+  const DocumentVector& v = database_vectors_[id];
+  for (DocumentVector::const_iterator it = v.begin(), end = v.end(); it != end; ++it) {
+    InvertedFile& file = word_files_[it->first];
+    for (InvertedFile::iterator fi = file.begin(), fe = file.end(); fi != fe; ++fi) {
+      if (fi->id == id) {
+        file.erase(fi);
+        break;
+      }
+    }
+  }
+
+  DocumentVector().swap(database_vectors_[id]);
+  erased_[id] = true;
+}
+
 void Database::computeTfIdfWeights(float default_weight)
 {
   float N = (float)database_vectors_.size();
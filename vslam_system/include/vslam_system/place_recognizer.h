@@ -83,6 +83,15 @@ public:
                      const FrameVector& all_frames, size_t N,
                      std::vector<const frame_common::Frame*>& matches);
 
+  /**
+   * \brief Renumber the saved ids after frames are removed.
+   *
+   * Frames mapped to -1 are no longer returned as matches.
+   *
+   * \param id_map Old-to-new frame id map, -1 for removed frames
+   */
+  void remap(const std::vector<int>& id_map);
+
 private:
   vt::GenericTree tree_;
   vt::Database database_;
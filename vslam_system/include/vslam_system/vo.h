@@ -94,8 +94,9 @@ namespace vslam
     /// \brief Transfers frames to external sba system.
     /// \param eframes A vector of external frames. The last frame in this will be transferred.
     /// \param esba    External SBA system to add the frame to.
+    /// \param refine  Whether to run a few SBA iterations on the whole external system.
     void transferLatestFrame(std::vector<fc::Frame, Eigen::aligned_allocator<fc::Frame> > &eframes,
-                             sba::SysSBA &esba);
+                             sba::SysSBA &esba, bool refine = true);
 
     /// \brief Gets the transform between frames.
     /// \param frameId ID of the first frame.
@@ -127,7 +128,8 @@ namespace vslam
 
   /// \brief Adds projections between two frames based on inlier matches.
   /// Adds any points not previously present in the external system, and fills
-  /// in ipts.
+  /// in ipts.  Stereo projections are weighted by the frames' point
+  /// weights, if they have them.
   /// \param f0      Previous frame.
   /// \param f1      Newest frame to add.
   /// \param frames  All the frames in the system.
@@ -166,6 +168,10 @@ namespace vslam
   
   /// \brief substitutes tri0 for tri1 in a point reference vector.
   void substPointRef(std::vector<int> &ipts, int tri0, int tri1);
+
+  /// \brief Re-indexes a point reference vector with an old-to-new track
+  /// index map, as returned by sba::SysSBA::mergeTracks().
+  void remapPointRef(std::vector<int> &ipts, const std::vector<int> &pidx);
   
   /// \brief Get a Vector3d projection from a keypoint at index.
   Vector3d getProjection(fc::Frame &frame, int index);
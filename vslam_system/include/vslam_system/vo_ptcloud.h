@@ -123,6 +123,9 @@ namespace vslam
 
   /// substitutes tri0 for tri1 in a point reference vector
   void substPointRef(std::vector<int> &ipts, int tri0, int tri1);
+
+  /// re-indexes a point reference vector with an old-to-new track index map
+  void remapPointRef(std::vector<int> &ipts, const std::vector<int> &pidx);
   
   /// \brief Get a Vector3d projection from a keypoint at index.
   Vector3d getProjection(fc::FrameExtended &frame, int index);
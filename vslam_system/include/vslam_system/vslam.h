@@ -10,6 +10,9 @@
 
 namespace vslam {
 
+/// \brief Wall clock time in milliseconds, for timing the stages.
+double mstime();
+
 /// \brief VSLAM class that performs visual odometry, loop closure through 
 /// place recognition, and large-scale optimization using SBA.
 class VslamSystem
@@ -72,6 +75,27 @@ class VslamSystem
     /// \param initial_runs How many iterations to do SBA for.
     void refine(int initial_runs=3);
 
+    /// \brief Cull redundant keyframes and low-value points from the
+    /// large-scale system, keeping frames, SBA and place recognition in
+    /// step.  Called every #cullInterval keyframes.
+    void cullMap();
+
+    int cullInterval;   ///< Keyframes between map culls; 0 for no culling.
+    double cullRatio;   ///< Fraction of a keyframe's points seen elsewhere for it to be redundant.
+    int cullMinObs;     ///< Number of other keyframes that must see a point for it to count as seen elsewhere.
+    int cullMinProjs;   ///< Minimum number of projections of a point that is kept.
+    double cullMaxErr;  ///< Projection error in pixels above which projections are dropped; 0 for none.
+    int nCull;          ///< Keyframes since the last cull.
+
+    /// \brief Wall-clock times in milliseconds of the stages of an addFrame() call.
+    struct StageTimes
+    {
+      double frame;     ///< Features, descriptors and stereo.
+      double vo;        ///< Visual odometry, including its windowed SBA.
+      double keyframe;  ///< Transfer to the large-scale SBA and place recognition; 0 for non-keyframes.
+    };
+    StageTimes stageTimes;  ///< Stage times of the last addFrame() call.
+
     int prInliers;  ///< Number of inliers needed for PR match.
     int numPRs;			///< Number of place recognitions that succeeded.
     int nSkip;      ///< Number of the most recent frames to skip for PR checking.
@@ -90,6 +114,8 @@ class VslamSystem
     void setPRWindow(int x, int y) { pose_estimator_.wx = x; pose_estimator_.wy = y; }; ///< Set the window size for place recognition matching.
     void setVOWindow(int x, int y) { vo_.pose_estimator_->wx = x; vo_.pose_estimator_->wy = y; }; ///< Set the window size for place recognition matching.
     void setHuber(double x) { sba_.huber = x; vo_.sba.huber = x; }
+    void setCulling(int interval, double ratio = 0.9, int minobs = 3) 
+    { cullInterval = interval; cullRatio = ratio; cullMinObs = minobs; }; ///< Set keyframe culling; interval 0 turns it off.
     
     
     
@@ -20,6 +20,16 @@ class VslamSystemMono : public VslamSystem
     /// \param image Image to add.
     bool addFrame(const frame_common::CamParams& camera_parameters,
                   const cv::Mat& image);
+
+    /// \brief Bundle adjust the latest keyframes and the points they see,
+    /// with the other keyframes that see those points held fixed.
+    /// The cost is bounded by the window, not the size of the map.
+    void localRefine();
+
+    /// Number of latest keyframes adjusted after each new keyframe; 0
+    /// adjusts the whole map instead.
+    int localWindow;
+    int localIters;   ///< LM iterations of the local adjustment.
 };
 
 } // namespace vslam
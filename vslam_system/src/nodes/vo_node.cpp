@@ -300,7 +300,8 @@ public:
     //sba_points_pub_.publish(msg);
   }
   
-  void publishProjection(int ci, int pi, Eigen::Vector3d &q, bool stereo)
+  // <weight> is the stereo confidence of the point, as in SysSBA::addProjs()
+  void publishProjection(int ci, int pi, Eigen::Vector3d &q, bool stereo, double weight = 1.0)
   {
     sba::Projection msg;
     msg.camindex = ci;
@@ -310,10 +311,23 @@ public:
     msg.d = q.z();
     msg.stereo = stereo;
     msg.usecovariance = false;
+    if (stereo && weight < 1.0)
+      {
+        msg.usecovariance = true;
+        for (int i=0; i<9; i++)
+          msg.covariance[i] = (i%4 == 0) ? 1.0 : 0.0;
+        msg.covariance[8] = sqrt(std::max(weight, 0.0));
+      }
     
     proj_msgs.push_back(msg);
   }
   
+  // stereo confidence of a frame's point, 1 if the frame has none
+  static double pointWeight(const fc::Frame &f, int i)
+  {
+    return i < (int)f.weights.size() ? f.weights[i] : 1.0;
+  }
+
     // add connections between frames, based on keypoint matches
   void addProjections(fc::Frame &f0, fc::Frame &f1, 
                       const std::vector<cv::DMatch> &inliers,
@@ -349,11 +363,11 @@ public:
             vo_.ipts.push_back(-1);  // external point index
 
             Vector3d ipt = getProjection(f0, i0);
-            publishProjection(ndi0, pti, ipt, true);
+            publishProjection(ndi0, pti, ipt, true, pointWeight(f0, i0));
 
             // projected point, ul,vl,ur
             ipt = getProjection(f1, i1);
-            publishProjection(ndi1, pti, ipt, true);
+            publishProjection(ndi1, pti, ipt, true, pointWeight(f1, i1));
           }
           
         // Commented out right now since we have no good way to merge tracks
@@ -395,7 +409,7 @@ public:
           
             // projected point, ul,vl,ur
             Vector3d ipt = getProjection(f1, i1);
-            publishProjection(ndi1, pti, ipt, true);
+            publishProjection(ndi1, pti, ipt, true, pointWeight(f1, i1));
           }
         else if (f0.ipts[i0] < 0)                 // add to previous point track
           {
@@ -404,7 +418,7 @@ public:
           
             // projected point, ul,vl,ur
             Vector3d ipt = getProjection(f0, i0);
-            publishProjection(ndi0, pti, ipt, true);
+            publishProjection(ndi0, pti, ipt, true, pointWeight(f0, i0));
           }
       }
   }
@@ -41,4 +41,20 @@ void PlaceRecognizer::findAndInsert(const frame_common::Frame& frame, uint32_t i
   }
 }
 
+void PlaceRecognizer::remap(const std::vector<int>& id_map)
+{
+  const uint32_t removed = (uint32_t)-1;
+  for (size_t i = 0; i < user_ids_.size(); ++i) {
+    uint32_t id = user_ids_[i];
+    if (id == removed || id >= id_map.size())
+      continue;
+    if (id_map[id] < 0) {
+      database_.erase(i);
+      user_ids_[i] = removed;
+    }
+    else
+      user_ids_[i] = id_map[id];
+  }
+}
+
 } //namespace vslam
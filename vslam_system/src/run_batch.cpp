@@ -0,0 +1,431 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+//
+// batch reprocessing of recorded sequences
+// each sequence (a directory of stereo images, or a PS bag file) runs in
+// its own VslamSystem; reader threads decode images ahead of the solver
+// into a bounded queue, and graph files are written by a separate thread
+//
+
+#include <vslam_system/vslam.h>
+#include <sba/sba.h>
+#include <sba/sba_file_io.h>
+#include <frame_common/frame.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <cstdio>
+#include <fstream>
+#include <deque>
+#include <algorithm>
+#include <dirent.h>
+#include <fnmatch.h>
+
+#include <opencv/highgui.h>
+#include <opencv2/legacy/legacy.hpp>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <sensor_msgs/CameraInfo.h>
+#include <stereo_msgs/DisparityImage.h>
+#include <sensor_msgs/Image.h>
+#include <cv_bridge/CvBridge.h>
+
+using namespace std;
+using namespace sba;
+using namespace frame_common;
+using namespace Eigen;
+using namespace vslam;
+
+
+// Fixed-size queue between threads.  push() blocks while the queue is
+// full, pop() while it is empty; close() ends the stream.
+template <class T>
+class BoundedQueue
+{
+public:
+  BoundedQueue(size_t n) : maxSize(n), closed(false) {}
+
+  // returns false if the queue has been closed
+  bool push(const T &x)
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    while (q.size() >= maxSize && !closed)
+      notFull.wait(lock);
+    if (closed) return false;
+    q.push_back(x);
+    notEmpty.notify_one();
+    return true;
+  }
+
+  // returns false once the queue is closed and empty
+  bool pop(T &x)
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    while (q.empty() && !closed)
+      notEmpty.wait(lock);
+    if (q.empty()) return false;
+    x = q.front();
+    q.pop_front();
+    notFull.notify_one();
+    return true;
+  }
+
+  void close()
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    closed = true;
+    notEmpty.notify_all();
+    notFull.notify_all();
+  }
+
+private:
+  size_t maxSize;
+  bool closed;
+  std::deque<T> q;
+  boost::mutex mutex;
+  boost::condition_variable notEmpty, notFull;
+};
+
+
+// A decoded input frame.
+struct StereoPair
+{
+  CamParams cam;
+  cv::Mat left;
+  cv::Mat right;                // right image, or disparities if nfrac > 0
+  int nfrac;                    // fractional disparity of <right>, 0 for an image
+};
+
+// A recorded sequence.
+struct Sequence
+{
+  string path;                  // image directory or bag file
+  string name;                  // base name of output files
+  bool isBag;
+};
+
+
+// settings shared by all jobs, fixed before the threads start
+static CamParams camp;
+static string lreg, rreg;       // left and right image templates
+static string vocabTree, vocabWeights, calonderTrees;
+static string outDir;
+static const int frameQueueSize = 16; // decoded frames buffered per sequence
+static const int writeInterval = 500; // keyframes between intermediate graph files
+
+
+// sorted file names in <dir> matching <reg>
+static void listDir(const string &dir, const string &reg, vector<string> &names)
+{
+  names.clear();
+  DIR *d = opendir(dir.c_str());
+  if (!d) return;
+  struct dirent *entry;
+  while ((entry = readdir(d)) != NULL)
+    if (!fnmatch(reg.c_str(),entry->d_name,0))
+      names.push_back(entry->d_name);
+  closedir(d);
+  sort(names.begin(), names.end());
+}
+
+// read a directory of stereo pairs
+static void readStereoDir(const Sequence &seq, BoundedQueue<StereoPair> *queue)
+{
+  vector<string> lnames, rnames;
+  listDir(seq.path, lreg, lnames);
+  listDir(seq.path, rreg, rnames);
+  if (lnames.size() != rnames.size())
+    printf("[Batch] %s: number of left/right images does not match: %d vs. %d\n", 
+           seq.name.c_str(), (int)lnames.size(), (int)rnames.size());
+  else
+    for (size_t i=0; i<lnames.size(); i++)
+      {
+        StereoPair sp;
+        sp.cam = camp;
+        sp.nfrac = 0;
+        sp.left = cv::imread(seq.path + "/" + lnames[i], 0);
+        sp.right = cv::imread(seq.path + "/" + rnames[i], 0);
+        if (sp.left.rows == 0 || sp.right.rows == 0)
+          {
+            printf("[Batch] %s: can't read %s\n", seq.name.c_str(), lnames[i].c_str());
+            break;
+          }
+        if (!queue->push(sp))
+          break;
+      }
+  queue->close();
+}
+
+// read color and disparity images from a PS bag, as in run_ps_bag
+static void readPSBag(const Sequence &seq, BoundedQueue<StereoPair> *queue)
+{
+  try
+    {
+      rosbag::Bag bag(seq.path);
+      rosbag::View view(bag);
+      boost::shared_ptr<sensor_msgs::CameraInfo> camera_info_left, camera_info_right;
+      boost::shared_ptr<sensor_msgs::Image> color_image;
+      boost::shared_ptr<stereo_msgs::DisparityImage> disparity_image;
+      sensor_msgs::CvBridge imageBridge, disparityBridge;
+
+      for (rosbag::View::iterator it = view.begin(); it != view.end(); ++it)
+        {
+          const string &topic = it->getTopic();
+          if (topic == "/primesense/left/camera_info")
+            camera_info_left = it->instantiate<sensor_msgs::CameraInfo>();
+          else if (topic == "/primesense/right/camera_info")
+            camera_info_right = it->instantiate<sensor_msgs::CameraInfo>();
+          else if (topic == "/primesense/left/color_image_raw")
+            color_image = it->instantiate<sensor_msgs::Image>();
+          else if (topic == "/primesense/disparity")
+            disparity_image = it->instantiate<stereo_msgs::DisparityImage>();
+          else
+            continue;
+
+          if (!camera_info_left || !camera_info_right || !color_image || !disparity_image)
+            continue;
+
+          // wait for a matching set
+          ros::Time stamp = color_image->header.stamp;
+          if (camera_info_left->header.stamp != stamp || camera_info_right->header.stamp != stamp ||
+              disparity_image->header.stamp != stamp)
+            continue;
+
+          StereoPair sp;
+          sp.cam.fx = camera_info_left->K[0];
+          sp.cam.fy = camera_info_left->K[4];
+          sp.cam.cx = camera_info_left->K[2];
+          sp.cam.cy = camera_info_left->K[5];
+          sp.cam.tx = - camera_info_right->P[3] / sp.cam.fx;
+
+          cv::Mat image(imageBridge.imgMsgToCv(color_image));
+          cv::cvtColor(image, sp.left, CV_RGB2GRAY);
+          disparityBridge.fromImage(disparity_image->image);
+          cv::Mat disp_image32f = disparityBridge.toIpl();
+          disp_image32f.convertTo(sp.right, CV_16UC1, 32.0);
+          sp.nfrac = 32;
+
+          // use each set once
+          color_image.reset();
+          disparity_image.reset();
+
+          if (!queue->push(sp))
+            break;
+        }
+    }
+  catch (rosbag::BagException &e)
+    {
+      printf("[Batch] %s: %s\n", seq.name.c_str(), e.what());
+    }
+  queue->close();
+}
+
+
+// hand a snapshot of the current graph to the writer
+static void queueGraph(sba::GraphWriter *writer, const SysSBA &sba, const string &fname)
+{
+  boost::shared_ptr<sba::GraphSnapshot> snap(new sba::GraphSnapshot);
+  snap->take(sba);
+  writer->write((fname + ".g2o").c_str(), snap, sba::GRAPH_TEXT, true);
+  writer->write((fname + "m.g2o").c_str(), snap, sba::GRAPH_TEXT_MONO, true);
+}
+
+
+// run one sequence through its own VSLAM system
+static void processSequence(const Sequence &seq, sba::GraphWriter *outq)
+{
+  double t0 = mstime();
+
+  // start decoding while the system loads its vocabulary
+  BoundedQueue<StereoPair> frames(frameQueueSize);
+  void (*readfn)(const Sequence &, BoundedQueue<StereoPair> *) = seq.isBag ? readPSBag : readStereoDir;
+  boost::thread reader(readfn, boost::cref(seq), &frames);
+
+  vslam::VslamSystem vslam(vocabTree, vocabWeights);
+  typedef cv::CalonderDescriptorExtractor<float> Calonder;
+  vslam.frame_processor_.setFrameDescriptor(new Calonder(calonderTrees));
+
+  // parameters, from run_stereo and run_ps_bag
+  if (seq.isBag)
+    {
+      vslam.setPointcloudProc(boost::shared_ptr<frame_common::PointcloudProc>(new frame_common::PointcloudProc()));
+      vslam.doPointPlane = false;
+      vslam.setKeyDist(0.01);	// meters
+      vslam.setKeyAngle(0.05);	// radians
+      vslam.setKeyInliers(200);
+      vslam.setHuber(40.0);     // Huber cost function cutoff
+      vslam.setVOWindow(128,128);
+      vslam.setVORansacIt(10000);
+    }
+  else
+    {
+      vslam.setKeyDist(0.4);	// meters
+      vslam.setKeyAngle(0.2);	// radians
+      vslam.setKeyInliers(300);
+      vslam.setHuber(2.0);      // Huber cost function cutoff
+    }
+  vslam.vo_.sba.verbose = false;
+  vslam.sba_.verbose = false;
+
+  // fixed RANSAC seeds, so reruns of a sequence agree
+  vslam.vo_.pose_estimator_->setSeed(1);
+  vslam.pose_estimator_.setSeed(1);
+
+  string base = outDir + "/" + seq.name;
+  StereoPair sp;
+  int nframes = 0;
+  while (frames.pop(sp))
+    {
+      nframes++;
+      bool is_keyframe = vslam.addFrame(sp.cam, sp.left, sp.right, sp.nfrac, sp.nfrac > 0);
+      if (!is_keyframe)
+        continue;
+
+      /// @todo Depending on broken encapsulation of VslamSystem here
+      int n = vslam.sba_.nodes.size();
+
+      // intermediate graphs
+      if (n > 10 && n%writeInterval == 0)
+        {
+          char num[32];
+          sprintf(num,"%d",n);
+          queueGraph(outq, vslam.sba_, base + num);
+        }
+
+      if (n > 4 && n%10 == 0)
+        vslam.refine();
+    }
+  reader.join();
+
+  queueGraph(outq, vslam.sba_, base);
+
+  printf("[Batch] %s: %d frames, %d keyframes, %d points in %0.1f s\n", seq.name.c_str(),
+         nframes, (int)vslam.sba_.nodes.size(), (int)vslam.sba_.tracks.size(), 
+         0.001*(mstime()-t0));
+}
+
+// take sequences off the list until there are none left
+static void runJobs(const vector<Sequence> *seqs, int *next, boost::mutex *nextMutex,
+                    sba::GraphWriter *outq)
+{
+  while (1)
+    {
+      int i;
+      {
+        boost::mutex::scoped_lock lock(*nextMutex);
+        i = (*next)++;
+      }
+      if (i >= (int)seqs->size())
+        return;
+      processSequence((*seqs)[i], outq);
+    }
+}
+
+
+// main loop
+
+int main(int argc, char** argv)
+{
+  if (argc < 10)
+    {
+      printf("Args are: <param file> <left image file template> <right image file template> "
+             "<vocab tree file> <vocab weights file> <calonder trees file> "
+             "<output dir> <number of jobs> <sequence> [<sequence> ...]\n"
+             "  A sequence is a directory of stereo images or a PS .bag file;\n"
+             "  0 jobs uses one per core.\n");
+      exit(0);
+    }
+
+  // get camera parameters, in the form: fx fy cx cy tx
+  fstream fstr;
+  fstr.open(argv[1],fstream::in);
+  if (!fstr.is_open())
+    {
+      printf("Can't open camera file %s\n",argv[1]);
+      exit(0);
+    }
+  fstr >> camp.fx;
+  fstr >> camp.fy;
+  fstr >> camp.cx;
+  fstr >> camp.cy;
+  fstr >> camp.tx;
+
+  cout << "Cam params: " << camp.fx << " " << camp.fy << " " << camp.cx
+       << " " << camp.cy << " " << camp.tx << endl;
+
+  lreg = argv[2];
+  rreg = argv[3];
+  vocabTree = argv[4];
+  vocabWeights = argv[5];
+  calonderTrees = argv[6];
+  outDir = argv[7];
+  int njobs = atoi(argv[8]);
+  if (njobs <= 0)
+    njobs = max(1, (int)boost::thread::hardware_concurrency());
+
+  vector<Sequence> seqs;
+  for (int i=9; i<argc; i++)
+    {
+      Sequence seq;
+      seq.path = argv[i];
+      if (seq.path.size() > 1 && seq.path[seq.path.size()-1] == '/') // see if slash at end
+        seq.path.erase(seq.path.size()-1);
+      seq.name = seq.path.substr(seq.path.rfind("/")+1);
+      seq.isBag = seq.name.size() > 4 && !seq.name.compare(seq.name.size()-4,4,".bag");
+      if (seq.isBag)
+        seq.name.erase(seq.name.size()-4);
+      seqs.push_back(seq);
+    }
+  njobs = min(njobs, (int)seqs.size());
+  printf("[Batch] %d sequences, %d jobs\n", (int)seqs.size(), njobs);
+
+  double t0 = mstime();
+
+  // the writer queue is bounded too, so a slow disk holds up the solvers
+  // rather than piling up graph copies
+  sba::GraphWriter outq(2*njobs+2);
+
+  int next = 0;
+  boost::mutex nextMutex;
+  boost::thread_group workers;
+  for (int i=0; i<njobs; i++)
+    workers.create_thread(boost::bind(runJobs, &seqs, &next, &nextMutex, &outq));
+  workers.join_all();
+
+  outq.flush();
+
+  printf("[Batch] Done in %0.1f s\n", 0.001*(mstime()-t0));
+  return 0;
+}
@@ -164,7 +164,7 @@ drawgraph(const SysSBA &sba, const ros::Publisher &cam_pub, const ros::Publisher
   ptmark.points.resize(npts/dec+1);
   for (int i=0, ii=0; i<npts; i+=dec, ii++)
     {
-      const Vector4d &pt = sba.tracks[i].point;
+      const Vector4d &pt = sba.tracks[i].point.cast<double>();
       ptmark.points[ii].x = pt(0);
       ptmark.points[ii].y = pt(2);
       ptmark.points[ii].z = -pt(1);
@@ -202,7 +202,7 @@ drawgraph(const SysSBA &sba, const ros::Publisher &cam_pub, const ros::Publisher
   ptmark.points.resize(npts/dec+1);
   for (int i=0, ii=0; i<npts; i+=dec, ii++)
     {
-      const Vector4d &pt = sba.tracks[i].point;
+      const Vector4d &pt = sba.tracks[i].point.cast<double>();
       ptmark.points[ii].x = pt(0);
       ptmark.points[ii].y = pt(2);
       ptmark.points[ii].z = -pt(1);
@@ -256,9 +256,9 @@ drawgraph(const SysSBA &sba, const ros::Publisher &cam_pub, const ros::Publisher
           if (prj.pointPlane)	// have a ptp projection
             {
               cammark.points.resize(ii+2);
-              Point pt0 = sba.tracks[i].point;
-              Vector3d plane_point = prj.plane_point;
-              Vector3d plane_normal = prj.plane_normal;
+              Point pt0 = sba.tracks[i].point.cast<double>();
+              Vector3d plane_point = prj.planePoint();
+              Vector3d plane_normal = prj.planeNormal();
               Eigen::Vector3d w = pt0.head<3>()-plane_point;
               //              Eigen::Vector3d projpt = plane_point+(w.dot(plane_normal))*plane_normal;
               Eigen::Vector3d projpt = pt0.head<3>() - (w.dot(plane_normal))*plane_normal;
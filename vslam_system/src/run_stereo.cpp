@@ -165,7 +165,7 @@ drawgraph(const SysSBA &sba, const ros::Publisher &cam_pub, const ros::Publisher
   ptmark.points.resize(npts/dec+1);
   for (int i=0, ii=0; i<npts; i+=dec, ii++)
     {
-      const Vector4d &pt = sba.tracks[i].point;
+      const Vector4d &pt = sba.tracks[i].point.cast<double>();
       ptmark.points[ii].x = pt(0);
       ptmark.points[ii].y = pt(2);
       ptmark.points[ii].z = -pt(1);
@@ -326,6 +326,9 @@ int main(int argc, char** argv)
   //  vslam.vo_.pose_estimator_->numRansac = 1000;
   vslam.vo_.sba.verbose = false;
   vslam.sba_.verbose = false;
+
+  // graph files are written in the background, so dumps don't hold up frames
+  sba::GraphWriter graphWriter;
   
   // set up markers for visualization
   ros::init(argc, argv, "VisBundler");
@@ -412,10 +415,12 @@ int main(int argc, char** argv)
               if (n > 10 && n%500 == 0)
                 {
                   char fn[1024];
+                  boost::shared_ptr<sba::GraphSnapshot> snap(new sba::GraphSnapshot);
+                  snap->take(vslam.sba_);
                   sprintf(fn,"newcollege%d.g2o", n);
-                  sba::writeGraphFile(fn,vslam.sba_);
+                  graphWriter.write(fn,snap);
                   sprintf(fn,"newcollege%dm.g2o", n);
-                  sba::writeGraphFile(fn,vslam.sba_,true);
+                  graphWriter.write(fn,snap,sba::GRAPH_TEXT_MONO);
                   //                  sba::writeLourakisFile(fn, vslam.sba_);
                   //                  vslam.sba_.doSBA(1,1.0e-4,0);
                   //                  sba::writeSparseA(fn, vslam.sba_);
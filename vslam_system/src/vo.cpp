@@ -66,7 +66,7 @@ namespace vslam
     sba.useCholmod(true);
 
     // for RANSAC
-    srand(time(NULL));
+    pose_estimator_->setSeed(time(NULL));
   }
 
   // TODO <fnew> is not changed, can be declared const
@@ -208,6 +208,10 @@ namespace vslam
   {
     vector<int> pidx(sba.tracks.size()); // point index for re-indexing
 
+    // drop node 0 from the covisibility graph; removed tracks are
+    //   taken out below, in the new node indices
+    sba.covis.removeFront(1);
+
     // run through tracks, resetting node indices by -1 and removing
     //   references to node 0
     int tn = 0;
@@ -224,7 +228,10 @@ namespace vslam
             else prj.isValid = false;
           }
         if (n < 2)              // remove this guy
-          pidx[i] = -1;
+          {
+            sba.covis.removeTrack(prjs);
+            pidx[i] = -1;
+          }
         else                    // keep this guy
           pidx[i] = tn++;
       }
@@ -256,29 +263,14 @@ namespace vslam
             
       }
       
-    // Redo point indeces of point-plane projections
-    for(size_t i=0; i<sba.tracks.size(); i++)
-      {
-        ProjMap &prjs = sba.tracks[i].projections;
-        if (prjs.size() == 0) continue;
-        for(ProjMap::iterator itr = prjs.begin(); itr != prjs.end(); itr++)
-          {
-            Proj &prj = itr->second;
-            if (prj.pointPlane && prj.plane_point_index >= 0)
-            {
-              prj.plane_point_index = pidx[prj.plane_point_index];
-              prj.plane_node_index -= 1;
-              if (prj.plane_node_index < 0 || prj.plane_point_index < 0)
-                prj.isValid = false;
-            }
-          }
-      }
+    // Redo point and node indices of point-plane constraints
+    sba.reindexPointPlaneCons(pidx, 1);
   }
 
   
   // transfer most recent frame to an external SBA system
   void voSt::transferLatestFrame(std::vector<fc::Frame, Eigen::aligned_allocator<fc::Frame> > &eframes,
-                                 SysSBA &esba)
+                                 SysSBA &esba, bool refine)
   {
     bool init = esba.nodes.size() == 0;
 
@@ -360,7 +352,8 @@ namespace vslam
     /// should reconstruct inliers from most recent two frames
     Frame &f0 = *(eframes.end()-2);
     addProjections(f0, f1, eframes, esba, pose_estimator_->inliers, f2w_frame0, ndi-1, ndi, NULL);
-    esba.doSBA(3,1.0e-4,SBA_SPARSE_CHOLESKY);
+    if (refine)
+      esba.doSBA(3,1.0e-4,SBA_SPARSE_CHOLESKY);
     if (doPointPlane)
       addPointCloudProjections(f0, f1, esba, pointcloud_matches_, f2w_frame0, f2w_frame1, ndi-1, ndi, NULL);
   }
@@ -411,6 +404,25 @@ namespace vslam
     return -1;
   }
 
+  // queue up a projection for SysSBA::addProjs()
+  static inline void addProjEntry(vector<ProjEntry> &prjs, int ci, int pi, 
+                                  const Vector3d &kp, bool stereo, double weight)
+  {
+    ProjEntry pe;
+    pe.ci = ci;
+    pe.pi = pi;
+    pe.kp = kp;
+    pe.stereo = stereo;
+    pe.weight = weight;
+    prjs.push_back(pe);
+  }
+
+  // stereo confidence of a frame's point, 1 if the frame has none
+  static inline double pointWeight(const fc::Frame &f, int i)
+  {
+    return i < (int)f.weights.size() ? f.weights[i] : 1.0;
+  }
+
   // add connections between frames, based on keypoint matches
   void addProjections(fc::Frame &f0, fc::Frame &f1, 
                       std::vector<fc::Frame, Eigen::aligned_allocator<fc::Frame> > &frames,
@@ -421,6 +433,11 @@ namespace vslam
       vector<bool> matched0(f0.ipts.size(),0);
       vector<bool> matched1(f1.ipts.size(),0);
 
+      // projections and track merges, done in bulk after all matches are seen
+      vector<ProjEntry> prjs;
+      prjs.reserve(2*inliers.size());
+      vector<pair<int,int> > merges;
+
       // Whether the frame we are adding is stereo or not.
       // Not sure this would do the right thing in the case of stereo-mono matches.
       bool stereo = f1.isStereo;
@@ -454,32 +471,17 @@ namespace vslam
               if (ipts)
                   ipts->push_back(-1);  // external point index
 
-              Vector3d ipt = getProjection(f0, i0);
-              sba.addProj(ndi0, pti, ipt, stereo);
+              addProjEntry(prjs, ndi0, pti, getProjection(f0, i0), stereo, pointWeight(f0, i0));
 
               // projected point, ul,vl,ur
-              ipt = getProjection(f1, i1);
-              sba.addProj(ndi1, pti, ipt, stereo);
+              addProjEntry(prjs, ndi1, pti, getProjection(f1, i1), stereo, pointWeight(f1, i1));
           }
 
           else if (f0.ipts[i0] >= 0 && f1.ipts[i1] >= 0) // merge two tracks
           {
               if (f0.ipts[i0] != f1.ipts[i1]) // different tracks
               {
-                  int tri = sba.mergeTracksSt(f0.ipts[i0],f1.ipts[i1]);
-                  if (tri >= 0)   // successful merge
-                  {
-                      // update the ipts in frames that connect to this track
-                      ProjMap &prjs = sba.tracks[tri].projections;
-                      for(ProjMap::iterator itr = prjs.begin(); itr != prjs.end(); itr++)
-                      {
-                          Proj &prj = itr->second;  
-                          if (tri == f0.ipts[i0])
-                              substPointRef(frames[prj.ndi].ipts, tri, f1.ipts[i1]);
-                          else
-                              substPointRef(frames[prj.ndi].ipts, tri, f0.ipts[i0]);
-                      }
-                  }
+                  merges.push_back(pair<int,int>(f0.ipts[i0],f1.ipts[i1]));
               }
           }
 
@@ -489,8 +491,7 @@ namespace vslam
               f1.ipts[i1] = pti;
 
               // projected point, ul,vl,ur
-              Vector3d ipt = getProjection(f1, i1);
-              sba.addProj(ndi1, pti, ipt, stereo);
+              addProjEntry(prjs, ndi1, pti, getProjection(f1, i1), stereo, pointWeight(f1, i1));
           }
           else if (f0.ipts[i0] < 0)                 // add to previous point track
           {
@@ -498,8 +499,28 @@ namespace vslam
               f0.ipts[i0] = pti;
 
               // projected point, ul,vl,ur
-              Vector3d ipt = getProjection(f0, i0);
-              sba.addProj(ndi0, pti, ipt, stereo);
+              addProjEntry(prjs, ndi0, pti, getProjection(f0, i0), stereo, pointWeight(f0, i0));
+          }
+      }
+
+      sba.addProjs(prjs);
+
+      // merge tracks and re-index point references
+      vector<int> pidx;
+      if (merges.size() > 0 && sba.mergeTracks(merges, &pidx) > 0)
+      {
+          for (int i=0; i<(int)frames.size(); i++)
+          {
+              remapPointRef(frames[i].ipts, pidx);
+              remapPointRef(frames[i].pl_ipts, pidx);
+          }
+          if (ipts)
+          {
+              int n = 0;
+              for (int i=0; i<(int)pidx.size(); i++)
+                  if (pidx[i] == n)   // kept track
+                      (*ipts)[n++] = (*ipts)[i];
+              ipts->resize(n);
           }
       }
   }
@@ -601,6 +622,16 @@ namespace vslam
           ipts[i] = tri0;
       }
   }
+
+  // re-index point references after tracks are merged or removed
+  void remapPointRef(std::vector<int> &ipts, const std::vector<int> &pidx)
+  {
+    for (int i=0; i<(int)ipts.size(); i++)
+      {
+        if (ipts[i] >= 0)
+          ipts[i] = pidx[ipts[i]];
+      }
+  }
                     
 } // end namespace vslam
 
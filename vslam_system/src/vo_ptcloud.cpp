@@ -67,7 +67,7 @@ namespace vslam
     sba.useCholmod(true);
 
     // for RANSAC
-    srand(time(NULL));
+    pose_estimator_->setSeed(time(NULL));
   }
 
   // TODO <fnew> is not changed, can be declared const
@@ -199,6 +199,10 @@ namespace vslam
   {
     vector<int> pidx(sba.tracks.size()); // point index for re-indexing
 
+    // drop node 0 from the covisibility graph; removed tracks are
+    //   taken out below, in the new node indices
+    sba.covis.removeFront(1);
+
     // run through tracks, resetting node indices by -1 and removing
     //   references to node 0
     int tn = 0;
@@ -215,7 +219,10 @@ namespace vslam
             else prj.isValid = false;
           }
         if (n < 2)              // remove this guy
-          pidx[i] = -1;
+          {
+            sba.covis.removeTrack(prjs);
+            pidx[i] = -1;
+          }
         else                    // keep this guy
           pidx[i] = tn++;
       }
@@ -246,23 +253,8 @@ namespace vslam
             f.pl_ipts[j] = pidx[f.pl_ipts[j]];
       }
       
-    // Redo point indeces of point-plane projections
-    for(size_t i=0; i<sba.tracks.size(); i++)
-      {
-        ProjMap &prjs = sba.tracks[i].projections;
-        if (prjs.size() == 0) continue;
-        for(ProjMap::iterator itr = prjs.begin(); itr != prjs.end(); itr++)
-          {
-            Proj &prj = itr->second;
-            if (prj.pointPlane)
-            {
-              prj.plane_point_index = pidx[prj.plane_point_index];
-              prj.plane_node_index -= 1;
-              if (prj.plane_node_index < 0 || prj.plane_point_index < 0)
-                prj.isValid = false;
-            }
-          }
-      }
+    // Redo point and node indices of point-plane constraints
+    sba.reindexPointPlaneCons(pidx, 1);
   }
 
   
@@ -402,6 +394,9 @@ namespace vslam
     vector<bool> matched0(f0.ipts.size(),0);
     vector<bool> matched1(f1.ipts.size(),0);
 
+    // track merges, done in bulk after all matches are added
+    vector<pair<int,int> > merges;
+
     // add points and projections
     for (int i=0; i<(int)inliers.size(); i++)
       {
@@ -440,20 +435,7 @@ namespace vslam
           {
             if (f0.ipts[i0] != f1.ipts[i1]) // different tracks
               {
-                int tri = sba.mergeTracksSt(f0.ipts[i0],f1.ipts[i1]);
-                if (tri >= 0)   // successful merge
-                  {
-                    // update the ipts in frames that connect to this track
-                    ProjMap &prjs = sba.tracks[tri].projections;
-                    for(ProjMap::iterator itr = prjs.begin(); itr != prjs.end(); itr++)
-                      {
-                        Proj &prj = itr->second;  
-                        if (tri == f0.ipts[i0])
-                          substPointRef(frames[prj.ndi].ipts, tri, f1.ipts[i1]);
-                        else
-                          substPointRef(frames[prj.ndi].ipts, tri, f0.ipts[i0]);
-                      }
-                  }
+                merges.push_back(pair<int,int>(f0.ipts[i0],f1.ipts[i1]));
               }
           }
 
@@ -476,6 +458,25 @@ namespace vslam
             sba.addStereoProj(ndi0, pti, ipt);
           }
       }
+
+    // merge tracks and re-index point references
+    vector<int> pidx;
+    if (merges.size() > 0 && sba.mergeTracks(merges, &pidx) > 0)
+      {
+        for (int i=0; i<(int)frames.size(); i++)
+          {
+            remapPointRef(frames[i].ipts, pidx);
+            remapPointRef(frames[i].pl_ipts, pidx);
+          }
+        if (ipts)
+          {
+            int n = 0;
+            for (int i=0; i<(int)pidx.size(); i++)
+              if (pidx[i] == n)   // kept track
+                (*ipts)[n++] = (*ipts)[i];
+            ipts->resize(n);
+          }
+      }
   }
   
   // Pointcloud matches, copied from above. Think of a more elegant way of doing this.
@@ -555,6 +556,16 @@ namespace vslam
           ipts[i] = tri0;
       }
   }
+
+  // re-index point references after tracks are merged or removed
+  void remapPointRef(std::vector<int> &ipts, const std::vector<int> &pidx)
+  {
+    for (int i=0; i<(int)ipts.size(); i++)
+      {
+        if (ipts[i] >= 0)
+          ipts[i] = pidx[ipts[i]];
+      }
+  }
   
   
 } // end namespace vslam
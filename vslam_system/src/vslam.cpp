@@ -36,11 +36,24 @@
 #include <cstdio>
 
 
+#include <sys/time.h>
+
 using namespace sba;
 using namespace pcl;
 
 namespace vslam {
 
+// elapsed time in milliseconds
+double mstime()
+{
+  timeval tv;
+  gettimeofday(&tv,NULL);
+  long long ts = tv.tv_sec;
+  ts *= 1000000;
+  ts += tv.tv_usec;
+  return (double)ts*.001;
+}
+
 VslamSystem::VslamSystem(const std::string& vocab_tree_file, const std::string& vocab_weights_file,
   int min_keyframe_inliers, double min_keyframe_distance, double min_keyframe_angle)
   : frame_processor_(10),
@@ -68,12 +81,23 @@ VslamSystem::VslamSystem(const std::string& vocab_tree_file, const std::string&
   numPRs = 0;                   // count of PR successes
   nSkip = 20;
   doPointPlane = true;
+
+  cullInterval = 0;             // no map culling
+  cullRatio = 0.9;
+  cullMinObs = 3;
+  cullMinProjs = 2;
+  cullMaxErr = 0.0;
+  nCull = 0;
+
+  stageTimes.frame = stageTimes.vo = stageTimes.keyframe = 0.0;
 }
 
 bool VslamSystem::addFrame(const frame_common::CamParams& camera_parameters,
                            const cv::Mat& left, const cv::Mat& right, int nfrac, 
                            bool setPointCloud)
 {
+  double t0 = mstime();
+
   // Set up next frame and compute descriptors
   frame_common::Frame next_frame;
   next_frame.setCamParams(camera_parameters); // this sets the projection and reprojection matrices
@@ -91,7 +115,9 @@ bool VslamSystem::addFrame(const frame_common::CamParams& camera_parameters,
     }
  
   // Add frame to visual odometer
+  double t1 = mstime();
   bool is_keyframe = vo_.addFrame(next_frame);
+  double t2 = mstime();
 
   // grow full SBA
   if (is_keyframe)
@@ -99,6 +125,10 @@ bool VslamSystem::addFrame(const frame_common::CamParams& camera_parameters,
     addKeyframe(next_frame); 
   }
 
+  stageTimes.frame = t1-t0;
+  stageTimes.vo = t2-t1;
+  stageTimes.keyframe = mstime()-t2;
+
   if (frames_.size() > 1 && vo_.pose_estimator_->inliers.size() < 40)
     std::cout << std::endl << "******** Bad image match: " << vo_.pose_estimator_->inliers.size() 
               << " inliers" << std::endl << std::endl;
@@ -110,6 +140,8 @@ bool VslamSystem::addFrame(const frame_common::CamParams& camera_parameters,
                            const cv::Mat& left, const cv::Mat& right,
                            const pcl::PointCloud<PointXYZRGB>& ptcloud, int nfrac)
 {
+  double t0 = mstime();
+
   // Set up next frame and compute descriptors
   frame_common::Frame next_frame;
   next_frame.setCamParams(camera_parameters); // this sets the projection and reprojection matrices
@@ -126,7 +158,9 @@ bool VslamSystem::addFrame(const frame_common::CamParams& camera_parameters,
   }
   
   // Add frame to visual odometer
+  double t1 = mstime();
   bool is_keyframe = vo_.addFrame(next_frame);
+  double t2 = mstime();
 
   // grow full SBA
   if (is_keyframe)
@@ -136,6 +170,10 @@ bool VslamSystem::addFrame(const frame_common::CamParams& camera_parameters,
     frames_.back().dense_pointcloud = ptcloud;
   }
 
+  stageTimes.frame = t1-t0;
+  stageTimes.vo = t2-t1;
+  stageTimes.keyframe = mstime()-t2;
+
   if (frames_.size() > 1 && vo_.pose_estimator_->inliers.size() < 40)
     std::cout << std::endl << "******** Bad image match: " << std::endl << std::endl;
 
@@ -217,6 +255,55 @@ void VslamSystem::addKeyframe(frame_common::Frame& next_frame)
 	        }
 	    }
     }
+
+    // keep the map from growing without bound
+    if (cullInterval > 0 && ++nCull >= cullInterval)
+      {
+        nCull = 0;
+        cullMap();
+      }
+}
+
+void VslamSystem::cullMap()
+{
+  // leave the place recognition skip window and the VO transfer frames alone
+  int nkeep = nSkip + 2;
+  std::vector<int> nds, nidx, pidx;
+
+  // low-value points first, so they don't make keyframes look needed
+  int npts = sba_.cullPoints(cullMinProjs, cullMaxErr, nkeep, pidx);
+  if (npts > 0)
+    for (int i = 0; i < (int)frames_.size(); i++)
+      {
+        remapPointRef(frames_[i].ipts, pidx);
+        remapPointRef(frames_[i].pl_ipts, pidx);
+      }
+
+  sba_.findRedundantNodes(cullRatio, cullMinObs, nkeep, nds);
+  if (nds.size() > 0)
+    {
+      npts += sba_.removeNodes(nds, nidx, pidx);
+
+      // frames are indexed by node, and their ids are node indices
+      int n = 0;
+      for (int i = 0; i < (int)frames_.size(); i++)
+        {
+          if (nidx[i] < 0) continue;
+          if (n != i)
+            frames_[n] = frames_[i];
+          frame_common::Frame &f = frames_[n];
+          f.frameId = n;
+          remapPointRef(f.ipts, pidx);
+          remapPointRef(f.pl_ipts, pidx);
+          n++;
+        }
+      frames_.resize(n);
+
+      place_recognizer_.remap(nidx);
+    }
+
+  printf("[CullMap] Removed %d keyframes and %d points; %d keyframes and %d points left\n",
+         (int)nds.size(), npts, (int)sba_.nodes.size(), (int)sba_.tracks.size());
 }
 
 void VslamSystem::refine(int initial_runs)
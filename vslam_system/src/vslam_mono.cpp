@@ -1,4 +1,6 @@
 #include <vslam_system/vslam_mono.h>
+#include <posest/pe2d.h>
+#include <algorithm>
 
 using namespace sba;
 
@@ -8,7 +10,11 @@ namespace vslam
   VslamSystemMono::VslamSystemMono(const std::string& vocab_tree_file, const std::string& vocab_weights_file)
     : VslamSystem(vocab_tree_file, vocab_weights_file)
   {
-    vo_.pose_estimator_ = boost::shared_ptr<pe::PoseEstimator>(new pe::PoseEstimator2d);
+    pe::PoseEstimator2d *pe2d = new pe::PoseEstimator2d;
+    pe2d->selectModel = true;   // homography and essential matrix initialization
+    vo_.pose_estimator_ = boost::shared_ptr<pe::PoseEstimator>(pe2d);
+    localWindow = 10;
+    localIters = 5;
   }
   
   bool VslamSystemMono::addFrame(const frame_common::CamParams& camera_parameters,
@@ -25,11 +31,13 @@ namespace vslam
     // Add frame to visual odometer
     bool is_keyframe = vo_.addFrame(next_frame);
 
-    // grow full SBA
+    // grow full SBA, adjusting only the latest keyframes
     if (is_keyframe) 
     {
       frames_.push_back(next_frame);
-      vo_.transferLatestFrame(frames_, sba_);
+      vo_.transferLatestFrame(frames_, sba_, localWindow <= 0);
+      if (localWindow > 0)
+        localRefine();
     }
       
     if (frames_.size() > 1 && vo_.pose_estimator_->inliers.size() < 40)
@@ -37,5 +45,96 @@ namespace vslam
 
     return is_keyframe;
   }
+
+
+  // Local bundle adjustment in a separate small system: the window
+  // nodes are free, other nodes seeing the window's points are fixed
+  // and come first, since SysSBA fixes its first <nFixed> nodes.
+  void VslamSystemMono::localRefine()
+  {
+    int nnodes = sba_.nodes.size();
+    int w0 = std::max(0, nnodes - localWindow); // first window node
+    if (nnodes - w0 < 2) return;
+
+    // points seen from the window
+    std::vector<int> pts;
+    std::vector<char> seen(sba_.tracks.size(), 0);
+    for (int i=w0; i<nnodes && i<(int)frames_.size(); i++)
+      {
+        const std::vector<int> &ipts = frames_[i].ipts;
+        for (int k=0; k<(int)ipts.size(); k++)
+          {
+            int pi = ipts[k];
+            if (pi >= 0 && pi < (int)seen.size() && !seen[pi])
+              {
+                seen[pi] = 1;
+                pts.push_back(pi);
+              }
+          }
+      }
+
+    // fixed nodes outside the window
+    std::vector<int> local(nnodes, -1);
+    std::vector<int> nds;
+    for (int k=0; k<(int)pts.size(); k++)
+      {
+        ProjMap &prjs = sba_.tracks[pts[k]].projections;
+        for (ProjMap::iterator it = prjs.begin(); it != prjs.end(); it++)
+          {
+            int ci = it->first;
+            if (ci < w0 && local[ci] < 0)
+              {
+                local[ci] = 0;
+                nds.push_back(ci);
+              }
+          }
+      }
+    std::sort(nds.begin(), nds.end());
+    int nfixed = nds.size();
+    for (int i=w0; i<nnodes; i++)
+      nds.push_back(i);
+
+    // monocular scale needs two fixed nodes; at the start of the map,
+    // fix the first window nodes instead
+    SysSBA lsba;
+    lsba.verbose = 0;
+    lsba.huber = sba_.huber;
+    lsba.nFixed = std::max(nfixed, std::min(2, (int)nds.size()-1));
+    for (int i=0; i<(int)nds.size(); i++)
+      {
+        local[nds[i]] = i;
+        lsba.nodes.push_back(sba_.nodes[nds[i]]);
+      }
+    lsba.covis.resize(lsba.nodes.size());
+
+    for (int k=0; k<(int)pts.size(); k++)
+      {
+        Track &tr = sba_.tracks[pts[k]];
+        Point pt = tr.point.cast<double>();
+        int pi = lsba.addPoint(pt);
+        for (ProjMap::iterator it = tr.projections.begin(); it != tr.projections.end(); it++)
+          {
+            Proj &prj = it->second;
+            if (prj.pointPlane || local[it->first] < 0) continue;
+            Eigen::Vector3d kp = prj.kp.cast<double>();
+            lsba.addProj(local[it->first], pi, kp, prj.stereo);
+          }
+      }
+
+    lsba.doSBA(localIters, 1.0e-4, SBA_DENSE_CHOLESKY);
+
+    // copy back the window nodes and the points
+    for (int i=lsba.nFixed; i<(int)nds.size(); i++)
+      {
+        Node &nd = sba_.nodes[nds[i]];
+        nd.trans = lsba.nodes[i].trans;
+        nd.qrot = lsba.nodes[i].qrot;
+        nd.setTransform();
+        nd.setProjection();
+        nd.setDr(true);
+      }
+    for (int k=0; k<(int)pts.size(); k++)
+      sba_.tracks[pts[k]].point = lsba.tracks[k].point;
+  }
   
   } // vslam
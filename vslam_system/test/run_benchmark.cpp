@@ -0,0 +1,404 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2009, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+//
+// deterministic replay benchmark for VslamSystem
+// renders a synthetic stereo sequence (a camera circling inside a textured
+// room), runs it through the system and writes a JSON report of throughput,
+// per-stage times and trajectory error; a second mode compares two reports
+//
+
+#include <vslam_system/vslam.h>
+#include <sba/sba.h>
+#include <frame_common/frame.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <algorithm>
+
+#include <opencv2/legacy/legacy.hpp>
+
+using namespace std;
+using namespace frame_common;
+using namespace Eigen;
+using namespace vslam;
+
+
+//
+// synthetic stereo
+//
+
+// image size and camera
+static const int imw = 640, imh = 480;
+static const CamParams camp = {400.0, 400.0, 320.0, 240.0, 0.09}; // fx fy cx cy baseline
+
+// room half-sizes (x, y, z) in meters, texture cell size, circle radius
+static const double room[3] = {6.0, 2.0, 6.0};
+static const double cell = 0.08;
+static const double radius = 2.0;
+
+// gray level of texture cell (i,j) on wall <face>
+static uint8_t cellValue(int face, int i, int j, unsigned int seed)
+{
+  unsigned int h = seed ^ (face*0x9e3779b9u);
+  h ^= (unsigned int)i*0x85ebca6bu;
+  h = (h << 13) | (h >> 19);
+  h ^= (unsigned int)j*0xc2b2ae35u;
+  h ^= h >> 16;
+  h *= 0x7feb352du;
+  h ^= h >> 15;
+  return 32 + (h & 0xbf);
+}
+
+// render a view from camera center <c>, rotation <R> (camera to world)
+static void render(cv::Mat &img, const Vector3d &c, const Matrix3d &R, unsigned int seed, cv::RNG &rng)
+{
+  img.create(imh, imw, CV_8UC1);
+  for (int v=0; v<imh; v++)
+    {
+      uint8_t *row = img.ptr<uint8_t>(v);
+      for (int u=0; u<imw; u++)
+        {
+          Vector3d d = R*Vector3d((u-camp.cx)/camp.fx, (v-camp.cy)/camp.fy, 1.0);
+
+          // nearest wall
+          double tmin = 1e10;
+          int axis = 0;
+          for (int a=0; a<3; a++)
+            {
+              if (d[a] == 0.0) continue;
+              double t = ((d[a] > 0 ? room[a] : -room[a]) - c[a]) / d[a];
+              if (t > 0 && t < tmin)
+                {
+                  tmin = t;
+                  axis = a;
+                }
+            }
+          Vector3d p = c + tmin*d;
+          int face = 2*axis + (d[axis] > 0);
+          int a1 = (axis+1)%3, a2 = (axis+2)%3;
+          row[u] = cellValue(face, (int)floor(p[a1]/cell), (int)floor(p[a2]/cell), seed);
+        }
+    }
+
+  // sensor noise
+  cv::Mat noise(imh, imw, CV_16SC1);
+  rng.fill(noise, cv::RNG::NORMAL, cv::Scalar(0), cv::Scalar(2.0));
+  cv::Mat img16;
+  img.convertTo(img16, CV_16SC1);
+  img16 += noise;
+  img16.convertTo(img, CV_8UC1);
+}
+
+// pose of frame <i>: circling the room center, looking outwards
+static void framePose(int i, double step, Vector3d &c, Matrix3d &R)
+{
+  double th = i*step;
+  c = Vector3d(radius*cos(th), 0.0, radius*sin(th));
+  Vector3d z(cos(th), 0.0, sin(th));
+  Vector3d y(0.0, 1.0, 0.0);
+  R.col(0) = y.cross(z);
+  R.col(1) = y;
+  R.col(2) = z;
+}
+
+
+//
+// statistics and reports
+//
+
+struct Stats
+{
+  double mean, p50, p90, p99, max, total;
+};
+
+static Stats stats(vector<double> v)
+{
+  Stats s;
+  memset(&s, 0, sizeof(s));
+  if (v.empty()) return s;
+  sort(v.begin(), v.end());
+  int n = v.size();
+  for (int i=0; i<n; i++)
+    s.total += v[i];
+  s.mean = s.total/n;
+  s.p50 = v[(int)(0.50*(n-1)+0.5)];
+  s.p90 = v[(int)(0.90*(n-1)+0.5)];
+  s.p99 = v[(int)(0.99*(n-1)+0.5)];
+  s.max = v[n-1];
+  return s;
+}
+
+static void writeStats(FILE *fp, const char *name, const vector<double> &v, bool last = false)
+{
+  Stats s = stats(v);
+  fprintf(fp, "    \"%s\": {\"count\": %d, \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, "
+          "\"p99\": %.3f, \"max\": %.3f, \"total\": %.3f}%s\n",
+          name, (int)v.size(), s.mean, s.p50, s.p90, s.p99, s.max, s.total, last ? "" : ",");
+}
+
+// Read the numbers of a report into "object.key" entries.  Only handles
+// the nested objects of numbers and strings that we write.
+static bool readReport(const char *fname, map<string,double> &vals)
+{
+  ifstream in(fname);
+  if (!in.is_open())
+    {
+      printf("[Benchmark] Can't open report %s\n", fname);
+      return false;
+    }
+  string s((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+  vector<string> path;
+  string key;
+  for (size_t i=0; i<s.size(); i++)
+    {
+      char ch = s[i];
+      if (ch == '"')
+        {
+          size_t j = s.find('"', i+1);
+          if (j == string::npos) return false;
+          string str = s.substr(i+1, j-i-1);
+          i = j;
+          size_t k = s.find_first_not_of(" \t\r\n", i+1);
+          if (k != string::npos && s[k] == ':')
+            key = str;
+        }
+      else if (ch == '{')
+        {
+          if (!key.empty())
+            path.push_back(key);
+          key.clear();
+        }
+      else if (ch == '}')
+        {
+          if (!path.empty())
+            path.pop_back();
+        }
+      else if (ch == '-' || (ch >= '0' && ch <= '9'))
+        {
+          char *end;
+          double x = strtod(s.c_str()+i, &end);
+          string name;
+          for (size_t k=0; k<path.size(); k++)
+            name += path[k] + ".";
+          vals[name + key] = x;
+          i = end - s.c_str() - 1;
+        }
+    }
+  return true;
+}
+
+// compare two reports; returns nonzero if <cur> is slower than <base>
+// by more than <tol> percent on throughput or latency percentiles
+static int compareReports(const char *base, const char *cur, double tol)
+{
+  map<string,double> b, c;
+  if (!readReport(base, b) || !readReport(cur, c))
+    return 2;
+
+  printf("%-28s %12s %12s %8s\n", "", "base", "current", "change");
+  int nfail = 0;
+  for (map<string,double>::iterator it = b.begin(); it != b.end(); it++)
+    {
+      if (c.find(it->first) == c.end()) continue;
+      double x0 = it->second, x1 = c[it->first];
+      double pct = x0 != 0.0 ? 100.0*(x1-x0)/fabs(x0) : 0.0;
+
+      // throughput should not drop, latency should not grow
+      const string &name = it->first;
+      bool gated = false, fail = false;
+      if (name == "fps")
+        {
+          gated = true;
+          fail = pct < -tol;
+        }
+      else if (name.find("_ms.") != string::npos &&
+               (name.find(".p50") != string::npos || name.find(".p90") != string::npos))
+        {
+          gated = true;
+          fail = pct > tol;
+        }
+      if (fail) nfail++;
+      printf("%-28s %12.3f %12.3f %+7.1f%%%s\n", name.c_str(), x0, x1, pct,
+             fail ? "  SLOWER" : (gated ? "" : "  -"));
+    }
+
+  if (b.count("trajectory_hash") && c.count("trajectory_hash") &&
+      b["trajectory_hash"] != c["trajectory_hash"])
+    printf("[Benchmark] Trajectories differ from the base run\n");
+
+  printf("[Benchmark] %d regressions over %.1f%%\n", nfail, tol);
+  return nfail > 0;
+}
+
+
+// main loop
+
+int main(int argc, char** argv)
+{
+  if (argc > 1 && !strcmp(argv[1], "-c"))
+    {
+      if (argc < 4)
+        {
+          printf("Args are: -c <base report> <current report> [max slowdown percent]\n");
+          exit(0);
+        }
+      return compareReports(argv[2], argv[3], argc > 4 ? atof(argv[4]) : 10.0);
+    }
+
+  if (argc < 5)
+    {
+      printf("Args are: <vocab tree file> <vocab weights file> <calonder trees file> <report file> "
+             "[number of frames] [seed] [degrees per frame]\n"
+             "      or: -c <base report> <current report> [max slowdown percent]\n");
+      exit(0);
+    }
+
+  int nframes = argc > 5 ? atoi(argv[5]) : 400;
+  unsigned int seed = argc > 6 ? atoi(argv[6]) : 1;
+  double step = (argc > 7 ? atof(argv[7]) : 1.0) * M_PI/180.0;
+
+  // set up the system as in run_stereo, with fixed seeds
+  vslam::VslamSystem vslam(argv[1], argv[2]);
+  typedef cv::CalonderDescriptorExtractor<float> Calonder;
+  vslam.frame_processor_.setFrameDescriptor(new Calonder(argv[3]));
+  vslam.setKeyDist(0.4);	// meters
+  vslam.setKeyAngle(0.2);	// radians
+  vslam.setKeyInliers(300);
+  vslam.setHuber(2.0);          // Huber cost function cutoff
+  vslam.vo_.sba.verbose = false;
+  vslam.sba_.verbose = false;
+  vslam.vo_.pose_estimator_->setSeed(seed);
+  vslam.pose_estimator_.setSeed(seed);
+
+  cv::RNG rng(seed);
+  vector<double> tframe, tstage[3], tkey, trefine, trender;
+  vector<int> keyIndex;         // input frame of each keyframe
+  cv::Mat left, right;
+
+  double t0 = mstime();
+  for (int i=0; i<nframes; i++)
+    {
+      // render the stereo pair
+      double tr = mstime();
+      Vector3d c;
+      Matrix3d R;
+      framePose(i, step, c, R);
+      render(left, c, R, seed, rng);
+      render(right, c + R.col(0)*camp.tx, R, seed, rng);
+      trender.push_back(mstime()-tr);
+
+      double ta = mstime();
+      bool is_keyframe = vslam.addFrame(camp, left, right);
+      double tb = mstime();
+      tframe.push_back(tb-ta);
+      tstage[0].push_back(vslam.stageTimes.frame);
+      tstage[1].push_back(vslam.stageTimes.vo);
+      if (!is_keyframe)
+        continue;
+
+      tstage[2].push_back(vslam.stageTimes.keyframe);
+      keyIndex.push_back(i);
+
+      // large-scale refinement, as in run_stereo
+      int n = vslam.sba_.nodes.size();
+      if (n > 4 && n%10 == 0)
+        {
+          vslam.refine();
+          trefine.push_back(mstime()-tb);
+        }
+      tkey.push_back(mstime()-ta);
+    }
+  double twall = mstime()-t0;
+  for (int i=0; i<(int)trender.size(); i++)
+    twall -= trender[i];        // rendering isn't part of the system
+
+  // trajectory error against the rendered poses, in the first camera frame;
+  // the hash of the estimated positions shows whether replays agree
+  Vector3d c0, ci;
+  Matrix3d R0, Ri;
+  framePose(0, step, c0, R0);
+  double sqerr = 0.0;
+  unsigned long long hash = 1469598103934665603ULL;
+  int nkf = min((int)keyIndex.size(), (int)vslam.sba_.nodes.size());
+  for (int k=0; k<nkf; k++)
+    {
+      framePose(keyIndex[k], step, ci, Ri);
+      Vector3d gt = R0.transpose()*(ci-c0);
+      Vector3d est = vslam.sba_.nodes[k].trans.head<3>();
+      sqerr += (gt-est).squaredNorm();
+      for (int j=0; j<3; j++)
+        {
+          float x = est[j];
+          unsigned int bits;
+          memcpy(&bits, &x, sizeof(bits));
+          hash = (hash ^ bits) * 1099511628211ULL;
+        }
+    }
+
+  FILE *fp = fopen(argv[4], "w");
+  if (!fp)
+    {
+      printf("[Benchmark] Can't open report %s\n", argv[4]);
+      exit(1);
+    }
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"frames\": %d,\n", nframes);
+  fprintf(fp, "  \"keyframes\": %d,\n", (int)keyIndex.size());
+  fprintf(fp, "  \"seed\": %u,\n", seed);
+  fprintf(fp, "  \"wall_s\": %.3f,\n", 0.001*twall);
+  fprintf(fp, "  \"fps\": %.3f,\n", nframes/(0.001*twall));
+  fprintf(fp, "  \"points\": %d,\n", (int)vslam.sba_.tracks.size());
+  fprintf(fp, "  \"place_recognitions\": %d,\n", vslam.numPRs);
+  fprintf(fp, "  \"rms_position_error_m\": %.6f,\n", nkf > 0 ? sqrt(sqerr/nkf) : 0.0);
+  fprintf(fp, "  \"trajectory_hash\": %llu,\n", hash % 1000000007ULL);
+  fprintf(fp, "  \"frame_ms\": {\n");
+  writeStats(fp, "total", tframe);
+  writeStats(fp, "features", tstage[0]);
+  writeStats(fp, "vo", tstage[1], true);
+  fprintf(fp, "  },\n");
+  fprintf(fp, "  \"keyframe_ms\": {\n");
+  writeStats(fp, "latency", tkey);
+  writeStats(fp, "transfer", tstage[2]);
+  writeStats(fp, "refine", trefine, true);
+  fprintf(fp, "  }\n");
+  fprintf(fp, "}\n");
+  fclose(fp);
+
+  printf("[Benchmark] %d frames, %d keyframes, %.1f frames/s, keyframe latency p90 %.1f ms, "
+         "RMS position error %.3f m\n", nframes, (int)keyIndex.size(), nframes/(0.001*twall),
+         stats(tkey).p90, nkf > 0 ? sqrt(sqerr/nkf) : 0.0);
+  return 0;
+}
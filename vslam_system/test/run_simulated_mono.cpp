@@ -138,7 +138,7 @@ drawgraph(SysSBA &sba, SysSPA &spa, ros::Publisher &cam_pub, ros::Publisher &pt_
   float zsum = 0, zsum2 = 0;
   for (int i=0, ii=0; i<npts; i+=dec, ii++)
     {
-      Vector4d &pt = sba.tracks[i].point;
+      const Vector4d &pt = sba.tracks[i].point.cast<double>();
       ptmark.points[ii].x = pt(0);
       ptmark.points[ii].y = pt(2);
       ptmark.points[ii].z = -pt(1);